@@ -1,17 +1,89 @@
 #pragma once
 #include <ATEMbase.h>
-#include <ATEMstd.h>
 #include "main.h"
 
+// -DATEM_TALLY_ONLY (set in platformio.ini) builds the lean ATEMtally client,
+// which keeps only tally, program/preview and version state. Without it the
+// full ATEMstd state is tracked.
+#ifdef ATEM_TALLY_ONLY
+#include <ATEMtally.h>
+typedef ATEMtally ATEMclient;
+#else
+#include <ATEMstd.h>
+typedef ATEMstd ATEMclient;
+#endif
+
 // maximum number of ATEM inputs
 // because ATEM Arduino Library uses a 64 element array
 // for atemTallyByIndexTallyFlags
 #define TALLY_COUNT 64
 #define TALLY_UPDATE_EACH 2000
 
-extern ATEMstd AtemSwitcher;
+// Every ATEM client runs in its own task, blocking in recvfrom() instead of
+// waiting for loop() and its delay(20), so a second switcher never delays the
+// first. Tally changes are handed to loop() (which owns ESP-NOW, vMix and web
+// state), merged per config.atemMerge and published right away.
+#define ATEM_TASK_CORE 1
+#define ATEM_TASK_PRIORITY 3    // above loop() (1), so a datagram is parsed as it arrives
+#define ATEM_TASK_STACK 4096
+#define ATEM_TASK_WAIT_MS 20    // longest block in recvfrom(); resend, backoff and fade timers run at least this often
+
+// Input names (InPr) of the main switcher are kept for this many video
+// sources, enough for the inputs plus the internal sources of a large model.
+// With config.atemNames each camera gets the name of the input that lights
+// it, sent in SET_NAMES frames only when it differs from the last one sent.
+#define ATEM_NAME_SOURCES 128
+
+// With config.micLive the main switcher's audio levels (AMLv) and mix options
+// (AMIP) give a "mic live" bit per camera: its input is mixed in (or follows
+// video while on program) and above config.micOnDb, until it stays below
+// config.micOffDb for config.micHoldMs. A MIC_LIVE frame goes out only when a
+// bit flips.
+
+// With config.frameSync and the switcher's frame grid locked (see
+// ATEMframeClock), a cut is sent with an applyAt: the first frame boundary of
+// the switcher's video at least TALLY_FRAME_MARGIN_US from sending, so every
+// receiver can switch on the same frame. The margin covers air time and
+// retries of the broadcast; receivers that get it later switch at once.
+#define TALLY_FRAME_MARGIN_US 4000
+
+typedef struct atem_frame_stats {
+  uint32_t aligned;     // tally changes sent with a frame-aligned applyAt
+  uint32_t leadMaxUs;   // longest from the frame of the cut to the one the receivers switch on
+} atem_frame_stats_t;
+
+// from reading the datagram in the ATEM task until espnow_tally() returned in loop()
+typedef struct atem_latency {
+  uint32_t count;
+  uint32_t lastUs;
+  uint32_t maxUs;
+  uint64_t totalUs;
+} atem_latency_t;
+
+// switcher 0 is config.atemIP, switcher n config.atemExtraIP[n-1]
+extern ATEMclient AtemSwitchers[ATEM_SWITCHER_COUNT];
 
 uint64_t getProgramBits();
 uint64_t getPreviewBits();
 void atem_setup();
-void atem_loop();
\ No newline at end of file
+bool atem_switcher_used(uint8_t n);
+void atem_camera_sources_changed();
+void atem_transition_fade_changed();
+void atem_loop();
+void atem_stop();
+// the network just got an address: hellos sent before it went nowhere, retry without waiting out the backoff
+void atem_network_up();
+const atem_latency_t *atem_latency(uint8_t n);
+const atem_frame_stats_t *atem_frame_stats();
+void atem_tally_map_changed();
+uint32_t atem_merge_suppressed();
+void atem_mic_changed();
+uint64_t atem_mic_live();
+uint32_t atem_mic_frames();
+void atem_names_changed();
+// count and parse time per get-command of every switcher in use, for /atem
+String atem_command_stats_json();
+// restarts them and the parse times, from each switcher's task
+void atem_reset_stats();
+uint32_t atem_names_sent();
+uint32_t atem_name_frames();
\ No newline at end of file
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <Arduino.h>
+
+// ATEM packet capture: every datagram the ATEM clients read is recorded into
+// a RAM buffer as a pcap file (LINKTYPE_RAW, each datagram wrapped in an IPv4
+// and UDP header from the switcher's port 9910), which /capture.pcap
+// downloads. Wireshark opens it as is; tools/atem-replay feeds it back
+// through the parser on Linux. Recording stops when the buffer is full.
+#define CAPTURE_DEFAULT_KB 64
+#define CAPTURE_MAX_KB 128
+#define CAPTURE_LINKTYPE_RAW 101
+
+// allocates kb of RAM and starts recording; a previous capture is dropped
+bool capture_start(uint16_t kb);
+void capture_stop();
+void capture_clear();
+bool capture_running();
+String capture_status_json();
+
+// stops recording and hands out the pcap bytes (NULL if there is no capture)
+const uint8_t *capture_data(size_t *length);
+
+// ATEMbase capture callback, runs in the ATEM tasks
+void capture_datagram(uint32_t switcherIP, uint16_t localPort, const uint8_t *datagram, uint16_t length, unsigned long receivedAt);
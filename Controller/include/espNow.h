@@ -25,8 +25,32 @@ enum espnow_command : uint8_t {
   SET_NAME_MAC = 13,
   SET_BRIGHTNESS_MAC = 14,
   SET_STATUS_BRIGHTNESS = 15,
+  // 16-31 are taken by signal icons on the ESP-IDF receiver
+  TEST_BEGIN = 32,
+  TEST_END = 33,
+  TEST_REPORT = 34,
+  CONTROLLER_HEARTBEAT = 35,
+  PROVISION_OPEN = 36,
+  PROVISION_CLAIM = 37,
+  PROVISION_ASSIGN = 38,
+  PROVISION_ACK = 39,
+  TRANSITION = 40,
+  SET_NAMES = 41,
+  MIC_LIVE = 42,
 };
 
+// SET_TALLY: [1][program u64][preview u64][sequence u16][generation u16][sentAt u32][applyAt u32].
+// sentAt and applyAt are the controller's micros(); a receiver switches at applyAt
+// on its own clock (offset from the arrival of sentAt) if it is ahead of sentAt by
+// less than SET_TALLY_MAX_LEAD_US, otherwise at once.
+#define SET_TALLY_MAX_LEAD_US 200000
+
+#define TRANSITION_END 0x01  // TRANSITION flags: last frame, receivers go back to plain tally
+
+// SET_NAMES: [SET_NAMES][count] then per camera [camId][len][name, no terminator],
+// as many as fit in one ESP-NOW frame
+#define NAME_LENGTH 16
+
 typedef struct esp_now_tally_info {
     uint8_t mac_addr[ESP_NOW_ETH_ALEN];
     uint8_t id;
@@ -35,6 +59,8 @@ typedef struct esp_now_tally_info {
     int8_t signal;
     uint8_t rgbBrightness;
     uint8_t statusBrightness;
+    uint16_t seqGaps;     // tally frames the receiver missed, by sequence number
+    uint16_t lateUs;      // most a timed tally was applied after its applyAt, since the last heartbeat
 } espnow_tally_info_t;
 
 espnow_tally_info_t * espnow_tallies();
@@ -42,6 +68,8 @@ uint8_t espnow_active_tally_count(unsigned long freshnessMs = 5000);
 uint8_t espnow_total_tally_count();
 unsigned long espnow_latest_heartbeat_age();
 void espnow_set_name(const String& name, uint64_t *bits);
+// names[i] (NUL-terminated) for camera ids[i]; returns the number of frames sent
+uint8_t espnow_set_names(const uint8_t *ids, const char (*names)[NAME_LENGTH + 1], uint8_t count);
 
 void espnow_setup();
 void espnow_loop();
@@ -51,7 +79,17 @@ void espnow_color(uint32_t, uint64_t *bits);
 void espnow_signal(uint8_t signal, uint64_t *bits);
 void espnow_tally();
 void espnow_tally(uint64_t *program, uint64_t *preview);
-void espnow_tally_test(int pgm, int pvw);
+// like espnow_tally(program, preview), with the receivers switching at applyAt (micros())
+void espnow_tally_at(uint64_t *program, uint64_t *preview, uint32_t applyAt);
+uint16_t espnow_rx_late_max();
+esp_err_t espnow_tally_test(int pgm, int pvw);
+uint16_t espnow_tally_sequence();
+uint16_t espnow_tally_generation();
+void espnow_adopt_counters(uint16_t sequence, uint16_t generation);
+void espnow_mirror(uint64_t program, uint64_t preview);
+void espnow_transition(uint8_t position, uint8_t flags, uint64_t from, uint64_t to);
+void espnow_mic_live(uint64_t live);
+esp_err_t espnow_broadcast(const uint8_t *payload, size_t len);
 void espnow_identify(uint64_t *bits, uint8_t seconds);
 void espnow_identify_mac(const uint8_t mac[6], uint8_t seconds);
 void espnow_blink(uint32_t color, bool enable, uint64_t *bits);
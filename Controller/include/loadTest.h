@@ -0,0 +1,33 @@
+#pragma once
+
+#include <Arduino.h>
+#include "espnow.h"
+
+#define LOADTEST_MAX_STEPS 8         // rates per sweep
+#define LOADTEST_MIN_FPS 1
+#define LOADTEST_MAX_FPS 500
+#define LOADTEST_MAX_SECONDS 60
+#define LOADTEST_CONTROL_REPEAT 3    // BEGIN/END are resent, receivers ignore duplicates
+#define LOADTEST_CONTROL_GAP_MS 60
+#define LOADTEST_SETTLE_MS 200       // quiet time around a run so no frame straddles BEGIN/END
+#define LOADTEST_REPORT_WINDOW_MS 1200
+#define LOADTEST_NO_REPORT 0xFFFFFFFF
+
+typedef struct loadtest_step {
+    uint16_t fps;
+    uint16_t session;
+    uint32_t attempted;      // frames the generator tried to send
+    uint32_t sendErrors;     // esp_now_send() refused the frame (mostly ESP_ERR_ESPNOW_NO_MEM)
+    uint32_t durationMs;
+    uint32_t applied[MAX_TALLY_COUNT];  // frames each receiver handled, indexed like espnow_tallies()
+} loadtest_step_t;
+
+// Run one generator pass per rate, seconds each; mixPercent of the frames are name/colour/blink
+bool loadtest_start(const uint16_t *fps, uint8_t steps, uint16_t seconds, uint8_t mixPercent);
+void loadtest_stop();
+bool loadtest_running();
+void loadtest_loop();
+
+// Called from the ESP-NOW receive callback for TEST_REPORT frames
+void loadtest_report(const uint8_t *mac, const uint8_t *data, int len);
+String loadtest_results_json();
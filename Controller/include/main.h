@@ -2,10 +2,22 @@
 
 #include <Arduino.h>
 
+#include "tallyMap.h"
+
 enum switcher_protocol : uint8_t {
     PROTOCOL_ATEM = 1,
     PROTOCOL_OBS  = 2,
     PROTOCOL_VMIX = 3,
+    PROTOCOL_MULTICAST = 4,  // follow an upstream controller over Ethernet
+};
+
+#define CAMERA_SOURCE_COUNT 64
+#define ATEM_SWITCHER_COUNT 2  // main switcher plus one more (e.g. an ISO); each extra one takes 132 bytes of EEPROM
+
+// how the tallies of several ATEM switchers combine
+enum atem_merge : uint8_t {
+    ATEM_MERGE_OR = 0,        // program/preview on any switcher
+    ATEM_MERGE_PRIORITY = 1,  // per camera the first switcher (in order) showing it on program or preview decides
 };
 
 struct controller_config {
@@ -18,6 +30,21 @@ struct controller_config {
     uint32_t vmixIP = (192<<24)+(168<<16)+(2<<8)+18;
     uint16_t vmixPort = 8099;
     bool protocolEnabled = true;
+    uint8_t redundancyPriority = 0;  // 0 = single controller, otherwise election priority
+    bool multicastSend = false;      // publish tallies for downstream controllers
+    uint16_t cameraSource[CAMERA_SOURCE_COUNT] = {};  // ATEM video source per camera ID (index = ID-1), 0 = TlIn index
+    bool transitionFade = false;     // stream mix progress so receivers cross-fade
+    uint32_t atemExtraIP[ATEM_SWITCHER_COUNT - 1] = {};  // switchers 2.., 0 = not used
+    uint16_t atemExtraSource[ATEM_SWITCHER_COUNT - 1][CAMERA_SOURCE_COUNT] = {};  // their camera -> source maps, like cameraSource
+    atem_merge atemMerge = ATEM_MERGE_OR;
+    uint8_t tallyMap[TALLY_MAP_ENTRIES][2] = {};  // input -> camera entries, input 0 = unused
+    bool atemNames = false;           // name the receivers after the ATEM inputs lighting them
+    uint8_t atemTallySource = 2;     // ATEMtallySource: 0 TlIn, 1 derived from busses and keyers, 2 derived until the first TlIn
+    bool micLive = false;            // send MIC_LIVE from the ATEM audio levels
+    int8_t micOnDb = -40;            // mic live gate opens at this level (dBFS)
+    int8_t micOffDb = -50;           // and closes below this one
+    uint16_t micHoldMs = 1000;       // after staying below it this long
+    bool frameSync = false;          // receivers switch on the switcher's next frame boundary
 };
 
 extern struct controller_config config;
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Controller-to-controller tally stream over the Ethernet link. An upstream
+// controller (config.multicastSend) publishes every tally frame and every
+// per-camera command; downstream controllers (PROTOCOL_MULTICAST) put them
+// straight on their own ESP-NOW radio. Frames are taken in the UDP task and
+// put on the radio by multicast_loop() in loop(), which owns the tally state.
+#define MULTICAST_GROUP IPAddress(239, 255, 84, 76)
+#define MULTICAST_PORT 9911
+#define MULTICAST_SOURCE_TIMEOUT 400    // follow another upstream (e.g. after a redundancy takeover) after this much silence
+#define MULTICAST_KEEPALIVE_MS 150      // an idle upstream repeats its STATE this often, well inside MULTICAST_SOURCE_TIMEOUT
+#define MULTICAST_RELAY_QUEUE 8         // RELAY frames waiting for loop()
+
+// packet: ['T']['M'][version][type][stream seq u16] + body
+#define MULTICAST_MAGIC0 'T'
+#define MULTICAST_MAGIC1 'M'
+#define MULTICAST_VERSION 1
+#define MULTICAST_HEADER_LEN 6
+
+enum multicast_type : uint8_t {
+  MULTICAST_STATE = 1,   // [tally seq u16][generation u16][program u64][preview u64]
+  MULTICAST_RELAY = 2,   // [len][raw ESP-NOW payload]
+};
+
+// upstream; only a controller with multicastSend and another protocol than MULTICAST publishes
+bool multicast_publishing();
+void multicast_send_state(uint16_t sequence, uint16_t generation, uint64_t program, uint64_t preview);
+void multicast_relay(const uint8_t *payload, size_t len);
+
+// both: keepalive of an upstream, frames taken by a downstream
+void multicast_loop();
+
+// downstream
+void multicast_setup();
+void multicast_stop();
+uint32_t multicast_received();
@@ -8,7 +8,28 @@
 #include "main.h"
 #include "memory.h"
 
+// Only the fields the tally needs are kept from a message (see the filter in
+// obs.cpp), so the document stays small however large OBS's message is.
+#define OBS_DOC_SIZE 512
+// Text frames larger than the websocket client's buffer are put together on
+// the heap up to this size; scene list events of large productions are the
+// biggest messages OBS sends us.
+#define OBS_MESSAGE_MAX 32768
+
+typedef struct obs_stats {
+  uint32_t messages;      // text messages parsed
+  uint32_t fragmented;    // ...of them put together from several receive events
+  uint32_t dropped;       // frames over OBS_MESSAGE_MAX, without memory, or with parts missing
+  uint32_t errors;        // messages deserializeJson() failed on
+  uint32_t parseMaxUs;
+  uint64_t parseTotalUs;
+  uint32_t largest;       // bytes of the largest message put together
+  uint32_t docMax;        // most bytes a filtered document used of OBS_DOC_SIZE
+  uint32_t stackFree;     // least free stack of the websocket task seen after parsing, bytes
+} obs_stats_t;
+
 void obs_setup();
 void obs_loop();
 void obs_broadcast_signal(uint64_t bits, uint8_t signal);
 void obs_stop();
+const obs_stats_t *obs_stats();
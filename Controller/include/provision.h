@@ -0,0 +1,33 @@
+#pragma once
+
+#include <Arduino.h>
+#include "espnow.h"
+
+// Provisioning window: receivers without a stored camera ID (or all of them)
+// send PROVISION_CLAIM, the controller hands out IDs from a plan in order of
+// arrival with PROVISION_ASSIGN and the receiver answers with PROVISION_ACK.
+#define PROVISION_DEFAULT_SECONDS 60
+#define PROVISION_MAX_SECONDS 600
+#define PROVISION_RESEND_MS 400      // ASSIGN is repeated until ACKed
+#define PROVISION_MAX_RESENDS 8
+#define PROVISION_CLAIM_QUEUE 16     // claims waiting for loop(); receivers repeat lost ones
+
+typedef struct provision_assignment {
+    uint8_t mac_addr[ESP_NOW_ETH_ALEN];
+    uint8_t id;
+    bool acked;
+    uint8_t resends;
+    unsigned long lastSent;
+} provision_assignment_t;
+
+// plan: IDs to hand out in order; ids in use by other heard receivers are skipped
+bool provision_start(const uint8_t *plan, uint8_t planCount, uint16_t seconds, bool all);
+void provision_stop();
+bool provision_open();
+void provision_loop();
+
+// Called from the ESP-NOW receive callback
+void provision_claim(const uint8_t *mac, const uint8_t *data, int len);
+void provision_ack(const uint8_t *mac, const uint8_t *data, int len);
+
+String provision_status_json();
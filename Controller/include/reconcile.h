@@ -0,0 +1,51 @@
+#pragma once
+
+#include <Arduino.h>
+#include "espnow.h"
+
+// Fields of a receiver that the controller keeps a desired value for
+#define RECONCILE_ID                1
+#define RECONCILE_NAME              2
+#define RECONCILE_RGB_BRIGHTNESS    4
+#define RECONCILE_STATUS_BRIGHTNESS 8
+
+#define RECONCILE_MAX_RETRIES 5      // resends per field before giving up
+#define RECONCILE_RETRY_MS 1500      // minimum gap between resends to one receiver
+#define RECONCILE_SENDS_PER_LOOP 4   // limit bursts on the radio
+
+typedef struct reconcile_entry {
+    uint8_t mac_addr[ESP_NOW_ETH_ALEN];
+    uint8_t fields;     // RECONCILE_* fields with a desired value
+    uint8_t pending;    // fields not confirmed by a heartbeat since they were set or found wrong
+    uint8_t mismatched; // fields a heartbeat found wrong since the last resend
+    uint8_t failed;     // fields that did not converge within RECONCILE_MAX_RETRIES
+    uint8_t id;
+    char name[17];
+    bool operatorName;  // name set on the web page, ATEM input names leave it alone
+    uint8_t rgbBrightness;
+    uint8_t statusBrightness;
+    uint8_t attempts[4];
+    unsigned long lastAttempt;
+} reconcile_entry_t;
+
+// Record the operator's intent and send it right away
+void reconcile_set_camid_mac(uint8_t camId, const uint8_t mac[6]);
+void reconcile_set_name_mac(const String& name, const uint8_t mac[6]);
+void reconcile_brightness_mac(uint8_t brightness, const uint8_t mac[6]);
+void reconcile_status_brightness(uint8_t brightness, const uint8_t mac[6]);
+void reconcile_camid(uint8_t camId, uint64_t *bits);
+void reconcile_set_name(const String& name, uint64_t *bits);
+// Only record the name for these receivers, for callers that send it themselves
+// (the ATEM input names); receivers with an operator set name are skipped
+void reconcile_expect_name(const String& name, uint64_t *bits);
+// Whether a receiver with this ID has a name set by the operator
+bool reconcile_operator_name(uint8_t camId);
+// Only record the ID of this receiver, for provisioning which assigns it itself; safe in the receive callback
+void reconcile_expect_id(uint8_t camId, const uint8_t mac[6]);
+void reconcile_brightness(uint8_t brightness, uint64_t *bits);
+
+// Compare a heartbeat with the desired state; reported is a mask of RECONCILE_* fields the receiver sent.
+// Called from the ESP-NOW receive callback, the rest from loop(); the desired state is shared under a lock.
+void reconcile_observe(const espnow_tally_info_t *tally, uint8_t reported);
+const char* reconcile_status(const uint8_t mac[6]);
+void reconcile_loop();
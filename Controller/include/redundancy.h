@@ -0,0 +1,28 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Two controllers on the same switcher elect a leader over ESP-NOW. Only the
+// leader transmits tallies; the standby mirrors the leader's state and counters
+// and takes over once the leader has been silent for REDUNDANCY_TAKEOVER_MS.
+#define REDUNDANCY_HEARTBEAT_MS 100
+#define REDUNDANCY_TAKEOVER_MS 500   // worst case until the standby transmits: this + one main loop pass
+
+enum redundancy_role : uint8_t {
+  ROLE_OFF = 0,       // redundancy disabled (priority 0), always transmits
+  ROLE_STANDBY = 1,
+  ROLE_LEADER = 2,
+};
+
+void redundancy_setup();
+void redundancy_loop();
+bool redundancy_is_leader();
+redundancy_role redundancy_role_now();
+const char* redundancy_role_name();
+
+// Tally state from this controller's own switcher connection while it is standby
+void redundancy_local_state(uint64_t program, uint64_t preview);
+
+// Called from the ESP-NOW receive callback; the frames are applied in redundancy_loop()
+void redundancy_peer_heartbeat(const uint8_t *mac, const uint8_t *data, int len);
+void redundancy_peer_tally(const uint8_t *mac, const uint8_t *data, int len);
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Input -> camera remapping (config.tallyMap) for the ATEM, OBS and vMix
+// tallies. Every entry lights camera `camera` from switcher input `input`
+// (TlIn index or camera map slot for ATEM, T<n> tag for OBS, input number for
+// vMix). An input with entries lights only those cameras, camera 0 keeps it
+// dark; inputs without entries light their own number. Several entries with
+// one camera let several inputs light it, several cameras per input light
+// several receivers.
+//
+// The map is compiled into 16 tables (one per 4 input bits) of 16 camera
+// masks each, so a tally is remapped with 16 lookups and ORs.
+#define TALLY_MAP_ENTRIES 32
+#define TALLY_MAP_INPUTS 64
+
+// rebuilds the tables from config.tallyMap; call after changing it
+void tallymap_compile();
+uint64_t tallymap_apply(uint64_t inputs);
+bool tallymap_identity();
+
+// "input:camera[+camera...],..." as accepted by tallymap_parse
+String tallymap_string();
+// replaces config.tallyMap; false (and config unchanged) if the text is invalid or too long
+bool tallymap_parse(const String &text);
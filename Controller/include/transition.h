@@ -0,0 +1,18 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Cross-fade stream for mix transitions (config.transitionFade). While the
+// switcher reports a running transition the position is quantised to
+// TRANSITION_STEPS levels and sent as TRANSITION frames, at most one every
+// TRANSITION_MIN_INTERVAL_MS. A 19 byte frame takes well under 1 ms on air,
+// so the stream stays below 2% of the channel.
+#define TRANSITION_STEPS 32
+#define TRANSITION_MIN_INTERVAL_MS 40   // 25 frames/s cap
+#define TRANSITION_STALE_MS 500         // no position for this long ends the fade
+
+// position 0-10000 as reported by the switcher
+void transition_update(bool inTransition, uint16_t position);
+void transition_loop();
+bool transition_active();
+uint32_t transition_frames();
@@ -29,7 +29,7 @@ you can keep a clear conscience: http://skaarhoj.com/about/licenses/
 /**
  * Constructor
  */
-ATEMbase::ATEMbase() {}
+ATEMbase::ATEMbase() : _socket(-1) {}
 
 /**
  * Setting up IP address for the switcher (and local port to send packets from)
@@ -43,13 +43,52 @@ void ATEMbase::begin(const IPAddress ip, const uint16_t localPort)
 {
 	neverConnected = true;
 	waitingForIncoming = false;
-	// Set up Udp communication object:
-	WiFiUDP Udp;
-	_Udp = Udp;
+	_closeSocket(); // The socket is opened by connect()
 	_switcherIP = ip;		// Set switcher IP address
 	_localPort = localPort; // Set default local port
 	_lastContact = 0;
 	_serialOutput = 0;
+	_lastReceiveMicros = 0;
+	_state = ATEM_STATE_IDLE;
+	_stateSince = millis();
+	_backoff = 0;
+	_backoffWait = 0;
+	_connectStartedAt = 0;
+	_timeToReady = 0;
+	_timeToFirstTally = 0;
+	_sessionTallied = false;
+	memset(_reconnects, 0, sizeof(_reconnects));
+	_txPendingCount = 0;
+	_txHistoryUsed = 0;
+	_txOverflows = 0;
+	_txResends = 0;
+	_txLost = 0;
+	_rxPackets = 0;
+	_rxBytes = 0;
+	_rxResent = 0;
+	_rxSizeMismatches = 0;
+	_acksSent = 0;
+	_rxResendRequests = 0;
+	_dumpResendRequests = 0;
+	_rxRateStart = millis();
+	_rxWindowPackets = 0;
+	_rxWindowBytes = 0;
+	_rxPacketRate = 0;
+	_rxByteRate = 0;
+	_returnPacketLength = 0;
+	_publishedProgram = 0;
+	_publishedPreview = 0;
+	_tallyPublished = false;
+	_tallyChanges = 0;
+	_tallySuppressed = 0;
+	_derivedPublished = 0;
+	_derivedTally.reset();
+	_tallyInSeen = false;
+	_micLive.reset();
+	_publishedMicLive = 0;
+	_frameClock.setVideoMode(0xFF);
+	_frameTimed = false;
+	resetParseStats();
 	resetCommandBundle();
 }
 
@@ -67,6 +106,10 @@ void ATEMbase::connect()
  */
 void ATEMbase::connect(const boolean useFixedPortNumber)
 {
+	neverConnected = false;
+	if (_state != ATEM_STATE_BACKOFF && _state != ATEM_STATE_CONNECTING)
+		_connectStartedAt = millis(); // A retry keeps counting from the first attempt
+	_setState(ATEM_STATE_CONNECTING);
 	_localPacketIdCounter = 0; // Init localPacketIDCounter to 0;
 	_initPayloadSent = false;  // Will be true after initial payload of data is delivered (regular 12-byte ping packages are transmitted.)
 	_hasInitialized = false;   // Will be true after initial payload of data is resent and received well
@@ -75,8 +118,19 @@ void ATEMbase::connect(const boolean useFixedPortNumber)
 	_lastContact = millis();   // Setting this, because even though we haven't had contact, it constitutes an attempt that should be responded to at least
 	memset(_missedInitializationPackages, 0xFF, (ATEM_maxInitPackageCount + 7) / 8);
 	_initPayloadSentAtPacketId = ATEM_maxInitPackageCount; // The max value it can be
+	_txPendingCount = 0;	// Commands of a previous session are never acknowledged
+	_txHistoryUsed = 0;
+	_sourceTally.reset();
+	_derivedTally.reset();
+	_tallyInSeen = false;
+	_sessionTallied = false;
+	_micLive.reset();
+	if (_publishedMicLive != 0 && _micLiveCallback != NULL)
+		_micLiveCallback(0);	// levels of a lost connection say nothing anymore
+	_publishedMicLive = 0;
+	_frameClock.reset();
 	uint16_t portNumber = useFixedPortNumber ? _localPort : random(50100, 65300);
-	_Udp.begin(portNumber);
+	_openSocket(portNumber);
 	// Send connectString to ATEM:
 	if (_serialOutput)
 	{
@@ -96,12 +150,31 @@ void ATEMbase::connect(const boolean useFixedPortNumber)
  * Keeps connection to the switcher alive
  * Therefore: Call this in the Arduino loop() function and make sure it gets call at least 2 times a second
  * Other recommendations might come up in the future.
+ *
+ * Never blocks (beyond delayTime): connect attempts are advanced by the state machine at the end,
+ * see ATEMconnectionState. A failed attempt or a lost connection waits ATEM_backoffMin ms before the
+ * next hello, doubling up to ATEM_backoffMax (ATEM_helloBackoffMax while hellos go unanswered) until
+ * the switcher reaches ATEM_STATE_READY again.
  */
 void ATEMbase::runLoop()
 {
-	runLoop(0);
+	_runLoop(0, 0);
 }
 void ATEMbase::runLoop(uint16_t delayTime)
+{
+	_runLoop(delayTime, 0);
+}
+
+/**
+ * For a dedicated task: blocks in the socket until a datagram arrives or waitMs passed, then handles
+ * everything that has arrived and the timers like runLoop(). Call it again right away.
+ */
+void ATEMbase::runLoopWait(uint16_t waitMs)
+{
+	_runLoop(0, waitMs);
+}
+
+void ATEMbase::_runLoop(uint16_t delayTime, uint16_t waitMs)
 {
 	if (neverConnected)
 	{
@@ -114,38 +187,60 @@ void ATEMbase::runLoop(uint16_t delayTime)
 
 	do
 	{
+		uint16_t wait = waitMs;
 		while (true)
-		{ // Iterate until UDP buffer is empty
-			uint16_t packetSize = _Udp.parsePacket();
-			if (_Udp.available())
+		{ // Iterate until the socket has no more datagrams
+			// The whole datagram is read once and parsed in place from _rxBuffer. Only the first read may block.
+			// (Before: a read per 12 byte header, 8 byte command header and 96 byte payload chunk, 58 per
+			// datagram of a 1 M/E state dump; on a host 2.87 against now 2.39 us parse time per datagram.)
+			int readSize = _receive(wait);
+			wait = 0;
+			if (readSize >= 0)
 			{
-				_Udp.read(_packet, 12); // Read header
-				_sessionID = word(_packet[2], _packet[3]);
-				uint8_t headerBitmask = _packet[0] >> 3;
-				_lastRemotePacketID = word(_packet[10], _packet[11]);
-				if (_lastRemotePacketID < ATEM_maxInitPackageCount)
+				if (readSize < 12)
+				{
+					continue;
+				}
+				_sessionID = word(_rxBuffer[2], _rxBuffer[3]);
+				uint8_t headerBitmask = _rxBuffer[0] >> 3;
+				_lastRemotePacketID = word(_rxBuffer[10], _rxBuffer[11]);
+				if (!_hasInitialized && _lastRemotePacketID < ATEM_maxInitPackageCount)
 				{
 					_missedInitializationPackages[_lastRemotePacketID >> 3] &= ~(B1 << (_lastRemotePacketID & 0x07));
 				}
 
-				uint16_t packetLength = word(_packet[0] & B00000111, _packet[1]);
+				uint16_t packetLength = word(_rxBuffer[0] & B00000111, _rxBuffer[1]);
+				if (headerBitmask & ATEM_headerCmd_Resend)
+					_rxResent++;
 
-				if (packetSize == packetLength)
+				if (readSize == packetLength)
 				{ // Just to make sure these are equal, they should be!
 					_lastContact = millis();
 					waitingForIncoming = false;
 
+					if ((headerBitmask & ATEM_headerCmd_Ack) && _txPendingCount > 0)
+					{
+						_txAcknowledge(word(_rxBuffer[4], _rxBuffer[5]));
+					}
+
 					if (headerBitmask & ATEM_headerCmd_HelloPacket)
 					{ // Respond to "Hello" packages:
+						// _rxBuffer[12]	The ATEM will return a "2" in this return package of same length. If the ATEM returns "3" it means "fully booked" (no more clients can connect) and a "4" seems to be a kind of reconnect (seen when you drop the connection and the ATEM desperately tries to figure out what happened...)
+						// _rxBuffer[15]	This number seems to increment with about 3 each time a new client tries to connect to ATEM. It may be used to judge how many client connections has been made during the up-time of the switcher?
+						if (_rxBuffer[12] == 3)
+						{
+							_giveUp(ATEM_CAUSE_REJECTED);
+							break;
+						}
 						_isConnected = true;
-
-						// _packet[12]	The ATEM will return a "2" in this return package of same length. If the ATEM returns "3" it means "fully booked" (no more clients can connect) and a "4" seems to be a kind of reconnect (seen when you drop the connection and the ATEM desperately tries to figure out what happened...)
-						// _packet[15]	This number seems to increment with about 3 each time a new client tries to connect to ATEM. It may be used to judge how many client connections has been made during the up-time of the switcher?
+						if (_state == ATEM_STATE_CONNECTING)
+							_setState(ATEM_STATE_SYNCING);
 
 						_wipeCleanPacketBuffer();
 						_createCommandHeader(ATEM_headerCmd_Ack, 12);
 						_packet[9] = 0x03; // This seems to be what the client should send upon first request.
 						_sendPacketBuffer(12);
+						_acksSent++;
 					}
 
 					// If a packet is 12 bytes long it indicates that all the initial information
@@ -158,7 +253,7 @@ void ATEMbase::runLoop(uint16_t delayTime)
 
 					// BTW: It has been observed on an old 10Mbit hub that packages could arrive in a different order than sent and this may
 					// mess things up a bit on the initialization. So it's recommended to has as direct routes as possible.
-					if (!_initPayloadSent && packetSize == 12 && _lastRemotePacketID > 1)
+					if (!_initPayloadSent && packetLength == 12 && _lastRemotePacketID > 1)
 					{
 						_initPayloadSent = true;
 						_initPayloadSentAtPacketId = _lastRemotePacketID;
@@ -178,6 +273,7 @@ void ATEMbase::runLoop(uint16_t delayTime)
 						_wipeCleanPacketBuffer();
 						_createCommandHeader(ATEM_headerCmd_Ack, 12, _lastRemotePacketID);
 						_sendPacketBuffer(12);
+						_acksSent++;
 
 #if ATEM_debug
 						if (_serialOutput & 0x80)
@@ -202,9 +298,15 @@ void ATEMbase::runLoop(uint16_t delayTime)
 						}
 					}
 					else if (_initPayloadSent && (headerBitmask & ATEM_headerCmd_RequestNextAfter) && _hasInitialized)
-					{ // ATEM is requesting a previously sent package which must have dropped out of the order. We return an empty one so the ATEM doesnt' crash (which some models will, if it doesn't get an answer before another 63 commands gets sent from the controller.)
-						uint8_t b1 = _packet[6];
-						uint8_t b2 = _packet[7];
+					{ // ATEM is requesting a previously sent package which must have dropped out of the order. If it is still in the resend history it is sent again,
+						// otherwise we return an empty one so the ATEM doesnt' crash (which some models will, if it doesn't get an answer before another 63 commands gets sent from the controller.)
+						uint8_t b1 = _rxBuffer[6];
+						uint8_t b2 = _rxBuffer[7];
+						_rxResendRequests++;
+						if (_txResend(word(b1, b2)))
+						{
+							continue;
+						}
 						_wipeCleanPacketBuffer();
 						_createCommandHeader(ATEM_headerCmd_Ack, 12, 0);
 						_packet[0] = ATEM_headerCmd_AckRequest << 3; // Overruling this. A small trick because createCommandHeader shouldn't increment local package ID counter
@@ -242,37 +344,42 @@ void ATEMbase::runLoop(uint16_t delayTime)
 
 					if (!(headerBitmask & ATEM_headerCmd_HelloPacket) && packetLength > 12)
 					{
+						_frameTimed = _hasInitialized && !(headerBitmask & ATEM_headerCmd_Resend);
+						unsigned long parseStart = micros();
 						_parsePacket(packetLength);
+						uint32_t parseTime = micros() - parseStart;
+						_parseCount++;
+						_parseTimeTotal += parseTime;
+						if (parseTime > _parseTimeMax)
+							_parseTimeMax = parseTime;
 					}
 				}
 				else
 				{
+					_rxSizeMismatches++;
 #if ATEM_debug
 					if (_serialOutput & 0x80)
 					{
 						Serial.print(F("ERROR: Packet size mismatch: "));
-						Serial.print(packetSize, DEC);
+						Serial.print(readSize, DEC);
 						Serial.print(F(" != "));
 						Serial.println(packetLength, DEC);
 					}
 #endif
-					// Flushing:
-					while (_Udp.available())
-					{
-						_Udp.read(_packet, ATEM_PACKET_LENGTH);
-					}
+					// Nothing to flush: the datagram was read completely (or dropped if larger than _rxBuffer)
 				}
 			}
 			else
 				break;
 		}
+		_rxRateUpdate();
 
 		// After initialization, we check which packages were missed and ask for them:
 		if (!_hasInitialized && _initPayloadSent && !waitingForIncoming)
 		{
-			for (uint8_t i = 1; i < _initPayloadSentAtPacketId; i++)
+			for (uint16_t i = 1; i < _initPayloadSentAtPacketId; i++)
 			{
-				if (i <= ATEM_maxInitPackageCount)
+				if (i < ATEM_maxInitPackageCount)
 				{
 					if (_missedInitializationPackages[i >> 3] & (B1 << (i & 0x7)))
 					{
@@ -291,6 +398,7 @@ void ATEMbase::runLoop(uint16_t delayTime)
 						_packet[8] = 0x01;
 
 						_sendPacketBuffer(12);
+						_dumpResendRequests++;
 						waitingForIncoming = true;
 						break;
 					}
@@ -303,20 +411,89 @@ void ATEMbase::runLoop(uint16_t delayTime)
 			if (!waitingForIncoming)
 			{
 				_hasInitialized = true;
+				_setState(ATEM_STATE_READY);
+				_timeToReady = millis() - _connectStartedAt;
+				_backoff = 0;
+				if (_micLiveCallback != NULL)
+				{
+					// the switcher only sends AMLv to clients that ask for it
+					_prepareCommandPacket(PSTR("SALN"), 4);
+					_packet[12 + _cBBO + 4 + 4 + 0] = 1;
+					_finishCommandPacket();
+				}
 				if (_serialOutput)
 				{
-					Serial.println(F("ATEM _hasInitialized = TRUE"));
+					Serial.print(F("ATEM _hasInitialized = TRUE after "));
+					Serial.print(_timeToReady);
+					Serial.println(F(" ms"));
 				}
 			}
 		}
+		if (_hasInitialized && _txPendingCount > 0)
+		{
+			_txResendTimedOut();
+		}
 	} while (delayTime > 0 && !hasTimedOut(enterTime, delayTime));
 
-	// If connection is gone anyway, try to reconnect:
-	if (hasTimedOut(_lastContact, 5000))
+	switch (_state)
 	{
-		if (_serialOutput)
-			Serial.println(F("Connection to ATEM Switcher has timed out - reconnecting!"));
-		connect();
+	case ATEM_STATE_CONNECTING:
+		if (hasTimedOut(_stateSince, ATEM_helloTimeout))
+			_giveUp(ATEM_CAUSE_HELLO_TIMEOUT);
+		break;
+	case ATEM_STATE_SYNCING:
+		if (hasTimedOut(_lastContact, ATEM_contactTimeout))
+			_giveUp(ATEM_CAUSE_SYNC_TIMEOUT);
+		break;
+	case ATEM_STATE_READY:
+		if (hasTimedOut(_lastContact, ATEM_contactTimeout))
+			_giveUp(ATEM_CAUSE_CONTACT_LOST);
+		break;
+	case ATEM_STATE_BACKOFF:
+		if (hasTimedOut(_stateSince, _backoffWait))
+			connect();
+		break;
+	default:
+		break;
+	}
+}
+
+void ATEMbase::_setState(ATEMconnectionState state)
+{
+	_state = state;
+	_stateSince = millis();
+}
+
+/**
+ * Drops the current attempt or connection and schedules the next connect() after the backoff delay.
+ * The delay gets up to 25% random jitter, so several clients of one switcher don't retry in lockstep.
+ */
+void ATEMbase::_giveUp(ATEMreconnectCause cause)
+{
+	if (_reconnects[cause] < 0xFFFF)
+		_reconnects[cause]++;
+	if (_state == ATEM_STATE_READY)
+		_connectStartedAt = millis(); // Time to ready counts from the moment the connection was lost
+	_isConnected = false;
+	_hasInitialized = false;
+	_initPayloadSent = false; // Otherwise the next runLoop() would take the dropped session for initialized
+	waitingForIncoming = false;
+	_closeSocket(); // Late packets of this session are not read anymore; connect() opens a new port
+
+	// a hello costs the switcher nothing, but one that is fully booked or fails its dump should not be pressed
+	uint16_t backoffMax = cause == ATEM_CAUSE_HELLO_TIMEOUT ? ATEM_helloBackoffMax : ATEM_backoffMax;
+	_backoff = _backoff == 0 ? ATEM_backoffMin : (_backoff >= backoffMax / 2 ? backoffMax : _backoff * 2);
+	_backoffWait = _backoff + random(_backoff / 4 + 1);
+	_setState(ATEM_STATE_BACKOFF);
+
+	if (_serialOutput)
+	{
+		static const char *const causes[ATEM_CAUSE_COUNT] = {"no hello answer", "switcher fully booked", "timeout during initial dump", "timeout"};
+		Serial.print(F("Connection to ATEM Switcher lost ("));
+		Serial.print(causes[cause]);
+		Serial.print(F(") - reconnecting in "));
+		Serial.print(_backoffWait);
+		Serial.println(F(" ms"));
 	}
 }
 
@@ -349,6 +526,69 @@ bool ATEMbase::hasInitialized()
 	return _hasInitialized;
 }
 
+/**
+ * Closes the socket. runLoop() stays idle until connect() or begin() is called again.
+ */
+void ATEMbase::end()
+{
+	_closeSocket();
+	_isConnected = false;
+	_hasInitialized = false;
+	_initPayloadSent = false;
+	neverConnected = false;
+	_setState(ATEM_STATE_IDLE);
+}
+
+/**
+ * micros() when the last datagram from the switcher was read, for receive-to-use latency
+ */
+unsigned long ATEMbase::getLastReceiveMicros()
+{
+	return _lastReceiveMicros;
+}
+
+ATEMconnectionState ATEMbase::getConnectionState()
+{
+	return _state;
+}
+
+/**
+ * Number of times a connection attempt or connection was given up for this cause since begin()
+ */
+uint16_t ATEMbase::getReconnectCount(ATEMreconnectCause cause)
+{
+	return cause < ATEM_CAUSE_COUNT ? _reconnects[cause] : 0;
+}
+
+/**
+ * Milliseconds from the first connect attempt (or from losing the previous connection)
+ * until the initial dump was complete, for the most recent time the switcher got ready
+ */
+uint32_t ATEMbase::getTimeToReady()
+{
+	return _timeToReady;
+}
+
+/**
+ * Milliseconds from the same start until the first tally of the connection was published; the
+ * initial dump carries TlIn (or the busses to derive it from) before it is complete, so this is
+ * usually well below getTimeToReady()
+ */
+uint32_t ATEMbase::getTimeToFirstTally()
+{
+	return _timeToFirstTally;
+}
+
+/**
+ * Skips the rest of a backoff wait, or sends a new hello while waiting for the answer to one that
+ * may have gone out before the network was up. Does nothing once the switcher answered.
+ */
+void ATEMbase::reconnectNow()
+{
+	if (_state == ATEM_STATE_BACKOFF || _state == ATEM_STATE_CONNECTING)
+		connect();
+}
+
 /**************
  *
  * Buffer work
@@ -367,65 +607,222 @@ void ATEMbase::_createCommandHeader(const uint8_t headerCmd, const uint16_t leng
 	_packet[3] = lowByte(_sessionID);  // Session ID
 	_packet[4] = highByte(remotePacketID); // Remote Packet ID, MSB
 	_packet[5] = lowByte(remotePacketID);  // Remote Packet ID, LSB
+	_packet[6] = 0; // Resend Packet ID and unknown bytes, callers set them afterwards if needed
+	_packet[7] = 0;
+	_packet[8] = 0;
+	_packet[9] = 0;
 
 	if (!(headerCmd & (ATEM_headerCmd_HelloPacket | ATEM_headerCmd_Ack | ATEM_headerCmd_RequestNextAfter)))
 	{
-		_localPacketIdCounter++;
+		_localPacketIdCounter = (_localPacketIdCounter + 1) & ATEM_packetIdMask;
 		//		if ((_localPacketIdCounter & 0xF) == 0xF) _localPacketIdCounter++;	// Uncommenting this line will jump the local package ID counter every 15 command - thereby introducing a stress test of the robustness of the "resent package" function from the ATEM switcher.
 		_packet[10] = highByte(_localPacketIdCounter); // Local Packet ID, MSB
 		_packet[11] = lowByte(_localPacketIdCounter);  // Local Packet ID, LSB
 	}
 }
-void ATEMbase::_sendPacketBuffer(uint8_t length)
+void ATEMbase::_sendPacketBuffer(uint16_t length)
 {
-	_Udp.beginPacket(_switcherIP, 9910);
-	_Udp.write(_packet, length);
-	_Udp.endPacket(); // TODO: Figure out why this may hang!!
+	_send(_packet, length);
 }
 
 /**
- * Sets all zeros in packet buffer:
+ * Opens the UDP socket on the local port, replacing an open one
  */
-void ATEMbase::_wipeCleanPacketBuffer()
+void ATEMbase::_openSocket(uint16_t port)
+{
+	_closeSocket();
+	_socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (_socket < 0)
+	{
+		if (_serialOutput)
+			Serial.println(F("Could not create UDP socket"));
+		return;
+	}
+	struct sockaddr_in local;
+	memset(&local, 0, sizeof(local));
+	local.sin_family = AF_INET;
+	local.sin_port = htons(port);
+	local.sin_addr.s_addr = htonl(INADDR_ANY);
+	if (bind(_socket, (struct sockaddr *)&local, sizeof(local)) < 0)
+	{
+		if (_serialOutput)
+			Serial.println(F("Could not bind UDP socket"));
+		_closeSocket();
+		return;
+	}
+	_socketWait = 0;
+	_socketPort = port;
+}
+
+void ATEMbase::_closeSocket()
 {
-	memset(_packet, 0, ATEM_PACKET_LENGTH);
+	if (_socket >= 0)
+	{
+		close(_socket);
+		_socket = -1;
+	}
 }
 
 /**
- * Reads from UDP channel to buffer. Will fill the buffer to the max or to the size of the current segment being parsed
- * Returns false if there are no more bytes, otherwise true
+ * Reads one datagram into _rxBuffer. With waitMs > 0 this blocks until one arrives or waitMs passed
+ * (also without a socket, e.g. during the reconnect backoff, so a task calling runLoopWait() never spins).
+ * Returns the datagram length, 0 for a datagram that is not from the switcher (its address and port 9910), or -1 if there was none.
  */
-bool ATEMbase::_readToPacketBuffer()
+int ATEMbase::_receive(uint16_t waitMs)
+{
+	if (_socket < 0)
+	{
+		if (waitMs > 0)
+			delay(waitMs);
+		return -1;
+	}
+	if (waitMs > 0 && waitMs != _socketWait)
+	{
+		struct timeval timeout;
+		timeout.tv_sec = waitMs / 1000;
+		timeout.tv_usec = (waitMs % 1000) * 1000;
+		setsockopt(_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		_socketWait = waitMs;
+	}
+	struct sockaddr_in from;
+	socklen_t fromLength = sizeof(from);
+	int length = recvfrom(_socket, _rxBuffer, ATEM_RX_BUFFER_LENGTH, waitMs > 0 ? 0 : MSG_DONTWAIT, (struct sockaddr *)&from, &fromLength);
+	if (length < 0)
+		return -1;
+	// Only the switcher's datagrams are parsed and counted
+	if (from.sin_addr.s_addr != (uint32_t)_switcherIP || from.sin_port != htons(9910))
+		return 0;
+	_rxPackets++;
+	_rxBytes += length;
+	_rxWindowPackets++;
+	_rxWindowBytes += length;
+	_lastReceiveMicros = micros();
+	if (_captureCallback != NULL)
+		_captureCallback((uint32_t)_switcherIP, _socketPort, _rxBuffer, length, _lastReceiveMicros);
+	return length;
+}
+
+void ATEMbase::_send(const uint8_t *data, uint16_t length)
 {
-	return _readToPacketBuffer(ATEM_PACKET_LENGTH);
+	if (_socket < 0)
+		return;
+	struct sockaddr_in to;
+	memset(&to, 0, sizeof(to));
+	to.sin_family = AF_INET;
+	to.sin_port = htons(9910);
+	to.sin_addr.s_addr = (uint32_t)_switcherIP;
+	sendto(_socket, data, length, 0, (struct sockaddr *)&to, sizeof(to));
 }
 
-bool ATEMbase::_readToPacketBuffer(uint8_t maxBytes)
+/**
+ * Sends the command datagram in _packet and keeps a copy until the switcher acknowledges it.
+ * If the history is full, the oldest unacknowledged datagram is given up.
+ */
+void ATEMbase::_sendCommandPacket(uint16_t length)
 {
-	maxBytes = maxBytes <= ATEM_PACKET_LENGTH ? maxBytes : ATEM_PACKET_LENGTH;
-	int remainingBytes = _cmdLength - 8 - _cmdPointer;
+	_sendPacketBuffer(length);
 
-	if (remainingBytes > 0)
+	if (length > ATEM_TX_HISTORY_LENGTH)
 	{
-		if (remainingBytes <= maxBytes)
-		{
-			_Udp.read(_packet, remainingBytes);
-			_cmdPointer += remainingBytes;
-			return false; // Returns false if finished.
-		}
-		else
+		_txLost++;
+		return;
+	}
+	while (_txPendingCount > 0 && (_txPendingCount == ATEM_TX_PENDING || _txHistoryUsed + length > ATEM_TX_HISTORY_LENGTH))
+	{
+		_txDropOldest(1);
+		_txLost++;
+	}
+	ATEMpendingPacket &pending = _txPending[_txPendingCount++];
+	pending.id = word(_packet[10], _packet[11]);
+	pending.length = length;
+	pending.sentAt = millis();
+	pending.tries = 0;
+	memcpy(_txHistory + _txHistoryUsed, _packet, length);
+	_txHistoryUsed += length;
+}
+
+/**
+ * Acknowledges are cumulative: everything up to ackId has arrived. IDs are compared
+ * modulo 15 bit so the wrap to 0 is handled.
+ */
+void ATEMbase::_txAcknowledge(uint16_t ackId)
+{
+	uint8_t acked = 0;
+	while (acked < _txPendingCount && ((ackId - _txPending[acked].id) & ATEM_packetIdMask) <= ATEM_packetIdMask / 2)
+	{
+		acked++;
+	}
+	if (acked > 0)
+	{
+		_txDropOldest(acked);
+	}
+}
+
+void ATEMbase::_txDropOldest(uint8_t count)
+{
+	uint16_t bytes = 0;
+	for (uint8_t i = 0; i < count; i++)
+	{
+		bytes += _txPending[i].length;
+	}
+	memmove(_txHistory, _txHistory + bytes, _txHistoryUsed - bytes);
+	_txHistoryUsed -= bytes;
+	memmove(_txPending, _txPending + count, (_txPendingCount - count) * sizeof(ATEMpendingPacket));
+	_txPendingCount -= count;
+}
+
+/**
+ * Sends a datagram from the history again, flagged as resend. False if it is not (or no longer) there.
+ */
+bool ATEMbase::_txResend(uint16_t id)
+{
+	uint16_t offset = 0;
+	for (uint8_t i = 0; i < _txPendingCount; i++)
+	{
+		ATEMpendingPacket &pending = _txPending[i];
+		if (pending.id == id)
 		{
-			_Udp.read(_packet, maxBytes);
-			_cmdPointer += maxBytes;
-			return true; // Returns true if there are still bytes to be read.
+			uint8_t *packet = _txHistory + offset;
+			packet[0] |= ATEM_headerCmd_Resend << 3;
+			_send(packet, pending.length);
+			pending.sentAt = millis();
+			pending.tries++;
+			_txResends++;
+			return true;
 		}
+		offset += pending.length;
 	}
-	else
+	return false;
+}
+
+/**
+ * Resends every datagram without acknowledge for ATEM_resendTimeout ms, gives up after ATEM_resendTries
+ */
+void ATEMbase::_txResendTimedOut()
+{
+	while (_txPendingCount > 0 && _txPending[0].tries >= ATEM_resendTries && hasTimedOut(_txPending[0].sentAt, ATEM_resendTimeout))
+	{
+		_txDropOldest(1);
+		_txLost++;
+	}
+	for (uint8_t i = 0; i < _txPendingCount; i++)
 	{
-		return false;
+		if (hasTimedOut(_txPending[i].sentAt, ATEM_resendTimeout))
+		{
+			_txResend(_txPending[i].id);
+		}
 	}
 }
 
+/**
+ * Clears the part of the packet buffer used by control packets (the hello packet is the longest with 20 bytes).
+ * Command payloads are cleared command by command in _prepareCommandPacket().
+ */
+void ATEMbase::_wipeCleanPacketBuffer()
+{
+	memset(_packet, 0, 20);
+}
+
 /**
  * If a package longer than a normal acknowledgement is received from the ATEM Switcher we must read through the contents.
  * Usually such a package contains updated state information about the mixer
@@ -435,69 +832,72 @@ void ATEMbase::_parsePacket(uint16_t packetLength)
 {
 
 	// If packet is more than an ACK packet (= if its longer than 12 bytes header), lets parse it:
-	uint16_t indexPointer = 12; // 12 bytes has already been read from the packet...
-	while (indexPointer < packetLength)
+	uint16_t indexPointer = 12; // 12 bytes of header
+	// In a timed datagram the cycle counter is read once per command; the time of a command runs up to the read after it
+	bool timed = _commandTimingSkip == 0;
+	_commandTimingSkip = timed ? ATEM_commandTimingSample - 1 : _commandTimingSkip - 1;
+	uint32_t cycles = timed ? ESP.getCycleCount() : 0;
+	while (indexPointer + 8 <= packetLength)
 	{
+		const uint8_t *cmdHeader = _rxBuffer + indexPointer;
 
 		// Read the length of segment (first word):
-		_Udp.read(_packet, 8);
-		_cmdLength = word(_packet[0], _packet[1]);
-		_cmdPointer = 0;
-
-		// Get the "command string", basically this is the 4 char variable name in the ATEM memory holding the various state values of the system:
-		char cmdStr[] = {
-			_packet[4], _packet[5], _packet[6], _packet[7], '\0'};
+		_cmdLength = word(cmdHeader[0], cmdHeader[1]);
 
-		// If length of segment larger than 8 (should always be...!)
-		if (_cmdLength > 8)
-		{
-			_parseGetCommands(cmdStr);
-
-			while (_readToPacketBuffer())
-			{
-			} // Empty, if not done yet.
-			indexPointer += _cmdLength;
-		}
-		else
+		// A command must at least hold its own header and must fit in the datagram
+		if (_cmdLength <= 8 || indexPointer + _cmdLength > packetLength)
 		{
-			indexPointer = 2000;
 #if ATEM_debug
 			if (_serialOutput & 0x80)
-				Serial.println(F("Bad CMD length, flushing..."));
+				Serial.println(F("Bad CMD length, skipping rest of packet..."));
 #endif
+			break;
+		}
 
-			// Flushing the buffer:
-			while (_Udp.available())
-			{
-				_Udp.read(_packet, ATEM_PACKET_LENGTH);
-			}
+		// Get the "command string", basically this is the 4 char variable name in the ATEM memory holding the various state values of the system.
+		// It is packed into one FourCC key (see ATEMfourcc.h) so subclasses dispatch without string compares:
+		uint32_t cmd = ATEM_FOURCC(cmdHeader[4], cmdHeader[5], cmdHeader[6], cmdHeader[7]);
+
+		_cmd.data = cmdHeader + 8;
+		_cmd.length = _cmdLength - 8;
+		_parseGetCommands(cmd);
+		if (timed)
+		{
+			uint32_t parsed = ESP.getCycleCount();
+			_commandStats.add(cmd, parsed - cycles);
+			cycles = parsed;
 		}
+		else
+		{
+			_commandStats.add(cmd);
+		}
+
+		indexPointer += _cmdLength;
 	}
+	_parsePacketEnd();
 }
 
 /**
- * This method should be overloaded in subclasses in order to handle specific get-commands
+ * Called after the last command of a datagram. Subclasses can act once on state
+ * that several commands of the same datagram update (like TlIn and TlSr).
  */
-void ATEMbase::_parseGetCommands(const char *cmdString)
+void ATEMbase::_parsePacketEnd()
 {
-	//	uint8_t mE, keyer, mediaPlayer, aUXChannel, windowIndex, multiViewer, memory, colorGenerator, box;
-	//	uint16_t audioSource, videoSource;
-	//	long temp;
-
-	uint8_t numberOfReads = 1;
-	while (_readToPacketBuffer())
-	{
-		numberOfReads++;
-	}
+}
 
+/**
+ * This method should be overloaded in subclasses in order to handle specific get-commands
+ */
+void ATEMbase::_parseGetCommands(uint32_t cmd)
+{
+	(void)cmd;	// only printed with ATEM_debug
 #if ATEM_debug
 	if (_serialOutput & 0x80)
 	{
+		char cmdString[] = {(char)(cmd >> 24), (char)(cmd >> 16), (char)(cmd >> 8), (char)cmd, '\0'};
 		Serial.print(cmdString);
 		Serial.print(", len: ");
-		Serial.print(_cmdLength);
-		Serial.print(", rds: ");
-		Serial.println(numberOfReads);
+		Serial.println(_cmdLength);
 	}
 #endif
 }
@@ -505,30 +905,37 @@ void ATEMbase::_parseGetCommands(const char *cmdString)
 void ATEMbase::_prepareCommandPacket(const char *cmdString, uint8_t cmdBytes, bool indexMatch)
 {
 
-	// First, in case of a command bundle, check if indexes are different OR if it's an entirely different command, then increase offset to accommodate new command:
-	if (_cBundle)
+	// First, in case of a command bundle, check if indexes are different OR if it's an entirely different command, then increase offset to accommodate new command.
+	// Otherwise the previous command of the bundle is updated in place.
+	bool newCommand = true;
+	if (_cBundle && _returnPacketLength > 0)
 	{
-		if (_returnPacketLength > 0 && (!indexMatch || strncmp_P((char *)(_packet + 12 + _cBBO + 4), cmdString, 4)))
+		if (!indexMatch || strncmp_P((char *)(_packet + 12 + _cBBO + 4), cmdString, 4))
 		{
 			_cBBO = _returnPacketLength - 12;
 		}
+		else
+		{
+			newCommand = false;
+		}
 	}
-	else
+
+	// A bundle that would outgrow the datagram is sent as it is and continued in a new one.
+	// A single command always fits (see the check of ATEM_PACKET_LENGTH in ATEMbase.h).
+	if (newCommand && 12 + _cBBO + 4 + 4 + cmdBytes > ATEM_PACKET_LENGTH)
 	{
-		_wipeCleanPacketBuffer(); // For command bundles, this is already done...
+		_createCommandHeader(ATEM_headerCmd_AckRequest, _returnPacketLength);
+		_sendCommandPacket(_returnPacketLength);
+		_cBBO = 0;
+		_txOverflows++;
 	}
-
-	_returnPacketLength = 12 + _cBBO + (4 + 4 + cmdBytes);
-
-	// Because we increased length of command, we need to check for buffer overflow:
-	if (_returnPacketLength > ATEM_PACKET_LENGTH)
+	if (newCommand)
 	{
-		Serial.println(F("FATAL ERROR: Packet Buffer Overflow in the ATEM Library! Too long or too many commands bundled!\n HALT"));
-		while (true)
-		{
-		} // STOP!
+		memset(_packet + 12 + _cBBO, 0, 4 + 4 + cmdBytes);
 	}
 
+	_returnPacketLength = 12 + _cBBO + (4 + 4 + cmdBytes);
+
 	// Copy Command String:
 	if (strlen_P(cmdString) == 4)
 	{
@@ -540,8 +947,8 @@ void ATEMbase::_prepareCommandPacket(const char *cmdString, uint8_t cmdBytes, bo
 #endif
 
 	// Command length:
-	_packet[12 + _cBBO] = 0;					// MSB - but it's always under 256, so....
-	_packet[12 + 1 + _cBBO] = 4 + 4 + cmdBytes; // LSB
+	_packet[12 + _cBBO] = highByte(4 + 4 + cmdBytes);		// MSB
+	_packet[12 + 1 + _cBBO] = lowByte(4 + 4 + cmdBytes); // LSB
 }
 
 void ATEMbase::_finishCommandPacket()
@@ -550,7 +957,7 @@ void ATEMbase::_finishCommandPacket()
 	{
 
 		_createCommandHeader(ATEM_headerCmd_AckRequest, _returnPacketLength);
-		_sendPacketBuffer(_returnPacketLength);
+		_sendCommandPacket(_returnPacketLength);
 		_returnPacketLength = 0;
 	}
 	else
@@ -585,23 +992,474 @@ void ATEMbase::serialOutput(uint8_t level)
 }
 
 /**
- * Timeout check
+ * Timeout check. Compares the elapsed time, which stays correct when millis() wraps after 49.7 days
+ * (time + timeout would wrap first and time out immediately).
  */
 bool ATEMbase::hasTimedOut(unsigned long time, unsigned long timeout)
 {
-	if ((unsigned long)(time + timeout) <= (unsigned long)millis())
-	{ // This should "wrap around" if time+timout is larger than the size of unsigned-longs, right?
-		return true;
+	return (unsigned long)(millis() - time) >= timeout;
+}
+
+uint8_t ATEMbase::getATEMmodel()
+{
+	return _ATEMmodel;
+}
+
+/**
+ * Number of datagrams with commands parsed since the last reset
+ */
+uint32_t ATEMbase::getParseCount()
+{
+	return _parseCount;
+}
+
+/**
+ * Average time in microseconds spent in _parsePacket() per datagram
+ */
+uint32_t ATEMbase::getParseTimeAverage()
+{
+	return _parseCount ? _parseTimeTotal / _parseCount : 0;
+}
+
+/**
+ * Longest time in microseconds spent in _parsePacket() for one datagram
+ */
+uint32_t ATEMbase::getParseTimeMax()
+{
+	return _parseTimeMax;
+}
+
+void ATEMbase::resetParseStats()
+{
+	_parseCount = 0;
+	_parseTimeTotal = 0;
+	_parseTimeMax = 0;
+	_commandStats.reset();
+	_commandTimingSkip = 0;
+}
+
+/**
+ * Count and parse time in CPU cycles (ESP.getCpuFreqMHz() per microsecond) per get-command since the last reset
+ */
+ATEMcommandStats &ATEMbase::getCommandStats()
+{
+	return _commandStats;
+}
+
+/**
+ * Closes the rate window once it is ATEM_rxRateWindow ms old. Also called by the rate getters, so the rates
+ * drop to what really arrived when the switcher goes quiet.
+ */
+void ATEMbase::_rxRateUpdate()
+{
+	unsigned long elapsed = millis() - _rxRateStart;
+	if (elapsed < ATEM_rxRateWindow)
+		return;
+	_rxPacketRate = (uint64_t)_rxWindowPackets * 1000 / elapsed;
+	_rxByteRate = (uint64_t)_rxWindowBytes * 1000 / elapsed;
+	_rxWindowPackets = 0;
+	_rxWindowBytes = 0;
+	_rxRateStart += elapsed;
+}
+
+/**
+ * Datagrams (and their bytes) read from the switcher since begin()
+ */
+uint32_t ATEMbase::getRxPacketCount()
+{
+	return _rxPackets;
+}
+
+uint32_t ATEMbase::getRxByteCount()
+{
+	return _rxBytes;
+}
+
+/**
+ * Datagrams (and bytes) per second from the switcher, averaged over the last ATEM_rxRateWindow ms or more
+ */
+uint32_t ATEMbase::getRxPacketRate()
+{
+	_rxRateUpdate();
+	return _rxPacketRate;
+}
+
+uint32_t ATEMbase::getRxByteRate()
+{
+	_rxRateUpdate();
+	return _rxByteRate;
+}
+
+/**
+ * Datagrams the switcher marked as resent, because we did not acknowledge them in time or asked for them
+ */
+uint32_t ATEMbase::getRxResentCount()
+{
+	return _rxResent;
+}
+
+/**
+ * Datagrams dropped because their header length did not match the datagram
+ */
+uint32_t ATEMbase::getRxSizeMismatchCount()
+{
+	return _rxSizeMismatches;
+}
+
+/**
+ * Acknowledges sent to the switcher (for hellos and datagrams asking for one)
+ */
+uint32_t ATEMbase::getAckCount()
+{
+	return _acksSent;
+}
+
+/**
+ * Times the switcher asked for a command datagram of ours again (RequestNextAfter)
+ */
+uint32_t ATEMbase::getRxResendRequestCount()
+{
+	return _rxResendRequests;
+}
+
+/**
+ * Times we asked the switcher for a datagram missed in the initial dump
+ */
+uint32_t ATEMbase::getDumpResendRequestCount()
+{
+	return _dumpResendRequests;
+}
+
+/**
+ * Maps cameras to ATEM video source IDs: sources[i] is the source of camera i+1.
+ * Mapped cameras take their tally from TlSr, 0 keeps the TlIn index of the camera.
+ */
+void ATEMbase::setCameraSourceMap(const uint16_t *sources, uint8_t count)
+{
+	_sourceTally.setCameraMap(sources, count);
+	_derivedTally.invalidate();
+}
+
+/**
+ * TlSr flags of a video source (bit 0 program, bit 1 preview), 0 if unknown
+ */
+uint8_t ATEMbase::getTallyBySource(uint16_t videoSource)
+{
+	return _sourceTally.flags(videoSource);
+}
+
+uint16_t ATEMbase::getTallyBySourceCount()
+{
+	return _sourceTally.sources();
+}
+
+/**
+ * Tally callbacks made since begin()
+ */
+uint32_t ATEMbase::getTallyChangeCount()
+{
+	return _tallyChanges;
+}
+
+/**
+ * TlIn/TlSr datagrams since begin() that repeated the tally of the last callback and were not passed on
+ */
+uint32_t ATEMbase::getTallySuppressedCount()
+{
+	return _tallySuppressed;
+}
+
+/**
+ * Selects where the tally callback takes its bits from, see ATEMtallySource.
+ * Set it before connect(): the derived tally is built from commands of the
+ * initial dump, which are only parsed for it while it is selected.
+ */
+void ATEMbase::setTallySource(ATEMtallySource source)
+{
+	if (source != _tallySource)
+		_derivedTally.invalidate();
+	_tallySource = source;
+}
+
+ATEMtallySource ATEMbase::getTallySource()
+{
+	return _tallySource;
+}
+
+/**
+ * True while the tally callback gets the derived tally
+ */
+bool ATEMbase::isTallyDerived()
+{
+	return _tallySource == ATEM_TALLY_DERIVED || (_tallySource == ATEM_TALLY_FALLBACK && !_tallyInSeen);
+}
+
+/**
+ * Datagrams since begin() whose tally was derived from busses and keyers
+ */
+uint32_t ATEMbase::getDerivedTallyCount()
+{
+	return _derivedPublished;
+}
+
+/**
+ * Reports every TrPs (transition position). The switcher sends one per frame while
+ * a transition runs, so it is left unparsed when no callback is set.
+ */
+void ATEMbase::setAtemTransitionCallback(atem_transition_cb_t cb)
+{
+	_transitionCallback = cb;
+}
+
+/**
+ * Reports the names of every input from InPr: all of them in the initial dump, later when an operator renames one
+ */
+void ATEMbase::setInputNameCallback(atem_input_name_cb_t cb)
+{
+	_inputNameCallback = cb;
+}
+
+/**
+ * Hands every datagram from the switcher (raw, before any checks) to cb, e.g. to record a capture
+ */
+void ATEMbase::setCaptureCallback(atem_capture_cb_t cb)
+{
+	_captureCallback = cb;
+}
+
+/**
+ * TrPs payload: [M/E][in transition][frames remaining][-][position u16, 0-10000]
+ */
+void ATEMbase::_parseTransitionPosition()
+{
+	if (_transitionCallback != NULL)
+	{
+		// one per frame while M/E 1 mixes
+		if (_frameTimed && _cmd[0] == 0 && _cmd[1] != 0)
+			_frameClock.observe(_lastReceiveMicros);
+		_transitionCallback(_cmd[0], _cmd[1] != 0, word(_cmd[4], _cmd[5]));
+	}
+}
+
+/**
+ * Reports the audio inputs that are mixed in and loud enough, only when they change.
+ * Set it before connect(): levels are requested once the initial dump is complete.
+ */
+void ATEMbase::setMicLiveCallback(atem_mic_live_cb_t cb)
+{
+	_micLiveCallback = cb;
+}
+
+void ATEMbase::setMicLiveThresholds(int8_t onDb, int8_t offDb, uint16_t holdMs)
+{
+	_micLive.setThresholds(onDb, offDb, holdMs);
+}
+
+/**
+ * Audio inputs whose level gate is open, mixed in or not
+ */
+uint64_t ATEMbase::getMicGate()
+{
+	return _micLive.gate();
+}
+
+/**
+ * Feeds AMIP and AMLv to the mic live state while someone listens
+ */
+void ATEMbase::_parseAudio(uint32_t cmd)
+{
+	if (_micLiveCallback == NULL)
+		return;
+	if (cmd == ATEM_CMD_AMLv)
+		_micLive.parseLevels(_cmd.data, _cmd.length, millis());
+	else if (cmd == ATEM_CMD_AMIP)
+		_micLive.parseInputProperties(_cmd.data, _cmd.length);
+}
+
+/**
+ * Audio follow video inputs go live with the published program tally, so this runs after _tallyPacketEnd()
+ */
+void ATEMbase::_micLivePacketEnd()
+{
+	if (_micLiveCallback == NULL)
+		return;
+	uint64_t live = _micLive.live(_publishedProgram, _sourceTally);
+	if (live == _publishedMicLive)
+		return;
+	_publishedMicLive = live;
+	_micLiveCallback(live);
+}
+
+/**
+ * VidM payload: [format][-][-][-]
+ */
+void ATEMbase::_parseVideoMode()
+{
+	_frameClock.setVideoMode(_cmd[0]);
+}
+
+/**
+ * Video mode format (VidM) of the switcher, 0xFF until it was received
+ */
+uint8_t ATEMbase::getVideoMode()
+{
+	return _frameClock.videoMode();
+}
+
+/**
+ * Frame period of the video mode in microseconds, 0 for an unknown mode
+ */
+uint32_t ATEMbase::getFramePeriodMicros()
+{
+	return _frameClock.period();
+}
+
+/**
+ * True once the frame grid has a period and a phase, taken from a tally change or a transition frame
+ */
+bool ATEMbase::isFrameClockLocked()
+{
+	return _frameClock.locked();
+}
+
+/**
+ * The frame boundary (in micros(), plus the switcher's constant send delay) at or before at.
+ * Read it from the tally callback, which runs in the same task as the parser.
+ */
+uint32_t ATEMbase::getFrameMicros(uint32_t at)
+{
+	return _frameClock.frameAt(at);
+}
+
+/**
+ * The first frame boundary at or after at, see getFrameMicros()
+ */
+uint32_t ATEMbase::getNextFrameMicros(uint32_t at)
+{
+	return _frameClock.nextFrame(at);
+}
+
+/**
+ * Largest time (us) a frame-triggered datagram arrived behind the frame grid
+ */
+uint32_t ATEMbase::getFrameJitterMax()
+{
+	return _frameClock.jitterMax();
+}
+
+/**
+ * Feeds a bus, transition or keyer command to the derived tally while it is the one published
+ */
+void ATEMbase::_parseDerivedTally(uint32_t cmd)
+{
+	if (isTallyDerived())
+		_derivedTally.parse(cmd, _cmd.data, _cmd.length);
+}
+
+/**
+ * Publishes the tally of a datagram from the selected source. tallyIn tells
+ * whether TlIn or (for mapped cameras) TlSr arrived; program and preview are
+ * the TlIn bits.
+ */
+void ATEMbase::_tallyPacketEnd(bool tallyIn, uint64_t program, uint64_t preview, atem_tally_cb_t cb)
+{
+	if (tallyIn)
+		_tallyInSeen = true;
+	if (isTallyDerived())
+	{
+		if (!_derivedTally.changed())
+			return;
+		_derivedTally.compute(&program, &preview, _sourceTally);
+		_derivedPublished++;
 	}
 	else
 	{
-		return false;
+		if (!tallyIn)
+			return;
+		_sourceTally.apply(&program, &preview);
 	}
+	if (!_sessionTallied)
+	{
+		_sessionTallied = true;
+		_timeToFirstTally = millis() - _connectStartedAt;
+	}
+	_publishTally(program, preview, cb);
 }
 
-uint8_t ATEMbase::getATEMmodel()
+/**
+ * Calls cb with the tally and the bits changed since the last call, unless nothing changed.
+ * The switcher repeats TlIn with every state change (and the camera map may hide the changed sources),
+ * so most datagrams carrying tally leave it as it was.
+ */
+void ATEMbase::_publishTally(uint64_t program, uint64_t preview, atem_tally_cb_t cb)
 {
-	return _ATEMmodel;
+	if (_tallyPublished && program == _publishedProgram && preview == _publishedPreview)
+	{
+		_tallySuppressed++;
+		return;
+	}
+	ATEMtallyDiff diff;
+	diff.programOn = program & ~_publishedProgram;
+	diff.programOff = _publishedProgram & ~program;
+	diff.previewOn = preview & ~_publishedPreview;
+	diff.previewOff = _publishedPreview & ~preview;
+	_publishedProgram = program;
+	_publishedPreview = preview;
+	_tallyPublished = true;
+	_tallyChanges++;
+	// the switcher cut on a frame boundary just before it sent this; the callback may ask for the next one
+	if (_frameTimed)
+		_frameClock.observe(_lastReceiveMicros);
+	if (cb != NULL)
+	{
+		cb(&program, &preview, &diff);
+	}
+}
+
+/**
+ * InPr payload: [video source u16][long name, 20 chars][short name, 4 chars][...port types, availability]
+ * The names are only NUL-terminated when shorter than their field.
+ */
+void ATEMbase::_parseInputProperties()
+{
+	if (_inputNameCallback == NULL || _cmd.length < 26)
+		return;
+	char longName[21];
+	char shortName[5];
+	memcpy(longName, _cmd.data + 2, 20);
+	longName[20] = 0;
+	memcpy(shortName, _cmd.data + 22, 4);
+	shortName[4] = 0;
+	_inputNameCallback(word(_cmd[0], _cmd[1]), longName, shortName);
+}
+
+/**
+ * Set-commands that did not fit the datagram of their bundle and were continued in a new one
+ */
+uint32_t ATEMbase::getTxOverflowCount()
+{
+	return _txOverflows;
+}
+
+/**
+ * Command datagrams sent again, after a timeout or because the switcher asked for them
+ */
+uint32_t ATEMbase::getTxResendCount()
+{
+	return _txResends;
+}
+
+/**
+ * Command datagrams given up without acknowledge
+ */
+uint32_t ATEMbase::getTxLostCount()
+{
+	return _txLost;
+}
+
+uint8_t ATEMbase::getTxPendingCount()
+{
+	return _txPendingCount;
 }
 
 float ATEMbase::audioWord2Db(uint16_t input)
@@ -962,6 +1820,7 @@ void ATEMbase::commandBundleStart()
 {
 	resetCommandBundle();
 	_wipeCleanPacketBuffer();
+	_returnPacketLength = 0;
 	_cBundle = true;
 }
 void ATEMbase::commandBundleEnd()
@@ -970,7 +1829,7 @@ void ATEMbase::commandBundleEnd()
 	{
 
 		_createCommandHeader(ATEM_headerCmd_AckRequest, _returnPacketLength);
-		_sendPacketBuffer(_returnPacketLength);
+		_sendCommandPacket(_returnPacketLength);
 		_returnPacketLength = 0;
 	}
 	resetCommandBundle();
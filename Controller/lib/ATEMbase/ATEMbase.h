@@ -32,26 +32,120 @@ you can keep a clear conscience: http://skaarhoj.com/about/licenses/
 
 #include "Arduino.h"
 
-#include <WiFiUdp.h>
+#include <lwip/sockets.h>
 
 #include <SkaarhojPgmspace.h>
 
+#include "ATEMfourcc.h"
+#include "ATEMsourceTally.h"
+#include "ATEMderivedTally.h"
+#include "ATEMmicLive.h"
+#include "ATEMframeClock.h"
+#include "ATEMcommandStats.h"
+
 #define ATEM_headerCmd_AckRequest 0x1	// Please acknowledge reception of this package...
 #define ATEM_headerCmd_HelloPacket 0x2	
 #define ATEM_headerCmd_Resend 0x4			// This is a resent information
 #define ATEM_headerCmd_RequestNextAfter 0x8	// I'm requesting you to resend something to me.
 #define ATEM_headerCmd_Ack 0x10		// This package is an acknowledge to package id (byte 4-5) ATEM_headerCmd_AckRequest
 
-#define ATEM_maxInitPackageCount 40		// The maximum number of initialization packages. By observation on a 2M/E 4K can be up to (not fixed!) 32. We allocate a f more then...
-#define ATEM_PACKET_LENGTH 96		// Size of packet buffer
+#define ATEM_maxInitPackageCount 512	// Remote packet IDs tracked during the initial dump. Older 2 M/E models sent up to ~32, Constellation models send several hundred.
+#define ATEM_packetIdMask 0x7FFF		// Packet IDs are 15 bit and wrap to 0
+#ifndef ATEM_PACKET_LENGTH
+#define ATEM_PACKET_LENGTH 1416		// Outgoing datagram buffer; command bundles fill it up to this size, which stays below the Ethernet MTU
+#endif
+#ifndef ATEM_TX_HISTORY_LENGTH
+#define ATEM_TX_HISTORY_LENGTH 2048	// Bytes of sent command datagrams kept until the switcher acknowledges them
+#endif
+#if ATEM_PACKET_LENGTH < 12 + 8 + 255
+#error "ATEM_PACKET_LENGTH must hold the largest single command (12 byte header, 8 byte command header, 255 bytes)"
+#endif
+#define ATEM_TX_PENDING 8			// Unacknowledged command datagrams kept for resend
+#define ATEM_resendTimeout 100		// ms before an unacknowledged command datagram is sent again...
+#define ATEM_resendTries 5			// ...at most this many times
+#define ATEM_RX_BUFFER_LENGTH 1500	// Whole incoming datagram; the switcher stays below the Ethernet MTU
+
+#define ATEM_helloTimeout 1000		// ms to wait for the switcher to answer our hello packet
+#define ATEM_contactTimeout 5000	// ms without any packet before the connection counts as lost
+#define ATEM_backoffMin 500			// First reconnect delay in ms, doubled on every failed attempt...
+#define ATEM_backoffMax 16000		// ...up to this
+#define ATEM_helloBackoffMax 2000	// ...or this while the switcher does not answer at all (off or rebooting), so it is found soon after it is back
+#define ATEM_rxRateWindow 1000		// ms over which the receive rates are averaged
+#define ATEM_commandTimingSample 16	// Every command is counted, the parse time of the commands in one of this many datagrams is measured
 
 #define ATEM_debug 0				// If "1" (true), more debugging information may hit the serial monitor, in particular when _serialDebug = 0x80. Setting this to "0" is recommended for production environments since it saves on flash memory.
 
+/**
+ * Connection states, advanced by runLoop() without blocking
+ */
+enum ATEMconnectionState : uint8_t
+{
+	ATEM_STATE_IDLE,		// begin() called, connect() not yet
+	ATEM_STATE_CONNECTING,	// Hello packet sent, waiting for the answer
+	ATEM_STATE_SYNCING,		// Handshake done, receiving (and re-requesting) the initial dump
+	ATEM_STATE_READY,		// Initial dump complete
+	ATEM_STATE_BACKOFF		// Waiting before the next connect attempt
+};
+
+/**
+ * Why a connection attempt or an established connection was given up
+ */
+enum ATEMreconnectCause : uint8_t
+{
+	ATEM_CAUSE_HELLO_TIMEOUT,	// No answer to the hello packet
+	ATEM_CAUSE_REJECTED,		// Switcher answered "fully booked"
+	ATEM_CAUSE_SYNC_TIMEOUT,	// Contact lost before the initial dump was complete
+	ATEM_CAUSE_CONTACT_LOST,	// Contact lost while ready
+	ATEM_CAUSE_COUNT
+};
+
+/**
+ * Where the tally callback takes its bits from
+ */
+enum ATEMtallySource : uint8_t
+{
+	ATEM_TALLY_TLIN,		// TlIn (and TlSr for mapped cameras) as the switcher reports it
+	ATEM_TALLY_DERIVED,		// Derived from busses and keyers (see ATEMderivedTally.h), TlIn is ignored
+	ATEM_TALLY_FALLBACK		// Derived until the first TlIn of the session, TlIn from then on
+};
+
+/**
+ * Tally bits that changed since the previous callback (all bits of the new state on the first one)
+ */
+struct ATEMtallyDiff
+{
+	uint64_t programOn;
+	uint64_t programOff;
+	uint64_t previewOn;
+	uint64_t previewOff;
+};
+
+typedef void (*atem_tally_cb_t)(uint64_t *program, uint64_t *preview, const ATEMtallyDiff *diff);
+typedef void (*atem_transition_cb_t)(uint8_t mE, bool inTransition, uint16_t position);	// position 0-10000
+typedef void (*atem_input_name_cb_t)(uint16_t videoSource, const char *longName, const char *shortName);	// names NUL-terminated, up to 20 and 4 chars
+typedef void (*atem_mic_live_cb_t)(uint64_t live);	// bit n-1: the audio input of camera n is mixed in and above its level gate
+typedef void (*atem_capture_cb_t)(uint32_t switcherIP, uint16_t localPort, const uint8_t *datagram, uint16_t length, unsigned long receivedAt);	// receivedAt in micros()
+
+/**
+ * Read-only view of one command payload (the bytes after the 8 byte command header)
+ * inside the receive buffer. Reads past the end of the command return 0.
+ */
+struct ATEMcommandView
+{
+	const uint8_t *data;
+	uint16_t length;
+
+	uint8_t operator[](uint16_t i) const { return i < length ? data[i] : 0; }
+};
+
 class ATEMbase
 {
   protected:
   
-  WiFiUDP _Udp;			// UDP object for communication, see constructor.
+	int _socket;						// lwIP UDP socket, -1 while closed
+	uint16_t _socketWait;				// Receive timeout (ms) currently set on _socket
+	uint16_t _socketPort;				// Local port _socket is bound to
+	unsigned long _lastReceiveMicros;	// micros() when the last datagram from the switcher was read
 
 	uint16_t _localPort; 				// Default local port to send from. Preferably it's chosen randomly inside the class.
 	IPAddress _switcherIP;				// IP address of the switcher
@@ -60,28 +154,97 @@ class ATEMbase
 	// ATEM Connection Basics
 	uint16_t _localPacketIdCounter;  	// This is our counter for the command packages we might like to send to ATEM
 	boolean _initPayloadSent;  			// If true, the initial reception of the ATEM memory has passed and we can begin to respond during the runLoop()
-	uint8_t _initPayloadSentAtPacketId;	// The Remote Package ID at which point the initialization payload was completed.
+	uint16_t _initPayloadSentAtPacketId;	// The Remote Package ID at which point the initialization payload was completed.
 	boolean _hasInitialized;  			// If true, all initial payload packets has been received during requests for resent - and we are completely ready to rock!
 	boolean _isConnected;				// Set true if we have received a hello package from the switcher.
 	uint16_t _sessionID;				// Session id of session, given by ATEM switcher
 	unsigned long _lastContact;			// Last time (millis) the switcher sent a packet to us.
 	uint16_t _lastRemotePacketID;		// The most recent Remote Packet Id from switcher
 	uint8_t _missedInitializationPackages[(ATEM_maxInitPackageCount+7)/8];	// Used to track which initialization packages have been missed
-	uint8_t _returnPacketLength;	
+	uint16_t _returnPacketLength;
 	
 	// ATEM Buffer:
-	uint8_t _packet[ATEM_PACKET_LENGTH];   		// Buffer for storing segments of the packets from ATEM and creating answer packets.
+	uint8_t _packet[ATEM_PACKET_LENGTH];   		// Buffer for creating answer and command packets.
+	uint8_t _rxBuffer[ATEM_RX_BUFFER_LENGTH];	// The current datagram from the ATEM, read in one go and parsed in place
 
 	uint16_t _cmdLength;				// Used when parsing packets
-	uint16_t _cmdPointer;				// Used when parsing packets
+	ATEMcommandView _cmd;				// Payload of the command being parsed
+
+	// Parse time statistics (micros per datagram with commands):
+	uint32_t _parseCount;
+	uint32_t _parseTimeTotal;
+	uint32_t _parseTimeMax;
+	ATEMcommandStats _commandStats;		// Count and parse cycles per get-command
+	uint8_t _commandTimingSkip;			// Datagrams to parse before the next timed one
+
+	// Link statistics since begin():
+	uint32_t _rxPackets;				// Datagrams accepted from the switcher, others are neither parsed nor counted
+	uint32_t _rxBytes;
+	uint32_t _rxResent;					// ...of them marked as resent by the switcher
+	uint32_t _rxSizeMismatches;			// ...of them dropped because the header length was not the datagram length
+	uint32_t _acksSent;					// Acknowledges sent for datagrams of the switcher
+	uint32_t _rxResendRequests;			// Requests of the switcher for a command datagram of ours
+	uint32_t _dumpResendRequests;		// Our requests for datagrams missed in the initial dump
+	unsigned long _rxRateStart;			// millis() when the current rate window began
+	uint32_t _rxWindowPackets;			// Datagrams and bytes in the current window
+	uint32_t _rxWindowBytes;
+	uint32_t _rxPacketRate;				// Datagrams and bytes per second in the last window
+	uint32_t _rxByteRate;
+
+	ATEMsourceTally _sourceTally;		// TlSr flags by video source and the camera -> source map
+	ATEMderivedTally _derivedTally;		// Tally from busses and keyers, fed while _tallySource is not ATEM_TALLY_TLIN
+	ATEMtallySource _tallySource = ATEM_TALLY_TLIN;
+	bool _tallyInSeen;					// TlIn received in this session
+	uint32_t _derivedPublished;			// Datagrams whose tally was taken from _derivedTally
+	uint64_t _publishedProgram;			// Tally of the last callback, see _publishTally()
+	uint64_t _publishedPreview;
+	bool _tallyPublished;				// False until the first callback after begin()
+	uint32_t _tallyChanges;				// Tally callbacks made
+	uint32_t _tallySuppressed;			// TlIn/TlSr datagrams that left the tally as it was
+	atem_transition_cb_t _transitionCallback = NULL;	// TrPs is only parsed while this is set
+	atem_input_name_cb_t _inputNameCallback = NULL;		// InPr is only parsed while this is set
+	atem_capture_cb_t _captureCallback = NULL;		// Gets every datagram from the switcher before it is parsed
+	atem_mic_live_cb_t _micLiveCallback = NULL;		// AMIP and AMLv are only parsed (and levels requested) while this is set
+	ATEMmicLive _micLive;
+	uint64_t _publishedMicLive;			// Live inputs of the last mic live callback
+	ATEMframeClock _frameClock;			// Video frame grid from VidM and the arrival of frame-triggered datagrams
+	bool _frameTimed;					// The datagram being parsed is a live one (not the initial dump or a resend), so it marks a frame
 
 	bool _cBundle;				// If set, we are building a set-command bundle.
-	uint8_t _cBBO;		// Bundle Buffer Offset; This is an offset if you want to add more commands.
+	uint16_t _cBBO;		// Bundle Buffer Offset; This is an offset if you want to add more commands.
+
+	// Sent command datagrams waiting for an acknowledge, oldest first. Their bytes are stored back to back in _txHistory.
+	struct ATEMpendingPacket
+	{
+		uint16_t id;			// Local packet ID
+		uint16_t length;
+		unsigned long sentAt;	// millis() of the last (re)send
+		uint8_t tries;
+	};
+	ATEMpendingPacket _txPending[ATEM_TX_PENDING];
+	uint8_t _txPendingCount;
+	uint16_t _txHistoryUsed;
+	uint8_t _txHistory[ATEM_TX_HISTORY_LENGTH];
+
+	uint32_t _txOverflows;		// Commands that did not fit the current bundle datagram and started a new one
+	uint32_t _txResends;		// Command datagrams sent again
+	uint32_t _txLost;			// Command datagrams given up unacknowledged (out of tries or history space)
 
 	uint8_t _ATEMmodel;
 
 	bool neverConnected;
 	bool waitingForIncoming;
+
+	// Connection state machine (see runLoop()):
+	ATEMconnectionState _state;
+	unsigned long _stateSince;			// millis() when _state was entered
+	uint16_t _backoff;					// Current reconnect delay in ms, 0 after ready
+	uint16_t _backoffWait;				// _backoff plus jitter for the current wait
+	unsigned long _connectStartedAt;	// millis() of the first connect attempt since the last ready state
+	uint32_t _timeToReady;				// ms from that attempt until ready, 0 before the first ready
+	uint32_t _timeToFirstTally;			// ms from that attempt until the first tally of the initial dump, 0 before the first one
+	bool _sessionTallied;				// A tally was published since the last connect()
+	uint16_t _reconnects[ATEM_CAUSE_COUNT];
 	
   public:
     ATEMbase();
@@ -91,6 +254,9 @@ class ATEMbase
     void connect(const boolean useFixedPortNumber);
     void runLoop();
 	void runLoop(uint16_t delayTime);
+	void runLoopWait(uint16_t waitMs);
+	void end();
+	unsigned long getLastReceiveMicros();
 		
 	uint16_t getATEM_lastRemotePacketId();
 	uint16_t getSessionID();
@@ -98,6 +264,12 @@ class ATEMbase
 	bool isConnected();
 	bool hasInitialized();
 
+	ATEMconnectionState getConnectionState();
+	uint16_t getReconnectCount(ATEMreconnectCause cause);
+	uint32_t getTimeToReady();
+	uint32_t getTimeToFirstTally();
+	void reconnectNow();
+
   	void serialOutput(uint8_t level);
 	bool hasTimedOut(unsigned long time, unsigned long timeout);
 
@@ -118,16 +290,81 @@ class ATEMbase
 	
 	uint8_t getATEMmodel();
 
+	uint32_t getParseCount();
+	uint32_t getParseTimeAverage();
+	uint32_t getParseTimeMax();
+	void resetParseStats();
+	ATEMcommandStats &getCommandStats();
+
+	uint32_t getRxPacketCount();
+	uint32_t getRxByteCount();
+	uint32_t getRxPacketRate();
+	uint32_t getRxByteRate();
+	uint32_t getRxResentCount();
+	uint32_t getRxSizeMismatchCount();
+	uint32_t getAckCount();
+	uint32_t getRxResendRequestCount();
+	uint32_t getDumpResendRequestCount();
+
+	void setCameraSourceMap(const uint16_t *sources, uint8_t count);
+	uint8_t getTallyBySource(uint16_t videoSource);
+	uint16_t getTallyBySourceCount();
+	uint32_t getTallyChangeCount();
+	uint32_t getTallySuppressedCount();
+	void setTallySource(ATEMtallySource source);
+	ATEMtallySource getTallySource();
+	bool isTallyDerived();
+	uint32_t getDerivedTallyCount();
+
+	void setAtemTransitionCallback(atem_transition_cb_t cb);
+	void setInputNameCallback(atem_input_name_cb_t cb);
+	void setCaptureCallback(atem_capture_cb_t cb);
+	void setMicLiveCallback(atem_mic_live_cb_t cb);
+	void setMicLiveThresholds(int8_t onDb, int8_t offDb, uint16_t holdMs);
+	uint64_t getMicGate();
+
+	uint8_t getVideoMode();
+	uint32_t getFramePeriodMicros();
+	bool isFrameClockLocked();
+	uint32_t getFrameMicros(uint32_t at);
+	uint32_t getNextFrameMicros(uint32_t at);
+	uint32_t getFrameJitterMax();
+
+	uint32_t getTxOverflowCount();
+	uint32_t getTxResendCount();
+	uint32_t getTxLostCount();
+	uint8_t getTxPendingCount();
+
   protected:
   	void _createCommandHeader(const uint8_t headerCmd, const uint16_t lengthOfData);
   	void _createCommandHeader(const uint8_t headerCmd, const uint16_t lengthOfData, const uint16_t remotePacketID);
-  	void _sendPacketBuffer(uint8_t length);
+  	void _sendPacketBuffer(uint16_t length);
+	void _openSocket(uint16_t port);
+	void _closeSocket();
+	int _receive(uint16_t waitMs);
+	void _send(const uint8_t *data, uint16_t length);
+	void _runLoop(uint16_t delayTime, uint16_t waitMs);
+	void _rxRateUpdate();
+	void _sendCommandPacket(uint16_t length);
+	void _txAcknowledge(uint16_t ackId);
+	void _txDropOldest(uint8_t count);
+	bool _txResend(uint16_t id);
+	void _txResendTimedOut();
 	void _wipeCleanPacketBuffer();
+	void _setState(ATEMconnectionState state);
+	void _giveUp(ATEMreconnectCause cause);
 
 	void _parsePacket(uint16_t packetLength);
-	virtual void _parseGetCommands(const char *cmdString);
-	bool _readToPacketBuffer();
-	bool _readToPacketBuffer(uint8_t maxBytes);
+	virtual void _parseGetCommands(uint32_t cmd);
+	virtual void _parsePacketEnd();
+	void _parseTransitionPosition();
+	void _parseInputProperties();
+	void _publishTally(uint64_t program, uint64_t preview, atem_tally_cb_t cb);
+	void _parseDerivedTally(uint32_t cmd);
+	void _parseAudio(uint32_t cmd);
+	void _parseVideoMode();
+	void _micLivePacketEnd();
+	void _tallyPacketEnd(bool tallyIn, uint64_t program, uint64_t preview, atem_tally_cb_t cb);
 	void _prepareCommandPacket(const char *cmdString, uint8_t cmdBytes, bool indexMatch=true);
 	void _finishCommandPacket();
 };
@@ -0,0 +1,56 @@
+/*
+Count and parse time per get-command, see ATEMcommandStats.h.
+*/
+
+#include "ATEMcommandStats.h"
+
+#include <string.h>
+
+ATEMcommandStats::ATEMcommandStats()
+{
+	reset();
+}
+
+void ATEMcommandStats::reset()
+{
+	memset(_table, 0, sizeof(_table));
+	memset(&_overflow, 0, sizeof(_overflow));
+}
+
+void ATEMcommandStats::add(uint32_t cmd, uint32_t cycles)
+{
+	ATEMcommandStat &entry = _entry(cmd);
+	entry.count++;
+	entry.timed++;
+	entry.cycles += cycles;
+}
+
+const ATEMcommandStat &ATEMcommandStats::at(uint16_t i)
+{
+	return _table[i & (ATEM_COMMAND_STATS - 1)];
+}
+
+const ATEMcommandStat &ATEMcommandStats::overflow()
+{
+	return _overflow;
+}
+
+/**
+ * The entry of cmd, taken from the free ones on its first use; the overflow entry once the table is full
+ */
+ATEMcommandStat &ATEMcommandStats::_entry(uint32_t cmd)
+{
+	uint8_t slot = atemCmdSlot(cmd);
+	for (uint16_t probe = 0; probe < ATEM_COMMAND_STATS; probe++)
+	{
+		ATEMcommandStat &entry = _table[(slot + probe) & (ATEM_COMMAND_STATS - 1)];
+		if (entry.cmd == cmd)
+			return entry;
+		if (entry.cmd == 0)
+		{
+			entry.cmd = cmd;
+			return entry;
+		}
+	}
+	return _overflow;
+}
@@ -0,0 +1,60 @@
+/*
+Count and cumulative parse time per get-command (FourCC) from the switcher.
+
+Entries live in an open-addressed table indexed by atemCmdSlot(), the hash
+the dispatch switches on, so a known command is found with one compare and
+an unknown one after a short probe. A switcher sends a little over a hundred
+different commands in its initial dump; commands beyond the table size are
+summed up in one overflow entry.
+
+Every command is counted. Times are CPU cycles of a sample of the commands:
+for a timed datagram the caller reads the cycle counter once per command and
+hands over the difference to the previous read (so the bookkeeping of one
+command is charged to the next), other datagrams are only counted. Average
+time per command is cycles / timed.
+*/
+
+#ifndef ATEMcommandStats_h
+#define ATEMcommandStats_h
+
+#include <stdint.h>
+
+#include "ATEMfourcc.h"
+
+#define ATEM_COMMAND_STATS (1 << ATEM_CMD_HASH_BITS)	// table size, a power of two
+
+struct ATEMcommandStat
+{
+	uint32_t cmd;		// FourCC, 0 for a free entry
+	uint32_t count;
+	uint32_t timed;		// ...of them with their cycles added up
+	uint64_t cycles;
+};
+
+class ATEMcommandStats
+{
+public:
+	ATEMcommandStats();
+
+	void reset();
+	// inline for the usual case of a command found in its own slot
+	void add(uint32_t cmd)
+	{
+		ATEMcommandStat &entry = _table[atemCmdSlot(cmd)];
+		(entry.cmd == cmd ? entry : _entry(cmd)).count++;
+	}
+	void add(uint32_t cmd, uint32_t cycles);
+
+	// entries in use are those with a non-zero cmd; i below ATEM_COMMAND_STATS
+	const ATEMcommandStat &at(uint16_t i);
+	// commands that found the table full
+	const ATEMcommandStat &overflow();
+
+private:
+	ATEMcommandStat &_entry(uint32_t cmd);
+
+	ATEMcommandStat _table[ATEM_COMMAND_STATS];
+	ATEMcommandStat _overflow;
+};
+
+#endif
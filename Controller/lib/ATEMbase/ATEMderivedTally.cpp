@@ -0,0 +1,210 @@
+/*
+Tally derived from the switcher state, see ATEMderivedTally.h.
+*/
+
+#include "ATEMderivedTally.h"
+
+#include <string.h>
+
+ATEMderivedTally::ATEMderivedTally()
+{
+	reset();
+}
+
+void ATEMderivedTally::reset()
+{
+	memset(_program, 0, sizeof(_program));
+	memset(_preview, 0, sizeof(_preview));
+	memset(_nextTransition, 0, sizeof(_nextTransition));
+	memset(_inTransition, 0, sizeof(_inTransition));
+	memset(_keyerOnAir, 0, sizeof(_keyerOnAir));
+	memset(_keyerFill, 0, sizeof(_keyerFill));
+	memset(_dskOnAir, 0, sizeof(_dskOnAir));
+	memset(_dskTie, 0, sizeof(_dskTie));
+	memset(_dskFill, 0, sizeof(_dskFill));
+	_valid = false;
+	_changed = false;
+}
+
+bool ATEMderivedTally::valid()
+{
+	return _valid;
+}
+
+/**
+ * True once after a command changed the derived tally (or invalidate() was called)
+ */
+bool ATEMderivedTally::changed()
+{
+	bool changed = _changed && _valid;
+	_changed = false;
+	return changed;
+}
+
+/**
+ * Forces the next changed(), e.g. after a new camera map
+ */
+void ATEMderivedTally::invalidate()
+{
+	_changed = true;
+}
+
+void ATEMderivedTally::parse(uint32_t cmd, const uint8_t *p, uint16_t length)
+{
+	switch (cmd)
+	{
+	case ATEM_CMD_PrgI:
+		if (length < 4 || p[0] >= ATEM_DERIVED_MES)
+			return;
+		_set(_program[p[0]], (uint16_t)((p[2] << 8) | p[3]));
+		if (p[0] == 0 && !_valid)
+		{
+			_valid = true;
+			_changed = true;
+		}
+		break;
+	case ATEM_CMD_PrvI:
+		if (length < 4 || p[0] >= ATEM_DERIVED_MES)
+			return;
+		_set(_preview[p[0]], (uint16_t)((p[2] << 8) | p[3]));
+		break;
+	case ATEM_CMD_TrSS:
+		if (length < 3 || p[0] >= ATEM_DERIVED_MES)
+			return;
+		_set(_nextTransition[p[0]], (uint8_t)(p[2] & 0x1F));
+		break;
+	case ATEM_CMD_TrPs:
+		// one per frame of a transition, a change only at its start and end
+		if (length < 2 || p[0] >= ATEM_DERIVED_MES)
+			return;
+		_set(_inTransition[p[0]], p[1] != 0);
+		break;
+	case ATEM_CMD_KeOn:
+		if (length < 3 || p[0] >= ATEM_DERIVED_MES || p[1] >= ATEM_DERIVED_KEYERS)
+			return;
+		_set(_keyerOnAir[p[0]][p[1]], p[2] != 0);
+		break;
+	case ATEM_CMD_KeBP:
+		if (length < 8 || p[0] >= ATEM_DERIVED_MES || p[1] >= ATEM_DERIVED_KEYERS)
+			return;
+		_set(_keyerFill[p[0]][p[1]], (uint16_t)((p[6] << 8) | p[7]));
+		break;
+	case ATEM_CMD_DskB:
+		if (length < 4 || p[0] >= ATEM_DERIVED_DSKS)
+			return;
+		_set(_dskFill[p[0]], (uint16_t)((p[2] << 8) | p[3]));
+		break;
+	case ATEM_CMD_DskP:
+		if (length < 2 || p[0] >= ATEM_DERIVED_DSKS)
+			return;
+		_set(_dskTie[p[0]], p[1] != 0);
+		break;
+	case ATEM_CMD_DskS:
+		// a downstream keyer mixing on or off is on air already
+		if (length < 3 || p[0] >= ATEM_DERIVED_DSKS)
+			return;
+		_set(_dskOnAir[p[0]], p[1] != 0 || p[2] != 0);
+		break;
+	default:
+		break;
+	}
+}
+
+void ATEMderivedTally::compute(uint64_t *program, uint64_t *preview, ATEMsourceTally &cameraMap)
+{
+	SourceSet onAir, next;
+	onAir.count = 0;
+	next.count = 0;
+	_onAir(0, onAir, 0);
+	_next(0, next, 0);
+	*program = _bits(onAir, cameraMap);
+	*preview = _bits(next, cameraMap);
+}
+
+void ATEMderivedTally::SourceSet::add(uint16_t source)
+{
+	if (source == 0 || has(source) || count >= ATEM_DERIVED_SOURCES)
+		return;
+	sources[count++] = source;
+}
+
+bool ATEMderivedTally::SourceSet::has(uint16_t source) const
+{
+	for (uint8_t i = 0; i < count; i++)
+	{
+		if (sources[i] == source)
+			return true;
+	}
+	return false;
+}
+
+void ATEMderivedTally::_onAir(uint8_t mE, SourceSet &set, uint8_t depth)
+{
+	_expand(_program[mE], set, depth);
+	for (uint8_t k = 0; k < ATEM_DERIVED_KEYERS; k++)
+	{
+		// a keyer in the running transition is on air while it mixes in or out
+		if (_keyerOnAir[mE][k] || (_inTransition[mE] && (_nextTransition[mE] & (2 << k))))
+			_expand(_keyerFill[mE][k], set, depth);
+	}
+	if (_inTransition[mE] && (_nextTransition[mE] & 1))
+		_expand(_preview[mE], set, depth);
+	if (mE != 0)
+		return;
+	for (uint8_t k = 0; k < ATEM_DERIVED_DSKS; k++)
+	{
+		if (_dskOnAir[k])
+			_expand(_dskFill[k], set, depth);
+	}
+}
+
+void ATEMderivedTally::_next(uint8_t mE, SourceSet &set, uint8_t depth)
+{
+	_expand(_preview[mE], set, depth);
+	for (uint8_t k = 0; k < ATEM_DERIVED_KEYERS; k++)
+	{
+		if (!_keyerOnAir[mE][k] && (_nextTransition[mE] & (2 << k)))
+			_expand(_keyerFill[mE][k], set, depth);
+	}
+	if (mE != 0)
+		return;
+	for (uint8_t k = 0; k < ATEM_DERIVED_DSKS; k++)
+	{
+		if (_dskTie[k] && !_dskOnAir[k])
+			_expand(_dskFill[k], set, depth);
+	}
+}
+
+/**
+ * Adds a source, and for an M/E output the sources of that M/E (one level deep)
+ */
+void ATEMderivedTally::_expand(uint16_t source, SourceSet &set, uint8_t depth)
+{
+	set.add(source);
+	if (depth > 0 || source < ATEM_SOURCE_ME_PROGRAM)
+		return;
+	uint16_t mE = (source - ATEM_SOURCE_ME_PROGRAM) / 10;
+	uint16_t output = (source - ATEM_SOURCE_ME_PROGRAM) % 10;
+	if (mE == 0 || mE >= ATEM_DERIVED_MES || output > 1)
+		return;
+	if (output == 0)
+		_onAir(mE, set, depth + 1);
+	else
+		_next(mE, set, depth + 1);
+}
+
+uint64_t ATEMderivedTally::_bits(const SourceSet &set, ATEMsourceTally &cameraMap)
+{
+	uint64_t bits = 0;
+	for (uint8_t i = 0; i < set.count; i++)
+	{
+		if (set.sources[i] >= 1 && set.sources[i] <= ATEM_SOURCE_TALLY_CAMERAS)
+			bits |= (uint64_t)1 << (set.sources[i] - 1);
+	}
+	for (uint8_t i = 0; i < cameraMap.mappedCameras(); i++)
+	{
+		uint64_t bit = (uint64_t)1 << cameraMap.mappedCamera(i);
+		bits = set.has(cameraMap.mappedSource(i)) ? (bits | bit) : (bits & ~bit);
+	}
+	return bits;
+}
@@ -0,0 +1,85 @@
+/*
+Tally derived from the switcher state, for firmware that sends TlIn late or
+rarely: program and preview bus of both M/Es (PrgI, PrvI), the next
+transition selection (TrSS), a running transition (TrPs), upstream keyers
+(KeOn, KeBP fill source) and downstream keyers (DskS, DskB fill source,
+DskP tie).
+
+On air are the program source of M/E 1, the fill of every keyer on air and,
+while a transition runs, the preview source and the keyers selected for it.
+Preview are the preview source, keyers selected to come on with the next
+transition and tied downstream keyers. An M/E 2 output (program 10020,
+preview 10021) on one of these busses brings in the sources of M/E 2 the
+same way. Nothing else is resolved (SuperSource boxes, media players).
+
+The state is updated command by command; parse() only flags a change when a
+value that feeds the tally differs, so compute() runs once per datagram that
+changed it.
+*/
+
+#ifndef ATEMderivedTally_h
+#define ATEMderivedTally_h
+
+#include <stdint.h>
+
+#include "ATEMfourcc.h"
+#include "ATEMsourceTally.h"
+
+#define ATEM_DERIVED_MES 2
+#define ATEM_DERIVED_KEYERS 4
+#define ATEM_DERIVED_DSKS 2
+#define ATEM_DERIVED_SOURCES 24		// sources on one bus: 2 M/Es x (2 busses + 4 keyers) + 2 DSKs, with room
+#define ATEM_SOURCE_ME_PROGRAM 10010	// M/E n program is 10000 + 10 * n, preview one more
+
+class ATEMderivedTally
+{
+public:
+	ATEMderivedTally();
+
+	// payload of a PrgI, PrvI, TrSS, TrPs, KeOn, KeBP, DskB, DskP or DskS; other commands are ignored
+	void parse(uint32_t cmd, const uint8_t *payload, uint16_t length);
+	void reset();
+	bool valid();
+	bool changed();
+	void invalidate();
+
+	// Cameras with a source in the map get its tally, all others the tally of input ID camera
+	void compute(uint64_t *program, uint64_t *preview, ATEMsourceTally &cameraMap);
+
+private:
+	uint16_t _program[ATEM_DERIVED_MES];
+	uint16_t _preview[ATEM_DERIVED_MES];
+	uint8_t _nextTransition[ATEM_DERIVED_MES];	// TrSS: bit 0 background, bits 1-4 keyers 1-4
+	bool _inTransition[ATEM_DERIVED_MES];
+	bool _keyerOnAir[ATEM_DERIVED_MES][ATEM_DERIVED_KEYERS];
+	uint16_t _keyerFill[ATEM_DERIVED_MES][ATEM_DERIVED_KEYERS];
+	bool _dskOnAir[ATEM_DERIVED_DSKS];
+	bool _dskTie[ATEM_DERIVED_DSKS];
+	uint16_t _dskFill[ATEM_DERIVED_DSKS];
+	bool _valid;	// PrgI of M/E 1 seen
+	bool _changed;
+
+	struct SourceSet
+	{
+		uint16_t sources[ATEM_DERIVED_SOURCES];
+		uint8_t count;
+		void add(uint16_t source);
+		bool has(uint16_t source) const;
+	};
+	void _onAir(uint8_t mE, SourceSet &set, uint8_t depth);
+	void _next(uint8_t mE, SourceSet &set, uint8_t depth);
+	void _expand(uint16_t source, SourceSet &set, uint8_t depth);
+	static uint64_t _bits(const SourceSet &set, ATEMsourceTally &cameraMap);
+
+	template <typename T>
+	void _set(T &field, T value)
+	{
+		if (field != value)
+		{
+			field = value;
+			_changed = true;
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,66 @@
+/*
+Command keys for dispatching ATEM get-commands without string compares.
+
+The 4 character command name in the header of every command is packed into
+one 32 bit key (first character in the top byte). atemCmdSlot() is a
+multiplicative hash that maps all keys below to distinct slots, so a switch
+on the slot compiles to a jump table and one compare with the full key
+confirms the match. The compiler rejects duplicate case labels, so a key
+added here that collides with another one breaks the build instead of the
+dispatch; pick a new ATEM_CMD_HASH_MULT then (tools/atem-bench checks it).
+
+Plain C++11 without Arduino dependencies so host tools can include it.
+*/
+
+#ifndef ATEMfourcc_h
+#define ATEMfourcc_h
+
+#include <stdint.h>
+
+#define ATEM_FOURCC(a, b, c, d) (((uint32_t)(uint8_t)(a) << 24) | ((uint32_t)(uint8_t)(b) << 16) | ((uint32_t)(uint8_t)(c) << 8) | (uint32_t)(uint8_t)(d))
+
+#define ATEM_CMD_HASH_BITS 7
+#define ATEM_CMD_HASH_MULT 0xEC786445UL
+
+constexpr uint8_t atemCmdSlot(uint32_t cmd)
+{
+	return (uint32_t)(cmd * (uint32_t)ATEM_CMD_HASH_MULT) >> (32 - ATEM_CMD_HASH_BITS);
+}
+
+// Known get-commands. Some are not handled yet but are reserved so the hash stays collision free for them.
+constexpr uint32_t ATEM_CMD_ver = ATEM_FOURCC('_', 'v', 'e', 'r');
+constexpr uint32_t ATEM_CMD_pin = ATEM_FOURCC('_', 'p', 'i', 'n');
+constexpr uint32_t ATEM_CMD_top = ATEM_FOURCC('_', 't', 'o', 'p');
+constexpr uint32_t ATEM_CMD_Powr = ATEM_FOURCC('P', 'o', 'w', 'r');
+constexpr uint32_t ATEM_CMD_VidM = ATEM_FOURCC('V', 'i', 'd', 'M');
+constexpr uint32_t ATEM_CMD_InPr = ATEM_FOURCC('I', 'n', 'P', 'r');
+constexpr uint32_t ATEM_CMD_InCm = ATEM_FOURCC('I', 'n', 'C', 'm');
+constexpr uint32_t ATEM_CMD_Time = ATEM_FOURCC('T', 'i', 'm', 'e');
+constexpr uint32_t ATEM_CMD_TlIn = ATEM_FOURCC('T', 'l', 'I', 'n');
+constexpr uint32_t ATEM_CMD_TlSr = ATEM_FOURCC('T', 'l', 'S', 'r');
+constexpr uint32_t ATEM_CMD_PrgI = ATEM_FOURCC('P', 'r', 'g', 'I');
+constexpr uint32_t ATEM_CMD_PrvI = ATEM_FOURCC('P', 'r', 'v', 'I');
+constexpr uint32_t ATEM_CMD_TrSS = ATEM_FOURCC('T', 'r', 'S', 'S');
+constexpr uint32_t ATEM_CMD_TrPr = ATEM_FOURCC('T', 'r', 'P', 'r');
+constexpr uint32_t ATEM_CMD_TrPs = ATEM_FOURCC('T', 'r', 'P', 's');
+constexpr uint32_t ATEM_CMD_TMxP = ATEM_FOURCC('T', 'M', 'x', 'P');
+constexpr uint32_t ATEM_CMD_KeOn = ATEM_FOURCC('K', 'e', 'O', 'n');
+constexpr uint32_t ATEM_CMD_KeBP = ATEM_FOURCC('K', 'e', 'B', 'P');
+constexpr uint32_t ATEM_CMD_DskB = ATEM_FOURCC('D', 's', 'k', 'B');
+constexpr uint32_t ATEM_CMD_DskP = ATEM_FOURCC('D', 's', 'k', 'P');
+constexpr uint32_t ATEM_CMD_DskS = ATEM_FOURCC('D', 's', 'k', 'S');
+constexpr uint32_t ATEM_CMD_FtbS = ATEM_FOURCC('F', 't', 'b', 'S');
+constexpr uint32_t ATEM_CMD_AuxS = ATEM_FOURCC('A', 'u', 'x', 'S');
+constexpr uint32_t ATEM_CMD_MPCE = ATEM_FOURCC('M', 'P', 'C', 'E');
+constexpr uint32_t ATEM_CMD_MPrp = ATEM_FOURCC('M', 'P', 'r', 'p');
+constexpr uint32_t ATEM_CMD_AMIP = ATEM_FOURCC('A', 'M', 'I', 'P');
+constexpr uint32_t ATEM_CMD_AMLv = ATEM_FOURCC('A', 'M', 'L', 'v');
+constexpr uint32_t ATEM_CMD_AMTl = ATEM_FOURCC('A', 'M', 'T', 'l');
+constexpr uint32_t ATEM_CMD_AEBP = ATEM_FOURCC('A', 'E', 'B', 'P');
+constexpr uint32_t ATEM_CMD_FAIP = ATEM_FOURCC('F', 'A', 'I', 'P');
+constexpr uint32_t ATEM_CMD_FAMP = ATEM_FOURCC('F', 'A', 'M', 'P');
+constexpr uint32_t ATEM_CMD_FASP = ATEM_FOURCC('F', 'A', 'S', 'P');
+constexpr uint32_t ATEM_CMD_FMLv = ATEM_FOURCC('F', 'M', 'L', 'v');
+constexpr uint32_t ATEM_CMD_FMTl = ATEM_FOURCC('F', 'M', 'T', 'l');
+
+#endif
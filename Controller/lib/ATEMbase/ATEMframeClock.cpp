@@ -0,0 +1,139 @@
+/*
+Frame grid of the switcher's video, see ATEMframeClock.h.
+*/
+
+#include "ATEMframeClock.h"
+
+// Frame period per VidM format in ns; interlaced formats by frame, not field
+static const uint32_t videoModePeriodNs[ATEM_VIDEO_MODES] = {
+	33366667, 40000000, 33366667, 40000000,				// 525i59.94, 625i50, both 4:3 and 16:9
+	20000000, 16683333,									// 720p50, 720p59.94
+	40000000, 33366667,									// 1080i50, 1080i59.94
+	41708333, 41666667, 40000000, 33366667, 20000000, 16683333,	// 1080p23.98 - 1080p59.94
+	41708333, 41666667, 40000000, 33366667, 20000000, 16683333,	// 2160p23.98 - 2160p59.94
+	41708333, 41666667, 40000000, 33366667, 20000000, 16683333,	// 4320p23.98 - 4320p59.94
+	33333333, 16666667,									// 1080p30, 1080p60
+};
+
+ATEMframeClock::ATEMframeClock()
+{
+	_mode = 0xFF;
+	_periodNs = 0;
+	reset();
+}
+
+/**
+ * Forgets the grid; the video mode stays
+ */
+void ATEMframeClock::reset()
+{
+	_anchor = 0;
+	_lastAt = 0;
+	_count = 0;
+	_jitterMax = 0;
+}
+
+void ATEMframeClock::setVideoMode(uint8_t mode)
+{
+	if (mode == _mode)
+		return;
+	_mode = mode;
+	_periodNs = mode < ATEM_VIDEO_MODES ? videoModePeriodNs[mode] : 0;
+	reset();
+}
+
+uint8_t ATEMframeClock::videoMode()
+{
+	return _mode;
+}
+
+uint32_t ATEMframeClock::period()
+{
+	return (_periodNs + 500) / 1000;
+}
+
+void ATEMframeClock::observe(uint32_t at)
+{
+	if (_periodNs == 0)
+		return;
+	// the first arrival, or one after so long that the signed distances below would wrap
+	if (_count == 0 || at - _lastAt > (1UL << 30))
+	{
+		_anchor = at;
+		_lastAt = at;
+		_count++;
+		return;
+	}
+	uint32_t frame = frameAt(at);
+	uint32_t late = at - frame;
+	uint32_t periodUs = _periodNs / 1000;
+	if (late > periodUs - periodUs / 4)
+	{
+		// less than a quarter frame ahead of the grid: this one is the earliest yet
+		_anchor = at;
+		late = 0;
+	}
+	else
+	{
+		uint32_t creep = (at - _lastAt) >> ATEM_FRAME_CREEP_SHIFT;
+		if (creep > late)
+			creep = late;
+		_anchor = frame + creep;
+		late -= creep;
+	}
+	if (late > _jitterMax)
+		_jitterMax = late;
+	_lastAt = at;
+	_count++;
+}
+
+bool ATEMframeClock::locked()
+{
+	return _periodNs != 0 && _count > 0;
+}
+
+uint32_t ATEMframeClock::frameAt(uint32_t at)
+{
+	if (!locked())
+		return at;
+	return _point(_frames(at));
+}
+
+uint32_t ATEMframeClock::nextFrame(uint32_t at)
+{
+	if (!locked())
+		return at;
+	int64_t frames = _frames(at);
+	uint32_t frame = _point(frames);
+	return frame == at ? at : _point(frames + 1);
+}
+
+/**
+ * Grid points from the anchor to at, rounded down (also before the anchor)
+ */
+int64_t ATEMframeClock::_frames(uint32_t at)
+{
+	int64_t ns = (int64_t)(int32_t)(at - _anchor) * 1000;
+	int64_t frames = ns / _periodNs;
+	if (ns < 0 && frames * (int64_t)_periodNs != ns)
+		frames--;
+	return frames;
+}
+
+uint32_t ATEMframeClock::_point(int64_t frames)
+{
+	int64_t ns = frames * (int64_t)_periodNs;
+	// rounded down also below zero, so a grid point is never after the time it was computed for
+	int64_t us = ns >= 0 ? ns / 1000 : -((-ns + 999) / 1000);
+	return _anchor + (uint32_t)(int32_t)us;
+}
+
+uint32_t ATEMframeClock::jitterMax()
+{
+	return _jitterMax;
+}
+
+uint32_t ATEMframeClock::observations()
+{
+	return _count;
+}
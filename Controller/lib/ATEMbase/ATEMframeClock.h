@@ -0,0 +1,58 @@
+/*
+Frame grid of the switcher's video in micros() of this controller.
+
+VidM gives the frame period. The phase comes from datagrams the switcher
+sends because something happened on a frame (a tally change, TrPs during a
+transition): it switches on a frame boundary and sends its new state right
+after, so these arrive a nearly constant time after a boundary, plus
+network jitter. The grid is anchored on the earliest of them. An arrival
+ahead of the grid moves it back at once; later ones only let it creep
+forward as fast as two crystals drift apart (about 120 ppm), so a delayed
+datagram never pulls it late.
+
+Grid points are the switcher's frame boundaries plus its own constant send
+delay, which cannot be seen from here.
+*/
+
+#ifndef ATEMframeClock_h
+#define ATEMframeClock_h
+
+#include <stdint.h>
+
+#define ATEM_VIDEO_MODES 28			// VidM formats 0-27
+#define ATEM_FRAME_CREEP_SHIFT 13	// the grid creeps forward at most 1/8192 of the time between arrivals
+
+class ATEMframeClock
+{
+public:
+	ATEMframeClock();
+
+	void reset();
+	// VidM format; a new one restarts the grid, unknown ones stop it
+	void setVideoMode(uint8_t mode);
+	uint8_t videoMode();
+	uint32_t period();	// frame period in us (rounded), 0 while unknown
+
+	// micros() of a datagram sent for a change on a frame
+	void observe(uint32_t at);
+	bool locked();
+	// grid point at or before at, and the first one at or after at
+	uint32_t frameAt(uint32_t at);
+	uint32_t nextFrame(uint32_t at);
+	// largest time an arrival came in behind the grid
+	uint32_t jitterMax();
+	uint32_t observations();
+
+private:
+	uint8_t _mode;
+	uint32_t _periodNs;	// ns, so 59.94 and 29.97 Hz don't drift by a rounding error every frame
+	uint32_t _anchor;	// a grid point
+	uint32_t _lastAt;	// last observation
+	uint32_t _count;
+	uint32_t _jitterMax;
+
+	int64_t _frames(uint32_t at);
+	uint32_t _point(int64_t frames);
+};
+
+#endif
@@ -0,0 +1,108 @@
+/*
+"Mic live" state of the audio inputs, see ATEMmicLive.h.
+*/
+
+#include "ATEMmicLive.h"
+
+#include <math.h>
+#include <string.h>
+
+ATEMmicLive::ATEMmicLive()
+{
+	setThresholds(-40, -50, 1000);
+	reset();
+}
+
+void ATEMmicLive::reset()
+{
+	_on = 0;
+	_follow = 0;
+	_gate = 0;
+	memset(_quietSince, 0, sizeof(_quietSince));
+}
+
+void ATEMmicLive::setThresholds(int8_t onDb, int8_t offDb, uint16_t holdMs)
+{
+	if (offDb > onDb)
+		offDb = onDb;
+	_onLevel = (uint32_t)(ATEM_MIC_LEVEL_FULL * pow(10.0, onDb / 20.0));
+	_offLevel = (uint32_t)(ATEM_MIC_LEVEL_FULL * pow(10.0, offDb / 20.0));
+	_holdMs = holdMs;
+}
+
+void ATEMmicLive::parseInputProperties(const uint8_t *p, uint16_t length)
+{
+	if (length < 9)
+		return;
+	uint16_t source = (p[0] << 8) | p[1];
+	if (source < 1 || source > ATEM_MIC_INPUTS)
+		return;
+	uint64_t bit = (uint64_t)1 << (source - 1);
+	_on = p[8] == 1 ? (_on | bit) : (_on & ~bit);
+	_follow = p[8] == 2 ? (_follow | bit) : (_follow & ~bit);
+}
+
+void ATEMmicLive::parseLevels(const uint8_t *p, uint16_t length, unsigned long now)
+{
+	if (length < 36)
+		return;
+	uint16_t count = (p[0] << 8) | p[1];
+	uint16_t levels = 36 + ((2 * count + 3) & ~3);
+	if (levels + 16 * (uint32_t)count > length)
+		return;
+	const uint8_t *ids = p + 36;
+	const uint8_t *level = p + levels;
+	for (uint16_t i = 0; i < count; i++, ids += 2, level += 16)
+	{
+		uint16_t source = (ids[0] << 8) | ids[1];
+		if (source < 1 || source > ATEM_MIC_INPUTS)
+			continue;
+		// 24 bit levels in the low bytes of each 32 bit field
+		uint32_t left = ((uint32_t)level[1] << 16) | (level[2] << 8) | level[3];
+		uint32_t right = ((uint32_t)level[5] << 16) | (level[6] << 8) | level[7];
+		uint32_t loudest = left > right ? left : right;
+		uint64_t bit = (uint64_t)1 << (source - 1);
+		if (loudest >= _onLevel)
+		{
+			_gate |= bit;
+			_quietSince[source - 1] = 0;
+		}
+		else if ((_gate & bit) && loudest < _offLevel)
+		{
+			if (_quietSince[source - 1] == 0)
+				_quietSince[source - 1] = now | 1; // 0 means "not quiet"
+			else if (now - _quietSince[source - 1] >= _holdMs)
+				_gate &= ~bit;
+		}
+		else
+		{
+			_quietSince[source - 1] = 0;
+		}
+	}
+}
+
+uint64_t ATEMmicLive::live(uint64_t program, ATEMsourceTally &cameraMap)
+{
+	return _cameras(_gate & _on, cameraMap) | (_cameras(_gate & _follow, cameraMap) & program);
+}
+
+uint64_t ATEMmicLive::gate()
+{
+	return _gate;
+}
+
+/**
+ * Input bits to camera bits, the way ATEMsourceTally maps TlIn
+ */
+uint64_t ATEMmicLive::_cameras(uint64_t inputs, ATEMsourceTally &cameraMap)
+{
+	uint64_t cameras = inputs;
+	for (uint8_t i = 0; i < cameraMap.mappedCameras(); i++)
+	{
+		uint16_t source = cameraMap.mappedSource(i);
+		uint64_t bit = (uint64_t)1 << cameraMap.mappedCamera(i);
+		bool live = source >= 1 && source <= ATEM_MIC_INPUTS && (inputs & ((uint64_t)1 << (source - 1)));
+		cameras = live ? (cameras | bit) : (cameras & ~bit);
+	}
+	return cameras;
+}
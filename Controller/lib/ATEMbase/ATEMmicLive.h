@@ -0,0 +1,57 @@
+/*
+"Mic live" state of the audio inputs 1-64 of the (classic) audio mixer.
+
+An input is live while it is mixed in (AMIP mix option on, or audio follow
+video with its video input on program) and its level gate is open. The gate
+opens when the louder channel of the input reaches the on threshold and
+closes once it stayed below the off threshold for the hold time, so speech
+pauses and levels around one threshold don't flicker.
+
+AMLv arrives many times a second with every input in it. Thresholds are
+kept as raw 24 bit levels, so a level packet costs a few byte reads and
+compares per input and no dB conversion.
+*/
+
+#ifndef ATEMmicLive_h
+#define ATEMmicLive_h
+
+#include <stdint.h>
+
+#include "ATEMsourceTally.h"
+
+#define ATEM_MIC_INPUTS 64				// audio sources 1-64, one bit each
+#define ATEM_MIC_LEVEL_FULL 0x800000	// raw level of 0 dBFS
+
+class ATEMmicLive
+{
+public:
+	ATEMmicLive();
+
+	void reset();
+	// onDb above offDb; holdMs the gate stays open below offDb
+	void setThresholds(int8_t onDb, int8_t offDb, uint16_t holdMs);
+
+	// AMIP: [source u16][type] .. [8 mix option: 0 off, 1 on, 2 audio follow video]
+	void parseInputProperties(const uint8_t *payload, uint16_t length);
+	// AMLv: [count u16][2] master/monitor levels, count x [source u16] (padded to 4), count x [L][R][peak L][peak R] (4 bytes each)
+	void parseLevels(const uint8_t *payload, uint16_t length, unsigned long now);
+
+	// live cameras: camera n+1 follows the input of its camera map slot (input n+1 if
+	// unmapped), audio follow video inputs only while their camera is set in program
+	uint64_t live(uint64_t program, ATEMsourceTally &cameraMap);
+	// inputs whose level gate is open
+	uint64_t gate();
+
+private:
+	uint64_t _on;		// mix option on
+	uint64_t _follow;	// mix option audio follow video
+	uint64_t _gate;		// level gate open
+	uint32_t _onLevel;
+	uint32_t _offLevel;
+	uint16_t _holdMs;
+	unsigned long _quietSince[ATEM_MIC_INPUTS];	// millis() when the level fell below _offLevel
+
+	static uint64_t _cameras(uint64_t inputs, ATEMsourceTally &cameraMap);
+};
+
+#endif
@@ -0,0 +1,109 @@
+/*
+Tally by source (TlSr) table, see ATEMsourceTally.h.
+*/
+
+#include "ATEMsourceTally.h"
+
+ATEMsourceTally::ATEMsourceTally()
+{
+	_mapCount = 0;
+	reset();
+}
+
+void ATEMsourceTally::reset()
+{
+	memset(_keys, 0xFF, sizeof(_keys));
+	_count = 0;
+	_valid = false;
+}
+
+/**
+ * Every TlSr carries the complete list, so the table is rebuilt from scratch
+ */
+void ATEMsourceTally::parse(const uint8_t *payload, uint16_t length)
+{
+	if (length < 2)
+		return;
+	uint16_t count = (payload[0] << 8) | payload[1];
+	if (count > (length - 2) / 3)
+		count = (length - 2) / 3;
+	if (count >= ATEM_SOURCE_TALLY_SLOTS)
+		count = ATEM_SOURCE_TALLY_SLOTS - 1; // keep one slot free so lookups terminate
+
+	memset(_keys, 0xFF, sizeof(_keys));
+	_count = 0;
+	for (uint16_t i = 0; i < count; i++)
+	{
+		const uint8_t *entry = payload + 2 + 3 * i;
+		uint16_t source = (entry[0] << 8) | entry[1];
+		if (source == ATEM_SOURCE_NONE)
+			continue;
+		uint8_t slot = _slot(source);
+		while (_keys[slot] != ATEM_SOURCE_NONE && _keys[slot] != source)
+			slot++; // wraps at 256
+		if (_keys[slot] == ATEM_SOURCE_NONE)
+			_count++;
+		_keys[slot] = source;
+		_flags[slot] = entry[2];
+	}
+	_valid = true;
+}
+
+bool ATEMsourceTally::valid()
+{
+	return _valid;
+}
+
+uint16_t ATEMsourceTally::sources()
+{
+	return _count;
+}
+
+uint8_t ATEMsourceTally::flags(uint16_t source)
+{
+	uint8_t slot = _slot(source);
+	while (_keys[slot] != ATEM_SOURCE_NONE)
+	{
+		if (_keys[slot] == source)
+			return _flags[slot];
+		slot++;
+	}
+	return 0;
+}
+
+void ATEMsourceTally::setCameraMap(const uint16_t *sources, uint8_t count)
+{
+	_mapCount = 0;
+	if (count > ATEM_SOURCE_TALLY_CAMERAS)
+		count = ATEM_SOURCE_TALLY_CAMERAS;
+	for (uint8_t i = 0; i < count; i++)
+	{
+		if (sources[i] == 0 || sources[i] == ATEM_SOURCE_NONE)
+			continue;
+		_mapCamera[_mapCount] = i;
+		_mapSource[_mapCount] = sources[i];
+		_mapCount++;
+	}
+}
+
+bool ATEMsourceTally::hasCameraMap()
+{
+	return _mapCount > 0;
+}
+
+/**
+ * Replaces the bits of mapped cameras with the flags of their source.
+ * Without a TlSr from the switcher (older firmware) the TlIn bits stay.
+ */
+void ATEMsourceTally::apply(uint64_t *program, uint64_t *preview)
+{
+	if (!_valid)
+		return;
+	for (uint8_t i = 0; i < _mapCount; i++)
+	{
+		uint64_t bit = (uint64_t)1 << _mapCamera[i];
+		uint8_t f = flags(_mapSource[i]);
+		*program = (f & 1) ? (*program | bit) : (*program & ~bit);
+		*preview = (f & 2) ? (*preview | bit) : (*preview & ~bit);
+	}
+}
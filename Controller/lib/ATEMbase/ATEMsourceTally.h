@@ -0,0 +1,58 @@
+/*
+Tally by source (TlSr): the switcher lists every video source ID with its
+tally flags (bit 0 program, bit 1 preview). The flags are kept in a small
+open addressing table keyed by source ID, so looking up a camera's source
+is O(1) no matter how many sources the model has or in which order the
+switcher lists them.
+
+A camera map (camera ID -> source ID) turns the table into the same
+program/preview bitmasks TlIn produces; cameras without a source keep their
+TlIn index bit.
+*/
+
+#ifndef ATEMsourceTally_h
+#define ATEMsourceTally_h
+
+#include <stdint.h>
+#include <string.h>
+
+#define ATEM_SOURCE_TALLY_SLOTS 256	// power of two, more than any switcher reports
+#define ATEM_SOURCE_TALLY_CAMERAS 64	// bits in the tally masks
+#define ATEM_SOURCE_NONE 0xFFFF
+
+class ATEMsourceTally
+{
+public:
+	ATEMsourceTally();
+
+	// payload: [count u16] then count x [source u16][flags u8]
+	void parse(const uint8_t *payload, uint16_t length);
+	void reset();
+	bool valid();
+	uint16_t sources();
+	uint8_t flags(uint16_t source);
+
+	// sources[i] is the source of camera i+1, 0 leaves the camera on its TlIn index
+	void setCameraMap(const uint16_t *sources, uint8_t count);
+	bool hasCameraMap();
+	void apply(uint64_t *program, uint64_t *preview);
+	// mapped cameras (index) and their sources, in camera order
+	uint8_t mappedCameras() { return _mapCount; }
+	uint8_t mappedCamera(uint8_t i) { return _mapCamera[i]; }
+	uint16_t mappedSource(uint8_t i) { return _mapSource[i]; }
+
+private:
+	uint16_t _keys[ATEM_SOURCE_TALLY_SLOTS];
+	uint8_t _flags[ATEM_SOURCE_TALLY_SLOTS];
+	uint16_t _count;
+	bool _valid;
+
+	// mapped cameras only
+	uint8_t _mapCamera[ATEM_SOURCE_TALLY_CAMERAS];
+	uint16_t _mapSource[ATEM_SOURCE_TALLY_CAMERAS];
+	uint8_t _mapCount;
+
+	static uint8_t _slot(uint16_t source) { return (uint8_t)((source * 0x9E37u) >> 8); }
+};
+
+#endif
@@ -186,7 +186,7 @@ void ATEMstd::changeUpstreamKeyOn(uint8_t keyer, bool state)
 }
 void ATEMstd::changeUpstreamKeyNextTransition(uint8_t keyer, bool state)
 { // Supporting "Background" by "0"
-	if (keyer >= 0 && keyer <= 4)
+	if (keyer <= 4)
 	{ // Todo: Should match available keyers depending on model?
 		uint8_t stateValue = getTransitionNextTransition(0);
 		if (state)
@@ -271,7 +271,7 @@ void ATEMstd::changeDVESettingsTemp(unsigned long Xpos, unsigned long Ypos, unsi
 	setKeyDVESizeY(0, 0, Ysize);
 	commandBundleEnd();
 }
-void ATEMstd::changeDVEMaskTemp(unsigned long top, unsigned long bottom, unsigned long left, unsigned long right)
+void ATEMstd::changeDVEMaskTemp(unsigned long, unsigned long, unsigned long, unsigned long)
 {	// TEMP
 	// N/A
 }
@@ -422,37 +422,36 @@ void ATEMstd::setWipeReverseDirection(bool reverse)
 // **
 // *********************************
 
-void ATEMstd::_parseGetCommands(const char *cmdStr)
+void ATEMstd::_parseGetCommands(uint32_t cmd)
 {
-	uint8_t mE, keyer, colorGenerator, aUXChannel, mediaPlayer, macroIndex;
+	uint8_t mE, keyer, aUXChannel, mediaPlayer;
 	uint16_t index, audioSource, sources;
+#if ATEM_debug
 	long temp;
+#endif
 
 	// log commands for statistics
-	// Serial.printf("%.4s\n", cmdStr);
+	// Serial.printf("%c%c%c%c\n", (char)(cmd >> 24), (char)(cmd >> 16), (char)(cmd >> 8), (char)cmd);
 
+	// One jump on the hashed key; each handler confirms the full key with a single compare (see ATEMfourcc.h)
+	switch (atemCmdSlot(cmd))
+	{
 	// Ignore very frequent commands
-	if (!strcmp_P(cmdStr, PSTR("TrPs")))
-		return;
-	else if (!strcmp_P(cmdStr, PSTR("Time")))
-		return;
-	else if (!strcmp_P(cmdStr, PSTR("MPrp")))
-		return;
-	else if (!strcmp_P(cmdStr, PSTR("FMTl")))
+	case atemCmdSlot(ATEM_CMD_Time):
+	case atemCmdSlot(ATEM_CMD_MPrp):
+	case atemCmdSlot(ATEM_CMD_FMTl):
+	case atemCmdSlot(ATEM_CMD_FASP):
+	case atemCmdSlot(ATEM_CMD_AEBP):
 		return;
-	else if (!strcmp_P(cmdStr, PSTR("TlSr")))
-		return;
-	else
-	{
-		_readToPacketBuffer(); // Default
-	}
 
-	if (!strcmp_P(cmdStr, PSTR("TlIn")))
+	case atemCmdSlot(ATEM_CMD_TlIn):
 	{
+		if (cmd != ATEM_CMD_TlIn)
+			break;
 #if ATEM_debug
 		temp = atemTallyByIndexSources;
 #endif
-		atemTallyByIndexSources = word(_packet[0], _packet[1]);
+		atemTallyByIndexSources = word(_cmd[0], _cmd[1]);
 		sources = atemTallyByIndexSources > 64 ? 64 : atemTallyByIndexSources;
 #if ATEM_debug
 		if ((_serialOutput == 0x80 && atemTallyByIndexSources != temp) || (_serialOutput == 0x81 && !hasInitialized()))
@@ -469,7 +468,7 @@ void ATEMstd::_parseGetCommands(const char *cmdStr)
 #if ATEM_debug
 			temp = atemTallyByIndexTallyFlags[a];
 #endif
-			atemTallyByIndexTallyFlags[a] = _packet[2 + a];
+			atemTallyByIndexTallyFlags[a] = _cmd[2 + a];
 			if (atemTallyByIndexTallyFlags[a] & 1) atemTallyProgram |= (uint64_t)1 << a;
 			if (atemTallyByIndexTallyFlags[a] & 2) atemTallyPreview |= (uint64_t)1 << a;
 #if ATEM_debug
@@ -482,25 +481,63 @@ void ATEMstd::_parseGetCommands(const char *cmdStr)
 			}
 #endif
 		}
-		if (atemTallyCallback != NULL)
+		atemTallyChanged = true;
+		break;
+	}
+	case atemCmdSlot(ATEM_CMD_VidM):
+	{
+		if (cmd != ATEM_CMD_VidM)
+			break;
+		atemVideoModeFormat = _cmd[0];
+		_parseVideoMode();
+		break;
+	}
+	case atemCmdSlot(ATEM_CMD_InPr):
+	{
+		if (cmd != ATEM_CMD_InPr)
+			break;
+		_parseInputProperties();
+		break;
+	}
+	case atemCmdSlot(ATEM_CMD_TrPs):
+	{
+		// Very frequent (every frame of a transition): only read when someone listens
+		if (cmd != ATEM_CMD_TrPs)
+			break;
+		_parseDerivedTally(cmd);
+		if (_transitionCallback == NULL)
+			break;
+		mE = _cmd[0];
+		if (mE <= 1)
 		{
-			atemTallyCallback(&atemTallyProgram, &atemTallyPreview);
+			atemTransitionInTransition[mE] = _cmd[1];
+			atemTransitionFramesRemaining[mE] = _cmd[2];
+			atemTransitionPosition[mE] = word(_cmd[4], _cmd[5]);
 		}
+		_parseTransitionPosition();
+		break;
 	}
-	else if (!strcmp_P(cmdStr, PSTR("FASP")))
-		return;
-	else if (!strcmp_P(cmdStr, PSTR("AEBP")))
-		return;
-	else if (!strcmp_P(cmdStr, PSTR("PrgI")))
+	case atemCmdSlot(ATEM_CMD_TlSr):
 	{
+		if (cmd != ATEM_CMD_TlSr)
+			break;
+		_sourceTally.parse(_cmd.data, _cmd.length);
+		atemTallyChanged = _sourceTally.hasCameraMap() || atemTallyChanged;
+		break;
+	}
+	case atemCmdSlot(ATEM_CMD_PrgI):
+	{
+		if (cmd != ATEM_CMD_PrgI)
+			break;
+		_parseDerivedTally(cmd);
 
-		mE = _packet[0];
+		mE = _cmd[0];
 		if (mE <= 1)
 		{
 #if ATEM_debug
 			temp = atemProgramInputVideoSource[mE];
 #endif
-			atemProgramInputVideoSource[mE] = word(_packet[2], _packet[3]);
+			atemProgramInputVideoSource[mE] = word(_cmd[2], _cmd[3]);
 #if ATEM_debug
 			if ((_serialOutput == 0x80 && atemProgramInputVideoSource[mE] != temp) || (_serialOutput == 0x81 && !hasInitialized()))
 			{
@@ -511,17 +548,21 @@ void ATEMstd::_parseGetCommands(const char *cmdStr)
 			}
 #endif
 		}
+		break;
 	}
-	else if (!strcmp_P(cmdStr, PSTR("PrvI")))
+	case atemCmdSlot(ATEM_CMD_PrvI):
 	{
+		if (cmd != ATEM_CMD_PrvI)
+			break;
+		_parseDerivedTally(cmd);
 
-		mE = _packet[0];
+		mE = _cmd[0];
 		if (mE <= 1)
 		{
 #if ATEM_debug
 			temp = atemPreviewInputVideoSource[mE];
 #endif
-			atemPreviewInputVideoSource[mE] = word(_packet[2], _packet[3]);
+			atemPreviewInputVideoSource[mE] = word(_cmd[2], _cmd[3]);
 #if ATEM_debug
 			if ((_serialOutput == 0x80 && atemPreviewInputVideoSource[mE] != temp) || (_serialOutput == 0x81 && !hasInitialized()))
 			{
@@ -532,17 +573,21 @@ void ATEMstd::_parseGetCommands(const char *cmdStr)
 			}
 #endif
 		}
+		break;
 	}
-	else if (!strcmp_P(cmdStr, PSTR("TrSS")))
+	case atemCmdSlot(ATEM_CMD_TrSS):
 	{
+		if (cmd != ATEM_CMD_TrSS)
+			break;
+		_parseDerivedTally(cmd);
 
-		mE = _packet[0];
+		mE = _cmd[0];
 		if (mE <= 1)
 		{
 #if ATEM_debug
 			temp = atemTransitionStyle[mE];
 #endif
-			atemTransitionStyle[mE] = _packet[1];
+			atemTransitionStyle[mE] = _cmd[1];
 #if ATEM_debug
 			if ((_serialOutput == 0x80 && atemTransitionStyle[mE] != temp) || (_serialOutput == 0x81 && !hasInitialized()))
 			{
@@ -556,7 +601,7 @@ void ATEMstd::_parseGetCommands(const char *cmdStr)
 #if ATEM_debug
 			temp = atemTransitionNextTransition[mE];
 #endif
-			atemTransitionNextTransition[mE] = _packet[2];
+			atemTransitionNextTransition[mE] = _cmd[2];
 #if ATEM_debug
 			if ((_serialOutput == 0x80 && atemTransitionNextTransition[mE] != temp) || (_serialOutput == 0x81 && !hasInitialized()))
 			{
@@ -567,17 +612,20 @@ void ATEMstd::_parseGetCommands(const char *cmdStr)
 			}
 #endif
 		}
+		break;
 	}
-	else if (!strcmp_P(cmdStr, PSTR("TrPr")))
+	case atemCmdSlot(ATEM_CMD_TrPr):
 	{
+		if (cmd != ATEM_CMD_TrPr)
+			break;
 
-		mE = _packet[0];
+		mE = _cmd[0];
 		if (mE <= 1)
 		{
 #if ATEM_debug
 			temp = atemTransitionPreviewEnabled[mE];
 #endif
-			atemTransitionPreviewEnabled[mE] = _packet[1];
+			atemTransitionPreviewEnabled[mE] = _cmd[1];
 #if ATEM_debug
 			if ((_serialOutput == 0x80 && atemTransitionPreviewEnabled[mE] != temp) || (_serialOutput == 0x81 && !hasInitialized()))
 			{
@@ -588,17 +636,20 @@ void ATEMstd::_parseGetCommands(const char *cmdStr)
 			}
 #endif
 		}
+		break;
 	}
-	else if (!strcmp_P(cmdStr, PSTR("TMxP")))
+	case atemCmdSlot(ATEM_CMD_TMxP):
 	{
+		if (cmd != ATEM_CMD_TMxP)
+			break;
 
-		mE = _packet[0];
+		mE = _cmd[0];
 		if (mE <= 1)
 		{
 #if ATEM_debug
 			temp = atemTransitionMixRate[mE];
 #endif
-			atemTransitionMixRate[mE] = _packet[1];
+			atemTransitionMixRate[mE] = _cmd[1];
 #if ATEM_debug
 			if ((_serialOutput == 0x80 && atemTransitionMixRate[mE] != temp) || (_serialOutput == 0x81 && !hasInitialized()))
 			{
@@ -609,18 +660,22 @@ void ATEMstd::_parseGetCommands(const char *cmdStr)
 			}
 #endif
 		}
+		break;
 	}
-	else if (!strcmp_P(cmdStr, PSTR("KeOn")))
+	case atemCmdSlot(ATEM_CMD_KeOn):
 	{
+		if (cmd != ATEM_CMD_KeOn)
+			break;
+		_parseDerivedTally(cmd);
 
-		mE = _packet[0];
-		keyer = _packet[1];
+		mE = _cmd[0];
+		keyer = _cmd[1];
 		if (mE <= 1 && keyer <= 3)
 		{
 #if ATEM_debug
 			temp = atemKeyerOnAirEnabled[mE][keyer];
 #endif
-			atemKeyerOnAirEnabled[mE][keyer] = _packet[2];
+			atemKeyerOnAirEnabled[mE][keyer] = _cmd[2];
 #if ATEM_debug
 			if ((_serialOutput == 0x80 && atemKeyerOnAirEnabled[mE][keyer] != temp) || (_serialOutput == 0x81 && !hasInitialized()))
 			{
@@ -633,17 +688,21 @@ void ATEMstd::_parseGetCommands(const char *cmdStr)
 			}
 #endif
 		}
+		break;
 	}
-	else if (!strcmp_P(cmdStr, PSTR("DskP")))
+	case atemCmdSlot(ATEM_CMD_DskP):
 	{
+		if (cmd != ATEM_CMD_DskP)
+			break;
+		_parseDerivedTally(cmd);
 
-		keyer = _packet[0];
+		keyer = _cmd[0];
 		if (keyer <= 1)
 		{
 #if ATEM_debug
 			temp = atemDownstreamKeyerTie[keyer];
 #endif
-			atemDownstreamKeyerTie[keyer] = _packet[1];
+			atemDownstreamKeyerTie[keyer] = _cmd[1];
 #if ATEM_debug
 			if ((_serialOutput == 0x80 && atemDownstreamKeyerTie[keyer] != temp) || (_serialOutput == 0x81 && !hasInitialized()))
 			{
@@ -657,7 +716,7 @@ void ATEMstd::_parseGetCommands(const char *cmdStr)
 #if ATEM_debug
 			temp = atemDownstreamKeyerRate[keyer];
 #endif
-			atemDownstreamKeyerRate[keyer] = _packet[2];
+			atemDownstreamKeyerRate[keyer] = _cmd[2];
 #if ATEM_debug
 			if ((_serialOutput == 0x80 && atemDownstreamKeyerRate[keyer] != temp) || (_serialOutput == 0x81 && !hasInitialized()))
 			{
@@ -671,7 +730,7 @@ void ATEMstd::_parseGetCommands(const char *cmdStr)
 #if ATEM_debug
 			temp = atemDownstreamKeyerPreMultiplied[keyer];
 #endif
-			atemDownstreamKeyerPreMultiplied[keyer] = _packet[3];
+			atemDownstreamKeyerPreMultiplied[keyer] = _cmd[3];
 #if ATEM_debug
 			if ((_serialOutput == 0x80 && atemDownstreamKeyerPreMultiplied[keyer] != temp) || (_serialOutput == 0x81 && !hasInitialized()))
 			{
@@ -685,7 +744,7 @@ void ATEMstd::_parseGetCommands(const char *cmdStr)
 #if ATEM_debug
 			temp = atemDownstreamKeyerClip[keyer];
 #endif
-			atemDownstreamKeyerClip[keyer] = word(_packet[4], _packet[5]);
+			atemDownstreamKeyerClip[keyer] = word(_cmd[4], _cmd[5]);
 #if ATEM_debug
 			if ((_serialOutput == 0x80 && atemDownstreamKeyerClip[keyer] != temp) || (_serialOutput == 0x81 && !hasInitialized()))
 			{
@@ -699,7 +758,7 @@ void ATEMstd::_parseGetCommands(const char *cmdStr)
 #if ATEM_debug
 			temp = atemDownstreamKeyerGain[keyer];
 #endif
-			atemDownstreamKeyerGain[keyer] = word(_packet[6], _packet[7]);
+			atemDownstreamKeyerGain[keyer] = word(_cmd[6], _cmd[7]);
 #if ATEM_debug
 			if ((_serialOutput == 0x80 && atemDownstreamKeyerGain[keyer] != temp) || (_serialOutput == 0x81 && !hasInitialized()))
 			{
@@ -713,7 +772,7 @@ void ATEMstd::_parseGetCommands(const char *cmdStr)
 #if ATEM_debug
 			temp = atemDownstreamKeyerInvertKey[keyer];
 #endif
-			atemDownstreamKeyerInvertKey[keyer] = _packet[8];
+			atemDownstreamKeyerInvertKey[keyer] = _cmd[8];
 #if ATEM_debug
 			if ((_serialOutput == 0x80 && atemDownstreamKeyerInvertKey[keyer] != temp) || (_serialOutput == 0x81 && !hasInitialized()))
 			{
@@ -727,7 +786,7 @@ void ATEMstd::_parseGetCommands(const char *cmdStr)
 #if ATEM_debug
 			temp = atemDownstreamKeyerMasked[keyer];
 #endif
-			atemDownstreamKeyerMasked[keyer] = _packet[9];
+			atemDownstreamKeyerMasked[keyer] = _cmd[9];
 #if ATEM_debug
 			if ((_serialOutput == 0x80 && atemDownstreamKeyerMasked[keyer] != temp) || (_serialOutput == 0x81 && !hasInitialized()))
 			{
@@ -741,7 +800,7 @@ void ATEMstd::_parseGetCommands(const char *cmdStr)
 #if ATEM_debug
 			temp = atemDownstreamKeyerTop[keyer];
 #endif
-			atemDownstreamKeyerTop[keyer] = (int16_t)word(_packet[10], _packet[11]);
+			atemDownstreamKeyerTop[keyer] = (int16_t)word(_cmd[10], _cmd[11]);
 #if ATEM_debug
 			if ((_serialOutput == 0x80 && atemDownstreamKeyerTop[keyer] != temp) || (_serialOutput == 0x81 && !hasInitialized()))
 			{
@@ -755,7 +814,7 @@ void ATEMstd::_parseGetCommands(const char *cmdStr)
 #if ATEM_debug
 			temp = atemDownstreamKeyerBottom[keyer];
 #endif
-			atemDownstreamKeyerBottom[keyer] = (int16_t)word(_packet[12], _packet[13]);
+			atemDownstreamKeyerBottom[keyer] = (int16_t)word(_cmd[12], _cmd[13]);
 #if ATEM_debug
 			if ((_serialOutput == 0x80 && atemDownstreamKeyerBottom[keyer] != temp) || (_serialOutput == 0x81 && !hasInitialized()))
 			{
@@ -769,7 +828,7 @@ void ATEMstd::_parseGetCommands(const char *cmdStr)
 #if ATEM_debug
 			temp = atemDownstreamKeyerLeft[keyer];
 #endif
-			atemDownstreamKeyerLeft[keyer] = (int16_t)word(_packet[14], _packet[15]);
+			atemDownstreamKeyerLeft[keyer] = (int16_t)word(_cmd[14], _cmd[15]);
 #if ATEM_debug
 			if ((_serialOutput == 0x80 && atemDownstreamKeyerLeft[keyer] != temp) || (_serialOutput == 0x81 && !hasInitialized()))
 			{
@@ -783,7 +842,7 @@ void ATEMstd::_parseGetCommands(const char *cmdStr)
 #if ATEM_debug
 			temp = atemDownstreamKeyerRight[keyer];
 #endif
-			atemDownstreamKeyerRight[keyer] = (int16_t)word(_packet[16], _packet[17]);
+			atemDownstreamKeyerRight[keyer] = (int16_t)word(_cmd[16], _cmd[17]);
 #if ATEM_debug
 			if ((_serialOutput == 0x80 && atemDownstreamKeyerRight[keyer] != temp) || (_serialOutput == 0x81 && !hasInitialized()))
 			{
@@ -794,17 +853,67 @@ void ATEMstd::_parseGetCommands(const char *cmdStr)
 			}
 #endif
 		}
+		break;
 	}
-	else if (!strcmp_P(cmdStr, PSTR("FtbS")))
+	case atemCmdSlot(ATEM_CMD_AMIP):
 	{
+		if (cmd != ATEM_CMD_AMIP)
+			break;
+		_parseAudio(cmd);
 
-		mE = _packet[0];
+		audioSource = word(_cmd[0], _cmd[1]);
+		index = getAudioSrcIndex(audioSource);
+		if (index != 0 || audioSource == 1) // unknown sources map to index 0 as well
+		{
+			atemAudioMixerInputMixOption[index] = _cmd[8];
+			atemAudioMixerInputVolume[index] = word(_cmd[10], _cmd[11]);
+			atemAudioMixerInputBalance[index] = (int16_t)word(_cmd[12], _cmd[13]);
+		}
+		break;
+	}
+	case atemCmdSlot(ATEM_CMD_AMLv):
+	{
+		// many per second while levels are enabled; only the mic live gate reads them
+		if (cmd != ATEM_CMD_AMLv)
+			break;
+		_parseAudio(cmd);
+		break;
+	}
+	case atemCmdSlot(ATEM_CMD_KeBP):
+	case atemCmdSlot(ATEM_CMD_DskB):
+	{
+		// fill sources, only kept for the derived tally
+		_parseDerivedTally(cmd);
+		break;
+	}
+	case atemCmdSlot(ATEM_CMD_DskS):
+	{
+		if (cmd != ATEM_CMD_DskS)
+			break;
+		_parseDerivedTally(cmd);
+
+		keyer = _cmd[0];
+		if (keyer <= 1)
+		{
+			atemDownstreamKeyerOnAir[keyer] = _cmd[1];
+			atemDownstreamKeyerInTransition[keyer] = _cmd[2];
+			atemDownstreamKeyerIsAutoTransitioning[keyer] = _cmd[3];
+			atemDownstreamKeyerFramesRemaining[keyer] = _cmd[4];
+		}
+		break;
+	}
+	case atemCmdSlot(ATEM_CMD_FtbS):
+	{
+		if (cmd != ATEM_CMD_FtbS)
+			break;
+
+		mE = _cmd[0];
 		if (mE <= 1)
 		{
 #if ATEM_debug
 			temp = atemFadeToBlackStateFullyBlack[mE];
 #endif
-			atemFadeToBlackStateFullyBlack[mE] = _packet[1];
+			atemFadeToBlackStateFullyBlack[mE] = _cmd[1];
 #if ATEM_debug
 			if ((_serialOutput == 0x80 && atemFadeToBlackStateFullyBlack[mE] != temp) || (_serialOutput == 0x81 && !hasInitialized()))
 			{
@@ -818,7 +927,7 @@ void ATEMstd::_parseGetCommands(const char *cmdStr)
 #if ATEM_debug
 			temp = atemFadeToBlackStateInTransition[mE];
 #endif
-			atemFadeToBlackStateInTransition[mE] = _packet[2];
+			atemFadeToBlackStateInTransition[mE] = _cmd[2];
 #if ATEM_debug
 			if ((_serialOutput == 0x80 && atemFadeToBlackStateInTransition[mE] != temp) || (_serialOutput == 0x81 && !hasInitialized()))
 			{
@@ -832,7 +941,7 @@ void ATEMstd::_parseGetCommands(const char *cmdStr)
 #if ATEM_debug
 			temp = atemFadeToBlackStateFramesRemaining[mE];
 #endif
-			atemFadeToBlackStateFramesRemaining[mE] = _packet[3];
+			atemFadeToBlackStateFramesRemaining[mE] = _cmd[3];
 #if ATEM_debug
 			if ((_serialOutput == 0x80 && atemFadeToBlackStateFramesRemaining[mE] != temp) || (_serialOutput == 0x81 && !hasInitialized()))
 			{
@@ -843,17 +952,20 @@ void ATEMstd::_parseGetCommands(const char *cmdStr)
 			}
 #endif
 		}
+		break;
 	}
-	else if (!strcmp_P(cmdStr, PSTR("AuxS")))
+	case atemCmdSlot(ATEM_CMD_AuxS):
 	{
+		if (cmd != ATEM_CMD_AuxS)
+			break;
 
-		aUXChannel = _packet[0];
+		aUXChannel = _cmd[0];
 		if (aUXChannel <= 5)
 		{
 #if ATEM_debug
 			temp = atemAuxSourceInput[aUXChannel];
 #endif
-			atemAuxSourceInput[aUXChannel] = word(_packet[2], _packet[3]);
+			atemAuxSourceInput[aUXChannel] = word(_cmd[2], _cmd[3]);
 #if ATEM_debug
 			if ((_serialOutput == 0x80 && atemAuxSourceInput[aUXChannel] != temp) || (_serialOutput == 0x81 && !hasInitialized()))
 			{
@@ -864,17 +976,20 @@ void ATEMstd::_parseGetCommands(const char *cmdStr)
 			}
 #endif
 		}
+		break;
 	}
-	else if (!strcmp_P(cmdStr, PSTR("MPCE")))
+	case atemCmdSlot(ATEM_CMD_MPCE):
 	{
+		if (cmd != ATEM_CMD_MPCE)
+			break;
 
-		mediaPlayer = _packet[0];
+		mediaPlayer = _cmd[0];
 		if (mediaPlayer <= 1)
 		{
 #if ATEM_debug
 			temp = atemMediaPlayerSourceType[mediaPlayer];
 #endif
-			atemMediaPlayerSourceType[mediaPlayer] = _packet[1];
+			atemMediaPlayerSourceType[mediaPlayer] = _cmd[1];
 #if ATEM_debug
 			if ((_serialOutput == 0x80 && atemMediaPlayerSourceType[mediaPlayer] != temp) || (_serialOutput == 0x81 && !hasInitialized()))
 			{
@@ -888,7 +1003,7 @@ void ATEMstd::_parseGetCommands(const char *cmdStr)
 #if ATEM_debug
 			temp = atemMediaPlayerSourceStillIndex[mediaPlayer];
 #endif
-			atemMediaPlayerSourceStillIndex[mediaPlayer] = _packet[2];
+			atemMediaPlayerSourceStillIndex[mediaPlayer] = _cmd[2];
 #if ATEM_debug
 			if ((_serialOutput == 0x80 && atemMediaPlayerSourceStillIndex[mediaPlayer] != temp) || (_serialOutput == 0x81 && !hasInitialized()))
 			{
@@ -902,7 +1017,7 @@ void ATEMstd::_parseGetCommands(const char *cmdStr)
 #if ATEM_debug
 			temp = atemMediaPlayerSourceClipIndex[mediaPlayer];
 #endif
-			atemMediaPlayerSourceClipIndex[mediaPlayer] = _packet[3];
+			atemMediaPlayerSourceClipIndex[mediaPlayer] = _cmd[3];
 #if ATEM_debug
 			if ((_serialOutput == 0x80 && atemMediaPlayerSourceClipIndex[mediaPlayer] != temp) || (_serialOutput == 0x81 && !hasInitialized()))
 			{
@@ -913,22 +1028,25 @@ void ATEMstd::_parseGetCommands(const char *cmdStr)
 			}
 #endif
 		}
+		break;
 	}
-	else if (!strcmp_P(cmdStr, PSTR("_pin")))
+	case atemCmdSlot(ATEM_CMD_pin):
 	{
-		if (_packet[5] == 'T')
+		if (cmd != ATEM_CMD_pin)
+			break;
+		if (_cmd[5] == 'T')
 		{
 			_ATEMmodel = 0;
 		}
-		else if (_packet[5] == '1')
+		else if (_cmd[5] == '1')
 		{
-			_ATEMmodel = _packet[29] == '4' ? 4 : 1;
+			_ATEMmodel = _cmd[29] == '4' ? 4 : 1;
 		}
-		else if (_packet[5] == '2')
+		else if (_cmd[5] == '2')
 		{
-			_ATEMmodel = _packet[29] == '4' ? 5 : 2;
+			_ATEMmodel = _cmd[29] == '4' ? 5 : 2;
 		}
-		else if (_packet[5] == 'P')
+		else if (_cmd[5] == 'P')
 		{
 			_ATEMmodel = 3;
 		}
@@ -961,14 +1079,17 @@ void ATEMstd::_parseGetCommands(const char *cmdStr)
 			}
 		}
 #endif
+		break;
 	}
-	else if (!strcmp_P(cmdStr, PSTR("_ver")))
+	case atemCmdSlot(ATEM_CMD_ver):
 	{
+		if (cmd != ATEM_CMD_ver)
+			break;
 
 #if ATEM_debug
 		temp = atemProtocolVersionMajor;
 #endif
-		atemProtocolVersionMajor = word(_packet[0], _packet[1]);
+		atemProtocolVersionMajor = word(_cmd[0], _cmd[1]);
 #if ATEM_debug
 		if ((_serialOutput == 0x80 && atemProtocolVersionMajor != temp) || (_serialOutput == 0x81 && !hasInitialized()))
 		{
@@ -980,7 +1101,7 @@ void ATEMstd::_parseGetCommands(const char *cmdStr)
 #if ATEM_debug
 		temp = atemProtocolVersionMinor;
 #endif
-		atemProtocolVersionMinor = word(_packet[2], _packet[3]);
+		atemProtocolVersionMinor = word(_cmd[2], _cmd[3]);
 #if ATEM_debug
 		if ((_serialOutput == 0x80 && atemProtocolVersionMinor != temp) || (_serialOutput == 0x81 && !hasInitialized()))
 		{
@@ -988,14 +1109,26 @@ void ATEMstd::_parseGetCommands(const char *cmdStr)
 			Serial.println(atemProtocolVersionMinor);
 		}
 #endif
+		break;
 	}
-	else
-	{
+	default:
+		break;
 	}
 }
 
 /**
- * @brief Set callback when TlIn packet comes
+ * TlIn and TlSr usually arrive in the same datagram; the callback sees both, and only if the tally changed
+ */
+void ATEMstd::_parsePacketEnd()
+{
+	bool tallyIn = atemTallyChanged;
+	atemTallyChanged = false;
+	_tallyPacketEnd(tallyIn, atemTallyProgram, atemTallyPreview, atemTallyCallback);
+	_micLivePacketEnd();
+}
+
+/**
+ * @brief Set callback for tally changes (TlIn/TlSr), with the bits turned on and off
  *
  * @param cb
  */
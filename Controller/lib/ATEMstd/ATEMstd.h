@@ -29,8 +29,6 @@ you can keep a clear conscience: http://skaarhoj.com/about/licenses/
 
 #include "ATEMbase.h"
 
-typedef void (*atem_tally_cb_t)(uint64_t *program, uint64_t *preview);
-
 class ATEMstd : public ATEMbase
 {
 public:
@@ -137,7 +135,8 @@ public:
 	// *********************************
 
 private:
-	void _parseGetCommands(const char *cmdStr);
+	void _parseGetCommands(uint32_t cmd);
+	void _parsePacketEnd();
 
 	// Private Variables in ATEM.h:
 
@@ -191,6 +190,7 @@ private:
 	uint8_t atemTallyByIndexTallyFlags[64];
 	uint64_t atemTallyProgram = 0;
 	uint64_t atemTallyPreview = 0;
+	bool atemTallyChanged = false;
 	atem_tally_cb_t atemTallyCallback;
 
 public:
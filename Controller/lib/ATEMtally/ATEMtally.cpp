@@ -0,0 +1,183 @@
+/*
+Tally-only ATEM client on top of ATEMbase, see ATEMtally.h.
+*/
+
+#include "ATEMtally.h"
+
+ATEMtally::ATEMtally() {}
+
+uint16_t ATEMtally::getProgramInput()
+{
+	return getProgramInputVideoSource(0);
+}
+uint16_t ATEMtally::getPreviewInput()
+{
+	return getPreviewInputVideoSource(0);
+}
+uint16_t ATEMtally::getProgramInputVideoSource(uint8_t mE)
+{
+	return mE <= 1 ? atemProgramInputVideoSource[mE] : 0;
+}
+uint16_t ATEMtally::getPreviewInputVideoSource(uint8_t mE)
+{
+	return mE <= 1 ? atemPreviewInputVideoSource[mE] : 0;
+}
+
+/**
+ * Tally of input index 1-64 as reported by TlIn
+ */
+boolean ATEMtally::getProgramTally(uint8_t inputNumber)
+{
+	if (inputNumber < 1 || inputNumber > ATEMtally_maxSources)
+		return false;
+	return (atemTallyProgram >> (inputNumber - 1)) & 1;
+}
+boolean ATEMtally::getPreviewTally(uint8_t inputNumber)
+{
+	if (inputNumber < 1 || inputNumber > ATEMtally_maxSources)
+		return false;
+	return (atemTallyPreview >> (inputNumber - 1)) & 1;
+}
+uint16_t ATEMtally::getTallyByIndexSources()
+{
+	return atemTallyByIndexSources;
+}
+
+uint16_t ATEMtally::getProtocolVersionMajor()
+{
+	return atemProtocolVersionMajor;
+}
+uint16_t ATEMtally::getProtocolVersionMinor()
+{
+	return atemProtocolVersionMinor;
+}
+
+/**
+ * @brief Set callback for tally changes (TlIn/TlSr), called at most once per datagram and only on change
+ */
+void ATEMtally::setAtemTallyCallback(atem_tally_cb_t cb)
+{
+	atemTallyCallback = cb;
+}
+
+/**
+ * Only the commands below are read; for everything else the payload is never touched
+ */
+void ATEMtally::_parseGetCommands(uint32_t cmd)
+{
+	uint8_t mE;
+
+	switch (atemCmdSlot(cmd))
+	{
+	case atemCmdSlot(ATEM_CMD_TlIn):
+	{
+		if (cmd != ATEM_CMD_TlIn)
+			break;
+		atemTallyByIndexSources = word(_cmd[0], _cmd[1]);
+		uint8_t sources = atemTallyByIndexSources > ATEMtally_maxSources ? ATEMtally_maxSources : atemTallyByIndexSources;
+		atemTallyProgram = 0;
+		atemTallyPreview = 0;
+		for (uint8_t a = 0; a < sources; a++)
+		{
+			uint8_t flags = _cmd[2 + a];
+			if (flags & 1)
+				atemTallyProgram |= (uint64_t)1 << a;
+			if (flags & 2)
+				atemTallyPreview |= (uint64_t)1 << a;
+		}
+		atemTallyChanged = true;
+		break;
+	}
+	case atemCmdSlot(ATEM_CMD_TlSr):
+	{
+		if (cmd != ATEM_CMD_TlSr)
+			break;
+		_sourceTally.parse(_cmd.data, _cmd.length);
+		atemTallyChanged = _sourceTally.hasCameraMap() || atemTallyChanged;
+		break;
+	}
+	case atemCmdSlot(ATEM_CMD_VidM):
+	{
+		if (cmd != ATEM_CMD_VidM)
+			break;
+		_parseVideoMode();
+		break;
+	}
+	case atemCmdSlot(ATEM_CMD_InPr):
+	{
+		if (cmd != ATEM_CMD_InPr)
+			break;
+		_parseInputProperties();
+		break;
+	}
+	case atemCmdSlot(ATEM_CMD_TrPs):
+	{
+		if (cmd != ATEM_CMD_TrPs)
+			break;
+		_parseTransitionPosition();
+		_parseDerivedTally(cmd);
+		break;
+	}
+	case atemCmdSlot(ATEM_CMD_PrgI):
+	{
+		if (cmd != ATEM_CMD_PrgI)
+			break;
+		mE = _cmd[0];
+		if (mE <= 1)
+			atemProgramInputVideoSource[mE] = word(_cmd[2], _cmd[3]);
+		_parseDerivedTally(cmd);
+		break;
+	}
+	case atemCmdSlot(ATEM_CMD_PrvI):
+	{
+		if (cmd != ATEM_CMD_PrvI)
+			break;
+		mE = _cmd[0];
+		if (mE <= 1)
+			atemPreviewInputVideoSource[mE] = word(_cmd[2], _cmd[3]);
+		_parseDerivedTally(cmd);
+		break;
+	}
+	case atemCmdSlot(ATEM_CMD_AMIP):
+	case atemCmdSlot(ATEM_CMD_AMLv):
+		_parseAudio(cmd);
+		break;
+	// Only for the derived tally; ATEMderivedTally::parse() confirms the full key
+	case atemCmdSlot(ATEM_CMD_TrSS):
+	case atemCmdSlot(ATEM_CMD_KeOn):
+	case atemCmdSlot(ATEM_CMD_KeBP):
+	case atemCmdSlot(ATEM_CMD_DskB):
+	case atemCmdSlot(ATEM_CMD_DskP):
+	case atemCmdSlot(ATEM_CMD_DskS):
+		_parseDerivedTally(cmd);
+		break;
+	case atemCmdSlot(ATEM_CMD_ver):
+	{
+		if (cmd != ATEM_CMD_ver)
+			break;
+		atemProtocolVersionMajor = word(_cmd[0], _cmd[1]);
+		atemProtocolVersionMinor = word(_cmd[2], _cmd[3]);
+		if (_serialOutput)
+		{
+			Serial.print(F("ATEM protocol version "));
+			Serial.print(atemProtocolVersionMajor);
+			Serial.print(F("."));
+			Serial.println(atemProtocolVersionMinor);
+		}
+		break;
+	}
+	default:
+		break;
+	}
+}
+
+/**
+ * TlIn and TlSr usually arrive in the same datagram; the callback sees both, and only if the tally changed
+ */
+void ATEMtally::_parsePacketEnd()
+{
+	bool tallyIn = atemTallyChanged;
+	atemTallyChanged = false;
+	_tallyPacketEnd(tallyIn, atemTallyProgram, atemTallyPreview, atemTallyCallback);
+	_micLivePacketEnd();
+}
@@ -0,0 +1,57 @@
+/*
+Tally-only ATEM client on top of ATEMbase.
+
+Keeps only what the tally bridge needs: the TlIn and TlSr tally flags,
+program and preview input of both M/Es, the protocol version, the video
+mode for the frame clock and (with the respective callback set) the
+transition position and input names. With a derived tally source
+(setTallySource()) the bus, transition and keyer commands feeding it are
+read as well, with a mic live callback the audio mixer input properties and
+levels. Every other command is skipped in _parseGetCommands() without
+touching its payload, which stays in the receive buffer of ATEMbase.
+
+Licensed like the rest of the ATEM library under the GNU GPL v3, see
+../ATEMbase/license.txt.
+*/
+
+#ifndef ATEMtally_h
+#define ATEMtally_h
+
+#include "ATEMbase.h"
+
+#define ATEMtally_maxSources 64 // TlIn entries kept; the tally bitmasks are 64 bit
+
+class ATEMtally : public ATEMbase
+{
+public:
+	ATEMtally();
+
+	uint16_t getProgramInput();
+	uint16_t getPreviewInput();
+	uint16_t getProgramInputVideoSource(uint8_t mE);
+	uint16_t getPreviewInputVideoSource(uint8_t mE);
+	boolean getProgramTally(uint8_t inputNumber);
+	boolean getPreviewTally(uint8_t inputNumber);
+	uint16_t getTallyByIndexSources();
+
+	uint16_t getProtocolVersionMajor();
+	uint16_t getProtocolVersionMinor();
+
+	void setAtemTallyCallback(atem_tally_cb_t f);
+
+private:
+	void _parseGetCommands(uint32_t cmd);
+	void _parsePacketEnd();
+
+	uint16_t atemProtocolVersionMajor;
+	uint16_t atemProtocolVersionMinor;
+	uint16_t atemProgramInputVideoSource[2];
+	uint16_t atemPreviewInputVideoSource[2];
+	uint16_t atemTallyByIndexSources;
+	uint64_t atemTallyProgram = 0;
+	uint64_t atemTallyPreview = 0;
+	bool atemTallyChanged = false;	// TlIn or TlSr in the current datagram
+	atem_tally_cb_t atemTallyCallback = NULL;
+};
+
+#endif
@@ -41,19 +41,49 @@ enum espnow_command : uint8_t {
   SET_CAMID_MAC = 12,
   SET_NAME_MAC = 13,
   SET_BRIGHTNESS_MAC = 14,
-  SET_STATUS_BRIGHTNESS = 15
+  SET_STATUS_BRIGHTNESS = 15,
+  TEST_BEGIN = 32,
+  TEST_END = 33,
+  TEST_REPORT = 34,
+  PROVISION_OPEN = 36,
+  PROVISION_CLAIM = 37,
+  PROVISION_ASSIGN = 38,
+  PROVISION_ACK = 39,
+  TRANSITION = 40,
+  SET_NAMES = 41
 };
 
+constexpr uint8_t TRANSITION_END = 0x01;
+
 constexpr uint8_t MAX_TALLIES = 64;
 constexpr unsigned long HEARTBEAT_INTERVAL = 2000;
 constexpr unsigned long LINK_TIMEOUT = 5000;
+constexpr unsigned long FADE_TIMEOUT = 600;  // end a fade whose closing frame got lost
+constexpr uint32_t SET_TALLY_MAX_LEAD_US = 200000;  // a later applyAt is taken as garbage and applied at once
+constexpr uint8_t CLOCK_CREEP_SHIFT = 13;  // the offset grows at most 1/8192 of the time between tallies
 
 uint8_t tallyId = 1;
+bool idAssigned = false;  // tallyId was stored in EEPROM slot 42 by a command or the button
 uint64_t programBits = 0;
 uint64_t previewBits = 0;
 uint8_t rgbBrightness = 255;
 uint8_t statusBrightness = 255;
 unsigned long lastPacketAt = 0;
+// counters appended to SET_TALLY by the controller, see handleSetTally
+bool tallyCounters = false;
+uint16_t tallySeq = 0;
+uint16_t tallyGen = 0;
+uint16_t seqGaps = 0;
+unsigned long lastTallyAt = 0;
+// frame-timed tallies: the controller's micros() at sending and the moment to switch, see handleSetTally
+bool clockSynced = false;
+uint32_t clockOffset = 0;  // our micros() minus the controller's, from the fastest frame seen
+uint32_t clockSyncedAt = 0;
+bool tallyScheduled = false;
+uint32_t scheduledAt = 0;  // our micros()
+uint64_t scheduledProgram = 0;
+uint64_t scheduledPreview = 0;
+uint16_t lateMaxUs = 0;  // most a scheduled tally was applied late since the last heartbeat
 unsigned long lastHeartbeatAt = 0;
 bool colorOverride = false;
 uint32_t overrideColor = 0;
@@ -66,6 +96,25 @@ uint32_t blinkColor = 0;
 unsigned long blinkNextToggle = 0;
 bool blinkState = false;
 bool otaEnabled = false;
+// load test session started by the controller (TEST_BEGIN/TEST_END)
+bool testActive = false;
+uint16_t testSession = 0;
+uint32_t testFrames = 0;
+bool testReportDue = false;
+unsigned long testReportAt = 0;
+// provisioning window opened by the controller (PROVISION_OPEN)
+bool provisioning = false;
+uint8_t provisionSession = 0;
+uint8_t provisionDoneSession = 0;
+unsigned long provisionUntil = 0;
+unsigned long nextClaimAt = 0;
+bool provisionAckDue = false;
+// mix in progress (TRANSITION): cameras in fadeFrom fade out, cameras in fadeTo fade in
+bool fadeActive = false;
+uint64_t fadeFrom = 0;
+uint64_t fadeTo = 0;
+uint8_t fadePosition = 0;
+unsigned long lastFadeAt = 0;
 enum led_type : uint8_t { LED_RGB = 0, LED_WS2812 = 1 };
 led_type ledType =
 #ifdef LED_TYPE_WS2812
@@ -108,6 +157,10 @@ void setTallyLeds() {
     r = (overrideColor >> 16) & 0xFF;
     g = (overrideColor >> 8) & 0xFF;
     b = overrideColor & 0xFF;
+  } else if (fadeActive && (fadeTo & bitn(tallyId))) {
+    r = fadePosition; g = 255 - fadePosition;  // preview -> program
+  } else if (fadeActive && (fadeFrom & bitn(tallyId))) {
+    r = 255 - fadePosition; g = fadePosition;  // program -> preview, where a mix leaves it
   } else if (isProgram() && isPreview()) {
     r = 255; g = 128; b = 0;  // orange if both
   } else if (isProgram()) {
@@ -156,6 +209,12 @@ void handleSetBrightnessMac(const uint8_t* data, int len) {
   setTallyLeds();
 }
 
+void saveTallyId() {
+  EEPROM.write(42, tallyId);
+  EEPROM.commit();
+  idAssigned = true;
+}
+
 void handleSetCamId(const uint8_t* data, int len) {
   if (len < 2 + (int)sizeof(uint64_t)) return;
   uint8_t newId = data[1];
@@ -164,6 +223,7 @@ void handleSetCamId(const uint8_t* data, int len) {
   memcpy(&bits, data + 2, sizeof(bits));
   if (bits & bitn(tallyId)) {
     tallyId = newId;
+    saveTallyId();
   }
 }
 
@@ -173,6 +233,7 @@ void handleSetCamIdMac(const uint8_t* data, int len) {
   if (newId == 0 || newId > MAX_TALLIES) return;
   if (memcmp(selfMac, data + 2, 6) != 0) return;
   tallyId = newId;
+  saveTallyId();
 }
 
 void saveNameToEeprom(uint8_t nameLen) {
@@ -207,6 +268,30 @@ void handleSetNameMac(const uint8_t* data, int len) {
   Serial.printf("Name set: %s\n", camName);
 }
 
+// [SET_NAMES][count] then per camera [camId][len][name]; only our own entry is taken
+void handleSetNames(const uint8_t* data, int len) {
+  if (len < 2) return;
+  uint8_t count = data[1];
+  int at = 2;
+  for (uint8_t i = 0; i < count; i++) {
+    if (at + 2 > len) return;
+    uint8_t id = data[at];
+    uint8_t nameLen = data[at + 1];
+    if (at + 2 + nameLen > len) return;
+    if (id == tallyId) {
+      if (nameLen > 31) nameLen = 31;
+      // names are sent again on every connect; spare the EEPROM if nothing changed
+      if (strlen(camName) == nameLen && memcmp(camName, data + at + 2, nameLen) == 0) return;
+      memcpy(camName, data + at + 2, nameLen);
+      camName[nameLen] = 0;
+      saveNameToEeprom(nameLen);
+      Serial.printf("Name set: %s\n", camName);
+      return;
+    }
+    at += 2 + nameLen;
+  }
+}
+
 void handleIdentify(const uint8_t* data, int len) {
   if (len < 2) return;
   uint8_t seconds = data[1];
@@ -254,11 +339,91 @@ void handleLedType(const uint8_t* data, int len) {
   ledType = (data[1] == LED_WS2812) ? LED_WS2812 : LED_RGB;
 }
 
+// Offset to the controller's clock: the smallest arrival minus send time is the
+// one with the least air and queue delay. Larger samples only move it up as
+// fast as the two crystals can drift apart, so one delayed frame does not count.
+void syncClock(uint32_t rxAt, uint32_t sentAt) {
+  uint32_t sample = rxAt - sentAt;
+  int32_t above = sample - clockOffset;
+  uint32_t elapsed = rxAt - clockSyncedAt;
+  if (!clockSynced || above < 0 || elapsed > (1UL << 30)) {
+    clockOffset = sample;
+    clockSynced = true;
+  } else {
+    uint32_t creep = elapsed >> CLOCK_CREEP_SHIFT;
+    clockOffset += (uint32_t)above < creep ? (uint32_t)above : creep;
+  }
+  clockSyncedAt = rxAt;
+}
+
+void applyTally(uint64_t program, uint64_t preview) {
+  programBits = program;
+  previewBits = preview;
+  colorOverride = false;  // reset overrides on fresh tally update
+  setTallyLeds();
+}
+
+void applyScheduledTally() {
+  uint32_t late = micros() - scheduledAt;
+  if (late > lateMaxUs) lateMaxUs = late > 0xFFFF ? 0xFFFF : late;
+  tallyScheduled = false;
+  applyTally(scheduledProgram, scheduledPreview);
+}
+
 void handleSetTally(const uint8_t* data, int len) {
+  uint32_t rxAt = micros();
   if (len < 1 + 2 * (int)sizeof(uint64_t)) return;
-  memcpy(&programBits, data + 1, sizeof(programBits));
-  memcpy(&previewBits, data + 1 + sizeof(uint64_t), sizeof(previewBits));
-  colorOverride = false;  // reset overrides on fresh tally update
+  if (len >= 1 + 2 * (int)sizeof(uint64_t) + 4) {
+    const uint8_t* c = data + 1 + 2 * sizeof(uint64_t);
+    uint16_t seq = c[0] | (c[1] << 8);
+    uint16_t gen = c[2] | (c[3] << 8);
+    unsigned long now = millis();
+    if (tallyCounters && now - lastTallyAt < LINK_TIMEOUT) {
+      // an older generation comes from a controller that has handed over
+      if ((int16_t)(gen - tallyGen) < 0) return;
+      int16_t step = seq - tallySeq;
+      if (step > 1) seqGaps = (step - 1 > 0xFFFF - seqGaps) ? 0xFFFF : seqGaps + step - 1;
+    }
+    tallyCounters = true;
+    tallySeq = seq;
+    tallyGen = gen;
+    lastTallyAt = now;
+  }
+  uint64_t program, preview;
+  memcpy(&program, data + 1, sizeof(program));
+  memcpy(&preview, data + 1 + sizeof(uint64_t), sizeof(preview));
+  if (len >= 1 + 2 * (int)sizeof(uint64_t) + 4 + 8) {
+    const uint8_t* t = data + 1 + 2 * sizeof(uint64_t) + 4;
+    uint32_t sentAt = t[0] | (t[1] << 8) | (t[2] << 16) | ((uint32_t)t[3] << 24);
+    uint32_t applyAt = t[4] | (t[5] << 8) | (t[6] << 16) | ((uint32_t)t[7] << 24);
+    syncClock(rxAt, sentAt);
+    uint32_t lead = applyAt - sentAt;
+    if (lead > 0 && lead < SET_TALLY_MAX_LEAD_US) {
+      // switched from loop() on the frame the controller picked, on our clock
+      scheduledAt = applyAt + clockOffset;
+      scheduledProgram = program;
+      scheduledPreview = preview;
+      tallyScheduled = true;
+      return;
+    }
+    // a repeat of the state waiting for its frame keeps that frame
+    if (tallyScheduled && program == scheduledProgram && preview == scheduledPreview) return;
+  }
+  tallyScheduled = false;
+  applyTally(program, preview);
+}
+
+void handleTransition(const uint8_t* data, int len) {
+  if (len < 3 + 2 * (int)sizeof(uint64_t)) return;
+  if (data[2] & TRANSITION_END) {
+    fadeActive = false;
+  } else {
+    fadePosition = data[1];
+    memcpy(&fadeFrom, data + 3, sizeof(fadeFrom));
+    memcpy(&fadeTo, data + 3 + sizeof(uint64_t), sizeof(fadeTo));
+    fadeActive = true;
+    lastFadeAt = millis();
+  }
   setTallyLeds();
 }
 
@@ -268,7 +433,90 @@ void handleSwitchCam(const uint8_t* data, int len) {
   uint8_t to = data[2];
   if (tallyId == from) {
     tallyId = to;
+    saveTallyId();
+  }
+}
+
+void handleProvisionOpen(const uint8_t* data, int len) {
+  if (len < 4) return;
+  uint8_t seconds = data[1];
+  bool all = data[2] != 0;
+  uint8_t session = data[3];
+  if (seconds == 0) {
+    provisioning = false;
+    return;
+  }
+  if (session == provisionDoneSession) return;  // already got our ID in this window
+  if (!all && idAssigned) return;
+  unsigned long now = millis();
+  if (!provisioning || session != provisionSession) {
+    nextClaimAt = now + random(0, 800);  // spread the claims of a whole rack
+  }
+  provisioning = true;
+  provisionSession = session;
+  provisionUntil = now + (unsigned long)seconds * 1000;
+}
+
+void handleProvisionAssign(const uint8_t* data, int len) {
+  if (len < 1 + 1 + 6) return;
+  uint8_t newId = data[1];
+  if (newId == 0 || newId > MAX_TALLIES) return;
+  if (memcmp(selfMac, data + 2, 6) != 0) return;
+  if (tallyId != newId || !idAssigned) {
+    tallyId = newId;
+    saveTallyId();
+    Serial.printf("Provisioned as %u\n", tallyId);
   }
+  // a repeated ASSIGN means our ACK got lost
+  provisioning = false;
+  provisionDoneSession = provisionSession;
+  provisionAckDue = true;
+  identifyActive = true;
+  identifyUntil = millis() + 2000;
+}
+
+void sendProvisionClaim() {
+  uint8_t payload[3] = {PROVISION_CLAIM, tallyId, (uint8_t)(idAssigned ? 1 : 0)};
+  uint8_t broadcastAddr[6] = {0xFF,0xFF,0xFF,0xFF,0xFF,0xFF};
+  esp_now_send(broadcastAddr, payload, sizeof(payload));
+}
+
+void sendProvisionAck() {
+  uint8_t payload[2] = {PROVISION_ACK, tallyId};
+  uint8_t broadcastAddr[6] = {0xFF,0xFF,0xFF,0xFF,0xFF,0xFF};
+  esp_now_send(broadcastAddr, payload, sizeof(payload));
+  provisionAckDue = false;
+}
+
+void handleTestBegin(const uint8_t* data, int len) {
+  if (len < 3) return;
+  uint16_t session = data[1] | (data[2] << 8);
+  if (testActive && session == testSession) return;  // repeated BEGIN
+  testActive = true;
+  testSession = session;
+  testFrames = 0;
+  testReportDue = false;
+}
+
+void handleTestEnd(const uint8_t* data, int len) {
+  if (len < 3 || !testActive) return;
+  uint16_t session = data[1] | (data[2] << 8);
+  if (session != testSession) return;
+  testActive = false;
+  testReportDue = true;
+  testReportAt = millis() + random(20, 600);  // spread the replies of all receivers
+}
+
+void sendTestReport() {
+  uint8_t payload[1 + 2 + 4];
+  payload[0] = TEST_REPORT;
+  payload[1] = testSession & 0xFF;
+  payload[2] = testSession >> 8;
+  memcpy(payload + 3, &testFrames, sizeof(testFrames));
+  uint8_t broadcastAddr[6] = {0xFF,0xFF,0xFF,0xFF,0xFF,0xFF};
+  esp_now_send(broadcastAddr, payload, sizeof(payload));
+  testReportDue = false;
+  Serial.printf("Load test %u: %u frames\n", testSession, testFrames);
 }
 
 void OnDataRecv(uint8_t *mac_addr, uint8_t *data, uint8_t len) {
@@ -299,6 +547,9 @@ void OnDataRecv(uint8_t *mac_addr, uint8_t *data, uint8_t len) {
     case SET_NAME_MAC:
       handleSetNameMac(data, len);
       break;
+    case SET_NAMES:
+      handleSetNames(data, len);
+      break;
     case SET_IDENTIFY:
       handleIdentify(data, len);
       break;
@@ -311,9 +562,28 @@ void OnDataRecv(uint8_t *mac_addr, uint8_t *data, uint8_t len) {
     case SWITCH_CAMID:
       handleSwitchCam(data, len);
       break;
+    case TRANSITION:
+      handleTransition(data, len);
+      break;
+    case PROVISION_OPEN:
+      handleProvisionOpen(data, len);
+      break;
+    case PROVISION_ASSIGN:
+      handleProvisionAssign(data, len);
+      break;
+    case TEST_BEGIN:
+      handleTestBegin(data, len);
+      break;
+    case TEST_END:
+      handleTestEnd(data, len);
+      break;
     default:
       break;
   }
+  if (testActive) {
+    uint8_t command = data[0];
+    if (command == SET_TALLY || command == SET_NAME || command == SET_COLOR || command == SET_BLINK) testFrames++;
+  }
 }
 
 void sendHeartbeat() {
@@ -325,6 +595,11 @@ void sendHeartbeat() {
   payload[1] = tallyId;
   payload[2] = rgbBrightness;
   payload[3] = statusBrightness;
+  payload[4] = seqGaps & 0xFF;
+  payload[5] = seqGaps >> 8;
+  payload[6] = lateMaxUs & 0xFF;
+  payload[7] = lateMaxUs >> 8;
+  lateMaxUs = 0;
   int8_t rssi = WiFi.RSSI();
   payload[8] = (uint8_t)rssi; // send signed RSSI as raw byte
   payload[9] = nameLen;
@@ -358,6 +633,7 @@ void handleButton() {
     lastState = state;
     if (state == LOW) {  // pressed
       tallyId = (tallyId % MAX_TALLIES) + 1;
+      saveTallyId();
       Serial.printf("Tally ID -> %u\n", tallyId);
       colorOverride = false;
       setTallyLeds();
@@ -397,6 +673,12 @@ void loadConfig() {
   if (rgbBrightness == 0xFF) rgbBrightness = 255;
   statusBrightness = EEPROM.read(41);
   if (statusBrightness == 0xFF) statusBrightness = 255;
+  // camera ID slot; 0xFF means never assigned, which provisioning looks for
+  uint8_t storedId = EEPROM.read(42);
+  if (storedId > 0 && storedId <= MAX_TALLIES) {
+    tallyId = storedId;
+    idAssigned = true;
+  }
 }
 
 void handleApiSet() {
@@ -457,6 +739,7 @@ void setup() {
 }
 
 void loop() {
+  if (tallyScheduled && (int32_t)(micros() - scheduledAt) >= 0) applyScheduledTally();
   unsigned long now = millis();
 
   // Status LED: on when recently received data
@@ -483,6 +766,28 @@ void loop() {
     setTallyLeds();
   }
 
+  if (fadeActive && now - lastFadeAt > FADE_TIMEOUT) {
+    fadeActive = false;
+    setTallyLeds();
+  }
+
+  if (provisionAckDue) {
+    sendProvisionAck();
+    lastHeartbeatAt = now - HEARTBEAT_INTERVAL - 1;  // let the controller see the new ID right away
+  }
+  if (provisioning && (long)(now - nextClaimAt) >= 0) {
+    if ((long)(now - provisionUntil) >= 0) {
+      provisioning = false;
+    } else {
+      sendProvisionClaim();
+      nextClaimAt = now + 1000 + random(0, 500);
+    }
+  }
+
+  if (testReportDue && (long)(now - testReportAt) >= 0) {
+    sendTestReport();
+  }
+
   if (now - lastHeartbeatAt > HEARTBEAT_INTERVAL) {
     sendHeartbeat();
     lastHeartbeatAt = now;
@@ -1,43 +1,517 @@
 #include "atem.h"
 #include "espnow.h"
 #include "main.h"
+#include "reconcile.h"
+#include "redundancy.h"
+#include "tallyMap.h"
+#include "transition.h"
 
-ATEMstd AtemSwitcher;
+ATEMclient AtemSwitchers[ATEM_SWITCHER_COUNT];
 boolean lastAtemIsConnected = false;
 
+typedef struct atem_connection {
+  TaskHandle_t task;
+  volatile bool sourcesChanged;  // set from the web handlers in loop(), applied by whoever runs the client
+  volatile bool networkUp;       // set from the network event task, likewise
+  volatile bool statsReset;      // set from the web handlers, likewise
+  // newest tally from the switcher's task; an unpublished one is simply overwritten
+  bool pending;
+  uint64_t pendingProgram;
+  uint64_t pendingPreview;
+  unsigned long receivedAt;
+  bool pendingFramed;      // config.frameSync and the frame grid locked when it arrived
+  uint32_t pendingCutAt;   // frame boundary the switcher cut on
+  uint32_t pendingPeriod;
+  // last tally of this switcher taken into the merge
+  bool haveTally;
+  uint64_t program;
+  uint64_t preview;
+  atem_latency_t latency;
+} atem_connection_t;
+
+static atem_connection_t connections[ATEM_SWITCHER_COUNT];
+static TaskHandle_t loopTaskHandle = nullptr;
+static volatile bool taskRunning = false;
+static volatile bool fadeChanged = false;
+static portMUX_TYPE handoffMux = portMUX_INITIALIZER_UNLOCKED;
+static uint64_t mergedProgram = 0;
+static uint64_t mergedPreview = 0;
+static atem_merge mergedWith = ATEM_MERGE_OR;
+static bool remerge = false;  // the tally map changed
+static uint32_t mergeSuppressed = 0;  // switcher changes that left the merged tally as it was
+static atem_frame_stats_t frameStats = {};
+
+// input names of the main switcher by video source, filled from its InPr commands
+typedef struct atem_input_name {
+  uint16_t source;
+  char name[NAME_LENGTH + 1];
+} atem_input_name_t;
+
+static atem_input_name_t inputNames[ATEM_NAME_SOURCES];
+static uint8_t inputNameCount = 0;
+static volatile bool namesChanged = false;
+static char sentNames[TALLY_COUNT][NAME_LENGTH + 1];  // per camera, as last sent to the receivers
+static uint32_t namesSent = 0;
+static uint32_t nameFrames = 0;
+
+// mic live cameras of the main switcher, from its audio levels
+static volatile bool micChanged = false;  // config.micLive or the thresholds changed
+static bool micPending = false;
+static uint64_t micPendingLive = 0;
+static uint64_t micLive = 0;
+static uint64_t micSent = 0;  // through the tally map, as last sent to the receivers
+static uint32_t micFrames = 0;
+
 uint64_t getProgramBits()
 {
-  uint64_t bits = 0;
-  for (int i = 1; i <= TALLY_COUNT; i++)
-    if (AtemSwitcher.getProgramTally(i))
-      bits |= (uint64_t)1 << (i - 1);
-  return bits;
+  return mergedProgram;
 }
 
 uint64_t getPreviewBits()
 {
-  uint64_t bits = 0;
-  for (int i = 1; i <= TALLY_COUNT; i++)
-    if (AtemSwitcher.getPreviewTally(i))
-      bits |= (uint64_t)1 << (i - 1);
-  return bits;
+  return mergedPreview;
+}
+
+bool atem_switcher_used(uint8_t n) {
+  if (n >= ATEM_SWITCHER_COUNT) return false;
+  return n == 0 || config.atemExtraIP[n - 1] != 0;
+}
+
+static uint32_t switcherIP(uint8_t n) {
+  return n == 0 ? config.atemIP : config.atemExtraIP[n - 1];
+}
+
+static const uint16_t *switcherSources(uint8_t n) {
+  return n == 0 ? config.cameraSource : config.atemExtraSource[n - 1];
+}
+
+// runs in the task of switcher N, only when its tally changed
+template <uint8_t N>
+static void onTally(uint64_t *program, uint64_t *preview, const ATEMtallyDiff *diff) {
+  atem_connection_t *c = &connections[N];
+  portENTER_CRITICAL(&handoffMux);
+  c->pendingProgram = *program;
+  c->pendingPreview = *preview;
+  c->receivedAt = AtemSwitchers[N].getLastReceiveMicros();
+  c->pendingFramed = config.frameSync && AtemSwitchers[N].isFrameClockLocked();
+  c->pendingCutAt = AtemSwitchers[N].getFrameMicros(c->receivedAt);
+  c->pendingPeriod = AtemSwitchers[N].getFramePeriodMicros();
+  c->pending = true;
+  portEXIT_CRITICAL(&handoffMux);
+  if (loopTaskHandle) xTaskNotifyGive(loopTaskHandle);
+}
+
+static_assert(ATEM_SWITCHER_COUNT <= 4, "add onTally<> instances below");
+static const atem_tally_cb_t tallyCallbacks[4] = {onTally<0>, onTally<1>, onTally<2>, onTally<3>};
+
+// runs in the task of the main switcher, for every InPr of the dump and every rename
+static void onInputName(uint16_t videoSource, const char *longName, const char *shortName) {
+  const char *name = longName[0] ? longName : shortName;
+  bool changed = false;
+  portENTER_CRITICAL(&handoffMux);
+  atem_input_name_t *entry = nullptr;
+  for (uint8_t i = 0; i < inputNameCount; i++) {
+    if (inputNames[i].source == videoSource) entry = &inputNames[i];
+  }
+  if (!entry && inputNameCount < ATEM_NAME_SOURCES) {
+    entry = &inputNames[inputNameCount++];
+    entry->source = videoSource;
+    entry->name[0] = 0;
+  }
+  if (entry && strncmp(entry->name, name, NAME_LENGTH) != 0) {
+    strncpy(entry->name, name, NAME_LENGTH);
+    entry->name[NAME_LENGTH] = 0;
+    changed = true;
+  }
+  portEXIT_CRITICAL(&handoffMux);
+  if (changed) {
+    namesChanged = true;
+    if (loopTaskHandle) xTaskNotifyGive(loopTaskHandle);
+  }
+}
+
+// runs in the task of the main switcher, only when a camera's mic went live or dead
+static void onMicLive(uint64_t live) {
+  portENTER_CRITICAL(&handoffMux);
+  micPendingLive = live;
+  micPending = true;
+  portEXIT_CRITICAL(&handoffMux);
+  if (loopTaskHandle) xTaskNotifyGive(loopTaskHandle);
+}
+
+// tally bits follow M/E 1 of the main switcher only, so its transition is the one to fade
+static void onTransition(uint8_t mE, bool inTransition, uint16_t position) {
+  if (mE == 0) transition_update(inTransition, position);
+}
+
+static void applyChanges(uint8_t n) {
+  if (connections[n].networkUp) {
+    connections[n].networkUp = false;
+    AtemSwitchers[n].reconnectNow();
+  }
+  if (connections[n].statsReset) {
+    connections[n].statsReset = false;
+    AtemSwitchers[n].resetParseStats();
+  }
+  if (connections[n].sourcesChanged) {
+    connections[n].sourcesChanged = false;
+    AtemSwitchers[n].setCameraSourceMap(switcherSources(n), CAMERA_SOURCE_COUNT);
+  }
+  if (n == 0 && fadeChanged) {
+    fadeChanged = false;
+    // TrPs arrives every frame of a transition; leave it unparsed unless fading
+    AtemSwitchers[0].setAtemTransitionCallback(config.transitionFade ? onTransition : NULL);
+  }
+  if (n == 0 && micChanged) {
+    micChanged = false;
+    // AMLv comes many times a second; only requested and parsed with config.micLive
+    AtemSwitchers[0].setMicLiveThresholds(config.micOnDb, config.micOffDb, config.micHoldMs);
+    AtemSwitchers[0].setMicLiveCallback(config.micLive ? onMicLive : NULL);
+  }
+}
+
+static void atemTask(void *arg) {
+  uint8_t n = (uint8_t)(uintptr_t)arg;
+  while (taskRunning) {
+    applyChanges(n);
+    AtemSwitchers[n].runLoopWait(ATEM_TASK_WAIT_MS);
+    if (n == 0) transition_loop();
+  }
+  AtemSwitchers[n].end();
+  connections[n].task = nullptr;
+  vTaskDelete(NULL);
 }
 
 void atem_setup() {
-  Serial.print("atem_setup IP:");
-  Serial.println(IPAddress(config.atemIP).toString());
-  AtemSwitcher.begin(config.atemIP);
-  AtemSwitcher.serialOutput(1);
-  AtemSwitcher.connect();
-  AtemSwitcher.setAtemTallyCallback(espnow_tally);
+  if (taskRunning) return;
+  loopTaskHandle = xTaskGetCurrentTaskHandle();
+  fadeChanged = true;
+  micChanged = true;
+  taskRunning = true;
+  for (uint8_t n = 0; n < ATEM_SWITCHER_COUNT; n++) {
+    if (!atem_switcher_used(n)) continue;
+    atem_connection_t *c = &connections[n];
+    Serial.printf("atem_setup %u IP:", n + 1);
+    Serial.println(IPAddress(switcherIP(n)).toString());
+    AtemSwitchers[n].begin(switcherIP(n));
+    AtemSwitchers[n].serialOutput(1);
+    AtemSwitchers[n].setAtemTallyCallback(tallyCallbacks[n]);
+    AtemSwitchers[n].setTallySource((ATEMtallySource)config.atemTallySource);
+    if (n == 0) AtemSwitchers[0].setInputNameCallback(onInputName);
+    c->sourcesChanged = true;
+    applyChanges(n);
+    AtemSwitchers[n].connect();
+    if (xTaskCreatePinnedToCore(atemTask, "atem", ATEM_TASK_STACK, (void *)(uintptr_t)n, ATEM_TASK_PRIORITY, &c->task, ATEM_TASK_CORE) != pdPASS) {
+      // atem_loop() keeps this client running, only with loop() latency
+      Serial.printf("atem: could not start task for switcher %u\n", n + 1);
+      c->task = nullptr;
+    }
+  }
+}
+
+void atem_stop() {
+  taskRunning = false;
+  for (uint8_t n = 0; n < ATEM_SWITCHER_COUNT; n++) {
+    while (connections[n].task) delay(1);
+    if (atem_switcher_used(n)) AtemSwitchers[n].end();
+    connections[n].haveTally = false;
+  }
+  lastAtemIsConnected = false;
+}
+
+void atem_network_up() {
+  for (uint8_t n = 0; n < ATEM_SWITCHER_COUNT; n++) connections[n].networkUp = true;
+}
+
+void atem_reset_stats() {
+  for (uint8_t n = 0; n < ATEM_SWITCHER_COUNT; n++) connections[n].statsReset = true;
+}
+
+// Read while the switcher's task adds to the table; a count may be a command behind, which is fine for statistics
+String atem_command_stats_json() {
+  uint32_t mhz = ESP.getCpuFreqMHz();
+  String s;
+  s.reserve(8192);
+  s = "{\"cpuMHz\":";
+  s += mhz;
+  s += ",\"atem\":[";
+  bool first = true;
+  for (uint8_t n = 0; n < ATEM_SWITCHER_COUNT; n++) {
+    if (!atem_switcher_used(n)) continue;
+    ATEMcommandStats &stats = AtemSwitchers[n].getCommandStats();
+    if (!first) s += ",";
+    first = false;
+    s += "{\"switcher\":";
+    s += n + 1;
+    s += ",\"overflow\":";
+    s += stats.overflow().count;
+    s += ",\"commands\":[";
+    bool firstCmd = true;
+    for (uint16_t i = 0; i < ATEM_COMMAND_STATS; i++) {
+      const ATEMcommandStat &stat = stats.at(i);
+      if (stat.cmd == 0) continue;
+      char name[5];
+      for (uint8_t b = 0; b < 4; b++) {
+        char c = stat.cmd >> (24 - 8 * b);
+        name[b] = isalnum((unsigned char)c) || c == '_' ? c : '?';
+      }
+      name[4] = 0;
+      if (!firstCmd) s += ",";
+      firstCmd = false;
+      s += "{\"cmd\":\"";
+      s += name;
+      s += "\",\"count\":";
+      s += stat.count;
+      s += ",\"timed\":";
+      s += stat.timed;
+      // average over the timed ones; times count, the estimated total
+      s += ",\"avgNs\":";
+      s += (uint32_t)(stat.timed ? stat.cycles * 1000 / stat.timed / mhz : 0);
+      s += ",\"totalUs\":";
+      s += (uint32_t)(stat.timed ? stat.cycles / stat.timed * stat.count / mhz : 0);
+      s += "}";
+    }
+    s += "]}";
+  }
+  s += "]}";
+  return s;
+}
+
+void atem_camera_sources_changed() {
+  for (uint8_t n = 0; n < ATEM_SWITCHER_COUNT; n++) connections[n].sourcesChanged = true;
+  namesChanged = true;
+}
+
+void atem_transition_fade_changed() {
+  fadeChanged = true;
+}
+
+void atem_tally_map_changed() {
+  remerge = true;
+  namesChanged = true;
+}
+
+void atem_mic_changed() {
+  micChanged = true;
+}
+
+uint64_t atem_mic_live() {
+  return micSent;
+}
+
+uint32_t atem_mic_frames() {
+  return micFrames;
+}
+
+void atem_names_changed() {
+  namesChanged = true;
+}
+
+uint32_t atem_names_sent() {
+  return namesSent;
+}
+
+uint32_t atem_name_frames() {
+  return nameFrames;
+}
+
+uint32_t atem_merge_suppressed() {
+  return mergeSuppressed;
+}
+
+const atem_latency_t *atem_latency(uint8_t n) {
+  return &connections[n < ATEM_SWITCHER_COUNT ? n : 0].latency;
+}
+
+const atem_frame_stats_t *atem_frame_stats() {
+  return &frameStats;
+}
+
+static void merge() {
+  uint64_t program = 0;
+  uint64_t preview = 0;
+  uint64_t decided = 0;
+  for (uint8_t n = 0; n < ATEM_SWITCHER_COUNT; n++) {
+    atem_connection_t *c = &connections[n];
+    if (!c->haveTally) continue;
+    if (config.atemMerge == ATEM_MERGE_PRIORITY) {
+      program |= c->program & ~decided;
+      preview |= c->preview & ~decided;
+      decided |= c->program | c->preview;
+    } else {
+      program |= c->program;
+      preview |= c->preview;
+    }
+  }
+  mergedProgram = tallymap_apply(program);
+  mergedPreview = tallymap_apply(preview);
+  mergedWith = config.atemMerge;
+  remerge = false;
+}
+
+// Camera n shows the name of the input whose tally lights it: the source of
+// camera map slot n (or input n) of the main switcher, through the tally map.
+// With several inputs on one camera the lowest one names it. Cameras the
+// operator named on the web page keep that name.
+static void publishNames() {
+  static atem_input_name_t knownNames[ATEM_NAME_SOURCES];
+  static char names[TALLY_COUNT][NAME_LENGTH + 1];
+  static char changedNames[TALLY_COUNT][NAME_LENGTH + 1];
+  uint8_t changedIds[TALLY_COUNT];
+
+  if (!config.atemNames) {
+    // switched back on, every name goes out again
+    memset(sentNames, 0, sizeof(sentNames));
+    namesChanged = false;
+    return;
+  }
+  if (!redundancy_is_leader()) return;  // keep it pending for a takeover
+  namesChanged = false;
+
+  // the switcher's task keeps adding names; look them up in a copy
+  portENTER_CRITICAL(&handoffMux);
+  uint8_t known = inputNameCount;
+  memcpy(knownNames, inputNames, known * sizeof(atem_input_name_t));
+  portEXIT_CRITICAL(&handoffMux);
+
+  memset(names, 0, sizeof(names));
+  for (uint8_t i = 0; i < TALLY_COUNT; i++) {
+    uint16_t source = config.cameraSource[i] ? config.cameraSource[i] : i + 1;
+    const char *name = nullptr;
+    for (uint8_t e = 0; e < known; e++) {
+      if (knownNames[e].source == source) name = knownNames[e].name;
+    }
+    if (!name || !name[0]) continue;
+    uint64_t cameras = tallymap_apply((uint64_t)1 << i);
+    for (uint8_t c = 0; c < TALLY_COUNT; c++) {
+      if ((cameras & ((uint64_t)1 << c)) && !names[c][0]) memcpy(names[c], name, NAME_LENGTH + 1);
+    }
+  }
+
+  uint8_t count = 0;
+  for (uint8_t c = 0; c < TALLY_COUNT; c++) {
+    if (!names[c][0] || strcmp(names[c], sentNames[c]) == 0) continue;
+    if (reconcile_operator_name(c + 1)) continue;
+    changedIds[count] = c + 1;
+    memcpy(changedNames[count], names[c], NAME_LENGTH + 1);
+    memcpy(sentNames[c], names[c], NAME_LENGTH + 1);
+    count++;
+  }
+  if (count == 0) return;
+  nameFrames += espnow_set_names(changedIds, changedNames, count);
+  namesSent += count;
+  // receivers that missed the frame get the name per MAC from their heartbeat
+  for (uint8_t i = 0; i < count; i++) {
+    uint64_t bits = (uint64_t)1 << (changedIds[i] - 1);
+    reconcile_expect_name(String(changedNames[i]), &bits);
+  }
+}
+
+// First frame boundary of the switcher's grid, after cutAt, at least TALLY_FRAME_MARGIN_US from now
+static uint32_t frameApplyAt(uint32_t cutAt, uint32_t period, uint32_t now) {
+  uint32_t ahead = now + TALLY_FRAME_MARGIN_US - cutAt;
+  // the change may only now be published, several frames after the cut
+  uint32_t frames = (int32_t)ahead <= 0 ? 1 : (ahead + period - 1) / period;
+  return cutAt + frames * period;
 }
 
 void atem_loop() {
-  AtemSwitcher.runLoop();
-  if (AtemSwitcher.isConnected()) {
+  bool connected = false;
+  bool changed = false;
+  bool remapped = remerge;
+  unsigned long receivedAt[ATEM_SWITCHER_COUNT];
+  bool received[ATEM_SWITCHER_COUNT];
+  // frame timing of the first switcher (in order) that reported a frame-timed change
+  bool framed = false;
+  uint32_t cutAt = 0;
+  uint32_t period = 0;
+  for (uint8_t n = 0; n < ATEM_SWITCHER_COUNT; n++) {
+    received[n] = false;
+    if (!atem_switcher_used(n)) continue;
+    atem_connection_t *c = &connections[n];
+    if (!c->task) {
+      applyChanges(n);
+      AtemSwitchers[n].runLoop();
+      if (n == 0) transition_loop();
+    }
+    portENTER_CRITICAL(&handoffMux);
+    if (c->pending) {
+      c->program = c->pendingProgram;
+      c->preview = c->pendingPreview;
+      c->haveTally = true;
+      c->pending = false;
+      receivedAt[n] = c->receivedAt;
+      received[n] = true;
+      if (c->pendingFramed && !framed) {
+        framed = true;
+        cutAt = c->pendingCutAt;
+        period = c->pendingPeriod;
+      }
+      changed = true;
+    }
+    portEXIT_CRITICAL(&handoffMux);
+    if (AtemSwitchers[n].isConnected()) {
+      connected = true;
+    } else if (c->haveTally) {
+      // a switcher that lost contact must not keep its cameras lit (or hide the others) in the merge
+      c->haveTally = false;
+      changed = true;
+    }
+  }
+
+  if (changed || remerge || (mergedWith != config.atemMerge && (mergedProgram || mergedPreview))) {
+    uint64_t program = mergedProgram;
+    uint64_t preview = mergedPreview;
+    merge();
+    // another switcher may already hold the changed cameras; espnow_loop() repeats the state anyway
+    if (mergedProgram == program && mergedPreview == preview) {
+      mergeSuppressed++;
+    } else {
+      if (framed) {
+        uint32_t applyAt = frameApplyAt(cutAt, period, micros());
+        espnow_tally_at(&mergedProgram, &mergedPreview, applyAt);
+        frameStats.aligned++;
+        if (applyAt - cutAt > frameStats.leadMaxUs) frameStats.leadMaxUs = applyAt - cutAt;
+      } else {
+        espnow_tally(&mergedProgram, &mergedPreview);
+      }
+      unsigned long now = micros();
+      for (uint8_t n = 0; n < ATEM_SWITCHER_COUNT; n++) {
+        if (!received[n]) continue;
+        atem_latency_t *l = &connections[n].latency;
+        uint32_t us = now - receivedAt[n];
+        l->count++;
+        l->lastUs = us;
+        l->totalUs += us;
+        if (us > l->maxUs) l->maxUs = us;
+      }
+    }
+  }
+
+  bool micReceived = false;
+  portENTER_CRITICAL(&handoffMux);
+  if (micPending) {
+    micLive = micPendingLive;
+    micPending = false;
+    micReceived = true;
+  }
+  portEXIT_CRITICAL(&handoffMux);
+  if (micReceived || remapped) {
+    // two inputs on one camera: one of them going quiet is no flip for the receiver
+    uint64_t live = tallymap_apply(micLive);
+    if (live != micSent) {
+      espnow_mic_live(live);
+      micSent = live;
+      micFrames++;
+    }
+  }
+
+  if (namesChanged) publishNames();
+
+  if (connected) {
     espnow_loop();
     lastAtemIsConnected = true;
   } else if (lastAtemIsConnected) {
     lastAtemIsConnected = false;
   }
-}
\ No newline at end of file
+}
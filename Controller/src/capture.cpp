@@ -0,0 +1,135 @@
+#include <Arduino.h>
+
+#include "atem.h"
+#include "capture.h"
+
+static uint8_t *buffer = nullptr;
+static size_t capacity = 0;
+static size_t used = 0;
+static volatile bool recording = false;
+static uint32_t packets = 0;
+static uint32_t dropped = 0;  // datagrams that did not fit any more
+static portMUX_TYPE captureMux = portMUX_INITIALIZER_UNLOCKED;
+// micros() wraps after 71 minutes; pcap timestamps keep counting
+static unsigned long lastMicros = 0;
+static uint32_t microsWraps = 0;
+
+static void put16(uint8_t *p, uint16_t v) {  // network order
+  p[0] = v >> 8;
+  p[1] = v;
+}
+
+static void put32le(uint8_t *p, uint32_t v) {
+  memcpy(p, &v, sizeof(v));  // pcap headers are written in host order (little endian)
+}
+
+static void attach(bool on) {
+  for (uint8_t n = 0; n < ATEM_SWITCHER_COUNT; n++) {
+    if (atem_switcher_used(n)) AtemSwitchers[n].setCaptureCallback(on ? capture_datagram : NULL);
+  }
+}
+
+bool capture_start(uint16_t kb) {
+  if (kb == 0 || kb > CAPTURE_MAX_KB) return false;
+  capture_clear();
+  buffer = (uint8_t *) malloc((size_t)kb * 1024);
+  if (!buffer) return false;
+  capacity = (size_t)kb * 1024;
+  // pcap global header: magic, version 2.4, zone, sigfigs, snaplen, link type
+  put32le(buffer, 0xA1B2C3D4);
+  buffer[4] = 2; buffer[5] = 0;
+  buffer[6] = 4; buffer[7] = 0;
+  put32le(buffer + 8, 0);
+  put32le(buffer + 12, 0);
+  put32le(buffer + 16, 65535);
+  put32le(buffer + 20, CAPTURE_LINKTYPE_RAW);
+  used = 24;
+  packets = 0;
+  dropped = 0;
+  lastMicros = micros();
+  microsWraps = 0;
+  recording = true;
+  attach(true);
+  return true;
+}
+
+void capture_stop() {
+  recording = false;
+  attach(false);
+}
+
+void capture_clear() {
+  capture_stop();
+  portENTER_CRITICAL(&captureMux);
+  uint8_t *old = buffer;
+  buffer = nullptr;
+  capacity = 0;
+  used = 0;
+  portEXIT_CRITICAL(&captureMux);
+  free(old);
+}
+
+bool capture_running() {
+  return recording;
+}
+
+const uint8_t *capture_data(size_t *length) {
+  capture_stop();
+  *length = buffer ? used : 0;
+  return buffer;
+}
+
+String capture_status_json() {
+  String s = "{\"recording\":";
+  s += recording ? 1 : 0;
+  s += ",\"packets\":";
+  s += packets;
+  s += ",\"dropped\":";
+  s += dropped;
+  s += ",\"bytes\":";
+  s += (uint32_t)used;
+  s += ",\"capacity\":";
+  s += (uint32_t)capacity;
+  s += "}";
+  return s;
+}
+
+void capture_datagram(uint32_t switcherIP, uint16_t localPort, const uint8_t *datagram, uint16_t length, unsigned long receivedAt) {
+  if (!recording) return;
+  const size_t record = 16 + 20 + 8 + length;
+  // filled under the lock too, so capture_clear() never frees a slot being written (a few us for a full datagram)
+  portENTER_CRITICAL(&captureMux);
+  if (!recording || !buffer || used + record > capacity) {
+    if (recording) dropped++;
+    portEXIT_CRITICAL(&captureMux);
+    return;
+  }
+  uint8_t *p = buffer + used;
+  if (receivedAt < lastMicros) microsWraps++;
+  lastMicros = receivedAt;
+  uint64_t us = ((uint64_t)microsWraps << 32) + receivedAt;
+  put32le(p, us / 1000000);
+  put32le(p + 4, us % 1000000);
+  put32le(p + 8, 20 + 8 + length);
+  put32le(p + 12, 20 + 8 + length);
+  uint8_t *ip = p + 16;
+  memset(ip, 0, 20);
+  ip[0] = 0x45;  // IPv4, 20 byte header
+  put16(ip + 2, 20 + 8 + length);
+  ip[8] = 64;    // TTL
+  ip[9] = 17;    // UDP
+  memcpy(ip + 12, &switcherIP, 4);  // already in network order; destination stays 0.0.0.0
+  uint32_t sum = 0;
+  for (int i = 0; i < 20; i += 2) sum += (ip[i] << 8) | ip[i + 1];
+  while (sum >> 16) sum = (sum & 0xFFFF) + (sum >> 16);
+  put16(ip + 10, ~sum);
+  uint8_t *udp = ip + 20;
+  put16(udp, 9910);
+  put16(udp + 2, localPort);
+  put16(udp + 4, 8 + length);
+  put16(udp + 6, 0);  // no checksum
+  memcpy(udp + 8, datagram, length);
+  used += record;
+  packets++;
+  portEXIT_CRITICAL(&captureMux);
+}
@@ -11,6 +11,14 @@
 #include "atem.h"
 #include "obs.h"
 #include "espnow.h"
+#include "reconcile.h"
+#include "loadTest.h"
+#include "redundancy.h"
+#include "multicast.h"
+#include "provision.h"
+#include "capture.h"
+#include "transition.h"
+#include "tallyMap.h"
 #include "main.h"
 
 static bool eth_connected = false;
@@ -51,6 +59,23 @@ void handleRoot() {
   web.send(500, "text/plain", "index.html not found");
 }
 
+// {"<camera ID>":<source>,...} for the mapped cameras
+static String cameraSourcesJson(const uint16_t *sources) {
+  String s = "{";
+  bool first = true;
+  for (int id = 1; id <= CAMERA_SOURCE_COUNT; id++) {
+    if (sources[id - 1] == 0) continue;
+    if (!first) s += ",";
+    first = false;
+    s += "\"";
+    s += id;
+    s += "\":";
+    s += sources[id - 1];
+  }
+  s += "}";
+  return s;
+}
+
 void handleConfigJson() {
   String s = "{";
   s += "\"protocol\":";
@@ -63,10 +88,178 @@ void handleConfigJson() {
   s += asIp(config.obsIP).toString();
   s += "\",\"obsport\":";
   s += config.obsPort;
+  {
+    const obs_stats_t *o = obs_stats();
+    s += ",\"obs\":{\"messages\":";
+    s += o->messages;
+    s += ",\"fragmented\":";
+    s += o->fragmented;
+    s += ",\"dropped\":";
+    s += o->dropped;
+    s += ",\"errors\":";
+    s += o->errors;
+    s += ",\"parseAvgUs\":";
+    s += (uint32_t)(o->messages ? o->parseTotalUs / o->messages : 0);
+    s += ",\"parseMaxUs\":";
+    s += o->parseMaxUs;
+    s += ",\"largest\":";
+    s += o->largest;
+    s += ",\"docMax\":";
+    s += o->docMax;
+    s += ",\"stackFree\":";
+    s += o->stackFree;
+    s += "}";
+  }
   s += ",\"vmixip\":\"";
   s += asIp(config.vmixIP).toString();
   s += "\",\"vmixport\":";
   s += config.vmixPort;
+  s += ",\"priority\":";
+  s += config.redundancyPriority;
+  s += ",\"role\":\"";
+  s += redundancy_role_name();
+  s += "\",\"multicast\":";
+  s += (config.multicastSend ? 1 : 0);
+  s += ",\"relayed\":";
+  s += multicast_received();
+  s += ",\"fade\":";
+  s += (config.transitionFade ? 1 : 0);
+  s += ",\"fadeFrames\":";
+  s += transition_frames();
+  s += ",\"tallysrc\":";
+  s += config.atemTallySource;
+  s += ",\"atemNames\":";
+  s += (config.atemNames ? 1 : 0);
+  s += ",\"namesSent\":";
+  s += atem_names_sent();
+  s += ",\"nameFrames\":";
+  s += atem_name_frames();
+  s += ",\"mic\":";
+  s += (config.micLive ? 1 : 0);
+  s += ",\"micOn\":";
+  s += config.micOnDb;
+  s += ",\"micOff\":";
+  s += config.micOffDb;
+  s += ",\"micHold\":";
+  s += config.micHoldMs;
+  s += ",\"micLive\":";
+  s += String(atem_mic_live());
+  s += ",\"micFrames\":";
+  s += atem_mic_frames();
+  {
+    // frame-accurate switching: how far the receivers can be from the switcher's frame, at most
+    ATEMclient &atem = AtemSwitchers[0];
+    const atem_frame_stats_t *f = atem_frame_stats();
+    uint32_t jitter = atem.getFrameJitterMax();
+    uint16_t rxLate = espnow_rx_late_max();
+    s += ",\"frameSync\":";
+    s += (config.frameSync ? 1 : 0);
+    s += ",\"frame\":{\"mode\":";
+    s += atem.getVideoMode();
+    s += ",\"periodUs\":";
+    s += atem.getFramePeriodMicros();
+    s += ",\"locked\":";
+    s += atem.isFrameClockLocked() ? "true" : "false";
+    s += ",\"aligned\":";
+    s += f->aligned;
+    s += ",\"leadMaxUs\":";
+    s += f->leadMaxUs;
+    s += ",\"jitterMaxUs\":";
+    s += jitter;
+    s += ",\"rxLateMaxUs\":";
+    s += rxLate;
+    s += ",\"boundUs\":";
+    s += f->leadMaxUs + jitter + rxLate;
+    s += "}";
+  }
+  s += ",\"camsrc\":";
+  s += cameraSourcesJson(config.cameraSource);
+  s += ",\"atemExtra\":[";
+  for (int n = 0; n < ATEM_SWITCHER_COUNT - 1; n++) {
+    if (n) s += ",";
+    s += "{\"ip\":\"";
+    s += config.atemExtraIP[n] ? asIp(config.atemExtraIP[n]).toString() : String("");
+    s += "\",\"camsrc\":";
+    s += cameraSourcesJson(config.atemExtraSource[n]);
+    s += "}";
+  }
+  s += "],\"merge\":";
+  s += config.atemMerge;
+  s += ",\"tallymap\":\"";
+  s += tallymap_string();
+  s += "\"";
+  // one entry per switcher in use, main switcher first
+  s += ",\"atem\":[";
+  for (uint8_t n = 0; n < ATEM_SWITCHER_COUNT; n++) {
+    if (!atem_switcher_used(n)) continue;
+    ATEMclient &atem = AtemSwitchers[n];
+    static const char *const states[] = {"idle", "connecting", "syncing", "ready", "backoff"};
+    if (n) s += ",";
+    s += "{\"parse\":{\"packets\":";
+    s += atem.getParseCount();
+    s += ",\"avgUs\":";
+    s += atem.getParseTimeAverage();
+    s += ",\"maxUs\":";
+    s += atem.getParseTimeMax();
+    s += "},\"link\":{\"state\":\"";
+    s += states[atem.getConnectionState()];
+    s += "\",\"firstTallyMs\":";
+    s += atem.getTimeToFirstTally();
+    s += ",\"readyMs\":";
+    s += atem.getTimeToReady();
+    s += ",\"helloTimeout\":";
+    s += atem.getReconnectCount(ATEM_CAUSE_HELLO_TIMEOUT);
+    s += ",\"rejected\":";
+    s += atem.getReconnectCount(ATEM_CAUSE_REJECTED);
+    s += ",\"syncTimeout\":";
+    s += atem.getReconnectCount(ATEM_CAUSE_SYNC_TIMEOUT);
+    s += ",\"contactLost\":";
+    s += atem.getReconnectCount(ATEM_CAUSE_CONTACT_LOST);
+    s += ",\"txOverflows\":";
+    s += atem.getTxOverflowCount();
+    s += ",\"txResends\":";
+    s += atem.getTxResendCount();
+    s += ",\"txLost\":";
+    s += atem.getTxLostCount();
+    s += ",\"rxPackets\":";
+    s += atem.getRxPacketCount();
+    s += ",\"rxBytes\":";
+    s += atem.getRxByteCount();
+    s += ",\"rxPerSec\":";
+    s += atem.getRxPacketRate();
+    s += ",\"rxBytesPerSec\":";
+    s += atem.getRxByteRate();
+    s += ",\"rxResent\":";
+    s += atem.getRxResentCount();
+    s += ",\"sizeMismatches\":";
+    s += atem.getRxSizeMismatchCount();
+    s += ",\"acks\":";
+    s += atem.getAckCount();
+    s += ",\"resendRequests\":";
+    s += atem.getRxResendRequestCount();
+    s += ",\"dumpRequests\":";
+    s += atem.getDumpResendRequestCount();
+    const atem_latency_t *l = atem_latency(n);
+    s += "},\"latency\":{\"count\":";
+    s += l->count;
+    s += ",\"lastUs\":";
+    s += l->lastUs;
+    s += ",\"avgUs\":";
+    s += (uint32_t)(l->count ? l->totalUs / l->count : 0);
+    s += ",\"maxUs\":";
+    s += l->maxUs;
+    s += "},\"tally\":{\"changes\":";
+    s += atem.getTallyChangeCount();
+    s += ",\"suppressed\":";
+    s += atem.getTallySuppressedCount();
+    s += ",\"derived\":";
+    s += atem.getDerivedTallyCount();
+    s += ",\"fromTlIn\":";
+    s += atem.isTallyDerived() ? "false" : "true";
+    s += "}}";
+  }
+  s += "],\"mergeSuppressed\":";
+  s += atem_merge_suppressed();
   s += ",\"tallies\":";
   // embed current tallies for faster load
   {
@@ -93,7 +286,13 @@ void handleConfigJson() {
       t += tallies[i].rgbBrightness;
       t += ",\"statusBrightness\":";
       t += tallies[i].statusBrightness;
-      t += "},";
+      t += ",\"gaps\":";
+      t += tallies[i].seqGaps;
+      t += ",\"late\":";
+      t += tallies[i].lateUs;
+      t += ",\"sync\":\"";
+      t += reconcile_status(tallies[i].mac_addr);
+      t += "\"},";
     }
     if (t[t.length()-1] == ',') t.remove(t.length()-1, 1);
     t += "]";
@@ -156,12 +355,12 @@ void handleSet() {
       return;
     } else if (name == "brightness" && !web.hasArg("mac")) {
       uint64_t bits = bitsFromCSV(web.arg("i"));
-      espnow_brightness(web.arg(i).toInt(), &bits);
+      reconcile_brightness(web.arg(i).toInt(), &bits);
       web.send(200, "text/plain", "OK");
       return;
     } else if (name == "camid" && !web.hasArg("mac")) {
       uint64_t bits = bitsFromCSV(web.arg("i"));
-      espnow_camid(web.arg(i).toInt(), &bits);
+      reconcile_camid(web.arg(i).toInt(), &bits);
       web.send(200, "text/plain", "OK");
       return;
     } else if (name == "signal") {
@@ -173,7 +372,8 @@ void handleSet() {
       return;
     } else if (name == "protocol") {
       config.protocol = (switcher_protocol) web.arg(i).toInt();
-      if (config.protocol != PROTOCOL_ATEM && config.protocol != PROTOCOL_OBS && config.protocol != PROTOCOL_VMIX) return;
+      if (config.protocol != PROTOCOL_ATEM && config.protocol != PROTOCOL_OBS && config.protocol != PROTOCOL_VMIX
+          && config.protocol != PROTOCOL_MULTICAST) return;
       configUpdated = true;
     } else if (name == "connect") {
       config.protocolEnabled = web.arg(i).toInt() != 0;
@@ -183,6 +383,23 @@ void handleSet() {
       config.atemIP = (uint32_t) ip;
       if (config.atemIP == 0) return;
       configUpdated = true;
+    } else if (name.startsWith("atemip")) {
+      // atemip2..atemipN add further switchers, 0.0.0.0 removes one
+      long switcher = name.substring(6).toInt();
+      if (switcher < 2 || switcher > ATEM_SWITCHER_COUNT) return;
+      config.atemExtraIP[switcher - 2] = ip.fromString(web.arg(i)) ? (uint32_t) ip : 0;
+      configUpdated = true;
+    } else if (name == "merge") {
+      long merge = web.arg(i).toInt();
+      if (merge != ATEM_MERGE_OR && merge != ATEM_MERGE_PRIORITY) return;
+      config.atemMerge = (atem_merge) merge;
+      connectionChanged = true;
+    } else if (name == "tallymap") {
+      // tallymap=<input>:<camera>[+<camera>...],... ; empty = every input lights its own camera
+      if (!tallymap_parse(web.arg(i))) return;
+      tallymap_compile();
+      atem_tally_map_changed();
+      connectionChanged = true;
     } else if (name == "obsip") {
       ip.fromString(web.arg(i));
       config.obsIP = (uint32_t) ip;
@@ -197,6 +414,62 @@ void handleSet() {
       config.vmixIP = (uint32_t) ip;
       if (config.vmixIP == 0) return;
       configUpdated = true;
+    } else if (name == "multicast") {
+      config.multicastSend = web.arg(i).toInt() != 0;
+      connectionChanged = true;
+    } else if (name == "priority") {
+      long priority = web.arg(i).toInt();
+      if (priority < 0 || priority > 254) return;
+      config.redundancyPriority = priority;
+      configUpdated = true;
+    } else if (name == "fade") {
+      config.transitionFade = web.arg(i).toInt() != 0;
+      if (config.protocol == PROTOCOL_ATEM) atem_transition_fade_changed();
+      connectionChanged = true;
+    } else if (name == "tallysrc") {
+      // the derived tally is built from the initial dump, so it takes a reconnect
+      long source = web.arg(i).toInt();
+      if (source < 0 || source > 2) return;
+      config.atemTallySource = source;
+      configUpdated = true;
+    } else if (name == "atemnames") {
+      config.atemNames = web.arg(i).toInt() != 0;
+      atem_names_changed();
+      connectionChanged = true;
+    } else if (name == "mic") {
+      // levels are requested once per connection, so switching it on or off takes a reconnect
+      config.micLive = web.arg(i).toInt() != 0;
+      configUpdated = true;
+    } else if (name == "micon" || name == "micoff") {
+      long dB = web.arg(i).toInt();
+      if (dB < -90 || dB > 0) return;
+      if (name == "micon") config.micOnDb = dB;
+      else config.micOffDb = dB;
+      if (config.micOffDb > config.micOnDb) config.micOffDb = config.micOnDb;
+      atem_mic_changed();
+      connectionChanged = true;
+    } else if (name == "michold") {
+      long ms = web.arg(i).toInt();
+      if (ms < 0 || ms > 60000) return;
+      config.micHoldMs = ms;
+      atem_mic_changed();
+      connectionChanged = true;
+    } else if (name == "framesync") {
+      config.frameSync = web.arg(i).toInt() != 0;
+      connectionChanged = true;
+    } else if (name == "camsrc") {
+      // camsrc=<ATEM video source ID>&i=<camera IDs>[&s=<switcher 1-n>]; 0 goes back to the TlIn index
+      long source = web.arg(i).toInt();
+      if (source < 0 || source >= 0xFFFF) return;
+      long switcher = web.hasArg("s") ? web.arg("s").toInt() : 1;
+      if (switcher < 1 || switcher > ATEM_SWITCHER_COUNT) return;
+      uint16_t *sources = switcher == 1 ? config.cameraSource : config.atemExtraSource[switcher - 2];
+      uint64_t bits = bitsFromCSV(web.arg("i"));
+      for (int id = 1; id <= CAMERA_SOURCE_COUNT; id++) {
+        if (bits & ((uint64_t)1 << (id - 1))) sources[id - 1] = source;
+      }
+      atem_camera_sources_changed();
+      connectionChanged = true;
     } else if (name == "vmixport") {
       config.vmixPort = web.arg(i).toInt();
       if (config.vmixPort == 0) return;
@@ -215,10 +488,10 @@ void handleSet() {
           nib++;
           if (nib == 2) { mac[idx++] = val; val = 0; nib = 0; }
         }
-      if (idx == 6) espnow_set_name_mac(web.arg(i), mac);
+      if (idx == 6) reconcile_set_name_mac(web.arg(i), mac);
       } else {
         uint64_t bits = bitsFromCSV(web.arg("i"));
-        espnow_set_name(web.arg(i), &bits);
+        reconcile_set_name(web.arg(i), &bits);
       }
       web.send(200, "text/plain", "OK");
       return;
@@ -268,7 +541,7 @@ void handleSet() {
       }
       if (idx == 6) {
         uint8_t newId = web.arg(i).toInt();
-        espnow_set_camid_mac(newId, mac);
+        reconcile_set_camid_mac(newId, mac);
       }
       web.send(200, "text/plain", "OK");
       return;
@@ -287,7 +560,7 @@ void handleSet() {
       }
       if (idx == 6) {
         uint8_t b = web.arg(i).toInt();
-        espnow_brightness_mac(b, mac);
+        reconcile_brightness_mac(b, mac);
       }
       web.send(200, "text/plain", "OK");
       return;
@@ -306,7 +579,7 @@ void handleSet() {
       }
       if (idx == 6) {
         uint8_t b = web.arg(i).toInt();
-        espnow_status_brightness(b, mac);
+        reconcile_status_brightness(b, mac);
       }
       web.send(200, "text/plain", "OK");
       return;
@@ -322,6 +595,106 @@ void handleSet() {
   }
 }
 
+// /stress?fps=50,100,200&seconds=10&mix=20 starts a sweep, /stress reports, /stress?stop=1 aborts
+void handleStress() {
+  if (web.hasArg("stop")) {
+    loadtest_stop();
+  } else if (web.hasArg("fps")) {
+    uint16_t rates[LOADTEST_MAX_STEPS];
+    uint8_t steps = 0;
+    String csv = web.arg("fps");
+    long number = 0;
+    for (size_t i = 0; i <= csv.length() && steps < LOADTEST_MAX_STEPS; ++i) {
+      if (i < csv.length() && isdigit(csv[i])) {
+        number = 10*number + csv[i] - '0';
+        if (number > 0xFFFF) number = 0xFFFF;
+      } else if (number > 0) {
+        rates[steps++] = number;
+        number = 0;
+      }
+    }
+    uint16_t seconds = web.hasArg("seconds") ? web.arg("seconds").toInt() : 10;
+    uint8_t mix = web.hasArg("mix") ? constrain(web.arg("mix").toInt(), 0L, 100L) : 20;
+    if (!loadtest_start(rates, steps, seconds, mix)) {
+      web.send(400, "text/plain", "Load test already running, or fps not 1-500 / seconds not 1-60");
+      return;
+    }
+  }
+  web.send(200, "application/json", loadtest_results_json());
+}
+
+// /capture?start=<KB> records ATEM datagrams, /capture?stop=1, /capture?clear=1 frees the buffer, /capture reports
+void handleCapture() {
+  if (web.hasArg("stop")) {
+    capture_stop();
+  } else if (web.hasArg("clear")) {
+    capture_clear();
+  } else if (web.hasArg("start")) {
+    long kb = web.arg("start").toInt();
+    if (kb <= 0) kb = CAPTURE_DEFAULT_KB;
+    if (kb > CAPTURE_MAX_KB || !capture_start(kb)) {
+      web.send(400, "text/plain", "start needs 1-128 KB of free RAM");
+      return;
+    }
+  }
+  web.send(200, "application/json", capture_status_json());
+}
+
+// /atem lists count and parse time per get-command, /atem?reset=1 restarts them and the parse times
+void handleAtemStats() {
+  if (web.hasArg("reset")) atem_reset_stats();
+  web.send(200, "application/json", atem_command_stats_json());
+}
+
+void handleCapturePcap() {
+  size_t length;
+  const uint8_t *data = capture_data(&length);
+  if (!data) {
+    web.send(404, "text/plain", "no capture, start one with /capture?start=64");
+    return;
+  }
+  web.sendHeader("Content-Disposition", "attachment; filename=atem.pcap");
+  web.setContentLength(length);
+  web.send(200, "application/vnd.tcpdump.pcap", "");
+  web.sendContent((const char *)data, length);
+}
+
+// /provision?plan=1-20&seconds=60[&all=1] opens a window, /provision reports, /provision?stop=1 closes
+void handleProvision() {
+  if (web.hasArg("stop")) {
+    provision_stop();
+  } else if (web.hasArg("plan")) {
+    // CSV of IDs and ranges, e.g. 1-8,12,20-24
+    uint8_t ids[MAX_TALLY_COUNT];
+    uint8_t count = 0;
+    String csv = web.arg("plan");
+    int number = 0;
+    int rangeStart = 0;
+    for (size_t i = 0; i <= csv.length(); ++i) {
+      char c = i < csv.length() ? csv[i] : ',';
+      if (isdigit(c)) {
+        number = 10*number + c - '0';
+        if (number > MAX_TALLY_COUNT) number = MAX_TALLY_COUNT;
+      } else if (c == '-') {
+        rangeStart = number;
+        number = 0;
+      } else if (number > 0) {
+        int from = rangeStart > 0 ? rangeStart : number;
+        for (int n = from; n <= number && count < MAX_TALLY_COUNT; n++) ids[count++] = n;
+        number = 0;
+        rangeStart = 0;
+      }
+    }
+    uint16_t seconds = web.hasArg("seconds") ? web.arg("seconds").toInt() : PROVISION_DEFAULT_SECONDS;
+    bool all = web.hasArg("all") && web.arg("all").toInt() != 0;
+    if (!provision_start(ids, count, seconds, all)) {
+      web.send(400, "text/plain", "plan needs IDs 1-64, seconds 1-600");
+      return;
+    }
+  }
+  web.send(200, "application/json", provision_status_json());
+}
+
 void handleTally() {
   web.send(200, "application/json", "{\"program\":"+String(programBits)+",\"preview\":"+String(previewBits)+"}");
 }
@@ -350,7 +723,13 @@ void handleSeen() {
     s += tallies[i].rgbBrightness;
     s += ", \"statusBrightness\":";
     s += tallies[i].statusBrightness;
-    s += "},";
+    s += ", \"gaps\":";
+    s += tallies[i].seqGaps;
+    s += ", \"late\":";
+    s += tallies[i].lateUs;
+    s += ", \"sync\":\"";
+    s += reconcile_status(tallies[i].mac_addr);
+    s += "\"},";
   }
   if (s[s.length()-1] == ',') s.remove(s.length()-1, 1); // remove last ,
   s += "]}";
@@ -390,7 +769,13 @@ String buildDevicesPayload() {
     s += tallies[i].rgbBrightness;
     s += ",\"statusBrightness\":";
     s += tallies[i].statusBrightness;
-    s += "},";
+    s += ",\"gaps\":";
+    s += tallies[i].seqGaps;
+    s += ",\"late\":";
+    s += tallies[i].lateUs;
+    s += ",\"sync\":\"";
+    s += reconcile_status(tallies[i].mac_addr);
+    s += "\"},";
   }
   if (s[s.length()-1] == ',') s.remove(s.length()-1, 1); // remove last ,
   s += "]}";
@@ -467,6 +852,7 @@ void WiFiEvent(WiFiEvent_t event)
       Serial.print(ETH.linkSpeed());
       Serial.println("Mbps");
       eth_connected = true;
+      atem_network_up();
       break;
     case ARDUINO_EVENT_ETH_DISCONNECTED:
       Serial.println("ETH Disconnected");
@@ -502,6 +888,11 @@ void setupWebserver() {
   web.on("/tally", handleTally);
   web.on("/set", handleSet);
   web.on("/seen", handleSeen);
+  web.on("/stress", handleStress);
+  web.on("/provision", handleProvision);
+  web.on("/capture", handleCapture);
+  web.on("/atem", handleAtemStats);
+  web.on("/capture.pcap", handleCapturePcap);
   web.on("/config", handleConfigJson);
   web.on("/update", HTTP_GET, handleUpdatePage);
   web.on("/update", HTTP_POST, handleUpdateResult, handleUpdateUpload);
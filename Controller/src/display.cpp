@@ -44,6 +44,8 @@ static const char* protocolLabel(switcher_protocol protocol) {
       return "OBS";
     case PROTOCOL_VMIX:
       return "VMIX";
+    case PROTOCOL_MULTICAST:
+      return "RELAY";
     default:
       return "UNKNOWN";
   }
@@ -8,6 +8,11 @@
 #include "atem.h"
 #include "espnow.h"
 #include "vmixServer.h"
+#include "reconcile.h"
+#include "loadTest.h"
+#include "redundancy.h"
+#include "multicast.h"
+#include "provision.h"
 #include "configWebserver.h" // for broadcastState declaration
 
 // Broadcast address, sends to all devices nearby
@@ -17,6 +22,15 @@ espnow_tally_info_t tallies[MAX_TALLY_COUNT];
 uint64_t programBits = 0;
 uint64_t previewBits = 0;
 long lastMessageAt = -10000;
+// appended to SET_TALLY: sequence counts frames, generation counts state changes
+static uint16_t tallySequence = 0;
+static uint16_t tallyGeneration = 0;
+
+// Per-camera commands also go to downstream controllers
+static esp_err_t sendCommand(const uint8_t *payload, size_t len) {
+  multicast_relay(payload, len);
+  return esp_now_send(broadcast_mac, payload, len);
+}
 
 espnow_tally_info_t * espnow_tallies() {
   return tallies;
@@ -64,30 +78,157 @@ void espnow_set_name(const String& name, uint64_t *bits) {
   payload[1] = nameLen;
   memcpy(payload + 2, name.c_str(), nameLen);
   memcpy(payload + 2 + nameLen, bits, sizeof(uint64_t));
-  esp_err_t result = esp_now_send(broadcast_mac, payload, 2 + nameLen + sizeof(uint64_t));
+  esp_err_t result = sendCommand(payload, 2 + nameLen + sizeof(uint64_t));
   if (result != ESP_OK) Serial.println("esp_now_send != OK (SET_NAME)");
 }
 
+uint8_t espnow_set_names(const uint8_t *ids, const char (*names)[NAME_LENGTH + 1], uint8_t count) {
+  uint8_t payload[ESP_NOW_MAX_DATA_LEN];
+  uint8_t frames = 0;
+  uint8_t i = 0;
+  while (i < count) {
+    size_t len = 2;
+    uint8_t packed = 0;
+    for (; i < count; i++) {
+      size_t nameLen = strnlen(names[i], NAME_LENGTH);
+      if (len + 2 + nameLen > sizeof(payload)) break;
+      payload[len] = ids[i];
+      payload[len + 1] = nameLen;
+      memcpy(payload + len + 2, names[i], nameLen);
+      len += 2 + nameLen;
+      packed++;
+    }
+    payload[0] = SET_NAMES;
+    payload[1] = packed;
+    esp_err_t result = sendCommand(payload, len);
+    if (result != ESP_OK) Serial.println("esp_now_send != OK (SET_NAMES)");
+    frames++;
+  }
+  return frames;
+}
+
 void espnow_tally() {
+  if (!redundancy_is_leader()) return;  // programBits is the leader's state, not ours
   espnow_tally(&programBits, &previewBits);
 }
 
-void espnow_tally(uint64_t *program, uint64_t *preview) {
-  uint8_t payload[1+sizeof(uint64_t)+sizeof(uint64_t)];
-  payload[0] = SET_TALLY;
-  memcpy(payload+1, program, sizeof(uint64_t));
-  memcpy(payload+1+sizeof(uint64_t), preview, sizeof(uint64_t));
-  esp_err_t result = esp_now_send(broadcast_mac, payload, sizeof(payload));
+static void sendTally(uint64_t *program, uint64_t *preview, bool timed, uint32_t applyAt) {
+  // a standby controller keeps its own view for a takeover and shows the leader's
+  if (!redundancy_is_leader()) {
+    redundancy_local_state(*program, *preview);
+    return;
+  }
+  if (*program != programBits || *preview != previewBits) tallyGeneration++;
   programBits = *program;
   previewBits = *preview;
-  if (result != ESP_OK) Serial.println("esp_now_send != OK");
+  // a running load test owns the air; its end puts the current state back
+  if (!loadtest_running()) {
+    tallySequence++;
+    uint8_t payload[1+sizeof(uint64_t)+sizeof(uint64_t)+2+2+4+4];
+    payload[0] = SET_TALLY;
+    memcpy(payload+1, program, sizeof(uint64_t));
+    memcpy(payload+1+sizeof(uint64_t), preview, sizeof(uint64_t));
+    memcpy(payload+1+2*sizeof(uint64_t), &tallySequence, sizeof(tallySequence));
+    memcpy(payload+3+2*sizeof(uint64_t), &tallyGeneration, sizeof(tallyGeneration));
+    // taken last, so the receivers' offset to our clock includes as little of our own delay as possible
+    uint32_t sentAt = micros();
+    if (!timed) applyAt = sentAt;
+    memcpy(payload+5+2*sizeof(uint64_t), &sentAt, sizeof(sentAt));
+    memcpy(payload+9+2*sizeof(uint64_t), &applyAt, sizeof(applyAt));
+    esp_err_t result = esp_now_send(broadcast_mac, payload, sizeof(payload));
+    if (result != ESP_OK) Serial.println("esp_now_send != OK");
+  }
+  if (multicast_publishing()) multicast_send_state(tallySequence, tallyGeneration, *program, *preview);
   vmix_tally(program, preview);
   broadcastState();
 }
 
+void espnow_tally(uint64_t *program, uint64_t *preview) {
+  sendTally(program, preview, false, 0);
+}
+
+void espnow_tally_at(uint64_t *program, uint64_t *preview, uint32_t applyAt) {
+  sendTally(program, preview, true, applyAt);
+}
+
+// most any receiver reported applying a timed tally late, over the heartbeats seen lately
+uint16_t espnow_rx_late_max() {
+  uint16_t late = 0;
+  unsigned long now = millis();
+  for (int i = 0; i < MAX_TALLY_COUNT; i++) {
+    if (tallies[i].id == 0 || now - tallies[i].last_seen > 5000) continue;
+    if (tallies[i].lateUs > late) late = tallies[i].lateUs;
+  }
+  return late;
+}
+
+uint16_t espnow_tally_sequence() {
+  return tallySequence;
+}
+
+uint16_t espnow_tally_generation() {
+  return tallyGeneration;
+}
+
+void espnow_adopt_counters(uint16_t sequence, uint16_t generation) {
+  tallySequence = sequence;
+  tallyGeneration = generation;
+}
+
+// State another controller put on the air; shown locally but not transmitted
+void espnow_mirror(uint64_t program, uint64_t preview) {
+  if (program == programBits && preview == previewBits) return;
+  programBits = program;
+  previewBits = preview;
+  vmix_tally(&programBits, &previewBits);
+  broadcastState();
+}
+
+// Mix progress for receivers that cross-fade: cameras in from fade out, cameras in to fade in
+void espnow_transition(uint8_t position, uint8_t flags, uint64_t from, uint64_t to) {
+  if (!redundancy_is_leader() || loadtest_running()) return;
+  // [40][position 0-255][flags][from u64][to u64]
+  uint8_t payload[3 + 2 * sizeof(uint64_t)];
+  payload[0] = TRANSITION;
+  payload[1] = position;
+  payload[2] = flags;
+  memcpy(payload + 3, &from, sizeof(uint64_t));
+  memcpy(payload + 3 + sizeof(uint64_t), &to, sizeof(uint64_t));
+  esp_err_t result = sendCommand(payload, sizeof(payload));
+  if (result != ESP_OK) Serial.println("esp_now_send != OK (TRANSITION)");
+}
+
+// Cameras whose talent mic is live; atem_loop() calls this only when a bit flipped
+void espnow_mic_live(uint64_t live) {
+  if (!redundancy_is_leader() || loadtest_running()) return;
+  // [42][live u64]
+  uint8_t payload[1 + sizeof(uint64_t)];
+  payload[0] = MIC_LIVE;
+  memcpy(payload + 1, &live, sizeof(uint64_t));
+  esp_err_t result = sendCommand(payload, sizeof(payload));
+  if (result != ESP_OK) Serial.println("esp_now_send != OK (MIC_LIVE)");
+}
+
+// Sends a tally frame for single cameras (0 = none) without touching the
+// stored state; used by the load generator, so errors are returned rather than printed
+
+esp_err_t espnow_tally_test(int pgm, int pvw) {
+  uint64_t program = (pgm > 0 && pgm <= MAX_TALLY_COUNT) ? (uint64_t)1 << (pgm - 1) : 0;
+  uint64_t preview = (pvw > 0 && pvw <= MAX_TALLY_COUNT) ? (uint64_t)1 << (pvw - 1) : 0;
+  uint8_t payload[1+sizeof(uint64_t)+sizeof(uint64_t)];
+  payload[0] = SET_TALLY;
+  memcpy(payload+1, &program, sizeof(uint64_t));
+  memcpy(payload+1+sizeof(uint64_t), &preview, sizeof(uint64_t));
+  return esp_now_send(broadcast_mac, payload, sizeof(payload));
+}
+
+esp_err_t espnow_broadcast(const uint8_t *payload, size_t len) {
+  return esp_now_send(broadcast_mac, payload, len);
+}
+
 void switchCamId(uint8_t id1, uint8_t id2) {
   uint8_t payload[3] = {SWITCH_CAMID, id1, id2};
-  esp_err_t result = esp_now_send(broadcast_mac, payload, sizeof(payload));
+  esp_err_t result = sendCommand(payload, sizeof(payload));
   if (result != ESP_OK) Serial.println("esp_now_send != OK");
 }
 
@@ -96,9 +237,8 @@ void espnow_brightness(uint8_t brightness, uint64_t *bits) {
   payload[0] = SET_BRIGHTNESS;
   payload[1] = brightness;
   memcpy(payload+2, bits, sizeof(*bits));
-  if (!esp_now_send(broadcast_mac, payload, sizeof(payload))) {
-    Serial.println("esp_now_send != OK");
-  }
+  esp_err_t result = sendCommand(payload, sizeof(payload));
+  if (result != ESP_OK) Serial.println("esp_now_send != OK");
 }
 
 void espnow_brightness_mac(uint8_t brightness, const uint8_t mac[6]) {
@@ -107,7 +247,7 @@ void espnow_brightness_mac(uint8_t brightness, const uint8_t mac[6]) {
   payload[0] = SET_BRIGHTNESS_MAC;
   payload[1] = brightness;
   memcpy(payload + 2, mac, 6);
-  esp_err_t result = esp_now_send(broadcast_mac, payload, sizeof(payload));
+  esp_err_t result = sendCommand(payload, sizeof(payload));
   if (result != ESP_OK) Serial.println("esp_now_send != OK (BRIGHTNESS_MAC)");
 }
 
@@ -116,7 +256,7 @@ void espnow_camid(uint8_t camId, uint64_t *bits) {
   payload[0] = SET_CAMID;
   payload[1] = camId;
   memcpy(payload+2, bits, sizeof(*bits));
-  esp_err_t result = esp_now_send(broadcast_mac, payload, sizeof(payload));
+  esp_err_t result = sendCommand(payload, sizeof(payload));
   if (result != ESP_OK) Serial.println("esp_now_send != OK");
 }
 
@@ -128,7 +268,7 @@ void espnow_color(uint32_t color, uint64_t *bits) {
   payload[2] = (color >> 8) & 0xFF;
   payload[3] = color & 0xFF;
   memcpy(payload+4, bits, sizeof(*bits));
-  esp_err_t result = esp_now_send(broadcast_mac, payload, sizeof(payload));
+  esp_err_t result = sendCommand(payload, sizeof(payload));
   if (result != ESP_OK) Serial.println("esp_now_send != OK");
 }
 
@@ -137,7 +277,7 @@ void espnow_signal(uint8_t signal, uint64_t *bits) {
   uint8_t payload[1+sizeof(uint64_t)];
   payload[0] = signal;  // Signal number is command number
   memcpy(payload+1, bits, sizeof(*bits));
-  esp_err_t result = esp_now_send(broadcast_mac, payload, sizeof(payload));
+  esp_err_t result = sendCommand(payload, sizeof(payload));
   if (result != ESP_OK) Serial.println("esp_now_send != OK");
 }
 
@@ -146,7 +286,7 @@ void espnow_identify(uint64_t *bits, uint8_t seconds) {
   payload[0] = SET_IDENTIFY;
   payload[1] = seconds;
   memcpy(payload + 2, bits, sizeof(uint64_t));
-  esp_err_t result = esp_now_send(broadcast_mac, payload, sizeof(payload));
+  esp_err_t result = sendCommand(payload, sizeof(payload));
   if (result != ESP_OK) Serial.println("esp_now_send != OK (IDENTIFY)");
 }
 
@@ -157,7 +297,7 @@ void espnow_identify_mac(const uint8_t mac[6], uint8_t seconds) {
   payload[1] = seconds;
   memcpy(payload + 2, mac, 6);
   // broadcast the payload; receivers compare mac internally
-  esp_err_t result = esp_now_send(broadcast_mac, payload, sizeof(payload));
+  esp_err_t result = sendCommand(payload, sizeof(payload));
   if (result != ESP_OK) Serial.println("esp_now_send != OK (IDENTIFY MAC)");
 }
 
@@ -169,7 +309,7 @@ void espnow_blink(uint32_t color, bool enable, uint64_t *bits) {
   payload[3] = (color >> 8) & 0xFF;
   payload[4] = color & 0xFF;
   memcpy(payload + 5, bits, sizeof(uint64_t));
-  esp_err_t result = esp_now_send(broadcast_mac, payload, sizeof(payload));
+  esp_err_t result = sendCommand(payload, sizeof(payload));
   if (result != ESP_OK) Serial.println("esp_now_send != OK (BLINK)");
 }
 
@@ -179,7 +319,7 @@ void espnow_set_camid_mac(uint8_t camId, const uint8_t mac[6]) {
   payload[0] = SET_CAMID_MAC;
   payload[1] = camId;
   memcpy(payload + 2, mac, 6);
-  esp_err_t result = esp_now_send(broadcast_mac, payload, sizeof(payload));
+  esp_err_t result = sendCommand(payload, sizeof(payload));
   if (result != ESP_OK) Serial.println("esp_now_send != OK (CAMID_MAC)");
 }
 
@@ -192,7 +332,7 @@ void espnow_set_name_mac(const String& name, const uint8_t mac[6]) {
   payload[1] = nameLen;
   memcpy(payload + 2, name.c_str(), nameLen);
   memcpy(payload + 2 + nameLen, mac, 6);
-  esp_err_t result = esp_now_send(broadcast_mac, payload, 2 + nameLen + 6);
+  esp_err_t result = sendCommand(payload, 2 + nameLen + 6);
   if (result != ESP_OK) Serial.println("esp_now_send != OK (NAME_MAC)");
 }
 
@@ -202,7 +342,7 @@ void espnow_status_brightness(uint8_t brightness, const uint8_t mac[6]) {
   payload[0] = SET_STATUS_BRIGHTNESS;
   payload[1] = brightness;
   memcpy(payload + 2, mac, 6);
-  esp_err_t result = esp_now_send(broadcast_mac, payload, sizeof(payload));
+  esp_err_t result = sendCommand(payload, sizeof(payload));
   if (result != ESP_OK) Serial.println("esp_now_send != OK (STATUS_BRIGHTNESS)");
 }
 
@@ -221,10 +361,17 @@ void OnDataRecv(const uint8_t *mac_addr, const uint8_t *data, int len)
   switch (command)
   {
   case HEARTBEAT: {
-    // data[1] = id, data[2] = rgb, data[3] = status, data[8] = signal, data[9] = nameLen, data[10..] = name
-    int8_t signal = (int8_t)data[8];
+    // data[1] = id, data[2] = rgb, data[3] = status, data[4..5] = missed tally frames,
+    // data[6..7] = most a timed tally was applied late (us), data[8] = signal, data[9] = nameLen, data[10..] = name
+    int8_t signal = len > 8 ? (int8_t)data[8] : 0;
+    uint16_t seqGaps = len > 5 ? data[4] | (data[5] << 8) : 0;
+    uint16_t lateUs = len > 7 ? data[6] | (data[7] << 8) : 0;
     uint8_t rgb = len > 2 ? data[2] : 255;
     uint8_t status = len > 3 ? data[3] : 255;
+    uint8_t reported = RECONCILE_ID;
+    if (len > 2) reported |= RECONCILE_RGB_BRIGHTNESS;
+    if (len > 3) reported |= RECONCILE_STATUS_BRIGHTNESS;
+    if (len > 9) reported |= RECONCILE_NAME;
     uint8_t nameLen = 0;
     const char* namePtr = nullptr;
     if (len > 10) {
@@ -241,11 +388,16 @@ void OnDataRecv(const uint8_t *mac_addr, const uint8_t *data, int len)
         tallies[i].signal = signal;
         tallies[i].rgbBrightness = rgb;
         tallies[i].statusBrightness = status;
+        tallies[i].seqGaps = seqGaps;
+        tallies[i].lateUs = lateUs;
         if (nameLen > 0) {
           uint8_t l = nameLen > 16 ? 16 : nameLen;
           memcpy(tallies[i].name, namePtr, l);
           tallies[i].name[l] = 0;
+        } else if (reported & RECONCILE_NAME) {
+          tallies[i].name[0] = 0;
         }
+        reconcile_observe(&tallies[i], reported);
         freeIdx = -1; // handled
         break;
       }
@@ -257,6 +409,8 @@ void OnDataRecv(const uint8_t *mac_addr, const uint8_t *data, int len)
       tallies[freeIdx].signal = signal;
       tallies[freeIdx].rgbBrightness = rgb;
       tallies[freeIdx].statusBrightness = status;
+      tallies[freeIdx].seqGaps = seqGaps;
+      tallies[freeIdx].lateUs = lateUs;
       if (nameLen > 0) {
         uint8_t l = nameLen > 16 ? 16 : nameLen;
         memcpy(tallies[freeIdx].name, namePtr, l);
@@ -264,11 +418,33 @@ void OnDataRecv(const uint8_t *mac_addr, const uint8_t *data, int len)
       } else {
         tallies[freeIdx].name[0] = 0;
       }
+      reconcile_observe(&tallies[freeIdx], reported);
     }
     broadcastState();
     break;
   }
   
+  case SET_TALLY:
+    // only another controller sends these
+    redundancy_peer_tally(mac_addr, data, len);
+    break;
+
+  case CONTROLLER_HEARTBEAT:
+    redundancy_peer_heartbeat(mac_addr, data, len);
+    break;
+
+  case PROVISION_CLAIM:
+    provision_claim(mac_addr, data, len);
+    break;
+
+  case PROVISION_ACK:
+    provision_ack(mac_addr, data, len);
+    break;
+
+  case TEST_REPORT:
+    loadtest_report(mac_addr, data, len);
+    break;
+
   case GET_TALLY:
     Serial.println("GET_TALLY");
     espnow_tally();
@@ -315,6 +491,8 @@ void espnow_setup()
     tallies[i].signal = 0;
     tallies[i].rgbBrightness = 255;
     tallies[i].statusBrightness = 255;
+    tallies[i].seqGaps = 0;
+    tallies[i].lateUs = 0;
   }
 
   vmixServerSetup();
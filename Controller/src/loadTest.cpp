@@ -0,0 +1,293 @@
+#include <Arduino.h>
+#include <cstring>
+#include <esp_timer.h>
+
+#include "espnow.h"
+#include "loadTest.h"
+
+enum loadtest_phase : uint8_t {
+  LOADTEST_IDLE,
+  LOADTEST_BEGIN,    // announcing the session
+  LOADTEST_RUN,      // generator task is sending
+  LOADTEST_DRAIN,    // let the last frames land before END
+  LOADTEST_END,      // announcing the end, collecting reports
+  LOADTEST_DONE,
+};
+
+static loadtest_step_t results[LOADTEST_MAX_STEPS];
+static uint8_t stepCount = 0;
+static uint8_t currentStep = 0;
+static uint16_t runSeconds = 10;
+static uint8_t mix = 20;
+static uint16_t nextSession = 0;
+
+static loadtest_phase phase = LOADTEST_IDLE;
+static unsigned long phaseAt = 0;
+static unsigned long runStartedAt = 0;
+static uint8_t controlSent = 0;
+
+static volatile bool generating = false;
+static TaskHandle_t generatorHandle = nullptr;
+
+// Filler frames carry an empty bitmask: every receiver has to parse them,
+// but no light changes and nothing gets written to flash.
+static esp_err_t sendFiller(uint32_t n) {
+  static const char name[] = "LOADTEST";
+  const uint64_t none = 0;
+  uint8_t payload[2 + sizeof(name) - 1 + sizeof(uint64_t)];
+  size_t len;
+  switch (n % 3) {
+    case 0:
+      payload[0] = SET_NAME;
+      payload[1] = sizeof(name) - 1;
+      memcpy(payload + 2, name, sizeof(name) - 1);
+      memcpy(payload + 2 + sizeof(name) - 1, &none, sizeof(none));
+      len = 2 + sizeof(name) - 1 + sizeof(none);
+      break;
+    case 1:
+      payload[0] = SET_COLOR;
+      payload[1] = n & 0xFF;
+      payload[2] = (n >> 8) & 0xFF;
+      payload[3] = 0x80;
+      memcpy(payload + 4, &none, sizeof(none));
+      len = 4 + sizeof(none);
+      break;
+    default:
+      payload[0] = SET_BLINK;
+      payload[1] = 0;
+      payload[2] = 0xFF;
+      payload[3] = 0x80;
+      payload[4] = 0;
+      memcpy(payload + 5, &none, sizeof(none));
+      len = 5 + sizeof(none);
+      break;
+  }
+  return espnow_broadcast(payload, len);
+}
+
+static void generatorTask(void *arg) {
+  loadtest_step_t *step = (loadtest_step_t *) arg;
+  const uint64_t start = esp_timer_get_time();
+  uint32_t frame = 0;
+  uint8_t mixAcc = 0;
+  while (generating) {
+    uint32_t due = (esp_timer_get_time() - start) * step->fps / 1000000ULL;
+    // never burst more than a few frames; if we fall behind the rate is simply not reached
+    for (uint8_t burst = 0; frame < due && burst < 8; burst++, frame++) {
+      esp_err_t result;
+      mixAcc += mix;
+      if (mixAcc >= 100) {
+        mixAcc -= 100;
+        result = sendFiller(frame);
+      } else {
+        // walk program over all cameras with preview on the next one
+        int cam = frame % MAX_TALLY_COUNT + 1;
+        result = espnow_tally_test(cam, cam % MAX_TALLY_COUNT + 1);
+      }
+      step->attempted++;
+      if (result != ESP_OK) step->sendErrors++;
+    }
+    frame = due;
+    vTaskDelay(1);
+  }
+  generatorHandle = nullptr;
+  vTaskDelete(NULL);
+}
+
+static void sendControl(espnow_command command, uint16_t session) {
+  uint8_t payload[3] = {command, (uint8_t)(session & 0xFF), (uint8_t)(session >> 8)};
+  if (espnow_broadcast(payload, sizeof(payload)) != ESP_OK) Serial.println("esp_now_send != OK (TEST)");
+}
+
+static void enterPhase(loadtest_phase next) {
+  phase = next;
+  phaseAt = millis();
+  controlSent = 0;
+}
+
+static void beginStep(uint8_t index) {
+  currentStep = index;
+  loadtest_step_t *step = &results[index];
+  step->session = nextSession++;
+  step->attempted = 0;
+  step->sendErrors = 0;
+  step->durationMs = 0;
+  for (int i = 0; i < MAX_TALLY_COUNT; i++) step->applied[i] = LOADTEST_NO_REPORT;
+  Serial.printf("loadtest: %u fps for %u s (session %u)\n", step->fps, runSeconds, step->session);
+  enterPhase(LOADTEST_BEGIN);
+}
+
+bool loadtest_start(const uint16_t *fps, uint8_t steps, uint16_t seconds, uint8_t mixPercent) {
+  if (loadtest_running() || !fps || steps == 0) return false;
+  if (steps > LOADTEST_MAX_STEPS) steps = LOADTEST_MAX_STEPS;
+  for (uint8_t i = 0; i < steps; i++) {
+    if (fps[i] < LOADTEST_MIN_FPS || fps[i] > LOADTEST_MAX_FPS) return false;
+  }
+  if (seconds == 0 || seconds > LOADTEST_MAX_SECONDS) return false;
+  if (nextSession == 0) nextSession = random(1, 0xFFFF);
+  stepCount = steps;
+  for (uint8_t i = 0; i < steps; i++) results[i].fps = fps[i];
+  runSeconds = seconds;
+  mix = mixPercent > 100 ? 100 : mixPercent;
+  beginStep(0);
+  return true;
+}
+
+void loadtest_stop() {
+  if (!loadtest_running()) return;
+  // keep what was measured so far; the current step still collects its reports
+  stepCount = currentStep + 1;
+  if (phase == LOADTEST_BEGIN) {
+    stepCount = currentStep;
+    enterPhase(stepCount ? LOADTEST_DONE : LOADTEST_IDLE);
+    espnow_tally();
+    return;
+  }
+  if (phase == LOADTEST_RUN) {
+    generating = false;
+    results[currentStep].durationMs = millis() - runStartedAt;
+    enterPhase(LOADTEST_DRAIN);
+  }
+}
+
+bool loadtest_running() {
+  return phase != LOADTEST_IDLE && phase != LOADTEST_DONE;
+}
+
+void loadtest_loop() {
+  unsigned long now = millis();
+  loadtest_step_t *step = &results[currentStep];
+  switch (phase) {
+    case LOADTEST_BEGIN:
+      if (controlSent < LOADTEST_CONTROL_REPEAT) {
+        if (now - phaseAt >= (unsigned long)controlSent * LOADTEST_CONTROL_GAP_MS) {
+          sendControl(TEST_BEGIN, step->session);
+          controlSent++;
+        }
+      } else if (now - phaseAt >= LOADTEST_CONTROL_REPEAT * LOADTEST_CONTROL_GAP_MS + LOADTEST_SETTLE_MS) {
+        generating = true;
+        runStartedAt = now;
+        if (xTaskCreatePinnedToCore(generatorTask, "loadtest", 3072, step, 2, &generatorHandle, 1) != pdPASS) {
+          Serial.println("loadtest: could not start generator task");
+          generating = false;
+          stepCount = currentStep;
+          enterPhase(stepCount ? LOADTEST_DONE : LOADTEST_IDLE);
+          espnow_tally();
+          break;
+        }
+        enterPhase(LOADTEST_RUN);
+      }
+      break;
+
+    case LOADTEST_RUN:
+      if (now - runStartedAt >= (unsigned long)runSeconds * 1000) {
+        generating = false;
+        step->durationMs = now - runStartedAt;
+        enterPhase(LOADTEST_DRAIN);
+      }
+      break;
+
+    case LOADTEST_DRAIN:
+      if (generatorHandle == nullptr && now - phaseAt >= LOADTEST_SETTLE_MS) enterPhase(LOADTEST_END);
+      break;
+
+    case LOADTEST_END:
+      if (controlSent < LOADTEST_CONTROL_REPEAT) {
+        if (now - phaseAt >= (unsigned long)controlSent * LOADTEST_CONTROL_GAP_MS) {
+          sendControl(TEST_END, step->session);
+          controlSent++;
+        }
+      } else if (now - phaseAt >= LOADTEST_REPORT_WINDOW_MS) {
+        Serial.printf("loadtest: session %u sent %u of %u frames in %u ms\n", step->session,
+                      step->attempted - step->sendErrors, step->attempted, step->durationMs);
+        if (currentStep + 1 < stepCount) {
+          beginStep(currentStep + 1);
+        } else {
+          enterPhase(LOADTEST_DONE);
+          espnow_tally();  // put the real tally state back on the air
+        }
+      }
+      break;
+
+    default:
+      break;
+  }
+}
+
+// data[1..2] = session, data[3..6] = frames handled (little endian like the bitmasks)
+void loadtest_report(const uint8_t *mac, const uint8_t *data, int len) {
+  if (len < 7) return;
+  uint16_t session = data[1] | (data[2] << 8);
+  uint32_t frames;
+  memcpy(&frames, data + 3, sizeof(frames));
+  for (uint8_t s = 0; s < stepCount; s++) {
+    if (results[s].session != session) continue;
+    espnow_tally_info_t *tallies = espnow_tallies();
+    for (int i = 0; i < MAX_TALLY_COUNT; i++) {
+      if (tallies[i].id != 0 && memcmp(tallies[i].mac_addr, mac, 6) == 0) {
+        results[s].applied[i] = frames;
+        return;
+      }
+    }
+    return;
+  }
+}
+
+String loadtest_results_json() {
+  String s = "{\"state\":\"";
+  s += phase == LOADTEST_IDLE ? "idle" : phase == LOADTEST_DONE ? "done" : "running";
+  s += "\",\"step\":";
+  s += currentStep;
+  s += ",\"seconds\":";
+  s += runSeconds;
+  s += ",\"mix\":";
+  s += mix;
+  s += ",\"steps\":[";
+  espnow_tally_info_t *tallies = espnow_tallies();
+  uint8_t shown = phase == LOADTEST_IDLE ? 0 : (phase == LOADTEST_DONE ? stepCount : currentStep + 1);
+  for (uint8_t st = 0; st < shown; st++) {
+    loadtest_step_t *step = &results[st];
+    uint32_t sent = step->attempted - step->sendErrors;
+    s += "{\"fps\":";
+    s += step->fps;
+    s += ",\"attempted\":";
+    s += step->attempted;
+    s += ",\"sendErrors\":";
+    s += step->sendErrors;
+    s += ",\"durationMs\":";
+    s += step->durationMs;
+    s += ",\"achievedFps\":";
+    s += step->durationMs ? (uint32_t)((uint64_t)sent * 1000 / step->durationMs) : 0;
+    s += ",\"receivers\":[";
+    for (int i = 0; i < MAX_TALLY_COUNT; i++) {
+      if (tallies[i].id == 0) continue;
+      char macbuf[18];
+      sprintf(macbuf, "%02X:%02X:%02X:%02X:%02X:%02X",
+              tallies[i].mac_addr[0], tallies[i].mac_addr[1], tallies[i].mac_addr[2],
+              tallies[i].mac_addr[3], tallies[i].mac_addr[4], tallies[i].mac_addr[5]);
+      s += "{\"mac\":\"";
+      s += macbuf;
+      s += "\",\"id\":";
+      s += tallies[i].id;
+      s += ",\"applied\":";
+      if (step->applied[i] == LOADTEST_NO_REPORT) {
+        s += "null,\"loss\":null},";
+        continue;
+      }
+      s += step->applied[i];
+      // loss in tenths of a percent; receivers that saw duplicates can't go below zero
+      uint32_t lost = step->applied[i] < sent ? sent - step->applied[i] : 0;
+      uint32_t tenths = sent ? (uint32_t)((uint64_t)lost * 1000 / sent) : 0;
+      s += ",\"loss\":";
+      s += tenths / 10;
+      s += ".";
+      s += tenths % 10;
+      s += "},";
+    }
+    if (s[s.length()-1] == ',') s.remove(s.length()-1, 1);
+    s += "]},";
+  }
+  if (s[s.length()-1] == ',') s.remove(s.length()-1, 1);
+  s += "]}";
+  return s;
+}
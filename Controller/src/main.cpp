@@ -1,6 +1,4 @@
 #include <Arduino.h>
-#include <ATEMbase.h>
-#include <ATEMstd.h>
 #include <EEPROM.h>
 #include <mdns.h>
 #include <ArduinoOTA.h>
@@ -11,6 +9,11 @@
 #include "obs.h"
 #include "vmix.h"
 #include "display.h"
+#include "reconcile.h"
+#include "loadTest.h"
+#include "redundancy.h"
+#include "multicast.h"
+#include "provision.h"
 
 struct controller_config config;
 static bool protocolRunning = false;
@@ -18,6 +21,8 @@ static bool protocolRunning = false;
 void startProtocol();
 void stopProtocol();
 
+static_assert(sizeof(controller_config) <= 512, "config must fit the EEPROM area");
+
 void readConfig()
 {
   Serial.println("readConfig");
@@ -33,11 +38,52 @@ void readConfig()
     config.obsIP = (uint32_t)IPAddress(192,168,88,21);
     config.obsPort = 4455;
     config.protocolEnabled = true;
+    config.redundancyPriority = 0;
+    config.multicastSend = false;
+    memset(config.cameraSource, 0, sizeof(config.cameraSource));
+    config.transitionFade = false;
+    memset(config.atemExtraIP, 0, sizeof(config.atemExtraIP));
+    memset(config.atemExtraSource, 0, sizeof(config.atemExtraSource));
+    config.atemMerge = ATEM_MERGE_OR;
+    memset(config.tallyMap, 0, sizeof(config.tallyMap));
+    config.atemNames = false;
+    config.atemTallySource = 2;
+    config.micLive = false;
+    config.micOnDb = -40;
+    config.micOffDb = -50;
+    config.micHoldMs = 1000;
+    config.frameSync = false;
   } else {
     if (config.protocolEnabled != 0 && config.protocolEnabled != 1) {
       config.protocolEnabled = true;
     }
+    if (config.redundancyPriority == 0xFF) config.redundancyPriority = 0;
+    if (config.multicastSend != 0 && config.multicastSend != 1) config.multicastSend = false;
+    for (int i = 0; i < CAMERA_SOURCE_COUNT; i++) {
+      if (config.cameraSource[i] == 0xFFFF) config.cameraSource[i] = 0;
+    }
+    if (config.transitionFade != 0 && config.transitionFade != 1) config.transitionFade = false;
+    for (int n = 0; n < ATEM_SWITCHER_COUNT - 1; n++) {
+      if (config.atemExtraIP[n] == 0xFFFFFFFF) config.atemExtraIP[n] = 0;
+      for (int i = 0; i < CAMERA_SOURCE_COUNT; i++) {
+        if (config.atemExtraSource[n][i] == 0xFFFF) config.atemExtraSource[n][i] = 0;
+      }
+    }
+    if (config.atemMerge != ATEM_MERGE_OR && config.atemMerge != ATEM_MERGE_PRIORITY) config.atemMerge = ATEM_MERGE_OR;
+    for (int e = 0; e < TALLY_MAP_ENTRIES; e++) {
+      if (config.tallyMap[e][0] > TALLY_MAP_INPUTS || config.tallyMap[e][1] > TALLY_MAP_INPUTS) config.tallyMap[e][0] = 0;
+    }
+    if (config.atemNames != 0 && config.atemNames != 1) config.atemNames = false;
+    if (config.atemTallySource > 2) config.atemTallySource = 2;
+    if (config.micLive != 0 && config.micLive != 1) config.micLive = false;
+    if (config.micHoldMs == 0xFFFF || config.micOnDb > 0 || config.micOffDb > config.micOnDb || config.micOffDb < -90) {
+      config.micOnDb = -40;
+      config.micOffDb = -50;
+      config.micHoldMs = 1000;
+    }
+    if (config.frameSync != 0 && config.frameSync != 1) config.frameSync = false;
   }
+  tallymap_compile();
   EEPROM.end();
 }	
 
@@ -63,6 +109,7 @@ void setup()
   Serial.printf("protocol=%d\n", config.protocol);
   setupWebserver();
   espnow_setup();
+  redundancy_setup();
   statusDisplaySetup();
   
   if (esp_err_t err = mdns_init()) {
@@ -91,11 +138,17 @@ void loop()
     else if (config.protocol == PROTOCOL_OBS) obs_loop();
     else if (config.protocol == PROTOCOL_VMIX) vmix_loop();
   }
+  multicast_loop();
   espnow_loop();
+  redundancy_loop();
+  loadtest_loop();
+  provision_loop();
+  if (!loadtest_running() && redundancy_is_leader()) reconcile_loop();
   webserverLoop();
   statusDisplayLoop();
   ArduinoOTA.handle();
-  delay(20);
+  // like delay(20), but the ATEM and multicast tasks wake us as soon as a tally is waiting
+  ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(20));
 }
 
 void startProtocol() {
@@ -103,12 +156,15 @@ void startProtocol() {
   if (config.protocol == PROTOCOL_ATEM) atem_setup();
   else if (config.protocol == PROTOCOL_OBS) obs_setup();
   else if (config.protocol == PROTOCOL_VMIX) vmix_setup();
+  else if (config.protocol == PROTOCOL_MULTICAST) multicast_setup();
   protocolRunning = true;
 }
 
 void stopProtocol() {
   if (!protocolRunning) return;
-  if (config.protocol == PROTOCOL_OBS) obs_stop();
+  if (config.protocol == PROTOCOL_ATEM) atem_stop();
+  else if (config.protocol == PROTOCOL_OBS) obs_stop();
   else if (config.protocol == PROTOCOL_VMIX) vmix_stop();
+  else if (config.protocol == PROTOCOL_MULTICAST) multicast_stop();
   protocolRunning = false;
 }
@@ -0,0 +1,202 @@
+#include <Arduino.h>
+#include <AsyncUDP.h>
+#include <cstring>
+
+#include "espnow.h"
+#include "main.h"
+#include "multicast.h"
+
+static AsyncUDP sender;
+static AsyncUDP listener;
+static bool listening = false;
+static uint16_t streamSeq = 0;
+
+// upstream: the last STATE, repeated while idle
+static bool stateSent = false;
+static unsigned long stateSentAt = 0;
+static uint16_t sentSequence = 0;
+static uint16_t sentGeneration = 0;
+static uint64_t sentProgram = 0;
+static uint64_t sentPreview = 0;
+
+// downstream, source selection in the UDP task
+static uint32_t sourceIp = 0;
+static uint16_t lastStreamSeq = 0;
+static unsigned long lastPacketAt = 0;
+static volatile uint32_t received = 0;
+
+// handed from the UDP task to loop(): the newest STATE and the RELAY frames in order
+static portMUX_TYPE handoffMux = portMUX_INITIALIZER_UNLOCKED;
+static TaskHandle_t loopTaskHandle = nullptr;
+static bool statePending = false;
+static bool sourceChanged = false;
+static uint16_t pendingGeneration = 0;
+static uint64_t pendingProgram = 0;
+static uint64_t pendingPreview = 0;
+static uint8_t relayQueue[MULTICAST_RELAY_QUEUE][ESP_NOW_MAX_DATA_LEN];
+static uint8_t relayLength[MULTICAST_RELAY_QUEUE];
+static uint8_t relayHead = 0;
+static uint8_t relayTail = 0;
+
+// loop() side
+static uint16_t lastGeneration = 0;
+static bool haveState = false;
+
+bool multicast_publishing() {
+  return config.multicastSend && config.protocol != PROTOCOL_MULTICAST;
+}
+
+static void sendPacket(multicast_type type, uint8_t *packet, size_t len) {
+  if (!multicast_publishing()) return;
+  streamSeq++;
+  packet[0] = MULTICAST_MAGIC0;
+  packet[1] = MULTICAST_MAGIC1;
+  packet[2] = MULTICAST_VERSION;
+  packet[3] = type;
+  memcpy(packet + 4, &streamSeq, sizeof(streamSeq));
+  sender.writeTo(packet, len, MULTICAST_GROUP, MULTICAST_PORT, TCPIP_ADAPTER_IF_ETH);
+}
+
+void multicast_send_state(uint16_t sequence, uint16_t generation, uint64_t program, uint64_t preview) {
+  if (!multicast_publishing()) return;
+  uint8_t packet[MULTICAST_HEADER_LEN + 2 + 2 + 2 * sizeof(uint64_t)];
+  uint8_t *body = packet + MULTICAST_HEADER_LEN;
+  memcpy(body, &sequence, sizeof(sequence));
+  memcpy(body + 2, &generation, sizeof(generation));
+  memcpy(body + 4, &program, sizeof(program));
+  memcpy(body + 4 + sizeof(uint64_t), &preview, sizeof(preview));
+  sendPacket(MULTICAST_STATE, packet, sizeof(packet));
+  stateSent = true;
+  stateSentAt = millis();
+  sentSequence = sequence;
+  sentGeneration = generation;
+  sentProgram = program;
+  sentPreview = preview;
+}
+
+void multicast_relay(const uint8_t *payload, size_t len) {
+  if (len == 0 || len > ESP_NOW_MAX_DATA_LEN) return;
+  uint8_t packet[MULTICAST_HEADER_LEN + 1 + ESP_NOW_MAX_DATA_LEN];
+  packet[MULTICAST_HEADER_LEN] = len;
+  memcpy(packet + MULTICAST_HEADER_LEN + 1, payload, len);
+  sendPacket(MULTICAST_RELAY, packet, MULTICAST_HEADER_LEN + 1 + len);
+}
+
+// Runs in the UDP task: picks the source and hands its frames to loop(), waking it
+static void onPacket(AsyncUDPPacket &packet) {
+  const uint8_t *data = packet.data();
+  size_t len = packet.length();
+  if (len < MULTICAST_HEADER_LEN || data[0] != MULTICAST_MAGIC0 || data[1] != MULTICAST_MAGIC1
+      || data[2] != MULTICAST_VERSION) return;
+
+  uint32_t ip = (uint32_t) packet.remoteIP();
+  uint16_t seq = data[4] | (data[5] << 8);
+  unsigned long now = millis();
+  bool sameSource = ip == sourceIp;
+  bool sourceAlive = sourceIp != 0 && now - lastPacketAt < MULTICAST_SOURCE_TIMEOUT;
+  if (!sameSource && sourceAlive) return;  // a second upstream while the first is talking
+  // multicast may duplicate or reorder; only move forward within one source
+  if (sameSource && sourceAlive && (int16_t)(seq - lastStreamSeq) <= 0) return;
+  sourceIp = ip;
+  lastStreamSeq = seq;
+  lastPacketAt = now;
+  received++;
+
+  const uint8_t *body = data + MULTICAST_HEADER_LEN;
+  size_t bodyLen = len - MULTICAST_HEADER_LEN;
+  switch ((multicast_type) data[3]) {
+    case MULTICAST_STATE: {
+      if (bodyLen < 4 + 2 * sizeof(uint64_t)) return;
+      portENTER_CRITICAL(&handoffMux);
+      if (!sameSource) sourceChanged = true;
+      pendingGeneration = body[2] | (body[3] << 8);
+      memcpy(&pendingProgram, body + 4, sizeof(pendingProgram));
+      memcpy(&pendingPreview, body + 4 + sizeof(uint64_t), sizeof(pendingPreview));
+      statePending = true;
+      portEXIT_CRITICAL(&handoffMux);
+      break;
+    }
+    case MULTICAST_RELAY: {
+      if (bodyLen < 1 || body[0] == 0 || body[0] > bodyLen - 1 || body[0] > ESP_NOW_MAX_DATA_LEN) return;
+      portENTER_CRITICAL(&handoffMux);
+      uint8_t next = (relayHead + 1) % MULTICAST_RELAY_QUEUE;
+      if (next != relayTail) {  // full: the command is lost, like a dropped datagram
+        memcpy(relayQueue[relayHead], body + 1, body[0]);
+        relayLength[relayHead] = body[0];
+        relayHead = next;
+      }
+      portEXIT_CRITICAL(&handoffMux);
+      break;
+    }
+    default:
+      return;
+  }
+  if (loopTaskHandle) xTaskNotifyGive(loopTaskHandle);
+}
+
+void multicast_loop() {
+  // upstream: without a cut the radio's periodic resend is too rare to keep downstream on this source
+  if (stateSent && multicast_publishing() && millis() - stateSentAt >= MULTICAST_KEEPALIVE_MS) {
+    multicast_send_state(sentSequence, sentGeneration, sentProgram, sentPreview);
+  }
+  if (!listening) return;
+
+  uint8_t relay[ESP_NOW_MAX_DATA_LEN];
+  while (true) {
+    uint8_t length = 0;
+    portENTER_CRITICAL(&handoffMux);
+    if (relayTail != relayHead) {
+      length = relayLength[relayTail];
+      memcpy(relay, relayQueue[relayTail], length);
+      relayTail = (relayTail + 1) % MULTICAST_RELAY_QUEUE;
+    }
+    portEXIT_CRITICAL(&handoffMux);
+    if (length == 0) break;
+    if (espnow_broadcast(relay, length) != ESP_OK) Serial.println("esp_now_send != OK (RELAY)");
+  }
+
+  portENTER_CRITICAL(&handoffMux);
+  bool pending = statePending;
+  bool newSource = sourceChanged;
+  uint16_t generation = pendingGeneration;
+  uint64_t program = pendingProgram;
+  uint64_t preview = pendingPreview;
+  statePending = false;
+  sourceChanged = false;
+  portEXIT_CRITICAL(&handoffMux);
+  if (!pending) return;
+  if (newSource) haveState = false;
+  // repeats and keepalives of the same generation are covered by our own periodic resend
+  if (haveState && generation == lastGeneration && program == programBits && preview == previewBits) return;
+  haveState = true;
+  lastGeneration = generation;
+  espnow_tally(&program, &preview);
+}
+
+void multicast_setup() {
+  if (listening) return;
+  loopTaskHandle = xTaskGetCurrentTaskHandle();
+  statePending = false;
+  relayHead = relayTail = 0;
+  if (!listener.listenMulticast(MULTICAST_GROUP, MULTICAST_PORT, 1, TCPIP_ADAPTER_IF_ETH)) {
+    Serial.println("multicast: listen failed");
+    return;
+  }
+  listener.onPacket(onPacket);
+  listening = true;
+  Serial.printf("multicast: following %s:%u\n", MULTICAST_GROUP.toString().c_str(), MULTICAST_PORT);
+}
+
+void multicast_stop() {
+  if (!listening) return;
+  listener.close();
+  listening = false;
+  sourceIp = 0;
+  haveState = false;
+  statePending = false;
+  relayHead = relayTail = 0;
+}
+
+uint32_t multicast_received() {
+  return received;
+}
@@ -1,6 +1,7 @@
 #include "ArduinoJson.h"
 #include "espnow.h"
 #include "obs.h"
+#include "tallyMap.h"
 
 #define MULTILINE(...) #__VA_ARGS__
 
@@ -8,6 +9,20 @@ static const char *TAG = "websocket";
 esp_websocket_client_handle_t client;
 uint64_t DSKbits = 0;
 
+// the fields obs_message_handler() reads; everything else (scene lists, item
+// arrays) is skipped while parsing instead of being stored in the document
+static StaticJsonDocument<384> filter;
+
+// a text frame larger than the client's receive buffer arrives in several
+// DATA events; its parts are collected here and parsed in place
+static char *message = nullptr;
+static int messageLength = 0;
+static obs_stats_t stats = {};
+
+const obs_stats_t *obs_stats() {
+  return &stats;
+}
+
 inline uint64_t bitn(uint8_t n) {
   return (uint64_t)1 << (n-1);
 }
@@ -29,11 +44,11 @@ uint64_t bitsFromTags(const char* s) {
           break;
         }
       }
-      if (n > 0) bits |= bitn(n);
+      if (n > 0 && n <= 64) bits |= bitn(n);
     } 
     boundary = !isalnum(s[i]);
   }
-  return bits;
+  return tallymap_apply(bits);
 }
 
 void obs_broadcast_signal(uint64_t bits, uint8_t signal) {
@@ -53,7 +68,7 @@ void obs_request_current_scenes() {
   esp_websocket_client_send_text(client, op2, strlen(op2), portMAX_DELAY);
 }
 
-void obs_message_handler(StaticJsonDocument<512> doc) {
+static void obs_message_handler(const JsonDocument &doc) {
   switch ((int)doc["op"]) {
   case 5: {
     if (doc["d"]["eventType"] == "CurrentProgramSceneChanged") {
@@ -111,27 +126,76 @@ void obs_message_handler(StaticJsonDocument<512> doc) {
   }
 }
 
+static void freeMessage() {
+  free(message);
+  message = nullptr;
+  messageLength = 0;
+}
+
+// const char * input is copied from as it is parsed, a char * buffer is parsed in place (ArduinoJson's zero-copy mode)
+template <typename TChar>
+static void parseMessage(TChar *json, size_t length) {
+  unsigned long start = micros();
+  StaticJsonDocument<OBS_DOC_SIZE> doc;
+  auto error = deserializeJson(doc, json, length, DeserializationOption::Filter(filter));
+  uint32_t parseUs = micros() - start;
+  stats.messages++;
+  stats.parseTotalUs += parseUs;
+  if (parseUs > stats.parseMaxUs) stats.parseMaxUs = parseUs;
+  if (doc.memoryUsage() > stats.docMax) stats.docMax = doc.memoryUsage();
+  if (error) {
+    stats.errors++;
+    Serial.print(F("deserializeJson() failed with code "));
+    Serial.println(error.c_str());
+    return;
+  }
+  obs_message_handler(doc);
+  // least free stack of this task so far, with the document on it
+  stats.stackFree = uxTaskGetStackHighWaterMark(NULL);
+}
+
+// One DATA event carries data_len bytes at payload_offset of a frame of
+// payload_len bytes. A frame that fits the client's buffer comes whole and is
+// parsed from there; larger ones are put together first. Continuation frames
+// (op_code 0) of a fragmented message are not handled: OBS sends every message
+// in one frame.
+static void onText(const esp_websocket_event_data_t *data) {
+  if (data->payload_offset == 0 && data->data_len >= data->payload_len) {
+    freeMessage();
+    parseMessage(data->data_ptr, data->data_len);
+    return;
+  }
+  if (data->payload_offset == 0) {
+    freeMessage();
+    if (data->payload_len > OBS_MESSAGE_MAX || (message = (char *)malloc(data->payload_len)) == nullptr) {
+      stats.dropped++;
+      return;
+    }
+    stats.fragmented++;
+    if ((uint32_t)data->payload_len > stats.largest) stats.largest = data->payload_len;
+  }
+  // a part of a dropped frame, or one out of order
+  if (message == nullptr || data->payload_offset != messageLength
+      || data->payload_offset + data->data_len > data->payload_len) {
+    if (message != nullptr) stats.dropped++;
+    freeMessage();
+    return;
+  }
+  memcpy(message + messageLength, data->data_ptr, data->data_len);
+  messageLength += data->data_len;
+  if (messageLength == data->payload_len) {
+    parseMessage(message, messageLength);
+    freeMessage();
+  }
+}
+
 static void websocket_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data)
 {
   esp_websocket_event_data_t *data = (esp_websocket_event_data_t *)event_data;
   switch (event_id) {
-  case WEBSOCKET_EVENT_DATA: {
-    // Serial.printf("Received opcode=%d\n", data->op_code);
-    if (data->op_code == 1) {
-      Serial.printf("<%.*s\n", data->data_len, (char *)data->data_ptr);
-      StaticJsonDocument<512> doc;  // list of scenes is larger than 512 bytes
-      auto error = deserializeJson(doc, data->data_ptr + data->payload_offset, data->payload_len);
-      if (error) {
-        Serial.print(F("deserializeJson() failed with code "));
-        Serial.println(error.c_str());
-        return;
-      }
-      obs_message_handler(doc);
-    } else {
-      // Serial.printf("Received=%.*s\n", data->data_len, (char *)data->data_ptr);
-    }
+  case WEBSOCKET_EVENT_DATA:
+    if (data->op_code == 1) onText(data);
     break;
-  }
   case WEBSOCKET_EVENT_ERROR:
     Serial.println("WS ERROR");
     break;
@@ -140,10 +204,26 @@ static void websocket_event_handler(void *handler_args, esp_event_base_t base, i
     break;
   case WEBSOCKET_EVENT_DISCONNECTED:
     Serial.println("WS DISCONNECTED");
+    freeMessage();
     break;
   }
 }
 
+static void buildFilter() {
+  if (!filter.isNull()) return;
+  filter["op"] = true;
+  filter["d"]["eventType"] = true;
+  filter["d"]["eventData"]["sceneName"] = true;
+  filter["d"]["eventData"]["type"] = true;
+  filter["d"]["eventData"]["to"] = true;
+  filter["d"]["eventData"]["signal"] = true;
+  filter["d"]["eventData"]["vendorName"] = true;
+  filter["d"]["eventData"]["eventData"]["new_scene"] = true;
+  filter["d"]["requestType"] = true;
+  filter["d"]["responseData"]["currentProgramSceneName"] = true;
+  filter["d"]["responseData"]["currentPreviewSceneName"] = true;
+}
+
 void obs_setup() {
   char uri[64];
   sprintf(uri, "ws://%s", inet_ntoa(config.obsIP), config.obsPort);
@@ -153,6 +233,7 @@ void obs_setup() {
     .port = config.obsPort,
   };
   obs_stop();
+  buildFilter();
   client = esp_websocket_client_init(&ws_cfg);
   esp_websocket_register_events(client, WEBSOCKET_EVENT_ANY, websocket_event_handler, (void *)client);
   esp_websocket_client_start(client);
@@ -171,4 +252,5 @@ void obs_stop() {
     esp_websocket_client_destroy(client);
     client = nullptr;
   }
+  freeMessage();
 }
@@ -0,0 +1,191 @@
+#include <Arduino.h>
+#include <cstring>
+
+#include "espnow.h"
+#include "provision.h"
+#include "reconcile.h"
+
+static uint8_t plan[MAX_TALLY_COUNT];
+static uint8_t planCount = 0;
+static bool openAll = false;
+static bool windowOpen = false;
+static unsigned long openedAt = 0;
+static unsigned long windowMs = 0;
+static unsigned long lastOpenAt = 0;
+static uint8_t session = 0;  // lets receivers ignore the periodic OPEN once they are done
+
+static provision_assignment_t assignments[MAX_TALLY_COUNT];
+static uint8_t assignmentCount = 0;
+
+// the receive callback only queues; IDs are handed out from loop()
+static uint8_t claimQueue[PROVISION_CLAIM_QUEUE][ESP_NOW_ETH_ALEN];
+static volatile uint8_t claimHead = 0;
+static volatile uint8_t claimTail = 0;
+
+static void sendOpen(uint8_t seconds) {
+  // [36][seconds, 0 closes][1 = all receivers, 0 = unassigned only][session]
+  uint8_t payload[4] = {PROVISION_OPEN, seconds, (uint8_t)(openAll ? 1 : 0), session};
+  if (espnow_broadcast(payload, sizeof(payload)) != ESP_OK) Serial.println("esp_now_send != OK (PROVISION_OPEN)");
+  lastOpenAt = millis();
+}
+
+static void sendAssign(provision_assignment_t *a) {
+  uint8_t payload[1 + 1 + 6];
+  payload[0] = PROVISION_ASSIGN;
+  payload[1] = a->id;
+  memcpy(payload + 2, a->mac_addr, 6);
+  if (espnow_broadcast(payload, sizeof(payload)) != ESP_OK) Serial.println("esp_now_send != OK (PROVISION_ASSIGN)");
+  a->lastSent = millis();
+}
+
+static provision_assignment_t* findAssignment(const uint8_t *mac) {
+  for (int i = 0; i < assignmentCount; i++) {
+    if (memcmp(assignments[i].mac_addr, mac, 6) == 0) return &assignments[i];
+  }
+  return nullptr;
+}
+
+// An ID is taken if this session handed it out or a receiver that is not
+// itself asking for a new one already uses it
+static bool idTaken(uint8_t id, const uint8_t *claimer) {
+  for (int i = 0; i < assignmentCount; i++) {
+    if (assignments[i].id == id) return true;
+  }
+  if (openAll) return false;  // everyone is being renumbered
+  espnow_tally_info_t *tallies = espnow_tallies();
+  for (int i = 0; i < MAX_TALLY_COUNT; i++) {
+    if (tallies[i].id != id) continue;
+    if (memcmp(tallies[i].mac_addr, claimer, 6) == 0) continue;
+    if (millis() - tallies[i].last_seen > 10000) continue;  // gone
+    return true;
+  }
+  return false;
+}
+
+static void assignNext(const uint8_t *mac) {
+  provision_assignment_t *a = findAssignment(mac);
+  if (a) {
+    // the receiver missed our ASSIGN or we missed its ACK
+    a->resends = 0;
+    sendAssign(a);
+    return;
+  }
+  if (assignmentCount >= MAX_TALLY_COUNT) return;
+  for (uint8_t p = 0; p < planCount; p++) {
+    if (idTaken(plan[p], mac)) continue;
+    a = &assignments[assignmentCount++];
+    memcpy(a->mac_addr, mac, 6);
+    a->id = plan[p];
+    a->acked = false;
+    a->resends = 0;
+    Serial.printf("provision: %02X:%02X:%02X:%02X:%02X:%02X -> %u\n",
+                  mac[0], mac[1], mac[2], mac[3], mac[4], mac[5], a->id);
+    sendAssign(a);
+    return;
+  }
+  Serial.println("provision: plan exhausted");
+}
+
+bool provision_start(const uint8_t *ids, uint8_t count, uint16_t seconds, bool all) {
+  if (!ids || count == 0 || seconds == 0 || seconds > PROVISION_MAX_SECONDS) return false;
+  if (count > MAX_TALLY_COUNT) count = MAX_TALLY_COUNT;
+  planCount = 0;
+  for (uint8_t i = 0; i < count; i++) {
+    if (ids[i] > 0 && ids[i] <= MAX_TALLY_COUNT) plan[planCount++] = ids[i];
+  }
+  if (planCount == 0) return false;
+  openAll = all;
+  session = session ? session + 1 : random(1, 256);
+  if (session == 0) session = 1;
+  assignmentCount = 0;
+  claimHead = claimTail = 0;
+  windowMs = (unsigned long)seconds * 1000;
+  openedAt = millis();
+  windowOpen = true;
+  // receivers keep their own timer; it is capped to one byte and refreshed below
+  sendOpen(seconds > 255 ? 255 : seconds);
+  return true;
+}
+
+void provision_stop() {
+  if (!windowOpen) return;
+  windowOpen = false;
+  sendOpen(0);
+  sendOpen(0);
+}
+
+bool provision_open() {
+  return windowOpen;
+}
+
+void provision_claim(const uint8_t *mac, const uint8_t *, int len) {
+  if (!windowOpen || len < 2) return;
+  uint8_t next = (claimHead + 1) % PROVISION_CLAIM_QUEUE;
+  if (next == claimTail) return;  // full; the receiver claims again
+  memcpy(claimQueue[claimHead], mac, 6);
+  claimHead = next;
+}
+
+void provision_ack(const uint8_t *mac, const uint8_t *data, int len) {
+  if (len < 2) return;
+  provision_assignment_t *a = findAssignment(mac);
+  if (!a || a->id != data[1]) return;
+  a->acked = true;
+  // the assigned ID is the desired one now, or reconcile would take it for drift and restore the old one
+  reconcile_expect_id(a->id, mac);
+}
+
+void provision_loop() {
+  if (!windowOpen) return;
+  unsigned long now = millis();
+  while (claimTail != claimHead) {
+    assignNext(claimQueue[claimTail]);
+    claimTail = (claimTail + 1) % PROVISION_CLAIM_QUEUE;
+  }
+  for (int i = 0; i < assignmentCount; i++) {
+    provision_assignment_t *a = &assignments[i];
+    if (a->acked || a->resends >= PROVISION_MAX_RESENDS || now - a->lastSent < PROVISION_RESEND_MS) continue;
+    a->resends++;
+    sendAssign(a);
+  }
+  unsigned long elapsed = now - openedAt;
+  if (elapsed >= windowMs) {
+    provision_stop();
+    Serial.printf("provision: closed, %u receivers assigned\n", assignmentCount);
+  } else if (now - lastOpenAt >= 5000) {
+    // late joiners and receivers that missed the first OPEN
+    unsigned long left = (windowMs - elapsed) / 1000;
+    sendOpen(left > 255 ? 255 : left);
+  }
+}
+
+String provision_status_json() {
+  String s = "{\"open\":";
+  s += windowOpen ? "true" : "false";
+  s += ",\"all\":";
+  s += openAll ? "true" : "false";
+  s += ",\"remaining\":";
+  s += windowOpen ? (windowMs - (millis() - openedAt)) / 1000 : 0;
+  s += ",\"plan\":[";
+  for (uint8_t p = 0; p < planCount; p++) {
+    s += plan[p];
+    if (p + 1 < planCount) s += ",";
+  }
+  s += "],\"assigned\":[";
+  for (int i = 0; i < assignmentCount; i++) {
+    char macbuf[18];
+    sprintf(macbuf, "%02X:%02X:%02X:%02X:%02X:%02X",
+            assignments[i].mac_addr[0], assignments[i].mac_addr[1], assignments[i].mac_addr[2],
+            assignments[i].mac_addr[3], assignments[i].mac_addr[4], assignments[i].mac_addr[5]);
+    s += "{\"mac\":\"";
+    s += macbuf;
+    s += "\",\"id\":";
+    s += assignments[i].id;
+    s += ",\"acked\":";
+    s += assignments[i].acked ? "true" : "false";
+    s += "},";
+  }
+  if (s[s.length()-1] == ',') s.remove(s.length()-1, 1);
+  s += "]}";
+  return s;
+}
@@ -0,0 +1,267 @@
+#include <Arduino.h>
+#include <cstring>
+
+#include "espnow.h"
+#include "reconcile.h"
+
+static reconcile_entry_t desired[MAX_TALLY_COUNT];
+static uint8_t desiredCount = 0;
+// desired[] is written by heartbeats in the WiFi task and by loop(); sends happen outside the lock
+static portMUX_TYPE desiredMux = portMUX_INITIALIZER_UNLOCKED;
+
+static reconcile_entry_t* findEntry(const uint8_t mac[6], bool create) {
+  for (int i = 0; i < desiredCount; i++) {
+    if (memcmp(desired[i].mac_addr, mac, 6) == 0) return &desired[i];
+  }
+  if (!create || desiredCount >= MAX_TALLY_COUNT) return nullptr;
+  reconcile_entry_t *e = &desired[desiredCount++];
+  memset(e, 0, sizeof(*e));
+  memcpy(e->mac_addr, mac, 6);
+  return e;
+}
+
+static uint8_t fieldIndex(uint8_t field) {
+  switch (field) {
+    case RECONCILE_ID: return 0;
+    case RECONCILE_NAME: return 1;
+    case RECONCILE_RGB_BRIGHTNESS: return 2;
+    default: return 3;
+  }
+}
+
+// A new desired value restarts the retry budget for that field; it is pending until a heartbeat shows it
+static void want(reconcile_entry_t *e, uint8_t field) {
+  e->fields |= field;
+  e->failed &= ~field;
+  e->pending |= field;
+  e->mismatched &= ~field;
+  e->attempts[fieldIndex(field)] = 0;
+}
+
+static bool bitsSelect(uint64_t *bits, uint8_t id) {
+  return id > 0 && id <= MAX_TALLY_COUNT && (*bits & ((uint64_t)1 << (id - 1)));
+}
+
+void reconcile_set_camid_mac(uint8_t camId, const uint8_t mac[6]) {
+  if (!mac || camId == 0 || camId > MAX_TALLY_COUNT) return;
+  portENTER_CRITICAL(&desiredMux);
+  reconcile_entry_t *e = findEntry(mac, true);
+  if (e) {
+    e->id = camId;
+    want(e, RECONCILE_ID);
+  }
+  portEXIT_CRITICAL(&desiredMux);
+  espnow_set_camid_mac(camId, mac);
+}
+
+void reconcile_set_name_mac(const String& name, const uint8_t mac[6]) {
+  if (!mac || name.length() == 0) return;
+  portENTER_CRITICAL(&desiredMux);
+  reconcile_entry_t *e = findEntry(mac, true);
+  if (e) {
+    strncpy(e->name, name.c_str(), 16);  // heartbeats only carry 16 chars
+    e->name[16] = 0;
+    e->operatorName = true;
+    want(e, RECONCILE_NAME);
+  }
+  portEXIT_CRITICAL(&desiredMux);
+  espnow_set_name_mac(name, mac);
+}
+
+void reconcile_brightness_mac(uint8_t brightness, const uint8_t mac[6]) {
+  if (!mac) return;
+  portENTER_CRITICAL(&desiredMux);
+  reconcile_entry_t *e = findEntry(mac, true);
+  if (e) {
+    e->rgbBrightness = brightness;
+    want(e, RECONCILE_RGB_BRIGHTNESS);
+  }
+  portEXIT_CRITICAL(&desiredMux);
+  espnow_brightness_mac(brightness, mac);
+}
+
+void reconcile_status_brightness(uint8_t brightness, const uint8_t mac[6]) {
+  if (!mac) return;
+  portENTER_CRITICAL(&desiredMux);
+  reconcile_entry_t *e = findEntry(mac, true);
+  if (e) {
+    e->statusBrightness = brightness;
+    want(e, RECONCILE_STATUS_BRIGHTNESS);
+  }
+  portEXIT_CRITICAL(&desiredMux);
+  espnow_status_brightness(brightness, mac);
+}
+
+// Bulk commands address receivers by their current id; pin the result to every known MAC they reach
+void reconcile_camid(uint8_t camId, uint64_t *bits) {
+  if (!bits) return;
+  espnow_tally_info_t *tallies = espnow_tallies();
+  if (camId > 0 && camId <= MAX_TALLY_COUNT) {
+    for (int i = 0; i < MAX_TALLY_COUNT; i++) {
+      if (!bitsSelect(bits, tallies[i].id)) continue;
+      portENTER_CRITICAL(&desiredMux);
+      reconcile_entry_t *e = findEntry(tallies[i].mac_addr, true);
+      if (e) {
+        e->id = camId;
+        want(e, RECONCILE_ID);
+      }
+      portEXIT_CRITICAL(&desiredMux);
+    }
+  }
+  espnow_camid(camId, bits);
+}
+
+static void expectName(const String& name, uint64_t *bits, bool byOperator) {
+  espnow_tally_info_t *tallies = espnow_tallies();
+  for (int i = 0; i < MAX_TALLY_COUNT; i++) {
+    if (!bitsSelect(bits, tallies[i].id)) continue;
+    portENTER_CRITICAL(&desiredMux);
+    reconcile_entry_t *e = findEntry(tallies[i].mac_addr, true);
+    if (e && (byOperator || !e->operatorName)) {
+      strncpy(e->name, name.c_str(), 16);
+      e->name[16] = 0;
+      e->operatorName = byOperator;
+      want(e, RECONCILE_NAME);
+    }
+    portEXIT_CRITICAL(&desiredMux);
+  }
+}
+
+void reconcile_set_name(const String& name, uint64_t *bits) {
+  if (!bits || name.length() == 0) return;
+  expectName(name, bits, true);
+  espnow_set_name(name, bits);
+}
+
+void reconcile_expect_name(const String& name, uint64_t *bits) {
+  if (!bits || name.length() == 0) return;
+  expectName(name, bits, false);
+}
+
+bool reconcile_operator_name(uint8_t camId) {
+  espnow_tally_info_t *tallies = espnow_tallies();
+  bool named = false;
+  portENTER_CRITICAL(&desiredMux);
+  for (int i = 0; i < MAX_TALLY_COUNT && !named; i++) {
+    if (tallies[i].id != camId) continue;
+    reconcile_entry_t *e = findEntry(tallies[i].mac_addr, false);
+    named = e && e->operatorName;
+  }
+  portEXIT_CRITICAL(&desiredMux);
+  return named;
+}
+
+void reconcile_expect_id(uint8_t camId, const uint8_t mac[6]) {
+  if (!mac || camId == 0 || camId > MAX_TALLY_COUNT) return;
+  portENTER_CRITICAL(&desiredMux);
+  reconcile_entry_t *e = findEntry(mac, true);
+  if (e) {
+    e->id = camId;
+    want(e, RECONCILE_ID);
+  }
+  portEXIT_CRITICAL(&desiredMux);
+}
+
+void reconcile_brightness(uint8_t brightness, uint64_t *bits) {
+  if (!bits) return;
+  espnow_tally_info_t *tallies = espnow_tallies();
+  for (int i = 0; i < MAX_TALLY_COUNT; i++) {
+    if (!bitsSelect(bits, tallies[i].id)) continue;
+    portENTER_CRITICAL(&desiredMux);
+    reconcile_entry_t *e = findEntry(tallies[i].mac_addr, true);
+    if (e) {
+      e->rgbBrightness = brightness;
+      want(e, RECONCILE_RGB_BRIGHTNESS);
+    }
+    portEXIT_CRITICAL(&desiredMux);
+  }
+  espnow_brightness(brightness, bits);
+}
+
+static void check(reconcile_entry_t *e, uint8_t field, bool matches) {
+  if (!(e->fields & field)) return;
+  if (matches) {
+    e->pending &= ~field;
+    e->mismatched &= ~field;
+    e->failed &= ~field;
+    e->attempts[fieldIndex(field)] = 0;
+  } else if (!(e->failed & field)) {
+    e->pending |= field;
+    e->mismatched |= field;
+  }
+}
+
+// Called from the ESP-NOW receive callback for every heartbeat
+void reconcile_observe(const espnow_tally_info_t *tally, uint8_t reported) {
+  portENTER_CRITICAL(&desiredMux);
+  reconcile_entry_t *e = findEntry(tally->mac_addr, false);
+  if (e && e->fields) {
+    if (reported & RECONCILE_ID) check(e, RECONCILE_ID, tally->id == e->id);
+    if (reported & RECONCILE_NAME) check(e, RECONCILE_NAME, strncmp(tally->name, e->name, 16) == 0);
+    if (reported & RECONCILE_RGB_BRIGHTNESS) check(e, RECONCILE_RGB_BRIGHTNESS, tally->rgbBrightness == e->rgbBrightness);
+    if (reported & RECONCILE_STATUS_BRIGHTNESS) check(e, RECONCILE_STATUS_BRIGHTNESS, tally->statusBrightness == e->statusBrightness);
+  }
+  portEXIT_CRITICAL(&desiredMux);
+}
+
+const char* reconcile_status(const uint8_t mac[6]) {
+  const char *status = "none";
+  portENTER_CRITICAL(&desiredMux);
+  reconcile_entry_t *e = findEntry(mac, false);
+  if (e && e->fields) status = e->failed ? "failed" : e->pending ? "pending" : "ok";
+  portEXIT_CRITICAL(&desiredMux);
+  return status;
+}
+
+// works on a copy taken under the lock
+static void resend(const reconcile_entry_t *e, uint8_t field) {
+  switch (field) {
+    case RECONCILE_ID: espnow_set_camid_mac(e->id, e->mac_addr); break;
+    case RECONCILE_NAME: espnow_set_name_mac(String(e->name), e->mac_addr); break;
+    case RECONCILE_RGB_BRIGHTNESS: espnow_brightness_mac(e->rgbBrightness, e->mac_addr); break;
+    case RECONCILE_STATUS_BRIGHTNESS: espnow_status_brightness(e->statusBrightness, e->mac_addr); break;
+  }
+}
+
+void reconcile_loop() {
+  unsigned long now = millis();
+  uint8_t sent = 0;
+  for (int i = 0; i < desiredCount && sent < RECONCILE_SENDS_PER_LOOP; i++) {
+    reconcile_entry_t copy;
+    uint8_t resendFields = 0;
+    uint8_t gaveUp = 0;
+    portENTER_CRITICAL(&desiredMux);
+    reconcile_entry_t *e = &desired[i];
+    uint8_t todo = e->mismatched & ~e->failed;
+    bool due = todo && now - e->lastAttempt >= RECONCILE_RETRY_MS;
+    if (due) {
+      for (uint8_t field = RECONCILE_ID; field <= RECONCILE_STATUS_BRIGHTNESS; field <<= 1) {
+        if (!(todo & field)) continue;
+        uint8_t &attempts = e->attempts[fieldIndex(field)];
+        if (attempts >= RECONCILE_MAX_RETRIES) {
+          e->failed |= field;
+          gaveUp |= field;
+          continue;
+        }
+        attempts++;
+        resendFields |= field;
+      }
+      // the next heartbeat tells whether it worked; the fields stay pending until then
+      e->mismatched = 0;
+      e->lastAttempt = now;
+      copy = *e;
+    }
+    portEXIT_CRITICAL(&desiredMux);
+    if (!due) continue;
+    for (uint8_t field = RECONCILE_ID; field <= RECONCILE_STATUS_BRIGHTNESS; field <<= 1) {
+      if (gaveUp & field) {
+        Serial.printf("reconcile: giving up on field %u for %02X:%02X:%02X:%02X:%02X:%02X\n", field,
+                      copy.mac_addr[0], copy.mac_addr[1], copy.mac_addr[2], copy.mac_addr[3], copy.mac_addr[4], copy.mac_addr[5]);
+      }
+      if (resendFields & field) {
+        resend(&copy, field);
+        sent++;
+      }
+    }
+  }
+}
@@ -0,0 +1,211 @@
+#include <Arduino.h>
+#include <cstring>
+#include <WiFi.h>
+
+#include "espnow.h"
+#include "main.h"
+#include "redundancy.h"
+
+static redundancy_role role = ROLE_OFF;
+static uint8_t selfMac[6];
+static unsigned long startedAt = 0;
+static unsigned long lastHeartbeatAt = 0;
+static unsigned long lastLeaderAt = 0;
+static unsigned long lastBetterStandbyAt = 0;
+
+// MAC of the leader whose heartbeat we follow; only its tally frames count
+static bool haveLeaderMac = false;
+static uint8_t leaderMac[6];
+
+// peer frames copied in the ESP-NOW receive callback (WiFi task), applied in redundancy_loop()
+#define REDUNDANCY_HEARTBEAT_LEN (3 + 2 + 2 + 2 * sizeof(uint64_t))
+#define REDUNDANCY_PEER_QUEUE 8
+struct peer_frame {
+  uint8_t mac[6];
+  uint8_t len;
+  uint8_t data[REDUNDANCY_HEARTBEAT_LEN];
+};
+static portMUX_TYPE peerMux = portMUX_INITIALIZER_UNLOCKED;
+static peer_frame peerQueue[REDUNDANCY_PEER_QUEUE];
+static uint8_t peerHead = 0;
+static uint8_t peerTail = 0;
+
+// highest counters heard from the leader, continued on takeover
+static bool peerCounters = false;
+static uint16_t peerSeq = 0;
+static uint16_t peerGen = 0;
+
+// what our own switcher connection reports while we are standby
+static bool localValid = false;
+static uint64_t localProgram = 0;
+static uint64_t localPreview = 0;
+
+// Priority decides, the MAC breaks ties, so both sides reach the same answer
+static bool outranks(uint8_t prioA, const uint8_t *macA, uint8_t prioB, const uint8_t *macB) {
+  if (prioA != prioB) return prioA > prioB;
+  return memcmp(macA, macB, 6) > 0;
+}
+
+static void adoptPeerCounters(uint16_t seq, uint16_t gen) {
+  if (!peerCounters || (int16_t)(seq - peerSeq) > 0) peerSeq = seq;
+  if (!peerCounters || (int16_t)(gen - peerGen) > 0) peerGen = gen;
+  peerCounters = true;
+}
+
+static void sendHeartbeat() {
+  // [35][priority][role][seq u16][gen u16][program u64][preview u64]
+  uint8_t payload[3 + 2 + 2 + 2 * sizeof(uint64_t)];
+  uint16_t seq = espnow_tally_sequence();
+  uint16_t gen = espnow_tally_generation();
+  payload[0] = CONTROLLER_HEARTBEAT;
+  payload[1] = config.redundancyPriority;
+  payload[2] = role;
+  memcpy(payload + 3, &seq, sizeof(seq));
+  memcpy(payload + 5, &gen, sizeof(gen));
+  memcpy(payload + 7, &programBits, sizeof(uint64_t));
+  memcpy(payload + 7 + sizeof(uint64_t), &previewBits, sizeof(uint64_t));
+  esp_err_t result = espnow_broadcast(payload, sizeof(payload));
+  if (result != ESP_OK) Serial.println("esp_now_send != OK (CONTROLLER_HEARTBEAT)");
+}
+
+static void takeOver() {
+  role = ROLE_LEADER;
+  haveLeaderMac = false;
+  if (peerCounters) espnow_adopt_counters(peerSeq, peerGen);
+  Serial.printf("redundancy: leader silent, taking over at seq %u gen %u\n",
+                espnow_tally_sequence(), espnow_tally_generation());
+  sendHeartbeat();
+  lastHeartbeatAt = millis();
+  // our own switcher view is the freshest; without one keep what the leader last sent
+  if (localValid) espnow_tally(&localProgram, &localPreview);
+  else espnow_tally();
+}
+
+void redundancy_setup() {
+  WiFi.macAddress(selfMac);
+  role = config.redundancyPriority ? ROLE_STANDBY : ROLE_OFF;
+  // listen for a running leader before claiming the role
+  startedAt = lastLeaderAt = lastBetterStandbyAt = millis();
+  if (role != ROLE_OFF) Serial.printf("redundancy: priority %u, standing by\n", config.redundancyPriority);
+}
+
+static void drainPeers();
+
+void redundancy_loop() {
+  if (role == ROLE_OFF) return;
+  drainPeers();
+  unsigned long now = millis();
+  if (now - lastHeartbeatAt >= REDUNDANCY_HEARTBEAT_MS) {
+    sendHeartbeat();
+    lastHeartbeatAt = now;
+  }
+  if (role == ROLE_STANDBY
+      && now - startedAt > REDUNDANCY_TAKEOVER_MS
+      && now - lastLeaderAt > REDUNDANCY_TAKEOVER_MS
+      && now - lastBetterStandbyAt > REDUNDANCY_TAKEOVER_MS) {
+    takeOver();
+  }
+}
+
+bool redundancy_is_leader() {
+  return role != ROLE_STANDBY;
+}
+
+redundancy_role redundancy_role_now() {
+  return role;
+}
+
+const char* redundancy_role_name() {
+  switch (role) {
+    case ROLE_LEADER: return "leader";
+    case ROLE_STANDBY: return "standby";
+    default: return "off";
+  }
+}
+
+void redundancy_local_state(uint64_t program, uint64_t preview) {
+  localProgram = program;
+  localPreview = preview;
+  localValid = true;
+}
+
+static void applyHeartbeat(const uint8_t *mac, const uint8_t *data, int len) {
+  if (len < (int)REDUNDANCY_HEARTBEAT_LEN) return;
+  uint8_t priority = data[1];
+  uint8_t peerRole = data[2];
+  if (peerRole == ROLE_STANDBY) {
+    if (outranks(priority, mac, config.redundancyPriority, selfMac)) lastBetterStandbyAt = millis();
+    return;
+  }
+  if (peerRole != ROLE_LEADER) return;
+  if (role == ROLE_LEADER) {
+    if (outranks(config.redundancyPriority, selfMac, priority, mac)) return;  // the peer steps down
+    Serial.println("redundancy: higher ranked leader seen, standing by");
+    role = ROLE_STANDBY;
+    redundancy_local_state(programBits, previewBits);
+    // keep counters monotonic across the handover in both directions
+    adoptPeerCounters(espnow_tally_sequence(), espnow_tally_generation());
+  }
+  lastLeaderAt = millis();
+  memcpy(leaderMac, mac, 6);
+  haveLeaderMac = true;
+  uint16_t seq, gen;
+  uint64_t program, preview;
+  memcpy(&seq, data + 3, sizeof(seq));
+  memcpy(&gen, data + 5, sizeof(gen));
+  memcpy(&program, data + 7, sizeof(program));
+  memcpy(&preview, data + 7 + sizeof(uint64_t), sizeof(preview));
+  adoptPeerCounters(seq, gen);
+  espnow_mirror(program, preview);
+}
+
+// The leader's own tally frames carry the newest counters and prove it is alive
+static void applyTally(const uint8_t *mac, const uint8_t *data, int len) {
+  if (role != ROLE_STANDBY || len < 1 + 2 * (int)sizeof(uint64_t) + 4) return;
+  if (!haveLeaderMac || memcmp(mac, leaderMac, 6) != 0) return;  // not the leader we follow
+  uint16_t seq, gen;
+  memcpy(&seq, data + 1 + 2 * sizeof(uint64_t), sizeof(seq));
+  memcpy(&gen, data + 3 + 2 * sizeof(uint64_t), sizeof(gen));
+  adoptPeerCounters(seq, gen);
+  lastLeaderAt = millis();
+}
+
+static void enqueuePeer(const uint8_t *mac, const uint8_t *data, int len) {
+  if (role == ROLE_OFF || len <= 0) return;
+  portENTER_CRITICAL(&peerMux);
+  uint8_t next = (peerHead + 1) % REDUNDANCY_PEER_QUEUE;
+  if (next != peerTail) {  // full: dropped, the next heartbeat follows within REDUNDANCY_HEARTBEAT_MS
+    peer_frame &f = peerQueue[peerHead];
+    memcpy(f.mac, mac, 6);
+    f.len = len < (int)sizeof(f.data) ? len : sizeof(f.data);
+    memcpy(f.data, data, f.len);
+    peerHead = next;
+  }
+  portEXIT_CRITICAL(&peerMux);
+}
+
+void redundancy_peer_heartbeat(const uint8_t *mac, const uint8_t *data, int len) {
+  enqueuePeer(mac, data, len);
+}
+
+void redundancy_peer_tally(const uint8_t *mac, const uint8_t *data, int len) {
+  enqueuePeer(mac, data, len);
+}
+
+// Applies the queued peer frames in arrival order, in loop()
+static void drainPeers() {
+  peer_frame f;
+  while (true) {
+    bool have = false;
+    portENTER_CRITICAL(&peerMux);
+    if (peerTail != peerHead) {
+      f = peerQueue[peerTail];
+      peerTail = (peerTail + 1) % REDUNDANCY_PEER_QUEUE;
+      have = true;
+    }
+    portEXIT_CRITICAL(&peerMux);
+    if (!have) break;
+    if (f.data[0] == CONTROLLER_HEARTBEAT) applyHeartbeat(f.mac, f.data, f.len);
+    else applyTally(f.mac, f.data, f.len);
+  }
+}
@@ -0,0 +1,106 @@
+#include <Arduino.h>
+
+#include "main.h"
+#include "tallyMap.h"
+
+static uint64_t table[TALLY_MAP_INPUTS / 4][16];
+static bool identity = true;
+
+void tallymap_compile() {
+  uint64_t cameras[TALLY_MAP_INPUTS];
+  bool mapped[TALLY_MAP_INPUTS] = {};
+  for (int i = 0; i < TALLY_MAP_INPUTS; i++) cameras[i] = (uint64_t)1 << i;
+
+  identity = true;
+  for (int e = 0; e < TALLY_MAP_ENTRIES; e++) {
+    uint8_t input = config.tallyMap[e][0];
+    uint8_t camera = config.tallyMap[e][1];
+    if (input < 1 || input > TALLY_MAP_INPUTS) continue;
+    if (!mapped[input - 1]) {
+      mapped[input - 1] = true;
+      cameras[input - 1] = 0;
+    }
+    if (camera >= 1 && camera <= TALLY_MAP_INPUTS) cameras[input - 1] |= (uint64_t)1 << (camera - 1);
+  }
+  for (int i = 0; i < TALLY_MAP_INPUTS; i++) {
+    if (cameras[i] != (uint64_t)1 << i) identity = false;
+  }
+
+  for (int n = 0; n < TALLY_MAP_INPUTS / 4; n++) {
+    for (int v = 0; v < 16; v++) {
+      uint64_t mask = 0;
+      for (int b = 0; b < 4; b++) {
+        if (v & (1 << b)) mask |= cameras[4 * n + b];
+      }
+      table[n][v] = mask;
+    }
+  }
+}
+
+uint64_t tallymap_apply(uint64_t inputs) {
+  if (identity) return inputs;
+  uint64_t cameras = 0;
+  for (int n = 0; n < TALLY_MAP_INPUTS / 4; n++) {
+    cameras |= table[n][(inputs >> (4 * n)) & 0xF];
+  }
+  return cameras;
+}
+
+bool tallymap_identity() {
+  return identity;
+}
+
+String tallymap_string() {
+  String s;
+  bool done[TALLY_MAP_ENTRIES] = {};
+  for (int e = 0; e < TALLY_MAP_ENTRIES; e++) {
+    uint8_t input = config.tallyMap[e][0];
+    if (input == 0 || done[e]) continue;
+    if (s.length()) s += ",";
+    s += input;
+    char separator = ':';
+    // all cameras of this input in one item, in entry order
+    for (int f = e; f < TALLY_MAP_ENTRIES; f++) {
+      if (config.tallyMap[f][0] != input) continue;
+      done[f] = true;
+      s += separator;
+      s += config.tallyMap[f][1];
+      separator = '+';
+    }
+  }
+  return s;
+}
+
+bool tallymap_parse(const String &text) {
+  uint8_t entries[TALLY_MAP_ENTRIES][2] = {};
+  int count = 0;
+  int start = 0;
+  while (start < (int)text.length()) {
+    int end = text.indexOf(',', start);
+    if (end < 0) end = text.length();
+    String item = text.substring(start, end);
+    item.trim();
+    start = end + 1;
+    if (item.length() == 0) continue;
+    int colon = item.indexOf(':');
+    if (colon <= 0) return false;
+    long input = item.substring(0, colon).toInt();
+    if (input < 1 || input > TALLY_MAP_INPUTS) return false;
+    int from = colon + 1;
+    while (true) {
+      int plus = item.indexOf('+', from);
+      String camera = item.substring(from, plus < 0 ? item.length() : plus);
+      camera.trim();
+      long id = camera.toInt();
+      if (camera.length() == 0 || id < 0 || id > TALLY_MAP_INPUTS || (id == 0 && camera != "0")) return false;
+      if (count == TALLY_MAP_ENTRIES) return false;
+      entries[count][0] = input;
+      entries[count][1] = id;
+      count++;
+      if (plus < 0) break;
+      from = plus + 1;
+    }
+  }
+  memcpy(config.tallyMap, entries, sizeof(entries));
+  return true;
+}
@@ -0,0 +1,67 @@
+#include <Arduino.h>
+
+#include "espnow.h"
+#include "main.h"
+#include "transition.h"
+
+static bool active = false;
+static uint64_t fromBits = 0;   // on air when the transition started
+static uint64_t toBits = 0;     // coming in
+static uint8_t sentStep = 0xFF;
+static uint8_t step = 0;
+static unsigned long lastSentAt = 0;
+static unsigned long lastUpdateAt = 0;
+static uint32_t frames = 0;
+
+static void sendStep(uint8_t flags) {
+  uint8_t position = (flags & TRANSITION_END) ? 255 : (uint16_t)step * 255 / (TRANSITION_STEPS - 1);
+  espnow_transition(position, flags, fromBits, toBits);
+  sentStep = step;
+  lastSentAt = millis();
+  frames++;
+}
+
+static void finish() {
+  active = false;
+  // one closing frame so receivers drop the fade without waiting for their timeout
+  sendStep(TRANSITION_END);
+}
+
+void transition_update(bool inTransition, uint16_t position) {
+  if (!config.transitionFade) return;
+  unsigned long now = millis();
+  lastUpdateAt = now;
+  if (!inTransition) {
+    if (active) finish();
+    return;
+  }
+  if (!active) {
+    active = true;
+    // the switcher may already show the incoming source on program; it is still the one fading in
+    toBits = previewBits;
+    fromBits = programBits & ~toBits;
+    sentStep = 0xFF;
+  }
+  if (position > 10000) position = 10000;
+  step = (uint32_t)position * TRANSITION_STEPS / 10001;
+  if (step != sentStep && now - lastSentAt >= TRANSITION_MIN_INTERVAL_MS) sendStep(0);
+}
+
+// Steps held back by the rate cap go out here, so the last position is never lost
+void transition_loop() {
+  if (!active) return;
+  unsigned long now = millis();
+  if (now - lastUpdateAt > TRANSITION_STALE_MS) {
+    finish();
+  } else if (step != sentStep && now - lastSentAt >= TRANSITION_MIN_INTERVAL_MS) {
+    sendStep(0);
+  }
+}
+
+bool transition_active() {
+  return active;
+}
+
+uint32_t transition_frames() {
+  return frames;
+}
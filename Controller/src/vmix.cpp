@@ -1,6 +1,7 @@
 #include <ETH.h>
 #include "espnow.h"
 #include "vmix.h"
+#include "tallyMap.h"
 
 #define TALLY_UPDATE_EACH 2000
 #define MULTILINE(...) #__VA_ARGS__
@@ -29,16 +30,19 @@ void vmix_loop() {
     int i = 1;
     char *b = buffer+9-i;
     while (true) {
-      if      (b[i] == '0') continue;
-      else if (b[i] == '1') programBits |= bitn(i+1);
-      else if (b[i] == '2') previewBits |= bitn(i+1);
+      if (i > 64) break;
+      if      (b[i] == '0') ;
+      else if (b[i] == '1') programBits |= bitn(i);
+      else if (b[i] == '2') previewBits |= bitn(i);
       else if (b[i] == '3') {
-        programBits |= bitn(i+1);
-        previewBits |= bitn(i+1);
+        programBits |= bitn(i);
+        previewBits |= bitn(i);
       }
       else break;
       i++;
     }
+    programBits = tallymap_apply(programBits);
+    previewBits = tallymap_apply(previewBits);
     espnow_tally(&programBits, &previewBits);
   } else if (strncmp(buffer, "SUBSCRIBE OK TALLY", 18) == 0) {
     Serial.println("SUBSCRIBE OK TALLY");
@@ -0,0 +1,301 @@
+// Host benchmark for the ATEM get-command dispatch.
+//
+// Compares the old strcmp chain of ATEMstd::_parseGetCommands with the FourCC
+// slot switch for every command of a state dump and checks that the keys in
+// ATEMfourcc.h hash to distinct slots.
+//
+//   g++ -O2 -std=c++11 -I../../lib/ATEMbase -o atemDispatchBench atemDispatchBench.cpp
+//   ./atemDispatchBench [dump.bin] [iterations]
+//
+// dump.bin holds raw ATEM datagrams back to back (UDP payloads as sent by the
+// switcher, each starting with its 12 byte header). Without a file a built-in
+// dump shaped like the initial state of a 1 M/E switcher is used.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "ATEMfourcc.h"
+
+static const uint32_t knownKeys[] = {
+	ATEM_CMD_ver, ATEM_CMD_pin, ATEM_CMD_top, ATEM_CMD_Powr, ATEM_CMD_VidM, ATEM_CMD_InPr, ATEM_CMD_InCm,
+	ATEM_CMD_Time, ATEM_CMD_TlIn, ATEM_CMD_TlSr, ATEM_CMD_PrgI, ATEM_CMD_PrvI, ATEM_CMD_TrSS, ATEM_CMD_TrPr,
+	ATEM_CMD_TrPs, ATEM_CMD_TMxP, ATEM_CMD_KeOn, ATEM_CMD_KeBP, ATEM_CMD_DskB, ATEM_CMD_DskP, ATEM_CMD_DskS,
+	ATEM_CMD_FtbS, ATEM_CMD_AuxS, ATEM_CMD_MPCE, ATEM_CMD_MPrp, ATEM_CMD_AMIP, ATEM_CMD_AMLv, ATEM_CMD_AMTl,
+	ATEM_CMD_AEBP, ATEM_CMD_FAIP, ATEM_CMD_FAMP, ATEM_CMD_FASP, ATEM_CMD_FMLv, ATEM_CMD_FMTl,
+};
+
+// counts per command in the built-in dump (roughly a 1 M/E with 20 inputs and Fairlight audio)
+static const struct
+{
+	const char *name;
+	int count;
+	int length;
+} syntheticDump[] = {
+	{"_ver", 1, 12}, {"_pin", 1, 52}, {"_top", 1, 28}, {"_MeC", 1, 12}, {"_mpl", 1, 12}, {"_MvC", 1, 12},
+	{"Powr", 1, 12}, {"VidM", 1, 12}, {"InPr", 42, 44}, {"MvPr", 1, 12}, {"MvIn", 10, 12}, {"TlIn", 1, 32},
+	{"TlSr", 1, 140}, {"PrgI", 1, 12}, {"PrvI", 1, 12}, {"TrSS", 1, 12}, {"TrPr", 1, 12}, {"TrPs", 1, 12},
+	{"TMxP", 1, 12}, {"TDpP", 1, 12}, {"TWpP", 1, 28}, {"KeOn", 4, 12}, {"KeBP", 4, 28}, {"KeLm", 4, 16},
+	{"KeDV", 4, 72}, {"DskB", 2, 12}, {"DskP", 2, 28}, {"DskS", 2, 20}, {"FtbP", 1, 12}, {"FtbS", 1, 12},
+	{"ColV", 2, 16}, {"AuxS", 6, 12}, {"MPCE", 2, 12}, {"MPfe", 20, 60}, {"MPrp", 4, 48}, {"CCdP", 60, 32},
+	{"FASP", 40, 64}, {"FAIP", 20, 28}, {"FAMP", 1, 48}, {"AEBP", 40, 68}, {"FMLv", 50, 64}, {"FMTl", 1, 44},
+	{"InCm", 1, 12}, {"Time", 1, 16},
+};
+
+static uint64_t sink;
+
+// the chain as it was before the switch, ignored commands first
+static int dispatchStrcmp(const char *cmdStr)
+{
+	if (!strcmp(cmdStr, "TrPs"))
+		return 0;
+	else if (!strcmp(cmdStr, "Time"))
+		return 0;
+	else if (!strcmp(cmdStr, "MPrp"))
+		return 0;
+	else if (!strcmp(cmdStr, "FMTl"))
+		return 0;
+	else if (!strcmp(cmdStr, "TlSr"))
+		return 0;
+
+	if (!strcmp(cmdStr, "TlIn"))
+		return 1;
+	else if (!strcmp(cmdStr, "FASP"))
+		return 0;
+	else if (!strcmp(cmdStr, "AEBP"))
+		return 0;
+	else if (!strcmp(cmdStr, "PrgI"))
+		return 2;
+	else if (!strcmp(cmdStr, "PrvI"))
+		return 3;
+	else if (!strcmp(cmdStr, "TrSS"))
+		return 4;
+	else if (!strcmp(cmdStr, "TrPr"))
+		return 5;
+	else if (!strcmp(cmdStr, "TMxP"))
+		return 6;
+	else if (!strcmp(cmdStr, "KeOn"))
+		return 7;
+	else if (!strcmp(cmdStr, "DskP"))
+		return 8;
+	else if (!strcmp(cmdStr, "FtbS"))
+		return 9;
+	else if (!strcmp(cmdStr, "AuxS"))
+		return 10;
+	else if (!strcmp(cmdStr, "MPCE"))
+		return 11;
+	else if (!strcmp(cmdStr, "_pin"))
+		return 12;
+	else if (!strcmp(cmdStr, "_ver"))
+		return 13;
+	return 0;
+}
+
+// same layout as ATEMstd::_parseGetCommands
+static int dispatchFourcc(uint32_t cmd)
+{
+	switch (atemCmdSlot(cmd))
+	{
+	case atemCmdSlot(ATEM_CMD_TrPs):
+	case atemCmdSlot(ATEM_CMD_Time):
+	case atemCmdSlot(ATEM_CMD_MPrp):
+	case atemCmdSlot(ATEM_CMD_FMTl):
+	case atemCmdSlot(ATEM_CMD_TlSr):
+	case atemCmdSlot(ATEM_CMD_FASP):
+	case atemCmdSlot(ATEM_CMD_AEBP):
+		return 0;
+	case atemCmdSlot(ATEM_CMD_TlIn):
+		return cmd == ATEM_CMD_TlIn ? 1 : 0;
+	case atemCmdSlot(ATEM_CMD_PrgI):
+		return cmd == ATEM_CMD_PrgI ? 2 : 0;
+	case atemCmdSlot(ATEM_CMD_PrvI):
+		return cmd == ATEM_CMD_PrvI ? 3 : 0;
+	case atemCmdSlot(ATEM_CMD_TrSS):
+		return cmd == ATEM_CMD_TrSS ? 4 : 0;
+	case atemCmdSlot(ATEM_CMD_TrPr):
+		return cmd == ATEM_CMD_TrPr ? 5 : 0;
+	case atemCmdSlot(ATEM_CMD_TMxP):
+		return cmd == ATEM_CMD_TMxP ? 6 : 0;
+	case atemCmdSlot(ATEM_CMD_KeOn):
+		return cmd == ATEM_CMD_KeOn ? 7 : 0;
+	case atemCmdSlot(ATEM_CMD_DskP):
+		return cmd == ATEM_CMD_DskP ? 8 : 0;
+	case atemCmdSlot(ATEM_CMD_FtbS):
+		return cmd == ATEM_CMD_FtbS ? 9 : 0;
+	case atemCmdSlot(ATEM_CMD_AuxS):
+		return cmd == ATEM_CMD_AuxS ? 10 : 0;
+	case atemCmdSlot(ATEM_CMD_MPCE):
+		return cmd == ATEM_CMD_MPCE ? 11 : 0;
+	case atemCmdSlot(ATEM_CMD_pin):
+		return cmd == ATEM_CMD_pin ? 12 : 0;
+	case atemCmdSlot(ATEM_CMD_ver):
+		return cmd == ATEM_CMD_ver ? 13 : 0;
+	default:
+		return 0;
+	}
+}
+
+static void addCommand(std::vector<uint8_t> &datagram, const char *name, int length)
+{
+	size_t at = datagram.size();
+	datagram.resize(at + length);
+	datagram[at] = length >> 8;
+	datagram[at + 1] = length & 0xFF;
+	memcpy(&datagram[at + 4], name, 4);
+}
+
+static std::vector<uint8_t> buildSyntheticDump()
+{
+	std::vector<uint8_t> dump, datagram;
+	for (size_t i = 0; i < sizeof(syntheticDump) / sizeof(syntheticDump[0]); i++)
+	{
+		for (int n = 0; n < syntheticDump[i].count; n++)
+		{
+			if (datagram.empty())
+				datagram.resize(12);
+			addCommand(datagram, syntheticDump[i].name, syntheticDump[i].length);
+			if (datagram.size() > 1300)
+			{
+				datagram[0] = 0x08 | (datagram.size() >> 8);
+				datagram[1] = datagram.size() & 0xFF;
+				dump.insert(dump.end(), datagram.begin(), datagram.end());
+				datagram.clear();
+			}
+		}
+	}
+	if (!datagram.empty())
+	{
+		datagram[0] = 0x08 | (datagram.size() >> 8);
+		datagram[1] = datagram.size() & 0xFF;
+		dump.insert(dump.end(), datagram.begin(), datagram.end());
+	}
+	return dump;
+}
+
+static bool readFile(const char *path, std::vector<uint8_t> &out)
+{
+	FILE *f = fopen(path, "rb");
+	if (!f)
+		return false;
+	uint8_t buf[4096];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+		out.insert(out.end(), buf, buf + n);
+	fclose(f);
+	return true;
+}
+
+// pointers to the command headers of all datagrams, the same walk as ATEMbase::_parsePacket
+static std::vector<const uint8_t *> collectCommands(const std::vector<uint8_t> &dump)
+{
+	std::vector<const uint8_t *> commands;
+	size_t at = 0;
+	while (at + 12 <= dump.size())
+	{
+		uint16_t packetLength = ((dump[at] & 0x07) << 8) | dump[at + 1];
+		if (packetLength < 12 || at + packetLength > dump.size())
+			break;
+		uint16_t index = 12;
+		while (index + 8 <= packetLength)
+		{
+			const uint8_t *header = &dump[at + index];
+			uint16_t cmdLength = (header[0] << 8) | header[1];
+			if (cmdLength <= 8 || index + cmdLength > packetLength)
+				break;
+			commands.push_back(header);
+			index += cmdLength;
+		}
+		at += packetLength;
+	}
+	return commands;
+}
+
+static bool checkSlots()
+{
+	bool ok = true;
+	size_t count = sizeof(knownKeys) / sizeof(knownKeys[0]);
+	for (size_t i = 0; i < count; i++)
+	{
+		for (size_t j = i + 1; j < count; j++)
+		{
+			if (atemCmdSlot(knownKeys[i]) == atemCmdSlot(knownKeys[j]))
+			{
+				printf("slot collision: key %zu and %zu -> %u\n", i, j, atemCmdSlot(knownKeys[i]));
+				ok = false;
+			}
+		}
+	}
+	return ok;
+}
+
+int main(int argc, char **argv)
+{
+	std::vector<uint8_t> dump;
+	if (argc > 1)
+	{
+		if (!readFile(argv[1], dump))
+		{
+			fprintf(stderr, "cannot read %s\n", argv[1]);
+			return 1;
+		}
+	}
+	else
+	{
+		dump = buildSyntheticDump();
+	}
+	int iterations = argc > 2 ? atoi(argv[2]) : 20000;
+
+	if (!checkSlots())
+		return 1;
+
+	std::vector<const uint8_t *> commands = collectCommands(dump);
+	if (commands.empty())
+	{
+		fprintf(stderr, "no commands in dump\n");
+		return 1;
+	}
+
+	// both must agree before timing them
+	for (size_t i = 0; i < commands.size(); i++)
+	{
+		const uint8_t *h = commands[i];
+		char cmdStr[] = {(char)h[4], (char)h[5], (char)h[6], (char)h[7], '\0'};
+		if (dispatchStrcmp(cmdStr) != dispatchFourcc(ATEM_FOURCC(h[4], h[5], h[6], h[7])))
+		{
+			printf("dispatch mismatch for %s\n", cmdStr);
+			return 1;
+		}
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	for (int it = 0; it < iterations; it++)
+	{
+		for (size_t i = 0; i < commands.size(); i++)
+		{
+			const uint8_t *h = commands[i];
+			char cmdStr[] = {(char)h[4], (char)h[5], (char)h[6], (char)h[7], '\0'};
+			sink += dispatchStrcmp(cmdStr);
+		}
+	}
+	double strcmpNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+	start = std::chrono::steady_clock::now();
+	for (int it = 0; it < iterations; it++)
+	{
+		for (size_t i = 0; i < commands.size(); i++)
+		{
+			const uint8_t *h = commands[i];
+			sink += dispatchFourcc(ATEM_FOURCC(h[4], h[5], h[6], h[7]));
+		}
+	}
+	double fourccNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+	double perCommand = (double)iterations * commands.size();
+	printf("%zu commands in %zu bytes, %d iterations\n", commands.size(), dump.size(), iterations);
+	printf("strcmp chain: %.2f ns/command\n", strcmpNs / perCommand);
+	printf("fourcc slot:  %.2f ns/command\n", fourccNs / perCommand);
+	printf("(checksum %llu)\n", (unsigned long long)sink);
+	return 0;
+}
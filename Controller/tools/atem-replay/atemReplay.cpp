@@ -0,0 +1,395 @@
+// Host replay of ATEM captures through the real parser.
+//
+// Reads a pcap file (from the controller's /capture.pcap, or tcpdump/Wireshark
+// on the switcher's network), takes every UDP datagram sent from port 9910 and
+// feeds it through the ATEM client built natively, with the clock set to the
+// capture timestamps. Prints the tally sequence the controller would have
+// published, optionally checks it against an expected file, then times the
+// parser over the whole capture.
+//
+//   g++ -O2 -std=c++11 -I../shim -I../../lib/ATEMbase -I../../lib/ATEMstd -I../../lib/ATEMtally
+//       -I../../lib/SkaarhojPgmspace -o atemReplay atemReplay.cpp ../shim/Arduino.cpp
+//       ../../lib/ATEMbase/ATEMbase.cpp ../../lib/ATEMbase/ATEMsourceTally.cpp ../../lib/ATEMbase/ATEMderivedTally.cpp
+//       ../../lib/ATEMbase/ATEMmicLive.cpp ../../lib/ATEMbase/ATEMframeClock.cpp ../../lib/ATEMbase/ATEMcommandStats.cpp
+//       ../../lib/ATEMstd/ATEMstd.cpp ../../lib/ATEMtally/ATEMtally.cpp
+//   ./atemReplay [options] capture.pcap
+//
+// The compiler call above is one command line; add -DATEM_TALLY_ONLY to replay
+// through ATEMtally like the default firmware.
+//
+//   --from a.b.c.d      only datagrams from this switcher
+//   --camsrc id=source  camera map entry (repeatable), like /set?camsrc
+//   --tally tlin|derived|fallback  tally source, like /set?tallysrc (default tlin)
+//   --expect file       compare the tally sequence, exit 1 on a difference
+//   --write file        store the tally sequence as an expected file
+//   --repeat n          passes for the throughput measurement (default 200)
+//   --verbose           library serial output
+
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef ATEM_TALLY_ONLY
+#include "ATEMtally.h"
+typedef ATEMtally ATEMclient;
+#else
+#include "ATEMstd.h"
+typedef ATEMstd ATEMclient;
+#endif
+
+#define ATEM_PORT 9910
+
+struct Datagram
+{
+	uint64_t us; // capture timestamp
+	uint32_t source;
+	std::vector<uint8_t> data;
+};
+
+struct TallyStep
+{
+	uint64_t us;
+	uint64_t program;
+	uint64_t preview;
+};
+
+// Gives the replay access to the datagram entry of the parser
+class ReplayClient : public ATEMclient
+{
+public:
+	// the same gate as ATEMbase::_runLoop(): complete datagrams with commands, no hello packets
+	bool feed(const Datagram &d)
+	{
+		uint16_t length = d.data.size();
+		if (length <= 12 || length > ATEM_RX_BUFFER_LENGTH)
+			return false;
+		if ((((d.data[0] & 0x07) << 8) | d.data[1]) != length)
+			return false;
+		if ((d.data[0] >> 3) & ATEM_headerCmd_HelloPacket)
+			return false;
+		memcpy(_rxBuffer, d.data.data(), length);
+		_parsePacket(length);
+		return true;
+	}
+};
+
+static std::vector<TallyStep> steps;
+static uint64_t currentUs;
+static bool recordSteps = true;
+
+static void onTally(uint64_t *program, uint64_t *preview, const ATEMtallyDiff *)
+{
+	if (recordSteps)
+		steps.push_back({currentUs, *program, *preview});
+}
+
+static uint32_t get32(const uint8_t *p, bool swapped)
+{
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return swapped ? __builtin_bswap32(v) : v;
+}
+
+static bool readFile(const char *path, std::vector<uint8_t> &out)
+{
+	FILE *f = fopen(path, "rb");
+	if (!f)
+		return false;
+	uint8_t buf[65536];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+		out.insert(out.end(), buf, buf + n);
+	fclose(f);
+	return true;
+}
+
+// offset of the IPv4 header in a frame of this link type, -1 if not IPv4
+static int ipOffset(uint32_t linkType, const uint8_t *frame, size_t length)
+{
+	switch (linkType)
+	{
+	case 0: // BSD loopback
+		return length >= 4 ? 4 : -1;
+	case 1: // Ethernet, optionally one VLAN tag
+	{
+		if (length < 14)
+			return -1;
+		uint16_t type = (frame[12] << 8) | frame[13];
+		if (type == 0x8100 && length >= 18)
+			return ((frame[16] << 8) | frame[17]) == 0x0800 ? 18 : -1;
+		return type == 0x0800 ? 14 : -1;
+	}
+	case 12:
+	case 101: // raw IP, what the controller writes
+		return 0;
+	case 113: // Linux cooked
+		return length >= 16 && ((frame[14] << 8) | frame[15]) == 0x0800 ? 16 : -1;
+	case 276: // Linux cooked v2
+		return length >= 20 && ((frame[0] << 8) | frame[1]) == 0x0800 ? 20 : -1;
+	default:
+		return -1;
+	}
+}
+
+static bool readPcap(const char *path, uint32_t from, std::vector<Datagram> &out)
+{
+	std::vector<uint8_t> file;
+	if (!readFile(path, file) || file.size() < 24)
+	{
+		fprintf(stderr, "cannot read %s\n", path);
+		return false;
+	}
+	uint32_t magic;
+	memcpy(&magic, file.data(), 4);
+	bool swapped, nanos;
+	if (magic == 0xA1B2C3D4 || magic == 0xA1B23C4D)
+		swapped = false;
+	else if (magic == 0xD4C3B2A1 || magic == 0x4D3CB2A1)
+		swapped = true;
+	else
+	{
+		fprintf(stderr, "%s is not a pcap file (pcapng: save as pcap in Wireshark)\n", path);
+		return false;
+	}
+	nanos = magic == 0xA1B23C4D || magic == 0x4D3CB2A1;
+	uint32_t linkType = get32(&file[20], swapped) & 0xFFFF;
+
+	size_t at = 24;
+	while (at + 16 <= file.size())
+	{
+		uint64_t seconds = get32(&file[at], swapped);
+		uint64_t fraction = get32(&file[at + 4], swapped);
+		uint32_t captured = get32(&file[at + 8], swapped);
+		at += 16;
+		if (at + captured > file.size())
+			break;
+		const uint8_t *frame = &file[at];
+		at += captured;
+
+		int ip = ipOffset(linkType, frame, captured);
+		if (ip < 0 || (size_t)ip + 20 > captured || (frame[ip] >> 4) != 4 || frame[ip + 9] != 17)
+			continue;
+		if (((frame[ip + 6] & 0x3F) << 8 | frame[ip + 7]) != 0)
+			continue; // fragment; the switcher stays below the MTU
+		size_t udp = ip + (frame[ip] & 0x0F) * 4;
+		if (udp + 8 > captured || ((frame[udp] << 8) | frame[udp + 1]) != ATEM_PORT)
+			continue;
+		uint32_t source;
+		memcpy(&source, frame + ip + 12, 4);
+		if (from && source != from)
+			continue;
+		size_t length = ((frame[udp + 4] << 8) | frame[udp + 5]);
+		if (length < 8 || udp + length > captured)
+			continue;
+
+		Datagram d;
+		d.us = seconds * 1000000 + (nanos ? fraction / 1000 : fraction);
+		d.source = source;
+		d.data.assign(frame + udp + 8, frame + udp + length);
+		out.push_back(d);
+	}
+	return true;
+}
+
+static size_t countCommands(const std::vector<uint8_t> &d)
+{
+	size_t commands = 0;
+	size_t index = 12;
+	while (index + 8 <= d.size())
+	{
+		uint16_t length = (d[index] << 8) | d[index + 1];
+		if (length <= 8 || index + length > d.size())
+			break;
+		commands++;
+		index += length;
+	}
+	return commands;
+}
+
+static std::string stepLine(const TallyStep &s)
+{
+	char line[64];
+	snprintf(line, sizeof(line), "program=%016llx preview=%016llx", (unsigned long long)s.program, (unsigned long long)s.preview);
+	return line;
+}
+
+static bool readExpected(const char *path, std::vector<std::string> &lines)
+{
+	FILE *f = fopen(path, "r");
+	if (!f)
+		return false;
+	char line[256];
+	while (fgets(line, sizeof(line), f))
+	{
+		std::string s(line);
+		while (!s.empty() && (s.back() == '\n' || s.back() == '\r' || s.back() == ' '))
+			s.pop_back();
+		if (!s.empty() && s[0] != '#')
+			lines.push_back(s);
+	}
+	fclose(f);
+	return true;
+}
+
+static void usage()
+{
+	fprintf(stderr, "usage: atemReplay [--from ip] [--camsrc id=source]... [--tally tlin|derived|fallback] [--expect file] [--write file] [--repeat n] [--verbose] capture.pcap\n");
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	const char *path = NULL;
+	const char *expectPath = NULL;
+	const char *writePath = NULL;
+	uint32_t from = 0;
+	int repeat = 200;
+	bool verbose = false;
+	uint16_t cameraSource[64] = {};
+	ATEMtallySource tallySource = ATEM_TALLY_TLIN;
+
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (arg == "--from" && hasValue)
+		{
+			struct in_addr address;
+			if (!inet_aton(argv[++i], &address))
+				usage();
+			from = address.s_addr;
+		}
+		else if (arg == "--camsrc" && hasValue)
+		{
+			int id, source;
+			if (sscanf(argv[++i], "%d=%d", &id, &source) != 2 || id < 1 || id > 64 || source < 0 || source >= 0xFFFF)
+				usage();
+			cameraSource[id - 1] = source;
+		}
+		else if (arg == "--tally" && hasValue)
+		{
+			std::string source = argv[++i];
+			if (source == "tlin")
+				tallySource = ATEM_TALLY_TLIN;
+			else if (source == "derived")
+				tallySource = ATEM_TALLY_DERIVED;
+			else if (source == "fallback")
+				tallySource = ATEM_TALLY_FALLBACK;
+			else
+				usage();
+		}
+		else if (arg == "--expect" && hasValue)
+			expectPath = argv[++i];
+		else if (arg == "--write" && hasValue)
+			writePath = argv[++i];
+		else if (arg == "--repeat" && hasValue)
+			repeat = atoi(argv[++i]);
+		else if (arg == "--verbose")
+			verbose = true;
+		else if (arg[0] != '-' && !path)
+			path = argv[i];
+		else
+			usage();
+	}
+	if (!path)
+		usage();
+
+	std::vector<Datagram> datagrams;
+	if (!readPcap(path, from, datagrams))
+		return 2;
+	if (datagrams.empty())
+	{
+		fprintf(stderr, "no ATEM datagrams (UDP from port %d) in %s\n", ATEM_PORT, path);
+		return 2;
+	}
+
+	hostSerialEnabled = verbose;
+	hostSetMicros(datagrams[0].us);
+	static ReplayClient atem; // about 8 kB of buffers, keep it off the stack
+	atem.begin(IPAddress(datagrams[0].source));
+	atem.serialOutput(verbose ? 1 : 0);
+	atem.setCameraSourceMap(cameraSource, 64);
+	atem.setTallySource(tallySource);
+	atem.setAtemTallyCallback(onTally);
+
+	// deterministic pass: clock at the capture time of each datagram
+	size_t parsed = 0, commands = 0, bytes = 0;
+	for (size_t i = 0; i < datagrams.size(); i++)
+	{
+		currentUs = datagrams[i].us;
+		hostSetMicros(currentUs);
+		if (atem.feed(datagrams[i]))
+		{
+			parsed++;
+			commands += countCommands(datagrams[i].data);
+			bytes += datagrams[i].data.size();
+		}
+	}
+	hostSerialEnabled = true;
+
+	printf("%zu datagrams from port %d, %zu with commands (%zu commands)\n", datagrams.size(), ATEM_PORT, parsed, commands);
+	printf("tally sequence (%zu steps):\n", steps.size());
+	for (size_t i = 0; i < steps.size(); i++)
+	{
+		printf("  %10.3f ms  %s\n", (steps[i].us - datagrams[0].us) / 1000.0, stepLine(steps[i]).c_str());
+	}
+
+	int result = 0;
+	if (writePath)
+	{
+		FILE *f = fopen(writePath, "w");
+		if (!f)
+		{
+			fprintf(stderr, "cannot write %s\n", writePath);
+			return 2;
+		}
+		fprintf(f, "# tally sequence of %s\n", path);
+		for (size_t i = 0; i < steps.size(); i++)
+			fprintf(f, "%s\n", stepLine(steps[i]).c_str());
+		fclose(f);
+	}
+	if (expectPath)
+	{
+		std::vector<std::string> expected;
+		if (!readExpected(expectPath, expected))
+		{
+			fprintf(stderr, "cannot read %s\n", expectPath);
+			return 2;
+		}
+		size_t i = 0;
+		while (i < expected.size() && i < steps.size() && expected[i] == stepLine(steps[i]))
+			i++;
+		if (i == expected.size() && i == steps.size())
+		{
+			printf("tally sequence matches %s\n", expectPath);
+		}
+		else
+		{
+			printf("tally sequence differs from %s at step %zu:\n  expected %s\n  got      %s\n", expectPath, i + 1,
+				   i < expected.size() ? expected[i].c_str() : "(end)", i < steps.size() ? stepLine(steps[i]).c_str() : "(end)");
+			result = 1;
+		}
+	}
+
+	// throughput: the whole capture through the parser, repeat times
+	if (repeat > 0 && parsed > 0)
+	{
+		recordSteps = false;
+		hostSerialEnabled = false;
+		atem.serialOutput(0);
+		auto start = std::chrono::steady_clock::now();
+		for (int r = 0; r < repeat; r++)
+			for (size_t i = 0; i < datagrams.size(); i++)
+				atem.feed(datagrams[i]);
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		hostSerialEnabled = true;
+		double total = (double)repeat;
+		printf("parser: %.0f packets/s, %.0f commands/s, %.1f MB/s (%d passes, %.3f s)\n", total * parsed / seconds,
+			   total * commands / seconds, total * bytes / seconds / 1e6, repeat, seconds);
+	}
+	return result;
+}
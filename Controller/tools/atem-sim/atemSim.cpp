@@ -0,0 +1,1648 @@
+// Simulated ATEM switcher and integration suite for the ATEM client.
+//
+// The simulator answers the hello handshake, sends an initial state dump shaped
+// like a 1 M/E switcher, serves RequestNextAfter, resends unacknowledged
+// datagrams, acknowledges and applies client commands (CPgI, CPvI, DCut, DAut,
+// SALN) and plays cut and transition scripts. Outgoing datagrams can be dropped or
+// reordered, incoming client datagrams dropped, all from a seeded generator.
+//
+//   g++ -O2 -std=c++11 -pthread -I../shim -I../../lib/ATEMbase -I../../lib/ATEMstd -I../../lib/ATEMtally
+//       -I../../lib/SkaarhojPgmspace -o atemSim atemSim.cpp ../shim/Arduino.cpp
+//       ../../lib/ATEMbase/ATEMbase.cpp ../../lib/ATEMbase/ATEMsourceTally.cpp ../../lib/ATEMbase/ATEMderivedTally.cpp
+//       ../../lib/ATEMbase/ATEMmicLive.cpp ../../lib/ATEMbase/ATEMframeClock.cpp ../../lib/ATEMbase/ATEMcommandStats.cpp
+//       ../../lib/ATEMstd/ATEMstd.cpp ../../lib/ATEMtally/ATEMtally.cpp
+//
+// The compiler call above is one command line; add -DATEM_TALLY_ONLY to test
+// ATEMtally like the default firmware (the client command scenario is skipped).
+//
+//   ./atemSim [--suite [name,...]] [options]
+//       runs the ATEM client natively against the simulator on --bind and
+//       reports connect time, time to first tally, resends and tally latency;
+//       exit 1 if a scenario fails. Scenarios: connect, cuts, transition, names,
+//       derived, mic-live, frame-sync, lossy-connect, lossy-cuts, commands,
+//       contact-lost, switcher-reboot, late-network, rejected.
+//   ./atemSim --serve [--script file] [options]
+//       runs only the simulator, for a controller on the network. Script lines:
+//       "wait <ms>", "cut <source>", "preview <source>", "auto <source> [frames]",
+//       "name <source> <long name>", "key <0|1>", "nextkey <0|1>", "dsk <0|1>",
+//       "tie <0|1>" (keyer 1 fill 3, DSK 1 fill 4), "tlin <0|1>",
+//       "level <input> <dBFS>", "mix <input> <0 off|1 on|2 follow video>",
+//       "loss <0-1>", "reorder <0-1>", "silent <ms>", "repeat"; without a script
+//       it cuts through the inputs every 2 s.
+//
+//   --bind a.b.c.d   simulator address (default 127.0.0.1, port 9910 like a switcher)
+//   --inputs n       camera inputs 1-40 (default 8)
+//   --loss p         drop probability of outgoing datagrams
+//   --reorder p      probability of holding an outgoing datagram back behind the next one
+//   --client-loss p  drop probability of incoming datagrams with commands
+//   --seed n         random seed (default 1)
+//   --verbose        simulator log and library serial output
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef ATEM_TALLY_ONLY
+#include "ATEMtally.h"
+typedef ATEMtally ATEMclient;
+#else
+#include "ATEMstd.h"
+typedef ATEMstd ATEMclient;
+#endif
+
+#define SIM_PORT 9910
+#define SIM_MAX_INPUTS 40
+#define SIM_PACKET_LENGTH 1400	 // dump datagrams are filled up to this
+#define SIM_RESEND_MS 200		 // unacknowledged datagrams are sent again after this
+#define SIM_PING_MS 500			 // keepalive while nothing else is sent
+#define SIM_SESSION_TIMEOUT 3000 // a client that stays quiet this long is dropped
+#define SIM_FRAME_MS 40			 // 25p
+#define SIM_LEVELS_MS 40		 // AMLv interval while a client asked for levels
+
+#define HDR_ACK_REQUEST 0x01
+#define HDR_HELLO 0x02
+#define HDR_RESEND 0x04
+#define HDR_REQUEST_NEXT_AFTER 0x08
+#define HDR_ACK 0x10
+
+static bool verbose = false;
+
+static void simLog(const char *format, ...) __attribute__((format(printf, 1, 2)));
+static void simLog(const char *format, ...)
+{
+	if (!verbose)
+		return;
+	va_list args;
+	va_start(args, format);
+	printf("  [sim %8.3f] ", micros() / 1000.0);
+	vprintf(format, args);
+	printf("\n");
+	va_end(args);
+}
+
+struct SimOptions
+{
+	uint32_t bind = htonl(INADDR_LOOPBACK);
+	uint8_t inputs = 8;
+	double loss = 0;
+	double reorder = 0;
+	double clientLoss = 0;
+	unsigned seed = 1;
+};
+
+struct SimStats
+{
+	unsigned sessions = 0;
+	unsigned rejected = 0;
+	unsigned sent = 0;
+	unsigned dropped = 0;
+	unsigned reordered = 0;
+	unsigned resends = 0;	 // own timeouts
+	unsigned requested = 0;	 // RequestNextAfter served
+	unsigned commands = 0;	 // client commands applied
+	unsigned duplicates = 0; // client datagrams received again after they were applied
+	unsigned clientDropped = 0;
+};
+
+class AtemSimulator
+{
+public:
+	AtemSimulator(const SimOptions &options) : _options(options), _random(options.seed) {}
+	~AtemSimulator() { stop(); }
+
+	bool start()
+	{
+		_socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+		if (_socket < 0)
+			return false;
+		int on = 1;
+		setsockopt(_socket, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+		struct timeval timeout = {0, 2000};
+		setsockopt(_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		struct sockaddr_in local;
+		memset(&local, 0, sizeof(local));
+		local.sin_family = AF_INET;
+		local.sin_addr.s_addr = _options.bind;
+		local.sin_port = htons(SIM_PORT);
+		if (bind(_socket, (struct sockaddr *)&local, sizeof(local)) < 0)
+		{
+			perror("simulator bind");
+			close(_socket);
+			_socket = -1;
+			return false;
+		}
+		_running = true;
+		_thread = std::thread(&AtemSimulator::_run, this);
+		return true;
+	}
+
+	void stop()
+	{
+		if (!_running)
+			return;
+		_running = false;
+		_thread.join();
+		close(_socket);
+		_socket = -1;
+	}
+
+	// Script actions, safe from any thread
+	// (cut and preview wait for the next frame boundary of the simulated video, like a switcher)
+	void cut(uint16_t source)
+	{
+		unsigned long frame = _waitForFrame();
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (source == _program)
+			return;
+		_preview = _program;
+		_program = source;
+		_transitionFrame = 0;
+		_tallyFrame = frame;
+		_sendState(true);
+	}
+	void preview(uint16_t source)
+	{
+		unsigned long frame = _waitForFrame();
+		std::lock_guard<std::mutex> lock(_mutex);
+		_preview = source;
+		_tallyFrame = frame;
+		_sendState(false);
+	}
+	void autoTransition(uint16_t source, uint8_t frames)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (source != _program)
+			_preview = source;
+		_transitionFrames = frames ? frames : 1;
+		_transitionFrame = 1;
+		_transitionNext = _nextFrame();
+	}
+	void setLoss(double loss, double reorder)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_options.loss = loss;
+		_options.reorder = reorder;
+	}
+	void setClientLoss(double loss)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_options.clientLoss = loss;
+	}
+	void setSilent(bool silent)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_silent = silent;
+	}
+	void rename(uint16_t source, const std::string &name)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_names[source] = name;
+		if (_session != SESSION_READY)
+			return;
+		std::vector<uint8_t> commands;
+		_inputProperties(commands, source);
+		_sendReliable(commands);
+	}
+	// upstream keyer 1 (fill _keyFill) on or off air, or selected for the next transition
+	void key(bool onAir)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_keyOnAir = onAir;
+		_sendKeyers();
+	}
+	void nextKey(bool selected)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_keyNext = selected;
+		_sendKeyers();
+	}
+	// downstream keyer 1 (fill _dskFill) on or off air, or tied to the next transition
+	void dsk(bool onAir)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_dskOnAir = onAir;
+		_sendKeyers();
+	}
+	void dskTie(bool tie)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_dskTie = tie;
+		_sendKeyers();
+	}
+	// audio mixer: input level in dBFS (below -60 is silence) and mix option (0 off, 1 on, 2 audio follow video)
+	void setLevel(uint16_t source, int dB)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_levels[source] = dB;
+	}
+	void setMixOption(uint16_t source, uint8_t option)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_mixOptions[source] = option;
+		if (_session != SESSION_READY)
+			return;
+		std::vector<uint8_t> commands;
+		_audioInput(commands, source);
+		_sendReliable(commands);
+	}
+	// without TlIn and TlSr, like firmware that sends them late or rarely
+	void setTallyIn(bool send)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_tallyIn = send;
+	}
+	void setFullyBooked(bool booked)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_fullyBooked = booked;
+	}
+
+	uint16_t program()
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		return _program;
+	}
+	bool inTransition()
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		return _transitionFrame > 0;
+	}
+	bool ready()
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		return _session == SESSION_READY;
+	}
+	SimStats stats()
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		return _stats;
+	}
+	// micros() when the current tally was first sent, and its program/preview bits as TlIn reports them
+	void lastTally(unsigned long *sentAt, uint64_t *program, uint64_t *preview)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		*sentAt = _tallySentAt;
+		*program = _tallyProgram;
+		*preview = _tallyPreview;
+	}
+	// micros() of the frame boundary the current tally was switched on
+	unsigned long lastFrame()
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		return _tallyFrame;
+	}
+
+private:
+	enum SessionState
+	{
+		SESSION_NONE,
+		SESSION_HELLO, // hello answered, waiting for the client's acknowledge
+		SESSION_READY  // dump sent, state changes follow
+	};
+
+	struct Outgoing
+	{
+		std::vector<uint8_t> data;
+		unsigned long sentAt;
+		bool acknowledged;
+	};
+
+	void _run()
+	{
+		uint8_t buffer[2048];
+		while (_running)
+		{
+			struct sockaddr_in from;
+			socklen_t fromLength = sizeof(from);
+			int length = recvfrom(_socket, buffer, sizeof(buffer), 0, (struct sockaddr *)&from, &fromLength);
+			std::lock_guard<std::mutex> lock(_mutex);
+			if (length >= 12 && !_silent)
+				_receive(buffer, length, from);
+			if (!_silent)
+				_timers();
+		}
+	}
+
+	void _receive(const uint8_t *d, int length, const struct sockaddr_in &from)
+	{
+		uint8_t flags = d[0] >> 3;
+		uint16_t packetId = (d[10] << 8) | d[11];
+
+		if (flags & HDR_HELLO)
+		{
+			_client = from;
+			_lastHeard = millis();
+			_stats.sessions++;
+			_session = SESSION_HELLO;
+			_sessionId = (d[2] << 8) | d[3];
+			std::vector<uint8_t> answer(20, 0);
+			_header(answer, HDR_HELLO, 0, 0);
+			answer[12] = _fullyBooked ? 3 : 2;
+			if (_fullyBooked)
+			{
+				_stats.rejected++;
+				_session = SESSION_NONE;
+			}
+			simLog("hello from port %u%s", ntohs(from.sin_port), _fullyBooked ? ", fully booked" : "");
+			_transmit(answer);
+			return;
+		}
+		if (_session == SESSION_NONE || from.sin_addr.s_addr != _client.sin_addr.s_addr || from.sin_port != _client.sin_port)
+			return;
+		_lastHeard = millis();
+
+		if ((flags & HDR_ACK_REQUEST) && length > 12 && _random01() < _options.clientLoss)
+		{
+			_stats.clientDropped++;
+			return; // the client has to resend
+		}
+		if (_session == SESSION_HELLO && (flags & HDR_ACK))
+		{
+			_sendDump();
+			return;
+		}
+		if (flags & HDR_ACK)
+			_acknowledged((d[4] << 8) | d[5]);
+		if (flags & HDR_REQUEST_NEXT_AFTER)
+		{
+			uint16_t id = (((d[6] << 8) | d[7]) + 1) & 0x7FFF;
+			std::map<uint16_t, Outgoing>::iterator it = _history.find(id);
+			if (it != _history.end())
+			{
+				it->second.data[0] |= HDR_RESEND << 3;
+				it->second.sentAt = millis();
+				_stats.requested++;
+				simLog("client asks for %u", id);
+				_transmit(it->second.data);
+			}
+		}
+		if (flags & HDR_ACK_REQUEST)
+		{
+			std::vector<uint8_t> ack(12, 0);
+			_header(ack, HDR_ACK, packetId, 0);
+			_transmit(ack);
+			if (!_applied.insert(packetId).second)
+			{
+				_stats.duplicates++;
+				return;
+			}
+			_applyCommands(d, length);
+		}
+	}
+
+	void _applyCommands(const uint8_t *d, int length)
+	{
+		int index = 12;
+		while (index + 8 <= length)
+		{
+			uint16_t commandLength = (d[index] << 8) | d[index + 1];
+			if (commandLength < 8 || index + commandLength > length)
+				break;
+			const uint8_t *payload = d + index + 8;
+			std::string name((const char *)d + index + 4, 4);
+			_stats.commands++;
+			simLog("command %s", name.c_str());
+			if (name == "CPgI" && payload[0] == 0)
+			{
+				_program = (payload[2] << 8) | payload[3];
+				_sendState(true);
+			}
+			else if (name == "CPvI" && payload[0] == 0)
+			{
+				_preview = (payload[2] << 8) | payload[3];
+				_sendState(false);
+			}
+			else if (name == "DCut" && payload[0] == 0)
+			{
+				std::swap(_program, _preview);
+				_transitionFrame = 0;
+				_sendState(true);
+			}
+			else if (name == "SALN")
+			{
+				_levelsEnabled = payload[0] & 1;
+				_levelsNext = millis();
+			}
+			else if (name == "DAut" && payload[0] == 0 && _transitionFrame == 0)
+			{
+				_transitionFrames = 25;
+				_transitionFrame = 1;
+				_transitionNext = _nextFrame();
+			}
+			index += commandLength;
+		}
+	}
+
+	// cumulative, like the client does it: everything up to id modulo 15 bit
+	void _acknowledged(uint16_t id)
+	{
+		for (std::map<uint16_t, Outgoing>::iterator it = _history.begin(); it != _history.end(); ++it)
+		{
+			if (((id - it->first) & 0x7FFF) < 0x4000)
+				it->second.acknowledged = true;
+		}
+	}
+
+	void _timers()
+	{
+		unsigned long now = millis();
+		if (_session == SESSION_NONE)
+			return;
+		if (now - _lastHeard > SIM_SESSION_TIMEOUT)
+		{
+			simLog("client quiet for %d ms, session dropped", SIM_SESSION_TIMEOUT);
+			_session = SESSION_NONE;
+			return;
+		}
+		if (_session != SESSION_READY)
+			return;
+
+		if (_levelsEnabled && (long)(now - _levelsNext) >= 0)
+		{
+			_levelsNext += SIM_LEVELS_MS;
+			_sendLevels();
+		}
+
+		if (_transitionFrame > 0 && (long)(micros() - _transitionNext) >= 0)
+		{
+			_tallyFrame = _transitionNext;
+			_transitionNext += SIM_FRAME_MS * 1000UL;
+			if (_transitionFrame > _transitionFrames)
+			{
+				std::swap(_program, _preview);
+				_transitionFrame = 0;
+				_sendTransition(false, 0, 0);
+				if (_keyNext)
+				{
+					_keyOnAir = !_keyOnAir;
+					_sendKeyers();
+				}
+				_sendState(true);
+			}
+			else
+			{
+				if (_transitionFrame == 1)
+					_sendState(true); // both sources on air from the first frame
+				_sendTransition(true, _transitionFrames - _transitionFrame, (uint32_t)9999 * _transitionFrame / _transitionFrames);
+				_transitionFrame++;
+			}
+		}
+
+		for (std::map<uint16_t, Outgoing>::iterator it = _history.begin(); it != _history.end(); ++it)
+		{
+			if (!it->second.acknowledged && now - it->second.sentAt >= SIM_RESEND_MS)
+			{
+				it->second.data[0] |= HDR_RESEND << 3;
+				it->second.sentAt = now;
+				_stats.resends++;
+				_transmit(it->second.data);
+			}
+		}
+		while (_history.size() > 256)
+			_history.erase(_oldest());
+
+		if (now - _lastSent >= SIM_PING_MS)
+			_sendReliable(std::vector<uint8_t>());
+		if (!_held.empty() && now - _heldAt >= 20)
+			_flushHeld();
+	}
+
+	// micros() of the first frame boundary from now on
+	unsigned long _nextFrame()
+	{
+		unsigned long period = SIM_FRAME_MS * 1000UL;
+		unsigned long now = micros();
+		return now + (period - (now - _frameZero) % period) % period;
+	}
+
+	unsigned long _waitForFrame()
+	{
+		unsigned long frame = _nextFrame();
+		long wait = (long)(frame - micros());
+		if (wait > 0)
+			std::this_thread::sleep_for(std::chrono::microseconds(wait));
+		return frame;
+	}
+
+	std::map<uint16_t, Outgoing>::iterator _oldest()
+	{
+		std::map<uint16_t, Outgoing>::iterator oldest = _history.begin();
+		for (std::map<uint16_t, Outgoing>::iterator it = _history.begin(); it != _history.end(); ++it)
+		{
+			if (((it->first - _nextId) & 0x7FFF) < ((oldest->first - _nextId) & 0x7FFF))
+				oldest = it;
+		}
+		return oldest;
+	}
+
+	void _header(std::vector<uint8_t> &d, uint8_t flags, uint16_t ackId, uint16_t packetId)
+	{
+		d[0] = (flags << 3) | ((d.size() >> 8) & 0x07);
+		d[1] = d.size() & 0xFF;
+		d[2] = _sessionId >> 8;
+		d[3] = _sessionId & 0xFF;
+		d[4] = ackId >> 8;
+		d[5] = ackId & 0xFF;
+		d[10] = packetId >> 8;
+		d[11] = packetId & 0xFF;
+	}
+
+	static void _command(std::vector<uint8_t> &commands, const char *name, const std::vector<uint8_t> &payload)
+	{
+		uint16_t length = 8 + payload.size();
+		commands.push_back(length >> 8);
+		commands.push_back(length & 0xFF);
+		commands.push_back(0);
+		commands.push_back(0);
+		commands.insert(commands.end(), name, name + 4);
+		commands.insert(commands.end(), payload.begin(), payload.end());
+	}
+
+	// Sends commands in one datagram that the client must acknowledge
+	void _sendReliable(const std::vector<uint8_t> &commands)
+	{
+		Outgoing out;
+		out.data.assign(12, 0);
+		out.data.insert(out.data.end(), commands.begin(), commands.end());
+		_header(out.data, HDR_ACK_REQUEST, 0, _nextId);
+		out.sentAt = millis();
+		out.acknowledged = false;
+		_history[_nextId] = out;
+		_nextId = (_nextId + 1) & 0x7FFF;
+		_transmit(out.data);
+	}
+
+	void _transmit(const std::vector<uint8_t> &d)
+	{
+		_lastSent = millis();
+		if (_random01() < _options.loss)
+		{
+			_stats.dropped++;
+			return;
+		}
+		if (_held.empty() && _random01() < _options.reorder)
+		{
+			_held = d;
+			_heldAt = millis();
+			_stats.reordered++;
+			return;
+		}
+		_sendTo(d);
+		_flushHeld();
+	}
+
+	void _flushHeld()
+	{
+		if (_held.empty())
+			return;
+		_sendTo(_held);
+		_held.clear();
+	}
+
+	void _sendTo(const std::vector<uint8_t> &d)
+	{
+		sendto(_socket, d.data(), d.size(), 0, (const struct sockaddr *)&_client, sizeof(_client));
+		_stats.sent++;
+	}
+
+	double _random01()
+	{
+		return std::uniform_real_distribution<double>(0, 1)(_random);
+	}
+
+	// Sources of a 1 M/E switcher: black, inputs, bars, colors, media players, program/preview outputs
+	std::vector<uint16_t> _sources()
+	{
+		std::vector<uint16_t> sources;
+		sources.push_back(0);
+		for (uint16_t i = 1; i <= _options.inputs; i++)
+			sources.push_back(i);
+		static const uint16_t internal[] = {1000, 2001, 2002, 3010, 3011, 3020, 3021, 10010, 10011};
+		sources.insert(sources.end(), internal, internal + sizeof(internal) / sizeof(internal[0]));
+		return sources;
+	}
+
+	// TlIn/TlSr flags of a source: bit 0 on air, bit 1 on preview
+	uint8_t _flags(uint16_t source)
+	{
+		bool mixing = _transitionFrame > 0;
+		bool program = source == _program || (mixing && source == _preview) || ((_keyOnAir || (mixing && _keyNext)) && source == _keyFill) ||
+					   (_dskOnAir && source == _dskFill);
+		bool preview = source == _preview || (_keyNext && !_keyOnAir && source == _keyFill) || (_dskTie && !_dskOnAir && source == _dskFill);
+		return (program ? 1 : 0) | (preview ? 2 : 0);
+	}
+
+	void _tallyCommands(std::vector<uint8_t> &commands)
+	{
+		std::vector<uint8_t> tlin(2 + _options.inputs, 0);
+		tlin[0] = 0;
+		tlin[1] = _options.inputs;
+		_tallyProgram = 0;
+		_tallyPreview = 0;
+		_tallySentAt = micros();
+		for (uint16_t i = 1; i <= _options.inputs; i++)
+		{
+			uint8_t flags = _flags(i);
+			tlin[1 + i] = flags;
+			if (flags & 1)
+				_tallyProgram |= (uint64_t)1 << (i - 1);
+			if (flags & 2)
+				_tallyPreview |= (uint64_t)1 << (i - 1);
+		}
+		if (!_tallyIn)
+			return;
+		tlin.resize((tlin.size() + 3) & ~3, 0);
+		_command(commands, "TlIn", tlin);
+
+		std::vector<uint16_t> sources = _sources();
+		std::vector<uint8_t> tlsr(2 + 3 * sources.size(), 0);
+		tlsr[0] = sources.size() >> 8;
+		tlsr[1] = sources.size() & 0xFF;
+		for (size_t i = 0; i < sources.size(); i++)
+		{
+			uint16_t source = sources[i];
+			tlsr[2 + 3 * i] = source >> 8;
+			tlsr[3 + 3 * i] = source & 0xFF;
+			tlsr[4 + 3 * i] = _flags(source);
+		}
+		tlsr.resize((tlsr.size() + 3) & ~3, 0);
+		_command(commands, "TlSr", tlsr);
+	}
+
+	void _keyerCommands(std::vector<uint8_t> &commands)
+	{
+		_command(commands, "TrSS", {0, 0, (uint8_t)(1 | (_keyNext ? 2 : 0)), 0, (uint8_t)(1 | (_keyNext ? 2 : 0)), 0, 0, 0, 0, 0, 0, 0});
+		_command(commands, "KeOn", {0, 0, (uint8_t)_keyOnAir, 0});
+		_command(commands, "DskP", {0, (uint8_t)_dskTie, 25, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0});
+		_command(commands, "DskS", {0, (uint8_t)_dskOnAir, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0});
+	}
+
+	void _sendKeyers()
+	{
+		if (_session != SESSION_READY)
+			return;
+		std::vector<uint8_t> commands;
+		_keyerCommands(commands);
+		_tallyCommands(commands);
+		_sendReliable(commands);
+	}
+
+	void _busCommands(std::vector<uint8_t> &commands)
+	{
+		_command(commands, "PrgI", {0, 0, (uint8_t)(_program >> 8), (uint8_t)_program});
+		_command(commands, "PrvI", {0, 0, (uint8_t)(_preview >> 8), (uint8_t)_preview, 0, 0, 0, 0});
+	}
+
+	void _sendState(bool programChanged)
+	{
+		if (_session != SESSION_READY)
+			return;
+		std::vector<uint8_t> commands;
+		if (programChanged)
+			_command(commands, "PrgI", {0, 0, (uint8_t)(_program >> 8), (uint8_t)_program});
+		_command(commands, "PrvI", {0, 0, (uint8_t)(_preview >> 8), (uint8_t)_preview, 0, 0, 0, 0});
+		_tallyCommands(commands);
+		_sendReliable(commands);
+	}
+
+	void _sendTransition(bool inTransition, uint8_t framesRemaining, uint16_t position)
+	{
+		std::vector<uint8_t> commands;
+		_command(commands, "TrPs", {0, (uint8_t)inTransition, framesRemaining, 0, (uint8_t)(position >> 8), (uint8_t)position, 0, 0});
+		_sendReliable(commands);
+	}
+
+	// AMIP of one audio input
+	void _audioInput(std::vector<uint8_t> &commands, uint16_t source)
+	{
+		std::map<uint16_t, uint8_t>::iterator option = _mixOptions.find(source);
+		std::vector<uint8_t> payload(16, 0);
+		payload[0] = source >> 8;
+		payload[1] = source & 0xFF;
+		payload[2] = 1;														// external video
+		payload[8] = option != _mixOptions.end() ? option->second : 2;		// mix option, audio follow video by default
+		payload[10] = 0x80;													// volume 0 dB
+		_command(commands, "AMIP", payload);
+	}
+
+	// AMLv with every input: master and monitor silent, per input left = right = its level
+	void _sendLevels()
+	{
+		uint16_t count = _options.inputs;
+		size_t levels = 36 + ((2 * count + 3) & ~3);
+		std::vector<uint8_t> payload(levels + 16 * count, 0);
+		payload[0] = count >> 8;
+		payload[1] = count & 0xFF;
+		for (uint16_t i = 0; i < count; i++)
+		{
+			uint16_t source = i + 1;
+			payload[36 + 2 * i] = source >> 8;
+			payload[37 + 2 * i] = source & 0xFF;
+			std::map<uint16_t, int>::iterator dB = _levels.find(source);
+			uint32_t raw = dB == _levels.end() || dB->second < -60 ? 0 : (uint32_t)(0x800000 * pow(10.0, dB->second / 20.0));
+			for (int channel = 0; channel < 4; channel++)
+			{
+				uint8_t *field = &payload[levels + 16 * i + 4 * channel];
+				field[1] = raw >> 16;
+				field[2] = raw >> 8;
+				field[3] = raw;
+			}
+		}
+		std::vector<uint8_t> commands;
+		_command(commands, "AMLv", payload);
+		_sendReliable(commands);
+	}
+
+	// InPr of one source, with the name set by rename() or a default one
+	void _inputProperties(std::vector<uint8_t> &commands, uint16_t source)
+	{
+		char longName[24], shortName[16];
+		if (source >= 1 && source <= _options.inputs)
+		{
+			snprintf(longName, sizeof(longName), "Camera %u", source);
+			snprintf(shortName, sizeof(shortName), "CAM%u", source);
+		}
+		else
+		{
+			snprintf(longName, sizeof(longName), "Source %u", source);
+			snprintf(shortName, sizeof(shortName), "S%u", source % 1000);
+		}
+		std::map<uint16_t, std::string>::iterator renamed = _names.find(source);
+		std::vector<uint8_t> payload;
+		payload.push_back(source >> 8);
+		payload.push_back(source & 0xFF);
+		std::vector<uint8_t> l = _name(renamed != _names.end() ? renamed->second.c_str() : longName, 20), s = _name(shortName, 4);
+		payload.insert(payload.end(), l.begin(), l.end());
+		payload.insert(payload.end(), s.begin(), s.end());
+		payload.resize(36, 0);
+		payload[26] = 1;	// available external port types
+		payload[32] = 0x1F; // available on all buses
+		_command(commands, "InPr", payload);
+	}
+
+	static std::vector<uint8_t> _name(const char *name, size_t length)
+	{
+		std::vector<uint8_t> bytes(length, 0);
+		memcpy(bytes.data(), name, std::min(strlen(name), length));
+		return bytes;
+	}
+
+	// The initial dump: about what a 1 M/E switcher sends, packed into full datagrams, ended by an empty one
+	void _sendDump()
+	{
+		_session = SESSION_READY;
+		_sessionId = 0x8000 | (_stats.sessions & 0x7FFF);
+		_nextId = 1;
+		_history.clear();
+		_applied.clear();
+		_transitionFrame = 0;
+		_levelsEnabled = false;
+
+		std::vector<std::vector<uint8_t>> commands;
+		std::vector<uint8_t> c;
+		_command(c, "_ver", {0, 2, 0, 30});
+		commands.push_back(c);
+		c.clear();
+		std::vector<uint8_t> product = _name("ATEM Simulated Switcher", 44);
+		_command(c, "_pin", product);
+		commands.push_back(c);
+		c.clear();
+		_command(c, "_top", {1, (uint8_t)(_options.inputs + 12), 1, 1, 1, 1, 0, 1, 1, 0, 0, 1, 1, 0, 0, 0, 0, 0, 0, 0});
+		commands.push_back(c);
+		c.clear();
+		_command(c, "_MeC", {0, 1, 0, 0});
+		commands.push_back(c);
+		c.clear();
+		_command(c, "_mpl", {20, 0, 0, 0});
+		commands.push_back(c);
+		c.clear();
+		_command(c, "VidM", {10, 0, 0, 0}); // 1080p25, see SIM_FRAME_MS
+		commands.push_back(c);
+
+		std::vector<uint16_t> sources = _sources();
+		for (size_t i = 0; i < sources.size(); i++)
+		{
+			c.clear();
+			_inputProperties(c, sources[i]);
+			commands.push_back(c);
+		}
+		for (uint16_t i = 1; i <= _options.inputs; i++)
+		{
+			c.clear();
+			_audioInput(c, i);
+			commands.push_back(c);
+		}
+		c.clear();
+		_busCommands(c);
+		_command(c, "TrPr", {0, 0, 0, 0});
+		_command(c, "TrPs", {0, 0, 25, 0, 0, 0, 0, 0});
+		_command(c, "KeBP", {0, 0, 0, 0, 0, 0, (uint8_t)(_keyFill >> 8), (uint8_t)_keyFill, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0});
+		_command(c, "DskB", {0, 0, (uint8_t)(_dskFill >> 8), (uint8_t)_dskFill, 0, 0, 0, 0});
+		_keyerCommands(c);
+		_tallyCommands(c);
+		_command(c, "FtbS", {0, 0, 0, 0});
+		_command(c, "Time", {10, 0, 0, 0, 0, 0, 0, 0});
+		commands.push_back(c);
+		c.clear();
+		_command(c, "InCm", {1, 0, 0, 0});
+		commands.push_back(c);
+
+		std::vector<uint8_t> datagram;
+		unsigned datagrams = 0;
+		for (size_t i = 0; i < commands.size(); i++)
+		{
+			if (12 + datagram.size() + commands[i].size() > SIM_PACKET_LENGTH)
+			{
+				_sendReliable(datagram);
+				datagrams++;
+				datagram.clear();
+			}
+			datagram.insert(datagram.end(), commands[i].begin(), commands[i].end());
+		}
+		_sendReliable(datagram);
+		_sendReliable(std::vector<uint8_t>()); // end of dump
+		simLog("dump sent in %u datagrams, session 0x%04X", datagrams + 2, _sessionId);
+	}
+
+	SimOptions _options;
+	std::mt19937 _random;
+	std::thread _thread;
+	std::atomic<bool> _running{false};
+	std::mutex _mutex;
+	int _socket = -1;
+
+	SessionState _session = SESSION_NONE;
+	struct sockaddr_in _client;
+	uint16_t _sessionId = 0;
+	uint16_t _nextId = 1;
+	std::map<uint16_t, Outgoing> _history;
+	std::set<uint16_t> _applied; // client packet ids already applied
+	std::map<uint16_t, std::string> _names; // long names set by rename()
+	unsigned long _lastHeard = 0;
+	unsigned long _lastSent = 0;
+	std::vector<uint8_t> _held;
+	unsigned long _heldAt = 0;
+	bool _silent = false;
+	bool _fullyBooked = false;
+	SimStats _stats;
+
+	uint16_t _program = 1;
+	uint16_t _preview = 2;
+	uint16_t _keyFill = 3; // upstream keyer 1 of M/E 1
+	bool _keyOnAir = false;
+	bool _keyNext = false; // selected for the next transition, toggled on air at its end
+	uint16_t _dskFill = 4; // downstream keyer 1
+	bool _dskOnAir = false;
+	bool _dskTie = false;
+	bool _tallyIn = true; // TlIn and TlSr sent
+	std::map<uint16_t, int> _levels;		// dBFS per audio input, silent if not set
+	std::map<uint16_t, uint8_t> _mixOptions; // audio follow video if not set
+	bool _levelsEnabled = false;			// client sent SALN
+	unsigned long _levelsNext = 0;
+	uint8_t _transitionFrames = 0;
+	uint8_t _transitionFrame = 0; // 0: no transition running
+	unsigned long _transitionNext = 0; // micros() of the next transition frame
+	unsigned long _frameZero = micros(); // a frame boundary of the simulated video
+	unsigned long _tallyFrame = 0;
+	unsigned long _tallySentAt = 0;
+	uint64_t _tallyProgram = 0;
+	uint64_t _tallyPreview = 0;
+};
+
+/**************
+ *
+ * Suite
+ *
+ **************/
+
+struct NameLog
+{
+	std::mutex mutex;
+	std::map<uint16_t, std::string> names;
+	unsigned callbacks = 0;
+};
+static NameLog nameLog;
+
+static void onInputName(uint16_t videoSource, const char *longName, const char *)
+{
+	std::lock_guard<std::mutex> lock(nameLog.mutex);
+	nameLog.names[videoSource] = longName;
+	nameLog.callbacks++;
+}
+
+struct TallyLog
+{
+	std::mutex mutex;
+	uint64_t program = 0;
+	uint64_t preview = 0;
+	unsigned long at = 0;
+	unsigned callbacks = 0;
+	unsigned badDiffs = 0; // diff not matching the previous callback, or nothing changed
+	unsigned transitionCallbacks = 0;
+	uint16_t lastPosition = 0;
+};
+static TallyLog tallyLog;
+
+static void onTally(uint64_t *program, uint64_t *preview, const ATEMtallyDiff *diff)
+{
+	std::lock_guard<std::mutex> lock(tallyLog.mutex);
+	if (diff->programOn != (*program & ~tallyLog.program) || diff->programOff != (tallyLog.program & ~*program) ||
+		diff->previewOn != (*preview & ~tallyLog.preview) || diff->previewOff != (tallyLog.preview & ~*preview) ||
+		(tallyLog.callbacks > 0 && *program == tallyLog.program && *preview == tallyLog.preview))
+		tallyLog.badDiffs++;
+	tallyLog.program = *program;
+	tallyLog.preview = *preview;
+	tallyLog.at = micros();
+	tallyLog.callbacks++;
+}
+
+struct MicLog
+{
+	std::mutex mutex;
+	uint64_t live = 0;
+	unsigned callbacks = 0;
+};
+static MicLog micLog;
+
+static void onMicLive(uint64_t live)
+{
+	std::lock_guard<std::mutex> lock(micLog.mutex);
+	micLog.live = live;
+	micLog.callbacks++;
+}
+
+static void onTransition(uint8_t, bool, uint16_t position)
+{
+	std::lock_guard<std::mutex> lock(tallyLog.mutex);
+	tallyLog.transitionCallbacks++;
+	tallyLog.lastPosition = position;
+}
+
+class Scenario
+{
+public:
+	Scenario(const SimOptions &options) : sim(options), atem(new ATEMclient()), _bind(options.bind)
+	{
+		std::lock_guard<std::mutex> lock(tallyLog.mutex);
+		tallyLog.program = tallyLog.preview = 0;
+		tallyLog.callbacks = tallyLog.badDiffs = tallyLog.transitionCallbacks = 0;
+		std::lock_guard<std::mutex> names(nameLog.mutex);
+		nameLog.names.clear();
+		nameLog.callbacks = 0;
+	}
+
+	bool start(ATEMtallySource tallySource = ATEM_TALLY_TLIN)
+	{
+		if (!sim.start())
+			return false;
+		atem->begin(IPAddress(_bind));
+		atem->setTallySource(tallySource);
+		atem->serialOutput(verbose ? 1 : 0);
+		atem->setAtemTallyCallback(onTally);
+		atem->setAtemTransitionCallback(onTransition);
+		atem->setInputNameCallback(onInputName);
+		return true;
+	}
+
+	// Runs the client like the firmware's ATEM task until done() or timeoutMs
+	template <class F>
+	bool runUntil(unsigned long timeoutMs, F done)
+	{
+		unsigned long start = millis();
+		while (millis() - start < timeoutMs)
+		{
+			atem->runLoopWait(5);
+			if (done())
+				return true;
+		}
+		return false;
+	}
+
+	void run(unsigned long ms)
+	{
+		runUntil(ms, [] { return false; });
+	}
+
+	// Waits until the client shows the simulator's current tally, also if it did not change
+	bool showsTally(unsigned long timeoutMs)
+	{
+		unsigned long sentAt;
+		uint64_t program, preview;
+		sim.lastTally(&sentAt, &program, &preview);
+		return runUntil(timeoutMs, [&] {
+			std::lock_guard<std::mutex> lock(tallyLog.mutex);
+			return tallyLog.program == program && tallyLog.preview == preview;
+		});
+	}
+
+	// Waits until the client shows the simulator's current tally, returns the latency in us or -1
+	long waitForTally(unsigned long timeoutMs)
+	{
+		unsigned long sentAt;
+		uint64_t program, preview;
+		sim.lastTally(&sentAt, &program, &preview);
+		long latency = -1;
+		runUntil(timeoutMs, [&] {
+			std::lock_guard<std::mutex> lock(tallyLog.mutex);
+			if (tallyLog.program != program || tallyLog.preview != preview)
+				return false;
+			latency = (long)(tallyLog.at - sentAt);
+			return true;
+		});
+		return latency;
+	}
+
+	AtemSimulator sim;
+	std::unique_ptr<ATEMclient> atem;
+
+private:
+	uint32_t _bind;
+};
+
+struct Latency
+{
+	std::vector<long> samples;
+	void add(long us) { samples.push_back(us); }
+	void print(const char *what)
+	{
+		if (samples.empty())
+			return;
+		std::vector<long> sorted = samples;
+		std::sort(sorted.begin(), sorted.end());
+		long total = 0;
+		for (size_t i = 0; i < sorted.size(); i++)
+			total += sorted[i];
+		printf("    %s: %zu samples, min %ld us, median %ld us, avg %ld us, max %ld us\n", what, sorted.size(), sorted.front(),
+			   sorted[sorted.size() / 2], total / (long)sorted.size(), sorted.back());
+	}
+};
+
+static void printLink(Scenario &s)
+{
+	SimStats st = s.sim.stats();
+	printf("    client: first tally after %u ms, ready after %u ms, reconnects %u/%u/%u/%u (hello/rejected/sync/lost)", s.atem->getTimeToFirstTally(), s.atem->getTimeToReady(),
+		   s.atem->getReconnectCount(ATEM_CAUSE_HELLO_TIMEOUT), s.atem->getReconnectCount(ATEM_CAUSE_REJECTED),
+		   s.atem->getReconnectCount(ATEM_CAUSE_SYNC_TIMEOUT), s.atem->getReconnectCount(ATEM_CAUSE_CONTACT_LOST));
+	printf(", tx resends %u lost %u, tally changes %u suppressed %u\n", s.atem->getTxResendCount(), s.atem->getTxLostCount(),
+		   s.atem->getTallyChangeCount(), s.atem->getTallySuppressedCount());
+	printf("    received: %u datagrams, %u bytes, %u resent, %u size mismatches; %u acks, %u dump requests, %u resend requests served\n",
+		   s.atem->getRxPacketCount(), s.atem->getRxByteCount(), s.atem->getRxResentCount(), s.atem->getRxSizeMismatchCount(),
+		   s.atem->getAckCount(), s.atem->getDumpResendRequestCount(), s.atem->getRxResendRequestCount());
+	printf("    simulator: %u sessions, %u sent, %u dropped, %u reordered, %u resent on timeout, %u on request, %u commands, %u duplicates\n",
+		   st.sessions, st.sent, st.dropped, st.reordered, st.resends, st.requested, st.commands, st.duplicates);
+}
+
+static bool expect(bool condition, const char *what)
+{
+	if (!condition)
+		printf("    FAILED: %s\n", what);
+	return condition;
+}
+
+static bool connect(const SimOptions &options, unsigned long readyWithinMs)
+{
+	Scenario s(options);
+	if (!s.start())
+		return false;
+	bool ready = s.runUntil(readyWithinMs, [&] { return s.atem->hasInitialized(); });
+	long latency = s.waitForTally(1000);
+	printLink(s);
+	ATEMcommandStats &commands = s.atem->getCommandStats();
+	uint32_t tallies = 0, kinds = 0;
+	for (uint16_t i = 0; i < ATEM_COMMAND_STATS; i++)
+	{
+		if (commands.at(i).cmd == ATEM_CMD_TlIn)
+			tallies = commands.at(i).count;
+		kinds += commands.at(i).cmd != 0;
+	}
+	printf("    commands: %u kinds, %u TlIn\n", kinds, tallies);
+	return expect(ready, "client ready in time") && expect(latency >= 0, "tally of the dump published") &&
+		   expect(s.atem->getTimeToFirstTally() <= s.atem->getTimeToReady(), "first tally before the dump was complete") &&
+		   expect(tallies > 0 && commands.overflow().count == 0, "commands of the dump counted");
+}
+
+static bool cuts(const SimOptions &options, unsigned count, unsigned long intervalMs, unsigned long timeoutMs)
+{
+	Scenario s(options);
+	if (!s.start() || !expect(s.runUntil(15000, [&] { return s.atem->hasInitialized(); }), "client ready"))
+		return false;
+	Latency latency;
+	unsigned missed = 0;
+	for (unsigned i = 0; i < count; i++)
+	{
+		s.sim.cut(1 + (i + 2) % options.inputs);
+		long us = s.waitForTally(timeoutMs);
+		if (us < 0)
+			missed++;
+		else
+			latency.add(us);
+		s.run(intervalMs);
+	}
+	latency.print("cut to tally callback");
+	printLink(s);
+	std::lock_guard<std::mutex> lock(tallyLog.mutex);
+	return expect(missed == 0, "every cut reached the tally callback") && expect(tallyLog.badDiffs == 0, "callbacks only on change, with matching diffs");
+}
+
+static bool transition(const SimOptions &options)
+{
+	Scenario s(options);
+	if (!s.start() || !expect(s.runUntil(3000, [&] { return s.atem->hasInitialized(); }), "client ready"))
+		return false;
+	s.sim.autoTransition(5, 25);
+	bool finished = s.runUntil(3000, [&] { return !s.sim.inTransition(); });
+	long latency = s.waitForTally(500);
+	unsigned positions;
+	{
+		std::lock_guard<std::mutex> lock(tallyLog.mutex);
+		positions = tallyLog.transitionCallbacks;
+	}
+	printf("    %u transition callbacks for 25 frames\n", positions);
+	printLink(s);
+	return expect(finished, "transition finished") && expect(latency >= 0, "tally after the transition") &&
+		   expect(positions >= 25, "every frame reached the transition callback");
+}
+
+// The client's frame grid, from tally arrivals, against the simulator's frame boundaries
+static bool frameSync(const SimOptions &options)
+{
+	Scenario s(options);
+	if (!s.start() || !expect(s.runUntil(3000, [&] { return s.atem->hasInitialized(); }), "client ready"))
+		return false;
+	bool mode = expect(s.atem->getVideoMode() == 10 && s.atem->getFramePeriodMicros() == SIM_FRAME_MS * 1000UL, "frame period from VidM");
+	unsigned missed = 0, lead = 0;
+	unsigned long at = 0;
+	for (unsigned i = 0; i < 12; i++)
+	{
+		s.run(30 + (i * 37) % 110); // not a whole number of frames apart
+		s.sim.cut(1 + (i + 1) % options.inputs);
+		if (s.waitForTally(500) < 0)
+		{
+			missed++;
+			continue;
+		}
+		{
+			std::lock_guard<std::mutex> lock(tallyLog.mutex);
+			at = tallyLog.at;
+		}
+		if (s.atem->getNextFrameMicros(at + 1) - s.atem->getFrameMicros(at) != SIM_FRAME_MS * 1000UL)
+			lead++;
+	}
+	// phase of the settled grid against the simulator's frames; the first cuts only lead up to it, and a
+	// loaded host may wake the simulator late for some of them
+	long period = SIM_FRAME_MS * 1000L;
+	long phase = (long)(uint32_t)(s.atem->getFrameMicros(at) - (uint32_t)s.sim.lastFrame()) % period;
+	if (phase > period / 2)
+		phase -= period;
+	printf("    frame grid %ld us from the simulator's frames, arrivals up to %u us behind it\n", phase, s.atem->getFrameJitterMax());
+	printLink(s);
+	return mode && expect(missed == 0, "every cut reached the tally callback") && expect(s.atem->isFrameClockLocked(), "frame grid locked") &&
+		   expect(labs(phase) < 1000, "frame grid within 1 ms of the simulator") && expect(lead == 0, "next frame one period after the current one");
+}
+
+// The derived tally against the TlIn bits the simulator computes (and, in derived mode, still sends)
+static bool derived(const SimOptions &options)
+{
+	unsigned missed = 0;
+	Scenario s(options);
+	if (!s.start(ATEM_TALLY_DERIVED) || !expect(s.runUntil(3000, [&] { return s.atem->hasInitialized(); }), "client ready"))
+		return false;
+	if (!s.showsTally(500))
+		missed++;
+	std::vector<std::function<void()>> steps = {
+		[&] { s.sim.cut(5); },		  [&] { s.sim.key(true); },	   [&] { s.sim.dsk(true); },		[&] { s.sim.preview(6); },
+		[&] { s.sim.key(false); },	  [&] { s.sim.nextKey(true); }, [&] { s.sim.dskTie(true); },	[&] { s.sim.dsk(false); },
+		[&] { s.sim.cut(2); },		  [&] { s.sim.dskTie(false); }, [&] { s.sim.nextKey(false); }};
+	for (size_t i = 0; i < steps.size(); i++)
+	{
+		steps[i]();
+		if (!s.showsTally(500))
+		{
+			unsigned long at;
+			uint64_t program, preview;
+			s.sim.lastTally(&at, &program, &preview);
+			std::lock_guard<std::mutex> lock(tallyLog.mutex);
+			printf("    step %zu: derived tally %llx/%llx, TlIn %llx/%llx\n", i + 1, (unsigned long long)tallyLog.program,
+				   (unsigned long long)tallyLog.preview, (unsigned long long)program, (unsigned long long)preview);
+			missed++;
+		}
+	}
+	// a mix with the keyer selected: both sources and the key on air while it runs, the key off air after it
+	s.sim.nextKey(true);
+	s.sim.autoTransition(7, 10);
+	bool mixed = s.runUntil(1000, [&] {
+		std::lock_guard<std::mutex> lock(tallyLog.mutex);
+		return tallyLog.program == ((1u << 1) | (1u << 6) | (1u << 2));
+	});
+	s.runUntil(2000, [&] { return !s.sim.inTransition(); });
+	if (!s.showsTally(500))
+		missed++;
+	bool stillDerived = s.atem->isTallyDerived();
+
+	// fallback: derived while the switcher sends no TlIn, TlIn as soon as it does
+	Scenario f(options);
+	f.sim.setTallyIn(false);
+	if (!f.start(ATEM_TALLY_FALLBACK) || !expect(f.runUntil(3000, [&] { return f.atem->hasInitialized(); }), "fallback client ready"))
+		return false;
+	bool fromDump = f.showsTally(500) && f.atem->isTallyDerived();
+	f.sim.cut(3);
+	bool cutDerived = f.showsTally(500);
+	f.sim.setTallyIn(true);
+	f.sim.cut(4);
+	bool switched = f.showsTally(500) && !f.atem->isTallyDerived();
+	printf("    %u derived tallies, %u in fallback mode before the first TlIn\n", s.atem->getDerivedTallyCount(), f.atem->getDerivedTallyCount());
+	printLink(s);
+	std::lock_guard<std::mutex> lock(tallyLog.mutex);
+	return expect(missed == 0, "derived tally equals TlIn after every change") && expect(mixed, "keyer and both sources on air during the mix") &&
+		   expect(stillDerived, "derived mode ignores TlIn") && expect(fromDump && cutDerived, "fallback derives the tally without TlIn") &&
+		   expect(switched, "fallback follows TlIn once it arrives") && expect(tallyLog.badDiffs == 0, "callbacks only on change, with matching diffs");
+}
+
+static bool micLive(const SimOptions &options)
+{
+	{
+		std::lock_guard<std::mutex> lock(micLog.mutex);
+		micLog.live = 0;
+		micLog.callbacks = 0;
+	}
+	Scenario s(options);
+	s.sim.setMixOption(1, 1); // input 1 always mixed in, the others follow video
+	s.atem->setMicLiveCallback(onMicLive);
+	s.atem->setMicLiveThresholds(-40, -50, 300);
+	if (!s.start() || !expect(s.runUntil(3000, [&] { return s.atem->hasInitialized(); }), "client ready"))
+		return false;
+	auto isLive = [&](uint64_t bits) {
+		std::lock_guard<std::mutex> lock(micLog.mutex);
+		return micLog.live == bits;
+	};
+	auto liveIs = [&](uint64_t bits, unsigned long timeoutMs) { return s.runUntil(timeoutMs, [&] { return isLive(bits); }); };
+	s.sim.setLevel(1, -20);
+	bool on = liveIs(1, 500);
+	s.sim.setLevel(1, -45); // between the thresholds: stays open
+	s.run(500);
+	bool held = isLive(1);
+	s.sim.setLevel(1, -70);
+	unsigned long quietAt = millis();
+	bool off = liveIs(0, 1000);
+	unsigned long closedAfter = millis() - quietAt;
+	s.sim.setLevel(3, -10); // audio follow video: live with its camera on program only
+	s.run(200);
+	bool offProgram = isLive(0);
+	s.sim.cut(3);
+	bool onProgram = liveIs(1 << 2, 500);
+	s.sim.cut(2);
+	bool leftProgram = liveIs(0, 500);
+	unsigned callbacks;
+	{
+		std::lock_guard<std::mutex> lock(micLog.mutex);
+		callbacks = micLog.callbacks;
+	}
+	printf("    %u mic live callbacks, gate closed %lu ms after the level dropped\n", callbacks, closedAfter);
+	printLink(s);
+	return expect(on, "mic live above the on threshold") && expect(held, "gate open between the thresholds") &&
+		   expect(off && closedAfter >= 300, "gate closed after the hold time") && expect(offProgram && onProgram && leftProgram, "audio follow video with the program tally") &&
+		   expect(callbacks == 4, "callbacks only on change");
+}
+
+static bool names(const SimOptions &options)
+{
+	Scenario s(options);
+	if (!s.start() || !expect(s.runUntil(3000, [&] { return s.atem->hasInitialized(); }), "client ready"))
+		return false;
+	size_t fromDump;
+	bool dumpNames;
+	{
+		std::lock_guard<std::mutex> lock(nameLog.mutex);
+		fromDump = nameLog.names.size();
+		dumpNames = nameLog.names[2] == "Camera 2" && nameLog.names[1000] == "Source 1000";
+	}
+	s.sim.rename(2, "Close-up left");
+	bool renamed = s.runUntil(1000, [&] {
+		std::lock_guard<std::mutex> lock(nameLog.mutex);
+		return nameLog.names[2] == "Close-up left";
+	});
+	s.sim.rename(3, "A name beyond twenty chars");
+	bool truncated = s.runUntil(1000, [&] {
+		std::lock_guard<std::mutex> lock(nameLog.mutex);
+		return nameLog.names[3] == "A name beyond twenty";
+	});
+	printf("    %zu input names from the dump\n", fromDump);
+	printLink(s);
+	return expect(fromDump == options.inputs + 10u && dumpNames, "every input name of the dump") && expect(renamed, "renamed input reported") &&
+		   expect(truncated, "20 char name without terminator");
+}
+
+#ifndef ATEM_TALLY_ONLY
+static bool commands(const SimOptions &options)
+{
+	Scenario s(options);
+	if (!s.start() || !expect(s.runUntil(3000, [&] { return s.atem->hasInitialized(); }), "client ready"))
+		return false;
+	s.sim.setClientLoss(options.clientLoss > 0 ? options.clientLoss : 0.3);
+	bool all = true;
+	for (uint16_t i = 0; i < 10; i++)
+	{
+		uint16_t source = 1 + (i + 3) % options.inputs;
+		s.atem->changeProgramInput(source);
+		all = s.runUntil(2000, [&] { return s.sim.program() == source; }) && all;
+	}
+	printLink(s);
+	return expect(all, "every program change applied by the simulator") && expect(s.atem->getTxLostCount() == 0, "no command given up");
+}
+#endif
+
+static bool contactLost(const SimOptions &options)
+{
+	Scenario s(options);
+	if (!s.start() || !expect(s.runUntil(3000, [&] { return s.atem->hasInitialized(); }), "client ready"))
+		return false;
+	s.sim.setSilent(true);
+	unsigned long silentAt = millis();
+	bool noticed = s.runUntil(ATEM_contactTimeout + 1000, [&] { return s.atem->getReconnectCount(ATEM_CAUSE_CONTACT_LOST) > 0; });
+	unsigned long noticedAfter = millis() - silentAt;
+	s.run(1000);
+	s.sim.setSilent(false);
+	s.sim.cut(3);
+	bool back = s.runUntil(ATEM_backoffMax + 3000, [&] { return s.atem->hasInitialized(); });
+	long latency = s.waitForTally(1000);
+	printf("    loss noticed after %lu ms, ready again %u ms after it\n", noticedAfter, s.atem->getTimeToReady());
+	printLink(s);
+	return expect(noticed, "contact loss noticed") && expect(back, "reconnected") && expect(latency >= 0, "tally after reconnect");
+}
+
+// The switcher stays away long enough for unanswered hellos to raise the backoff, like during a reboot
+static bool switcherReboot(const SimOptions &options)
+{
+	Scenario s(options);
+	if (!s.start() || !expect(s.runUntil(3000, [&] { return s.atem->hasInitialized(); }), "client ready"))
+		return false;
+	s.sim.setSilent(true);
+	bool noticed = s.runUntil(ATEM_contactTimeout + 1000, [&] { return s.atem->getReconnectCount(ATEM_CAUSE_CONTACT_LOST) > 0; });
+	unsigned long lostAt = millis();
+	s.run(11000);
+	s.sim.setSilent(false);
+	unsigned long backAt = millis();
+	bool ready = s.runUntil(ATEM_backoffMax + 3000, [&] { return s.atem->hasInitialized(); });
+	// time to first tally counts from the loss
+	long firstTally = (long)(lostAt + s.atem->getTimeToFirstTally() - backAt);
+	printf("    %u unanswered hellos, first tally %ld ms after the switcher was back\n", s.atem->getReconnectCount(ATEM_CAUSE_HELLO_TIMEOUT), firstTally);
+	printLink(s);
+	return expect(noticed, "contact loss noticed") && expect(ready, "reconnected") &&
+		   expect(firstTally < ATEM_helloBackoffMax * 5 / 4 + ATEM_helloTimeout, "hello backoff capped while the switcher is away");
+}
+
+// The controller came up before its network: the first hello went nowhere, reconnectNow() once it is up
+static bool lateNetwork(const SimOptions &options)
+{
+	Scenario s(options);
+	s.sim.setSilent(true);
+	if (!s.start())
+		return false;
+	s.run(300);
+	s.sim.setSilent(false);
+	unsigned long upAt = millis();
+	s.atem->reconnectNow();
+	bool tallied = s.runUntil(ATEM_helloTimeout, [&] { return s.atem->getTimeToFirstTally() > 0; });
+	unsigned long after = millis() - upAt;
+	printf("    first tally %lu ms after the network came up\n", after);
+	printLink(s);
+	return expect(tallied && after < 200, "first tally right after reconnectNow()");
+}
+
+static bool rejected(const SimOptions &options)
+{
+	Scenario s(options);
+	s.sim.setFullyBooked(true);
+	if (!s.start())
+		return false;
+	bool backoff = s.runUntil(2000, [&] { return s.atem->getReconnectCount(ATEM_CAUSE_REJECTED) > 0; });
+	bool state = s.atem->getConnectionState() == ATEM_STATE_BACKOFF;
+	s.sim.setFullyBooked(false);
+	bool ready = s.runUntil(ATEM_backoffMax + 3000, [&] { return s.atem->hasInitialized(); });
+	printLink(s);
+	return expect(backoff && state, "fully booked answer leads to backoff") && expect(ready, "connected once a place is free");
+}
+
+static int runSuite(const SimOptions &options, const std::string &only)
+{
+	struct Entry
+	{
+		const char *name;
+		std::function<bool()> run;
+	};
+	SimOptions lossy = options;
+	lossy.loss = options.loss > 0 ? options.loss : 0.2;
+	lossy.reorder = options.reorder > 0 ? options.reorder : 0.1;
+	std::vector<Entry> entries = {
+		{"connect", [&] { return connect(options, 1000); }},
+		{"cuts", [&] { return cuts(options, 50, 60, 500); }},
+		{"transition", [&] { return transition(options); }},
+		{"names", [&] { return names(options); }},
+		{"derived", [&] { return derived(options); }},
+		{"mic-live", [&] { return micLive(options); }},
+		{"frame-sync", [&] { return frameSync(options); }},
+		{"lossy-connect", [&] { return connect(lossy, 15000); }},
+		{"lossy-cuts", [&] { return cuts(lossy, 30, 60, 3000); }},
+#ifndef ATEM_TALLY_ONLY
+		{"commands", [&] { return commands(options); }},
+#endif
+		{"contact-lost", [&] { return contactLost(options); }},
+		{"switcher-reboot", [&] { return switcherReboot(options); }},
+		{"late-network", [&] { return lateNetwork(options); }},
+		{"rejected", [&] { return rejected(options); }},
+	};
+
+	unsigned failed = 0, ran = 0;
+	for (size_t i = 0; i < entries.size(); i++)
+	{
+		if (!only.empty() && ("," + only + ",").find("," + std::string(entries[i].name) + ",") == std::string::npos)
+			continue;
+		printf("%s\n", entries[i].name);
+		unsigned long start = millis();
+		bool ok = entries[i].run();
+		printf("  %s (%lu ms)\n", ok ? "ok" : "FAILED", millis() - start);
+		ran++;
+		failed += ok ? 0 : 1;
+	}
+	printf("%u of %u scenarios passed\n", ran - failed, ran);
+	return failed ? 1 : 0;
+}
+
+/**************
+ *
+ * Standalone simulator
+ *
+ **************/
+
+static int serve(const SimOptions &options, const char *scriptPath)
+{
+	std::vector<std::string> script;
+	if (scriptPath)
+	{
+		FILE *f = fopen(scriptPath, "r");
+		if (!f)
+		{
+			fprintf(stderr, "cannot read %s\n", scriptPath);
+			return 2;
+		}
+		char line[128];
+		while (fgets(line, sizeof(line), f))
+		{
+			std::string s(line);
+			s.erase(std::find_if(s.rbegin(), s.rend(), [](char c) { return !isspace((unsigned char)c); }).base(), s.end());
+			if (!s.empty() && s[0] != '#')
+				script.push_back(s);
+		}
+		fclose(f);
+	}
+	else
+	{
+		for (unsigned i = 1; i <= options.inputs; i++)
+		{
+			script.push_back("wait 2000");
+			script.push_back("cut " + std::to_string(i));
+		}
+		script.push_back("repeat");
+	}
+
+	AtemSimulator sim(options);
+	if (!sim.start())
+		return 2;
+	double loss = options.loss, reorder = options.reorder;
+	struct in_addr address = {options.bind};
+	printf("simulated switcher on %s:%d, %u inputs\n", inet_ntoa(address), SIM_PORT, options.inputs);
+	for (size_t pc = 0; pc < script.size(); pc++)
+	{
+		char verb[16] = "";
+		double a = 0, b = 0;
+		int fields = sscanf(script[pc].c_str(), "%15s %lf %lf", verb, &a, &b);
+		std::string v = verb;
+		if (v == "wait")
+			delay((unsigned long)a);
+		else if (v == "cut")
+			sim.cut(a);
+		else if (v == "preview")
+			sim.preview(a);
+		else if (v == "auto")
+			sim.autoTransition(a, fields > 2 ? b : 25);
+		else if (v == "name" && fields > 1)
+		{
+			size_t at = script[pc].find(' ', 5);
+			sim.rename(a, at == std::string::npos ? "" : script[pc].substr(at + 1));
+		}
+		else if (v == "key")
+			sim.key(a != 0);
+		else if (v == "nextkey")
+			sim.nextKey(a != 0);
+		else if (v == "dsk")
+			sim.dsk(a != 0);
+		else if (v == "tie")
+			sim.dskTie(a != 0);
+		else if (v == "tlin")
+			sim.setTallyIn(a != 0);
+		else if (v == "level" && fields > 2)
+			sim.setLevel(a, b);
+		else if (v == "mix" && fields > 2)
+			sim.setMixOption(a, b);
+		else if (v == "loss")
+			sim.setLoss(loss = a, reorder);
+		else if (v == "reorder")
+			sim.setLoss(loss, reorder = a);
+		else if (v == "silent")
+		{
+			sim.setSilent(true);
+			delay((unsigned long)a);
+			sim.setSilent(false);
+		}
+		else if (v == "repeat")
+			pc = (size_t)-1;
+		else
+		{
+			fprintf(stderr, "unknown script line: %s\n", script[pc].c_str());
+			return 2;
+		}
+		if (v != "wait" && v != "repeat")
+			printf("%8.3f %s, %s\n", millis() / 1000.0, script[pc].c_str(), sim.ready() ? "client connected" : "no client");
+	}
+	while (sim.inTransition())
+		delay(10);
+	return 0;
+}
+
+static void usage()
+{
+	fprintf(stderr, "usage: atemSim [--suite [name,...] | --serve [--script file]] [--bind ip] [--inputs n] [--loss p] [--reorder p] [--client-loss p] [--seed n] [--verbose]\n");
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	SimOptions options;
+	bool serving = false;
+	std::string only;
+	const char *scriptPath = NULL;
+
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (arg == "--suite")
+		{
+			if (hasValue && argv[i + 1][0] != '-')
+				only = argv[++i];
+		}
+		else if (arg == "--serve")
+			serving = true;
+		else if (arg == "--script" && hasValue)
+			scriptPath = argv[++i];
+		else if (arg == "--bind" && hasValue)
+		{
+			struct in_addr address;
+			if (!inet_aton(argv[++i], &address))
+				usage();
+			options.bind = address.s_addr;
+		}
+		else if (arg == "--inputs" && hasValue)
+			options.inputs = std::max(1, std::min(SIM_MAX_INPUTS, atoi(argv[++i])));
+		else if (arg == "--loss" && hasValue)
+			options.loss = atof(argv[++i]);
+		else if (arg == "--reorder" && hasValue)
+			options.reorder = atof(argv[++i]);
+		else if (arg == "--client-loss" && hasValue)
+			options.clientLoss = atof(argv[++i]);
+		else if (arg == "--seed" && hasValue)
+			options.seed = atoi(argv[++i]);
+		else if (arg == "--verbose")
+			verbose = true;
+		else
+			usage();
+	}
+	hostSerialEnabled = verbose;
+	setvbuf(stdout, NULL, _IOLBF, 0); // progress shows up when piped
+	if (options.inputs < 6)
+		options.inputs = serving ? options.inputs : 6; // the suite cuts to inputs 3 and 5
+
+	if (serving)
+		return serve(options, scriptPath);
+	return runSuite(options, only);
+}
@@ -0,0 +1,243 @@
+// Host test of receiver reconcile and provisioning.
+//
+// Builds src/reconcile.cpp and src/provision.cpp natively against simulated
+// receivers: they take SET_*_MAC commands and PROVISION_ASSIGN addressed to
+// them, answer with PROVISION_ACK and send heartbeats, all on a fixed clock.
+// Each scenario drives loop() the way the controller does.
+//
+//   g++ -O2 -std=c++11 -I../shim -I../../include -o reconcileTest reconcileTest.cpp
+//       ../shim/Arduino.cpp ../../src/reconcile.cpp ../../src/provision.cpp
+//   ./reconcileTest [name,...]
+//
+// The compiler call above is one command line. Exit 1 if a scenario fails.
+// Scenarios: converge, pending, provisioned-id, operator-name.
+
+#include <Arduino.h>
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "espnow.h"
+#include "provision.h"
+#include "reconcile.h"
+
+struct Receiver
+{
+	uint8_t mac[6];
+	uint8_t id;
+	bool deaf;	// ignores commands, like one out of range
+};
+
+static std::vector<Receiver> receivers;
+static espnow_tally_info_t tallies[MAX_TALLY_COUNT];
+static unsigned camIdSends = 0;	// SET_CAMID_MAC sent, by reconcile or the operator
+static uint64_t now = 1000000;
+
+static void advance(unsigned long ms)
+{
+	now += (uint64_t)ms * 1000;
+	hostSetMicros(now);
+}
+
+static Receiver *receiver(const uint8_t mac[6])
+{
+	for (size_t i = 0; i < receivers.size(); i++)
+		if (memcmp(receivers[i].mac, mac, 6) == 0)
+			return &receivers[i];
+	return nullptr;
+}
+
+// What espNow.cpp does with a heartbeat: refresh the table and compare it with the desired state
+static void heartbeat(const Receiver &r)
+{
+	int slot = -1;
+	for (int i = 0; i < MAX_TALLY_COUNT && slot < 0; i++)
+		if (tallies[i].id != 0 && memcmp(tallies[i].mac_addr, r.mac, 6) == 0)
+			slot = i;
+	for (int i = 0; i < MAX_TALLY_COUNT && slot < 0; i++)
+		if (tallies[i].id == 0)
+			slot = i;
+	espnow_tally_info_t &t = tallies[slot];
+	memcpy(t.mac_addr, r.mac, 6);
+	t.id = r.id;
+	t.last_seen = millis();
+	reconcile_observe(&t, RECONCILE_ID);
+}
+
+// One second of the controller's loop() with a heartbeat of every receiver at its end
+static void runSecond()
+{
+	for (int i = 0; i < 10; i++)
+	{
+		advance(100);
+		provision_loop();
+		reconcile_loop();
+	}
+	for (size_t i = 0; i < receivers.size(); i++)
+		heartbeat(receivers[i]);
+}
+
+static bool expect(bool condition, const char *what)
+{
+	if (!condition)
+		printf("    FAILED: %s\n", what);
+	return condition;
+}
+
+/**************
+ *
+ * ESP-NOW of the controller, delivered to the simulated receivers
+ *
+ **************/
+
+espnow_tally_info_t *espnow_tallies()
+{
+	return tallies;
+}
+
+void espnow_set_camid_mac(uint8_t camId, const uint8_t mac[6])
+{
+	camIdSends++;
+	Receiver *r = receiver(mac);
+	if (r && !r->deaf)
+		r->id = camId;
+}
+
+void espnow_set_name_mac(const String &, const uint8_t *) {}
+void espnow_brightness_mac(uint8_t, const uint8_t *) {}
+void espnow_status_brightness(uint8_t, const uint8_t *) {}
+void espnow_camid(uint8_t, uint64_t *) {}
+void espnow_set_name(const String &, uint64_t *) {}
+void espnow_brightness(uint8_t, uint64_t *) {}
+
+esp_err_t espnow_broadcast(const uint8_t *payload, size_t len)
+{
+	if (len == 8 && payload[0] == PROVISION_ASSIGN)
+	{
+		Receiver *r = receiver(payload + 2);
+		if (r && !r->deaf)
+		{
+			r->id = payload[1];
+			uint8_t ack[2] = {PROVISION_ACK, r->id};
+			provision_ack(r->mac, ack, sizeof(ack));
+		}
+	}
+	return ESP_OK;
+}
+
+/**************
+ *
+ * Scenarios
+ *
+ **************/
+
+static Receiver addReceiver(uint8_t last, uint8_t id)
+{
+	Receiver r = {{0x24, 0x0A, 0xC4, 0x00, 0x00, last}, id, false};
+	receivers.push_back(r);
+	return r;
+}
+
+// An ID set by the operator reaches a receiver that missed it once
+static bool converge()
+{
+	Receiver r = addReceiver(1, 2);
+	receiver(r.mac)->deaf = true;
+	reconcile_set_camid_mac(4, r.mac);
+	runSecond();
+	receiver(r.mac)->deaf = false;
+	for (int i = 0; i < 5; i++)
+		runSecond();
+	return expect(receiver(r.mac)->id == 4, "receiver took the desired ID") &&
+		   expect(strcmp(reconcile_status(r.mac), "ok") == 0, "status ok once a heartbeat shows it");
+}
+
+// A field found wrong stays pending after the resend, until a heartbeat shows the desired value
+static bool pending()
+{
+	Receiver r = addReceiver(2, 5);
+	receiver(r.mac)->deaf = true;
+	reconcile_set_camid_mac(6, r.mac);
+	bool pendingAtFirst = strcmp(reconcile_status(r.mac), "pending") == 0;
+	heartbeat(*receiver(r.mac));
+	unsigned sends = camIdSends;
+	for (int i = 0; i < 20 && camIdSends == sends; i++)
+	{
+		advance(100);
+		reconcile_loop();
+	}
+	bool resent = camIdSends > sends;
+	bool pendingAfterResend = strcmp(reconcile_status(r.mac), "pending") == 0;
+	receiver(r.mac)->deaf = false;
+	reconcile_set_camid_mac(6, r.mac);
+	heartbeat(*receiver(r.mac));
+	return expect(pendingAtFirst, "pending before any heartbeat") && expect(resent, "resent after a wrong heartbeat") &&
+		   expect(pendingAfterResend, "still pending right after the resend") &&
+		   expect(strcmp(reconcile_status(r.mac), "ok") == 0, "ok once a heartbeat shows it");
+}
+
+// A receiver with an ID pinned by the operator is provisioned to a new one; reconcile must not put the old one back
+static bool provisionedId()
+{
+	Receiver r = addReceiver(3, 3);
+	reconcile_set_camid_mac(3, r.mac);
+	runSecond();
+	bool pinned = strcmp(reconcile_status(r.mac), "ok") == 0;
+
+	uint8_t plan[] = {7};
+	provision_start(plan, sizeof(plan), 10, true);
+	uint8_t claim[2] = {PROVISION_CLAIM, 0};
+	provision_claim(r.mac, claim, sizeof(claim));
+	unsigned sends = camIdSends;
+	for (int i = 0; i < 12; i++)
+		runSecond();
+	return expect(pinned, "operator ID confirmed before provisioning") && expect(!provision_open(), "window closed") &&
+		   expect(receiver(r.mac)->id == 7, "receiver keeps the provisioned ID") &&
+		   expect(camIdSends == sends, "no SET_CAMID_MAC back to the old ID") &&
+		   expect(strcmp(reconcile_status(r.mac), "ok") == 0, "provisioned ID is the desired one");
+}
+
+// A name set on the web page is not replaced by the ATEM input names
+static bool operatorName()
+{
+	Receiver named = addReceiver(4, 8);
+	addReceiver(5, 9);
+	runSecond();
+	reconcile_set_name_mac(String("Host"), named.mac);
+	uint64_t bits = ((uint64_t)1 << (8 - 1)) | ((uint64_t)1 << (9 - 1));
+	reconcile_expect_name(String("CAM 8"), &bits);
+	return expect(reconcile_operator_name(8), "operator name kept after an ATEM name") &&
+		   expect(!reconcile_operator_name(9), "a receiver without one takes ATEM names");
+}
+
+int main(int argc, char **argv)
+{
+	hostSerialEnabled = false;
+	hostSetMicros(now);
+	std::string only = argc > 1 ? argv[1] : "";
+	struct Entry
+	{
+		const char *name;
+		std::function<bool()> run;
+	};
+	std::vector<Entry> entries = {
+		{"converge", converge},
+		{"pending", pending},
+		{"provisioned-id", provisionedId},
+		{"operator-name", operatorName},
+	};
+	unsigned failed = 0, ran = 0;
+	for (size_t i = 0; i < entries.size(); i++)
+	{
+		if (!only.empty() && ("," + only + ",").find("," + std::string(entries[i].name) + ",") == std::string::npos)
+			continue;
+		printf("%s\n", entries[i].name);
+		bool ok = entries[i].run();
+		printf("  %s\n", ok ? "ok" : "FAILED");
+		ran++;
+		failed += ok ? 0 : 1;
+	}
+	printf("%u of %u scenarios passed\n", ran - failed, ran);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,156 @@
+// Host implementation of the Arduino shim, see Arduino.h
+
+#include "Arduino.h"
+
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+HostSerial Serial;
+EspClass ESP;
+bool hostSerialEnabled = true;
+
+static bool fixedClock = false;
+static uint64_t fixedMicros = 0;
+
+static uint64_t clockMicros()
+{
+	if (fixedClock)
+		return fixedMicros;
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+void hostSetMicros(uint64_t us)
+{
+	fixedClock = true;
+	fixedMicros = us;
+}
+
+void hostUseRealClock()
+{
+	fixedClock = false;
+}
+
+unsigned long millis()
+{
+	return (unsigned long)(clockMicros() / 1000);
+}
+
+unsigned long micros()
+{
+	return (unsigned long)clockMicros();
+}
+
+static uint64_t monotonicNanos()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+uint32_t EspClass::getCycleCount()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return (uint32_t)__rdtsc();
+#else
+	return (uint32_t)monotonicNanos();
+#endif
+}
+
+uint32_t EspClass::getCpuFreqMHz()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	static uint32_t mhz = 0;
+	if (mhz == 0)
+	{
+		// TSC ticks over 20 ms of the monotonic clock, once
+		uint64_t start = monotonicNanos();
+		uint64_t tsc = __rdtsc();
+		while (monotonicNanos() - start < 20000000)
+			;
+		mhz = (uint32_t)((__rdtsc() - tsc) * 1000 / (monotonicNanos() - start));
+		if (mhz == 0)
+			mhz = 1;
+	}
+	return mhz;
+#else
+	return 1000;
+#endif
+}
+
+void delay(unsigned long ms)
+{
+	if (fixedClock)
+		fixedMicros += (uint64_t)ms * 1000;
+	else
+		usleep(ms * 1000);
+}
+
+long random(long max)
+{
+	return max > 0 ? rand() % max : 0;
+}
+
+long random(long min, long max)
+{
+	return max > min ? min + rand() % (max - min) : min;
+}
+
+void HostSerial::printf(const char *format, ...)
+{
+	if (!hostSerialEnabled)
+		return;
+	va_list args;
+	va_start(args, format);
+	vprintf(format, args);
+	va_end(args);
+}
+
+void HostSerial::print(const char *s)
+{
+	if (hostSerialEnabled)
+		fputs(s, stdout);
+}
+
+void HostSerial::print(char c)
+{
+	if (hostSerialEnabled)
+		fputc(c, stdout);
+}
+
+void HostSerial::print(long v, int base)
+{
+	if (!hostSerialEnabled)
+		return;
+	if (base == HEX)
+		printf("%lX", v);
+	else
+		printf("%ld", v);
+}
+
+void HostSerial::print(unsigned long v, int base)
+{
+	if (!hostSerialEnabled)
+		return;
+	if (base == HEX)
+		printf("%lX", v);
+	else
+		printf("%lu", v);
+}
+
+void HostSerial::print(double v, int digits)
+{
+	if (hostSerialEnabled)
+		printf("%.*f", digits, v);
+}
+
+void HostSerial::print(const IPAddress &ip)
+{
+	if (hostSerialEnabled)
+		printf("%u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
+}
@@ -0,0 +1,143 @@
+// Minimal Arduino API for building the ATEM library on Linux.
+//
+// Only what lib/ATEMbase, lib/ATEMstd and lib/ATEMtally use, plus String,
+// Serial.printf and FreeRTOS locks for the controller modules that host tools
+// build (reconcile, provision). Time comes from
+// the host clock unless a tool sets it with hostSetMicros() for a
+// deterministic run; Serial prints to stdout (hostSerialEnabled = false
+// silences it).
+
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+
+typedef bool boolean;
+typedef uint8_t byte;
+typedef uint16_t word;
+
+#define F(s) (s)
+#define PSTR(s) (s)
+#define strcmp_P strcmp
+#define strncmp_P strncmp
+#define strcpy_P strcpy
+#define strncpy_P strncpy
+#define strlen_P strlen
+#define memcpy_P memcpy
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+#define pgm_read_byte_near(p) (*(const uint8_t *)(p))
+
+#define B0 0
+#define B1 1
+#define B00000111 7
+#define DEC 10
+#define HEX 16
+#define BIN 2
+
+#define highByte(w) ((uint8_t)((w) >> 8))
+#define lowByte(w) ((uint8_t)((w) & 0xFF))
+inline uint16_t makeWord(uint8_t h, uint8_t l) { return (h << 8) | l; }
+#define word(...) makeWord(__VA_ARGS__)
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+long random(long max);
+long random(long min, long max);
+
+// Fixes the clock to us (and keeps it there) until hostUseRealClock()
+void hostSetMicros(uint64_t us);
+void hostUseRealClock();
+
+// The cycle counter is the TSC on x86 (cheap to read, like CCOUNT on the ESP32) and the monotonic
+// clock in ns elsewhere; it runs also while the clock is fixed
+class EspClass
+{
+public:
+	uint32_t getCycleCount();
+	uint32_t getCpuFreqMHz();
+};
+extern EspClass ESP;
+
+class IPAddress
+{
+public:
+	IPAddress() : _address(0) {}
+	IPAddress(uint32_t address) : _address(address) {}
+	IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : _address(a | (b << 8) | (c << 16) | ((uint32_t)d << 24)) {}
+	operator uint32_t() const { return _address; }	// network order, like the ESP32 core
+	uint8_t operator[](int i) const { return _address >> (8 * i); }
+
+private:
+	uint32_t _address;
+};
+
+// Single threaded host tools need no locks
+typedef int portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED 0
+#define portENTER_CRITICAL(mux) ((void)(mux))
+#define portEXIT_CRITICAL(mux) ((void)(mux))
+
+class String
+{
+public:
+	String() {}
+	String(const char *s) : _s(s ? s : "") {}
+	String(int v) : _s(std::to_string(v)) {}
+	String(unsigned int v) : _s(std::to_string(v)) {}
+	String(long v) : _s(std::to_string(v)) {}
+	String(unsigned long v) : _s(std::to_string(v)) {}
+	const char *c_str() const { return _s.c_str(); }
+	unsigned int length() const { return _s.length(); }
+	char operator[](unsigned int i) const { return i < _s.length() ? _s[i] : 0; }
+	void remove(unsigned int index, unsigned int count) { _s.erase(index, count); }
+	template <class T>
+	String &operator+=(const T &v)
+	{
+		_s += String(v)._s;
+		return *this;
+	}
+	String &operator+=(const String &v)
+	{
+		_s += v._s;
+		return *this;
+	}
+	bool operator==(const char *s) const { return _s == s; }
+
+private:
+	std::string _s;
+};
+
+class HostSerial
+{
+public:
+	void printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+	void print(const char *s);
+	void print(char c);
+	void print(long v, int base = DEC);
+	void print(unsigned long v, int base = DEC);
+	void print(int v, int base = DEC) { print((long)v, base); }
+	void print(unsigned int v, int base = DEC) { print((unsigned long)v, base); }
+	void print(double v, int digits = 2);
+	void print(const IPAddress &ip);
+	void println() { print("\n"); }
+	template <class T>
+	void println(const T &v)
+	{
+		print(v);
+		println();
+	}
+	template <class T>
+	void println(const T &v, int base)
+	{
+		print(v, base);
+		println();
+	}
+};
+extern HostSerial Serial;
+extern bool hostSerialEnabled;
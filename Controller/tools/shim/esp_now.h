@@ -0,0 +1,9 @@
+// The part of ESP-NOW's API that controller headers name, see Arduino.h
+
+#pragma once
+
+#include <stdint.h>
+
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_NOW_ETH_ALEN 6
@@ -0,0 +1,6 @@
+// The controller sources include "espnow.h"; the header is include/espNow.h,
+// which a case-sensitive file system does not find by that name
+
+#pragma once
+
+#include "../../include/espNow.h"
@@ -0,0 +1,8 @@
+// lwIP exposes the BSD socket API; on Linux it is the system one
+#pragma once
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
@@ -5,11 +5,13 @@
 #include <string.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
 #include "esp_log.h"
 #include "driver/rmt_tx.h"
 #include "led_strip_encoder.h"
 #include "nvs_flash.h"
 #include "esp_timer.h"
+#include "esp_random.h"
 
 static const char *TAG = "tally";
 #define DEBUG 1
@@ -53,6 +55,10 @@ uint8_t broadcast_mac[ESP_NOW_ETH_ALEN] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
 nvs_handle_t nvs_tally_handle;
 
 unsigned long lastMessageReceived = -TALLY_UPDATE_EACH;
+// sequence/generation appended to SET_TALLY by the controller
+bool tallyCounters = false;
+uint16_t tallyGen = 0;
+unsigned long lastTallyAt = 0;
 uint8_t camId = DEFAULT_CAMID;
 uint8_t camGroup = DEFAULT_CAMGROUP;
 uint8_t bright_ratio = 255/DEFAULT_BRIGHTNESS;
@@ -80,14 +86,71 @@ typedef enum {
   SIGNAL_ISOUP = 21,
   SIGNAL_ISODOWN = 22,
   SIGNAL_OK = 23,
+
+  TEST_BEGIN = 32,
+  TEST_END = 33,
+  TEST_REPORT = 34,
+  PROVISION_OPEN = 36,
+  PROVISION_CLAIM = 37,
+  PROVISION_ASSIGN = 38,
+  PROVISION_ACK = 39,
+  TRANSITION = 40,
+  MIC_LIVE = 42,
 } espnow_command;
 
+#define TRANSITION_END 0x01
+#define FADE_TIMEOUT 600  // end a fade whose closing frame got lost
+#define SET_TALLY_MAX_LEAD_US 200000  // a later applyAt is taken as garbage and applied at once
+#define CLOCK_CREEP_SHIFT 13  // the clock offset grows at most 1/8192 of the time between tallies
+
+// Commands the controller's load generator sends (9 is SET_NAME there)
+#define TEST_FRAME_NAME 9
+#define TEST_FRAME_BLINK 11
+
+bool testActive = false;
+uint16_t testSession = 0;
+uint32_t testFrames = 0;
+bool testReportDue = false;
+unsigned long testReportAt = 0;
+
+// camId came from NVS rather than DEFAULT_CAMID; provisioning looks for the others
+bool camIdAssigned = false;
+bool provisioning = false;
+uint8_t provisionSession = 0;
+uint8_t provisionDoneSession = 0;
+unsigned long provisionUntil = 0;
+unsigned long nextClaimAt = 0;
+bool provisionAckDue = false;
+
+// last SET_TALLY, repainted when a cross-fade ends
+uint64_t tallyProgram = 0;
+uint64_t tallyPreview = 0;
+// mix in progress (TRANSITION) that involves this camera
+bool fadeActive = false;
+unsigned long lastFadeAt = 0;
+// last MIC_LIVE, cameras whose talent mic is live
+uint64_t micLive = 0;
+// frame-timed SET_TALLY: offset of our clock to the controller's (from the
+// fastest frame seen) and the tally waiting in tallyTimer for its frame
+bool clockSynced = false;
+uint32_t clockOffset = 0;
+uint32_t clockSyncedAt = 0;
+esp_timer_handle_t tallyTimer = NULL;
+bool tallyScheduled = false;
+int64_t scheduledAt = 0;
+uint64_t scheduledProgram = 0;
+uint64_t scheduledPreview = 0;
+// the tally, the scheduled one with tallyTimer, the fade and every write to the
+// LEDs are shared by the ESP-NOW receive callback (WiFi task), scheduledTally()
+// (esp_timer task) and the main loop
+SemaphoreHandle_t tallyLock = NULL;
+
 unsigned long millis() {
   return esp_timer_get_time() / 1000;
 }
 
 void delay(long ms) {
-  vTaskDelay(pdMS_TO_TICKS(2000));
+  vTaskDelay(pdMS_TO_TICKS(ms));
 }
 
 void show() {
@@ -139,19 +202,12 @@ void readCamId() {
   esp_err_t err = nvs_get_u8(nvs_tally_handle, "camId", &camId);
   switch (err) {
       case ESP_OK:
+          camIdAssigned = true;
           break;
       case ESP_ERR_NVS_NOT_FOUND:
+          // not stored until something assigns an ID, so provisioning can find us
           printf("camId not saved yet!\n");
           camId = DEFAULT_CAMID;
-          err = nvs_set_u8(nvs_tally_handle, "camId", camId);
-          printf((err != ESP_OK) ? "Failed to save default camId.\n" : "Default camId saved.\n");
-          // Commit written value.
-          // After setting any values, nvs_commit() must be called to ensure changes are written
-          // to flash storage. Implementations may write to storage at other times,
-          // but this is not guaranteed.
-          printf("Committing updates in NVS ... ");
-          err = nvs_commit(nvs_tally_handle);
-          printf((err != ESP_OK) ? "Failed!\n" : "Done\n");
           break;
       default :
           printf("Error (%s) reading!\n", esp_err_to_name(err));
@@ -186,8 +242,11 @@ void readCamGroup() {
 }
 
 void writeCamId() {
-  if (nvs_set_u8(nvs_tally_handle, "camId", camId) != ESP_OK)
+  // After setting any values, nvs_commit() must be called to ensure changes are written
+  // to flash storage.
+  if (nvs_set_u8(nvs_tally_handle, "camId", camId) != ESP_OK || nvs_commit(nvs_tally_handle) != ESP_OK)
     ESP_LOGI(TAG, "writeCamId failed!");
+  camIdAssigned = true;
 }
 
 void writeCamGroup() {
@@ -605,23 +664,107 @@ inline bool getBit(uint64_t bits, int i) {
   return bits & ((uint64_t)1 << i);
 }
 
+void showTally() {
+  for (int i=0; i<LED_COUNT; i++) {
+    setPixelColor(i, 255*getBit(tallyProgram, camId-1), 255*getBit(tallyPreview, camId-1), 0);
+  }
+  // mic live: the first pixel turns blue over the tally colour
+  if (getBit(micLive, camId-1)) setPixelColor(0, 0, 0, 255);
+  show();
+}
+
+// A larger arrival minus send time than the smallest one is delay, not drift;
+// it may only move the offset up as fast as two crystals drift apart
+static void syncClock(uint32_t rxAt, uint32_t sentAt) {
+  uint32_t sample = rxAt - sentAt;
+  int32_t above = sample - clockOffset;
+  uint32_t elapsed = rxAt - clockSyncedAt;
+  if (!clockSynced || above < 0 || elapsed > (1UL << 30)) {
+    clockOffset = sample;
+    clockSynced = true;
+  } else {
+    uint32_t creep = elapsed >> CLOCK_CREEP_SHIFT;
+    clockOffset += (uint32_t)above < creep ? (uint32_t)above : creep;
+  }
+  clockSyncedAt = rxAt;
+}
+
+// With tallyLock held
+static void applyTally(uint64_t program, uint64_t preview) {
+  tallyProgram = program;
+  tallyPreview = preview;
+  // the fade owns the LEDs until it ends
+  if (!fadeActive) showTally();
+}
+
+static void scheduledTally(void *arg) {
+  xSemaphoreTake(tallyLock, portMAX_DELAY);
+  // while this waited for the lock, the receive callback may have applied a newer tally or scheduled a later one
+  if (tallyScheduled && esp_timer_get_time() >= scheduledAt) {
+    tallyScheduled = false;
+    applyTally(scheduledProgram, scheduledPreview);
+  }
+  xSemaphoreGive(tallyLock);
+}
+
 // Callback function that will be executed when data is received
 static void espnow_recv_cb(const esp_now_recv_info_t *recv_info, const uint8_t *data, int len) {
   espnow_command command = (espnow_command)data[0];
+#ifdef DEBUG
   ESP_LOGI(TAG, "<[%d] ", command);
+#endif
+  if (testActive && (command == SET_TALLY || command == SET_COLOR
+      || command == TEST_FRAME_NAME || command == TEST_FRAME_BLINK)) {
+    testFrames++;
+  }
   switch (command) {
 
   case SET_TALLY: {
+    uint32_t rxAt = (uint32_t)esp_timer_get_time();
+    if (len >= 1 + 2 * (int)sizeof(uint64_t) + 4) {
+      uint16_t gen = data[19] | (data[20] << 8);
+      // an older generation comes from a controller that has handed over
+      if (tallyCounters && millis() - lastTallyAt < 5000 && (int16_t)(gen - tallyGen) < 0) break;
+      tallyCounters = true;
+      tallyGen = gen;
+      lastTallyAt = millis();
+    }
     uint64_t *program_p = (uint64_t *)(data+1);
     uint64_t *preview_p = (uint64_t *)(data+1+sizeof(uint64_t));
     // uint8_t  *group_p   = (uint8_t *) (data+1+sizeof(uint64_t)+sizeof(uint64_t));
     // if (group_p <= data+len && *group_p != camGroup) return;
-    fillColor(
-      255*getBit(*program_p, camId-1),
-      255*getBit(*preview_p, camId-1),
-      0
-    );
     lastMessageReceived = millis();
+    bool timed = false;
+    xSemaphoreTake(tallyLock, portMAX_DELAY);
+    if (len >= 1 + 2 * (int)sizeof(uint64_t) + 4 + 8) {
+      // [sentAt u32][applyAt u32], the controller's micros()
+      uint32_t sentAt, applyAt;
+      memcpy(&sentAt, data + 21, sizeof(sentAt));
+      memcpy(&applyAt, data + 25, sizeof(applyAt));
+      syncClock(rxAt, sentAt);
+      uint32_t lead = applyAt - sentAt;
+      if (lead > 0 && lead < SET_TALLY_MAX_LEAD_US) {
+        int32_t wait = applyAt + clockOffset - (uint32_t)esp_timer_get_time();
+        if (wait > 0 && tallyTimer) {
+          esp_timer_stop(tallyTimer);
+          scheduledProgram = *program_p;
+          scheduledPreview = *preview_p;
+          scheduledAt = esp_timer_get_time() + wait;
+          tallyScheduled = true;
+          esp_timer_start_once(tallyTimer, wait);
+          timed = true;
+        }
+      } else if (tallyScheduled && *program_p == scheduledProgram && *preview_p == scheduledPreview) {
+        // a repeat of the state waiting for its frame keeps that frame
+        timed = true;
+      }
+    }
+    if (!timed) {
+      if (tallyScheduled) esp_timer_stop(tallyTimer);
+      tallyScheduled = false;
+      applyTally(*program_p, *preview_p);
+    }
+    xSemaphoreGive(tallyLock);
 #ifdef DEBUG
     ESP_LOGI(TAG, "SET_TALLY");
     // for (int i=1; i<len; i++) ESP_LOGI(TAG, "%02x ", data[i]);
@@ -643,7 +786,9 @@ static void espnow_recv_cb(const esp_now_recv_info_t *recv_info, const uint8_t *
     uint64_t *bits_p = (uint64_t *)(data+4);
     ESP_LOGI(TAG, "SET_COLOR #%02x%02x%02x\n", data[2], data[3], data[4]);
     if (getBit(*bits_p, camId-1)) {
+      xSemaphoreTake(tallyLock, portMAX_DELAY);
       fillColor(data[1], data[2], data[3]);
+      xSemaphoreGive(tallyLock);
     }
     lastMessageReceived = millis();
     break;
@@ -693,7 +838,9 @@ static void espnow_recv_cb(const esp_now_recv_info_t *recv_info, const uint8_t *
     if (getBit(*bits_p, camId-1)) {
       camId = data[1];
       writeCamId();
+      xSemaphoreTake(tallyLock, portMAX_DELAY);
       displayNumber(0, 0, 255, camId);
+      xSemaphoreGive(tallyLock);
       ESP_LOGI(TAG, "SET_CAMID %d\n", camId);
       delay(1000);  // so new number is visible
     }
@@ -710,11 +857,15 @@ static void espnow_recv_cb(const esp_now_recv_info_t *recv_info, const uint8_t *
   }
 
   case SET_CAMGROUP: {
+    // the controller uses 9 for SET_NAME, which is never exactly this long
+    if (len != 2 + (int)sizeof(uint64_t)) break;
     uint64_t *bits_p = (uint64_t *)(data+2);
     if (getBit(*bits_p, camId-1)) {
       camGroup = data[1];
       writeCamGroup();
+      xSemaphoreTake(tallyLock, portMAX_DELAY);
       displayNumber(0, 255, 0, camGroup);
+      xSemaphoreGive(tallyLock);
       ESP_LOGI(TAG, "SET_CAMGRUOP %d\n", camGroup);
       delay(1000);  // so new number is visible
     }
@@ -748,7 +899,130 @@ static void espnow_recv_cb(const esp_now_recv_info_t *recv_info, const uint8_t *
   case GET_TALLY:
     ESP_LOGI(TAG, "GET_TALLY");
     break;
+
+  case TRANSITION: {
+    if (len < 3 + 2 * (int)sizeof(uint64_t)) break;
+    uint64_t from, to;
+    memcpy(&from, data + 3, sizeof(from));
+    memcpy(&to, data + 3 + sizeof(uint64_t), sizeof(to));
+    uint8_t position = data[1];
+    lastMessageReceived = millis();
+    xSemaphoreTake(tallyLock, portMAX_DELAY);
+    if ((data[2] & TRANSITION_END) || !(getBit(from, camId-1) || getBit(to, camId-1))) {
+      if (fadeActive) {
+        fadeActive = false;
+        showTally();
+      }
+    } else {
+      fadeActive = true;
+      lastFadeAt = millis();
+      if (getBit(to, camId-1)) {
+        fillColor(position, 255 - position, 0);  // preview -> program
+      } else {
+        fillColor(255 - position, position, 0);  // program -> preview, where a mix leaves it
+      }
+    }
+    xSemaphoreGive(tallyLock);
+    break;
+  }
+
+  case MIC_LIVE: {
+    if (len < 1 + (int)sizeof(uint64_t)) break;
+    memcpy(&micLive, data + 1, sizeof(micLive));
+    lastMessageReceived = millis();
+    xSemaphoreTake(tallyLock, portMAX_DELAY);
+    if (!fadeActive) showTally();
+    xSemaphoreGive(tallyLock);
+    break;
+  }
+
+  case PROVISION_OPEN: {
+    if (len < 4) break;
+    uint8_t seconds = data[1];
+    bool all = data[2] != 0;
+    uint8_t session = data[3];
+    if (seconds == 0) {
+      provisioning = false;
+      break;
+    }
+    if (session == provisionDoneSession) break;  // already got our ID in this window
+    if (!all && camIdAssigned) break;
+    if (!provisioning || session != provisionSession) {
+      nextClaimAt = millis() + esp_random() % 800;  // spread the claims of a whole rack
+    }
+    provisioning = true;
+    provisionSession = session;
+    provisionUntil = millis() + (unsigned long)seconds * 1000;
+    break;
+  }
+
+  case PROVISION_ASSIGN: {
+    if (len < 1 + 1 + 6) break;
+    uint8_t mac[6];
+    esp_wifi_get_mac(WIFI_IF_STA, mac);
+    if (memcmp(mac, data + 2, 6) != 0) break;
+    if (data[1] == 0 || data[1] > TALLY_COUNT) break;
+    if (camId != data[1] || !camIdAssigned) {
+      camId = data[1];
+      writeCamId();
+      ESP_LOGI(TAG, "PROVISIONED %d", camId);
+    }
+    // a repeated ASSIGN means our ACK got lost
+    provisioning = false;
+    provisionDoneSession = provisionSession;
+    provisionAckDue = true;
+    break;
   }
+
+  case TEST_BEGIN: {
+    if (len < 3) break;
+    uint16_t session = data[1] | (data[2] << 8);
+    if (testActive && session == testSession) break;  // repeated BEGIN
+    testActive = true;
+    testSession = session;
+    testFrames = 0;
+    testReportDue = false;
+    break;
+  }
+
+  case TEST_END: {
+    if (len < 3 || !testActive) break;
+    uint16_t session = data[1] | (data[2] << 8);
+    if (session != testSession) break;
+    testActive = false;
+    testReportAt = millis() + 20 + esp_random() % 580;  // spread the replies of all receivers
+    testReportDue = true;
+    break;
+  }
+
+  default:
+    break;
+  }
+}
+
+void sendProvisionClaim() {
+  uint8_t payload[3] = {PROVISION_CLAIM, camId, camIdAssigned ? 1 : 0};
+  esp_err_t err = esp_now_send(broadcast_mac, payload, sizeof(payload));
+  if (err != ESP_OK) ESP_LOGI(TAG, "esp_now_send returned 0x%x: %s\n", err, esp_err_to_name(err));
+}
+
+void sendProvisionAck() {
+  uint8_t payload[2] = {PROVISION_ACK, camId};
+  esp_err_t err = esp_now_send(broadcast_mac, payload, sizeof(payload));
+  if (err != ESP_OK) ESP_LOGI(TAG, "esp_now_send returned 0x%x: %s\n", err, esp_err_to_name(err));
+  provisionAckDue = false;
+}
+
+void sendTestReport() {
+  uint8_t payload[1 + 2 + 4];
+  payload[0] = TEST_REPORT;
+  payload[1] = testSession & 0xFF;
+  payload[2] = testSession >> 8;
+  memcpy(payload + 3, &testFrames, sizeof(testFrames));
+  esp_err_t err = esp_now_send(broadcast_mac, payload, sizeof(payload));
+  if (err != ESP_OK) ESP_LOGI(TAG, "esp_now_send returned 0x%x: %s\n", err, esp_err_to_name(err));
+  testReportDue = false;
+  ESP_LOGI(TAG, "Load test %u: %lu frames", testSession, (unsigned long)testFrames);
 }
 
 void sendHeartbeat() {
@@ -805,6 +1079,13 @@ void app_main() {
   displayNumber(0, 0, 255, camId);
   delay(300);
 
+  tallyLock = xSemaphoreCreateMutex();
+  const esp_timer_create_args_t tallyTimerArgs = {
+    .callback = scheduledTally,
+    .name = "tally",
+  };
+  ESP_ERROR_CHECK(esp_timer_create(&tallyTimerArgs, &tallyTimer));
+
   ESP_LOGI(TAG, "wifi_init");
   wifi_init();
 
@@ -827,13 +1108,43 @@ void app_main() {
   ESP_ERROR_CHECK( esp_now_register_recv_cb(espnow_recv_cb) );
 
   // Loop
+  unsigned long lastHeartbeat = millis();
+  sendHeartbeat();
   while (1) {
+    delay(50);
+    if (testReportDue && (long)(millis() - testReportAt) >= 0) {
+      sendTestReport();
+    }
+    xSemaphoreTake(tallyLock, portMAX_DELAY);
+    if (fadeActive && millis() - lastFadeAt > FADE_TIMEOUT) {
+      fadeActive = false;
+      showTally();
+    }
+    xSemaphoreGive(tallyLock);
+    if (provisionAckDue) {
+      sendProvisionAck();
+      sendHeartbeat();
+      xSemaphoreTake(tallyLock, portMAX_DELAY);
+      displayNumber(0, 0, 255, camId);
+      xSemaphoreGive(tallyLock);
+    }
+    if (provisioning && (long)(millis() - nextClaimAt) >= 0) {
+      if ((long)(millis() - provisionUntil) >= 0) {
+        provisioning = false;
+      } else {
+        sendProvisionClaim();
+        nextClaimAt = millis() + 1000 + esp_random() % 500;
+      }
+    }
+    if (millis() - lastHeartbeat < 2000) continue;
+    lastHeartbeat = millis();
     sendHeartbeat();
-    delay(2000);
     if (millis() - lastMessageReceived > 5000) {
+      xSemaphoreTake(tallyLock, portMAX_DELAY);
       fillColor(0, 0, 0);
       setPixelColor(millis()%LED_COUNT, 128, 0, 0);
       show();
+      xSemaphoreGive(tallyLock);
     }
     // TODO: read Serial.read();
   }